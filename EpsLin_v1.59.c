@@ -0,0 +1,10709 @@
+/////////////////////////////////////////////////////
+//
+// EpsLin Neo v1.59
+// based on EpsLin (c) Juha Forsten 5 Aug / 2006
+// https://sites.google.com/site/epslin4free/
+// https://gitlab.com/jforsten/EpsLin/-/blob/master/EpsLin.c
+// -------------------------------------------------
+//  * File utility for Ensoniq samplers (EPS/ASR)
+//
+//  ------------------------------------------------------------------------
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 2 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program; if not, write to the Free Software
+//  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+//
+// -------------------------------------------------------------------------
+//
+//  TO COMPILE:
+//  ===========
+//
+//  Should compile in Linux, macOS, and Windows (Cygwin) just by typing:
+//
+//    gcc EpsLin_v1.59.c -o epslin
+//
+//  (with older glibc add '-pthread')
+//
+//  In Windows you have to install "fdrawcmd.sys" from
+//         http://simonowen.com/fdrawcmd/
+//
+//  and get the header file from
+//         http://simonowen.com/fdrawcmd/fdrawcmd.h
+//
+//  and put it in the same directory as the EpsLin source.
+//
+//  HISTORY
+//  =======
+//
+//  v9.99: [FUTURE]
+//       - Optional "allowed" devices list to minimize
+//         unintentional writes to devices like system
+//         hard disk etc.. for Format and ImageCopy
+//         THIS COULD SAVE YOUR DAY (or even two)..!
+//       - Check mode and only EFE erase/put use the
+//         'I' write to check if 's' media type..
+//       - Use 's' media type in Get and in GetFat/SetFat
+//
+// vX.XX: [FUTURE]
+//       - TODO: allow a sector offset to be supplied; needed to
+//               handle direct access of SCSI2SD-ready SD cards
+//       - TODO: add recursive mode for GetEFE
+//       - TODO: create named sub-directories when GetEFE is used
+//               such as 'root', etc. to hold EFEs on export
+//
+//  v1.59:
+//       - Added move/rename of EFEs and directories (-M) which only relinks the
+//         directory entry, so the FAT chain and the data are left untouched.
+//       - Fixed root directory being treated as non-contiguous when a sub-directory
+//         updated the file count of its parent.
+//       - Added direct image-to-image copy (-x) of EFEs and whole directory
+//         trees. Block runs are streamed from the source FAT chains straight
+//         into the destination allocator, and the destination FAT is committed once.
+//         Destination can be of any image format, it is open next to the source.
+//       - Make directory (-m) accepts nested paths ('/') and lists of sibling dirs
+//         (','), creating missing parents like 'mkdir -p'. All dirs are built in
+//         memory and FAT/free count are written once. Fixes a crash in -m.
+//       - FAT-table of disk access (and 's' media) is read on first use, so
+//         GetInfo reads only the system blocks. FAT-table of images and Linux
+//         devices is read in chunks on first use, so getting/putting EFEs on a
+//         large device no longer reads its whole FAT.
+//       - Added content hashes (-H, XXH64 of the EFE data) to the directory listing
+//         and to parse-friendly output. Chains are resolved to block runs first,
+//         and image files are hashed by a pool of threads.
+//       - EFE extraction (-g) from image files copies whole block runs with
+//         copy_file_range (sendfile as fallback) in Linux, so the data doesn't pass
+//         through user space. Other systems use one large read/write per run.
+//       - Added tar stream output (-T) for -g. EFEs, with their EFE headers, and
+//         with -R whole directory trees, are written in one pass through a 1MB buffer
+//         to a file or to stdout (messages then go to stderr).
+//       - Put (-p) streams EFE data through one 256KB buffer regardless of the EFE
+//         size or fragmentation (was a malloc of the whole EFE/fragment).
+//       - Put (-p) of several EFEs is planned up front: dir entries and free space
+//         are checked before anything is written, space is allocated biggest
+//         EFE first, data is written in one ascending sweep and FAT/dir once.
+//         Fixes multiple EFEs put into a sub-directory (only the first one
+//         landed) and the uninitialized dir tail in SaveDirBlocks.
+//       - Put (-p) reads an EFE, or a tar stream of EFEs (ie. from -T), from stdin
+//         when the EFE filename is '-'. Each EFE is written to its own space as
+//         it is read, through one fixed buffer, without temp files.
+//       - Added in-place replace (-u) of an EFE. The old FAT chain is reused,
+//         trimmed or extended only as needed, only changed data blocks are
+//         written, and the dir index stays the same.
+//       - Erase (-e) with -z discards the freed blocks: punch-hole for image
+//         files and BLKDISCARD for block devices (Linux).
+//       - EFEs can be selected by name glob and type for -g/-e/-x ('name:PIANO*',
+//         'type:ASR-Bnk'), resolved against the loaded dir. With -R sub-dirs are
+//         searched too, and -g extracts selected dirs into local dirs.
+//       - Put (-p) with -k skips EFEs already in the dir. Name, type and size are
+//         compared first, and only then the data hashes (XXH64).
+//       - Get (-g/-T) with -J joins the parts of multi-file instruments to one
+//         EFE while extracting. The parts are read straight from their chains.
+//       - EDE/EDA images are read in place through a block map of the skip
+//         table (listing, get, copy, check), so no temp image is needed.
+//       - GKH output: disk read (-r) and conversion (-c) from IMG/EDE/EDA write
+//         GKH files as one stream (DISKINFO and IMAGE tags, Intel byte order).
+//       - IMG <-> EDE/EDA/GKH conversions stream data in large chunks. EDx output
+//         reads the FAT once and writes the used blocks with gathered writes.
+//       - HFE (HxC floppy emulator v1/v3) images, also SuperDisk: MFM tracks are
+//         decoded/encoded with lookup tables, and all operations work on .hfe.
+//       - Packed images (.epz): 64KB chunks compressed one by one (LZ77) with
+//         an index at the end. List, get, put, erase and check work in place
+//         through a small chunk cache, only written chunks are re-packed.
+//         Space of superseded chunks is reclaimed by rewriting the file.
+//       - Image type is detected from the content: one probe read of the first
+//         blocks finds EPZ/HFE/GKH/EFE/EDE/EDA (also 'Mac'-format) signatures and
+//         the raw ID block, so misnamed files work. Extension and size are the
+//         fallback. Compressed files (gzip, xz...) get a clear error.
+//       - 'Mac'-format EFE/EDE/EDA files are read in place: the extra bytes are
+//         skipped while reading, with a map of file offsets made in one pass
+//         (was a copy of the whole file in memory and in a temp file).
+//         Mac EFEs can now be put (-p/-u), the EFE check came too early.
+//       - Image formats are backends (open, read, write, flush, close, encode)
+//         selected once when the image is opened. GKH and EPZ are written in
+//         place, EDE/EDA and HFE through memory, and conversions go from one
+//         backend to another. No more temp image files.
+//       - ImageDisk (.imd) images: tracks are scanned once on open to index the
+//         sectors, which are then read in place (compressed sectors expanded when
+//         read). Written and converted to like HFE, keeping the IMD comment.
+//       - Batch conversion (-B): images of directories and files converted to one
+//         format in parallel, each in a child process of its own, with a summary
+//         of failed files and throughput.
+//
+//  v1.58:
+//       - Added additional Ensoniq signature checks for routines which are *not* full disk read/write/format.
+//
+//  v1.57:
+//       - Rudimentary support for VFX/SD file types.
+//       - Fixed bug introduced in v1.56 which extracted all EFEs even when subset was specified.
+//       - SD-1, VFXSD, and TS disks are now extracted starting at index 0, unlike ASR/EPS disks.
+//       - Fixed cosmetic problem during directory listing for VFX/SD/TS files which are only 11 characters instead of 12.
+//       - Proper handling of VFX/SD/TS files which are erroneously detected as multi-file.
+//
+//  v1.56:
+//       - Rudimentary support for TS10/TS12 file types.
+//
+//  v1.55:
+//       - Support for 4GB partitions (i.e. prints the free blocks/bytes correctly)
+//
+//  v1.54:
+//       - Multiple compiler warnings have been corrected.
+//       - [macOS] Fixed "Abort trap: 6" bug on multi-part reporting.
+//
+//	v1.53:
+//       - Fixed issue with "Part_xx" being appended to full path
+//         rather than base filename.
+//       - ASR SuperDisk is now allowed as a split target.
+//
+//	v1.52:
+//       - Made newline characters compatible with Windows apps,
+//         such as Notepad, et al.
+//
+//  v1.51:
+//       - Fixed error with additional IsEFE checks from v1.47.
+//       - Entries which can't be exported are now skipped by GetEFE.
+//
+//  v1.50:
+//       - Added preliminary macOS support, although issues may exist.
+//
+//  v1.47:
+//       - Added handling for EFEs with "/" in Ensoniq filename.
+//       - Fixed crash in PutEFE when directory full (39th entry).
+//       - Improved wildcard/globbing usage, although still not
+//         100% case-insensitive under Windows, as is ideal.
+//       - Null sector no longer used for vanity message, etc.
+//       - Improved EFE/EFA/INS checking before PutEFE is allowed.
+//       - Added INS extension support as an alias for EFE.
+//       - Added Directory and Disk Information mode (read-only).
+//       - Show usage help when '?' or unknown arguments used.
+//       - Show usage help when run without arguments rather than
+//         than showing potential "fdrawcmd.sys" error.
+//
+//  v1.46:
+//       - [Windows] Cygwin component in non-contiguous portion
+//         of the GetEFEs routine caused *some* EFEs not to extract
+//         properly; routine was given an overhaul.
+//       - Corrected SuperDisk support in PutEFE/GetMedia/EraseEFEs.
+//       - Removed path from filename when printing report.
+//
+//  v1.45: (forked by Thomas Arashikage)
+//       - [Windows] Tweaks to help compile under Cygwin.
+//       - [Windows] Fixed FAT block calculation in GetEFE and GetInfo,
+//                   as values could sometimes be off by one!
+//       - [Windows] ReadBlock function altered to avoid abort on error.
+//       - [Windows] Too restrictive permissions on newly created
+//                   files (IMG, EFE, EDE, et al) were lessened.
+//       - Corrected disk label size and default string.
+//       - Added ASR-Macro to identified file types.
+//       - Added SuperDisk (255 block) support for EPS16 and ASR which
+//         is only applicable with HFEs under floppy emulators.
+//
+//  v1.42:
+//       - [Windows] Had to optimize the I/O functions involved
+//         when EFEs are GET/ERASED/PUT from/to media. This increased
+//         the run time memory consumption, as the whole FAT
+//         table are loaded to memory in order to avoid
+//         seeks in CD-ROM (/dev/scd) and to write Iomega
+//		     Zip drives which don't support single byte writes.
+//         As the load/save time of the FAT table depends on the size
+//         of the media, it _might_ take quite a long time for some media,
+//         thus making the get/put/erase slow. As the Zip drive is the only
+//	       device to test this, it happens to take only 2 seconds to
+//         read+write the table, so it's quite reasonable.
+//         If you send me a SCSI device, that is very slow for this reason,
+//         I'll try to optimize the functions more - until that,
+//         for me it's fast enough.. ;-)
+//       - Options that accept parameter 'a' (= all), now starts
+//         at idx 1 (not 0 as previous versions).
+//       - Added progress info when EFEs are put/get.
+//
+//  v1.41:
+//       - [Windows] Added support for /dev/scd layer in Cygwin..
+//         Since the seeks are possible only in 2048 byte multiples
+//         had to make some mods to ReadBlock etc. functions.
+//         Minor penalties in performance..
+//
+//  v1.40: NOW PORTED TO WINDOWS!!
+//       - Uses Simon Owens "fdrawcmd.sys" (http://simonowen.com/fdrawcmd/)
+//         driver for low-level floppy access. Thanks Simon!
+//       - Minor differences between Cygwin (Win32) and Linux in command
+//         line arguments (for ex. Cygwin requires allways parameter for -p)
+//       - Should support also SCSI devices through Cygwin layer
+//       - Some minor fixes
+//
+//  v1.37:
+//       - Fixed nasty bug in dir-argument (-d) parsing, that
+//         sometimes leads an error "ERROR: Index '0' is not a directory!".
+//         Hopefully now solved..
+//       - More investigation had to be done to find out how EPS knows, when to
+//         load Song (instruments has the mask,that tells what location to load -
+//         for song there are no such info). It seems that if index is 0, it is
+//         not counted as a valid song, so no song data is loaded.
+//         The BankInfo function is modified based on that knowledge.
+//
+//         BTW: You can make deeper dir structures with EPS than banks can handle, so..
+//              don't do it if you want to use files in those dirs with banks.. :-)
+//
+//       - Minor changes to BankInfo output. Paths starts with '/' and ends with no '/'
+//
+//
+//  v1.36:
+//       - Option to join multifile EFEs to single EFE file
+//
+//  v1.35:
+//       - Added missing CR,LF,EOF bytes to EFE header (cosmetic)
+//       - Option to show info from Ensoniq Bank EFE
+//       - Option to split EFE to multifile parts added
+//       - Option to print directory listing in compact mode to make the
+//         parsing for external programs easier.
+//       - Some code clean-ups...
+//
+//  v1.34:
+//        - Support for Multi Files (ie. instruments, that don't fit in one floppy)
+//        - Fixed (new) gcc errors
+//
+//  NOTES!
+//  ======
+//
+//  * Some _commercial_ EPS/ASR tools corrupts the FAT.. You should avoid
+//    those programs.. IF you have to use them, please at least check
+//    the disks and image-files before use with EpsLin 'check' option (-C).
+//    If you use those corrupted disk/images you may lose data!!
+//
+//   TODO:
+//   =====
+//
+//   [CYGWIN]:
+//   !! PutEFE doesn't work without idx number.. It's the Optget that
+//      doesn't support optional arguments, so we'll wait for proper version...
+//
+//   [GENERAL]
+//
+//	 !! Format -fi optimize (now redundancy in allocated fat_block write)
+//
+//   !! MkDir max level.. (Bank can load files only max 11-level deep dirs)
+//
+//   !! Fix MKDIR Kludge in PutEFE...
+//
+//   !! Using Floppy with ReadImage sometimes mess up the FD controller !?
+//
+//   !! Add 'image copy' -feature (ie. make it possible to transfer
+//      data in SCSI HD <-> ZIP, Zip requires '0x6d' at first byte in disk)
+//
+//   ! WAV to EFE & EFE to WAV conversions.
+//
+//   ! In EPS, the OS has to be in one contiguous part
+//     * ASR doesn't mind...
+//
+//   - Dir-transfer function (copy files recursively..)
+//     Useful to transfer whole dir structures from medium to an another.
+//     (Must take care of changing SCSI-ID in Bank-files ?)
+//
+//   - Erase: Recurse Dirs !!
+//
+//   - Format_n_Write -support (?!)
+//
+
+// Uncomment to enter debug state...
+// #define DEBUG
+
+#include <ctype.h>
+#include <stdio.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/ioctl.h>
+#include <libgen.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <time.h>
+#include <fnmatch.h>
+
+#ifdef __APPLE__
+  #include <sys/uio.h>			// equivalent of <sys/io.h>
+#elif __CYGWIN__
+  #include <sys/uio.h>			// equivalent of <sys/io.h>
+  #include <windows.h>
+  #include "fdrawcmd.h"			// floppy drive support -- from http://simonowen.com/fdrawcmd/fdrawcmd.h
+#else   // Linux
+  #include <sys/io.h>
+  #include <linux/fd.h>			// floppy drive support
+  #include <linux/fdreg.h>		// floppy drive support
+  #include <sys/syscall.h>		// copy_file_range
+  #include <sys/sendfile.h>		// sendfile
+  #include <linux/falloc.h>		// FALLOC_FL_PUNCH_HOLE
+  #include <sys/uio.h>			// writev
+  #ifndef BLKDISCARD				// <linux/fs.h> would redefine BLOCK_SIZE
+  #define BLKDISCARD _IO(0x12,119)
+  #endif
+#endif
+
+#ifdef __CYGWIN__				// Windows
+	// do nothing
+#else   						// Linux and macOS
+	#define O_BINARY 0 			// In Windows, open is set to binary mode.
+								// In Linux, this is not defined so set it to 0
+								// (this value is ORed, so no harm is done..)
+#endif
+
+#ifdef __CYGWIN__
+#define VERSION     "v1.59 (Beta)"
+#elif __APPLE__
+#define VERSION     "v1.59 (Beta)"
+#else   // Linux
+#define VERSION     "v1.59"
+#endif
+
+// This idea is too close to commercial "vanity" spam, so has been reverted to classic 0x6D/0xB6 fill pattern.
+// Code only left for illustration purposes.
+#ifdef __CYGWIN__
+#define FIRST_BLOCK_MESSAGE "Created with EpsLin for Windows"
+#else
+#define FIRST_BLOCK_MESSAGE "Created with EpsLin for Linux"
+#endif
+
+#define BLOCK_SIZE      512				// amount of bytes per block
+#define ID_BLOCK          1				// ID block is 1 because block 0 is null (0x6D/0xB6 filler)
+#define DISK_LABEL_SIZE   7				// disk label is contained within ID block
+
+#define OS_BLOCK          2				// OS block comes directly after ID block
+
+#define DIR_START_BLOCK   3				// DR area comes directly after OS block
+#define DIR_BLOCKS        2				// 1024 bytes for entire directory (DR)
+#define DIR_END_BLOCK     4				// DR area consists of blocks 3 and 4
+
+#define EFE_SIZE                26		// each directory entry is 26 bytes
+#define EFE_SIG_SIZE            50		// EFE header signatures are in the first 50 bytes
+#define MAX_NUM_OF_DIR_ENTRIES  39		// 1024 bytes in directory, so only 39 entries possible...
+                                        // ...but zero indexed, so 0~38
+#define MAX_DIR_DEPTH    10             // maximum amount of nesting
+
+#define FAT_START_BLOCK      5			// FAT comes directly after DR area, but there is a variable amount
+										// of FAT blocks; amount depends on capacity of specific volume
+#define FAT_ENTRIES_PER_BLK	170			// 170 FAT entries allowed in each FAT block
+
+#define MAX_DISK_SECT       20			// ASR uses 20 sectors per track, EPS/EPS16 uses 10 sectors
+
+#define EPS_IMAGE_SIZE      819200		// size in bytes of EPS/EPS16 800K DD diskettes
+#define E16_SD_IMAGE_SIZE  2611200		// size in bytes of EPS16 2550K "SuperDisk" images
+#define ASR_IMAGE_SIZE     1638400		// size in bytes of ASR 1600K HD diskettes
+#define ASR_SD_IMAGE_SIZE  5222400		// size in bytes of ASR 5100K "SuperDisk" images
+
+// Buffer size for image copy
+#define IMAGE_COPY_BUFFER_BLOCKS  100
+
+// Buffer size for streaming EFE data between images
+#define STREAM_BUFFER_BLOCKS  512
+
+// Head of EFE read from a stream kept in memory (header and OS version)
+#define EFE_HEAD_SIZE  (4*BLOCK_SIZE)
+
+// Max. number of threads hashing EFE data
+#define MAX_HASH_THREADS  8
+
+// Max. number of conversions running at a time (see BatchConvert)
+#define MAX_BATCH_WORKERS  32
+
+// Max. number of images open through backends at a time (ie. -x)
+#define MAX_OPEN_IMAGES  2
+
+// FAT-tables of file access read on first use (see LoadFAT)
+#define MAX_LAZY_FATS   4
+#define LAZY_FAT_CHUNK  16	// FAT blocks read at a time
+
+// Buffer size for tar stream output (1MB)
+#define TAR_BUFFER_BLOCKS  2048
+#define TAR_RECORD_SIZE    10240		// tar archive is padded to full records
+
+#define DEFAULT_DISK_LABEL "DISK000"	// seven characters max
+
+#define EDE_LABEL  "EPS-16 Disk"
+#define EDE_SKIP_START     0xA0
+#define EDE_SKIP_SIZE       200
+#define EDE_ID             0x03
+
+#define EDA_LABEL  "ASR-10 Disk"
+#define EDA_SKIP_START     0x60
+#define EDA_SKIP_SIZE       400
+#define EDA_ID             0xCB
+
+// GKH output: header of ID, byte order, version and number of tags,
+// then DISKINFO and IMAGE tags (10 bytes each), zeros up to the fixed
+// 58 byte header size of GKH files, then the image
+#define GKH_TAG_DISKINFO   0x0A
+#define GKH_TAG_IMAGE      0x0B
+#define GKH_HEADER_SIZE    58
+#define GKH_BUFFER_BLOCKS  2048		// 1MB
+
+// HFE (HxC floppy emulator) images
+#define HFE_V1_SIGNATURE   "HXCPICFE"
+#define HFE_V3_SIGNATURE   "HXCHFEV3"
+#define HFE_SHUGART_MODE   7			// generic Shugart interface
+#define HFE_MAX_SECT       20
+#define HFE_GAP3           40			// gap after sector (as in format)
+#define HFE_TRACK_START    146			// gap, sync and index mark
+#define HFE_SECTOR_SIZE    574			// ID and data fields with syncs and gap 2
+
+// ImageDisk (IMD) images: ASCII header and comment ending with 0x1A,
+// then each track as mode, cylinder, head, sectors, size code and
+// sector numbering map, and each sector as a type byte and its data
+#define IMD_SIGNATURE      "IMD "
+#define IMD_EOF            0x1A
+#define IMD_CYL_MAP        0x80			// head byte: cylinder map follows
+#define IMD_HEAD_MAP       0x40			// head byte: head map follows
+#define IMD_SIZE_512       2			// size code of 512 byte sectors
+#define IMD_MODE_250K_MFM  5			// EPS (DD)
+#define IMD_MODE_500K_MFM  3			// ASR (HD)
+#define IMD_MISSING        0			// sector kinds of the index
+#define IMD_DATA           1
+#define IMD_FILL           2			// compressed, one byte repeated
+
+// Packed images (EPZ): header block, compressed chunks, index at the end
+#define EPZ_SIGNATURE      "EPSLINZ1"
+#define EPZ_CHUNK_SIZE     (128*BLOCK_SIZE)	// 64KB, compressed one by one
+#define EPZ_INDEX_ENTRY    16			// offset (8), length (4), kind (1), reserved (3)
+#define EPZ_CACHE_CHUNKS   8
+#define EPZ_DEAD_SHARE     4			// rewritten when over 1/4 of the file is dead (see PackedCompact)
+#define EPZ_ZERO           0			// chunk of zeros, nothing stored
+#define EPZ_STORED         1			// chunk didn't compress, stored as is
+#define EPZ_LZ             2			// LZ77 sequences (see PackLZ)
+
+// 'Mac'-format files are mapped every 4KB (see ConvertMacFormat)
+#define MAC_MAP_STEP       (8*BLOCK_SIZE)
+
+// Probe read of SniffImageType (signatures and ID block)
+#define SNIFF_SIZE         (4*BLOCK_SIZE)
+
+// Imagefile types
+#define EPS_TYPE              'e'
+#define E16_SD_TYPE           's'
+#define ASR_SD_TYPE           'S'
+#define ASR_TYPE              'a'
+#define GKH_TYPE              'g'
+#define EDE_TYPE              'E'
+#define EDA_TYPE              'A'
+#define HFE_TYPE              'h'
+#define EPZ_TYPE              'z'
+#define IMD_TYPE              'i'
+#define EFE_TYPE              'F'		// single EFE, not an image
+#define OTHER_TYPE            'o'
+
+// Modes for Ensoniq Model Family
+//
+// ASR, EPS16, and EPS have the same identifier on disk, and are within the same "family" of sampler models.
+// SD-1 and VFXSD have the same identifier on disk, and are within the same "family" of models.
+// TS10/TS12 have the same identifier on disk, and are within the same "family" of models.
+#define EPS_FAM 0
+#define VFX_FAM 1
+#define TS_FAM 2
+
+// Modes for Bank Info
+#define MODE_EPS 4
+#define MODE_E16 23
+#define MODE_ASR 30
+
+// OS version info offsets (in EFE)
+#define EPS_OS_POS 0x3A8
+#define E16_OS_POS 0x390
+#define ASR_OS_POS 0x6F2
+
+// Modes
+#define NONE    0
+#define READ    1
+#define WRITE   2
+#define GET     3
+#define PUT     4
+#define ERASE   5
+#define MKDIR   6
+#define FORMAT  7
+#define DIRLIST 8
+#define MOVE    9
+#define COPY   10
+#define REPLACE 11
+#define BATCH  12
+#define TEST   99
+
+// Print modes
+#define HUMAN_READABLE 0
+#define COMPUTER_READABLE 1
+
+// Return values
+#define ERR -1
+#define OK   0
+
+// Error print-out & exit
+#ifdef DEBUG
+#define EEXIT(args)  (fprintf(stderr,"(line: %d) ",__LINE__), fprintf args, exit(ERR))
+#else
+#define EEXIT(args)  (fprintf args, exit(ERR))
+#endif
+
+// File permissions
+#ifdef __CYGWIN__           // Windows
+#define FILE_RIGHTS 0777    // all can read, write and execute
+#else                       // Linux and macOS
+#define FILE_RIGHTS 0700    // owner can read, write and execute
+#endif
+
+// For 'getopt'
+// Next two lines generate "redeclared without dllimport" warnings under CYGWIN, but apparently harmless.
+extern char *optarg;
+extern int optind, opterr, optopt;
+
+// Run of contiguous blocks within a FAT chain
+typedef struct {
+  unsigned int start;
+  unsigned int count;
+} BlockRun;
+
+// Datatype for floppy disk access
+#ifdef __CYGWIN__
+typedef HANDLE FD_HANDLE;
+#else // Linux and macOS
+typedef int FD_HANDLE;
+#endif
+
+// Volume opened for image-to-image copy
+typedef struct {
+  char media_type;
+  FD_HANDLE fd;
+  int file;
+  unsigned char *DiskFAT;
+  unsigned int fat_blks;
+  unsigned int total_blks;
+  unsigned int free_blks;
+  unsigned char OSBlock[512];
+} Volume;
+
+#ifdef __CYGWIN__
+char* LastError ()
+{
+  static char sz[256];
+  FormatMessage(FORMAT_MESSAGE_FROM_SYSTEM | FORMAT_MESSAGE_IGNORE_INSERTS, NULL, GetLastError(),
+		MAKELANGID(LANG_NEUTRAL, SUBLANG_DEFAULT), sz, sizeof(sz), NULL);
+  return GetLastError() ? sz : "no error";
+}
+#endif
+
+
+// Declaration of ReadBlocks and WriteBlocks
+int ReadBlocks(char media_type, FD_HANDLE fd, int file, unsigned int start_block,
+	       unsigned int length, unsigned char *buffer);
+int WriteBlocks(char media_type, FD_HANDLE fd, int file, unsigned int start_block,
+		unsigned int length, unsigned char *buffer);
+
+// Declaration of image read/write (through the backend of the open image, see ImageOpen)
+ssize_t MacPread(int file, void *buffer, size_t len, off_t pos);
+ssize_t ImageRead(int file, void *buffer, size_t len, off_t pos);
+ssize_t ImageWrite(int file, void *buffer, size_t len, off_t pos);
+int IsMappedImage(int file);
+
+// Declaration of image type detection (see SniffImageType)
+int ProbeImageType(char in_file[FILENAME_MAX], char *image_type);
+int GetImageType(char in_file[FILENAME_MAX], char *image_type);
+
+// Declaration of content hashes (see XXH64)
+unsigned long long HashRuns(char media_type, FD_HANDLE fd, int file,
+			    BlockRun *Run, int runs, unsigned int blks,
+			    unsigned char *Buffer);
+unsigned long long HashData(int in, unsigned int blks, unsigned char *Buffer);
+
+// EPS/ASR-file types
+static char *EpsTypes[50]={
+  //  0         1         2         3         4         5         6         7         8         9
+  "(empty)","EPS-OS ","DIR/   ","Instr  ","EPS-Bnk","EPS-Seq","EPS-Sng","EPS-Sys",".. /   ","EPS-Mac",
+
+  // 10        11        12        13        14        15        16        17        18        19
+  "SD-1Pro","SD-6Pro","SD-30Pg","SD-60Pg","SD-1Pre","SD-10Ps","SD-20Ps","SD-1Seq","SD30Seq","SD60Seq",
+
+  // 20        21        22        23        24        25        26        27        28        29
+  "SD-SysX","SD-Set ","SD-SqOS","E16-Bnk","E16-Eff","E16-Seq","E16-Sng","E16-OS ","ASR-Seq","ASR-Sng",
+
+  // 30        31        32        33        34        35        36        37        38        39
+  "ASR-Bnk","ASR-Trk","ASR-OS ","ASR-Eff","ASR-Mac","TS-6Pro","TS-60Pg","TS120Pg","TS-1Pre","TS-60Ps",
+  
+  // 40        41        42        43        44        45        46        47        48        49
+  "TS120Ps","TS-1Seq","TS30Seq","TS60Seq","ENS44xx","ENS45xx","ENS46xx","ENS47xx","ENS48xx","ENS49xx",
+  
+};
+
+// 00 (0x00) = Unused/Blank/Empty
+// 01 (0x01) = EPS (original/classic) Operating System
+// 02 (0x02) = Sub-Directory
+// 03 (0x03) = EPS Individual Instrument File
+// 04 (0x04) = EPS Bank of Sounds
+// 05 (0x05) = EPS Sequence File
+// 06 (0x06) = EPS Song File
+// 07 (0x07) = EPS System Exclusive File
+// 08 (0x08) = Pointer to Parent Directory
+// 09 (0x09) = EPS Macro File
+// 10 (0x0A) = SD-1/VFX-SD 1 Program File
+// 11 (0x0B) = SD-1/VFX-SD 6 Program File
+// 12 (0x0C) = SD-1/VFX-SD 30 Program File
+// 13 (0x0D) = SD-1/VFX-SD 60 Program File
+// 14 (0x0E) = SD-1/VFX-SD 1 Preset File
+// 15 (0x0F) = SD-1/VFX-SD 10 Presets File
+// 16 (0x10) = SD-1/VFX-SD 20 Presets File
+// 17 (0x11) = SD-1/VFX-SD 1 Sequence/Song File
+// 18 (0x12) = SD-1/VFX-SD 30 Sequence/Songs File
+// 19 (0x13) = SD-1/VFX-SD 60 Sequence/Songs File
+// 20 (0x14) = SD-1/VFX-SD System Exclusive File
+// 21 (0x15) = SD-1/VFX-SD System Setup File
+// 22 (0x16) = SD-1/VFX-SD Sequencer Operating System
+// 23 (0x17) = EPS-16 Plus Bank File
+// 24 (0x18) = EPS-16 Plus Effect File
+// 25 (0x19) = EPS-16 Plus Sequence File
+// 26 (0x1A) = EPS-16 Plus Song File
+// 27 (0x1B) = EPS-16 Plus Operating System
+// 28 (0x1C) = ASR-10 Sequence File
+// 29 (0x1D) = ASR-10 Song File
+// 30 (0x1E) = ASR-10 Bank File
+// 31 (0x1F) = ASR-10 Audio Track
+// 32 (0x20) = ASR-10 Operating System
+// 33 (0x21) = ASR-10 Effect File
+// 34 (0x22) = ASR-10 Macro File / TS "1-PROGRAM" File (strange that there's a number overlap...)
+// 35 (0x23) = TS "6-PROGRAMS" File
+// 36 (0x24) = TS "60-PROGRAMS" File
+// 37 (0x25) = TS "120-PROGRAMS" File
+// 38 (0x26) = TS "1-PRESET" File
+// 39 (0x27) = TS "60-PRESETS" File
+// 40 (0x28) = TS "120-PRESETS" File
+// 41 (0x29) = TS "1-SEQ/SONG" File
+// 42 (0x2A) = TS "30-SEQ/SONGS" File
+// 43 (0x2B) = TS "60-SEQ/SONGS" File
+
+// Global Variables -- could be bad form, but...
+int allmode = 0;			// assume a subset of EFEs should be processed, rather than every EFE
+int familymode = EPS_FAM;	// assume disk is an ASR/EPS16/EPS sampler disk, unless detected otherwise as VFXSD/TS/SD-1
+int passedValidation = 1;	// assume disk is an intact Ensoniq volume
+char *select_spec = NULL;	// 'name:'/'type:' selectors of -g/-e/-x, resolved against the loaded dir
+int joinmode = 0;			// join parts of multi-file instruments when extracting (-J)
+
+// FAT-table of disk access is read on first use (see GetInfo and LoadLazyFAT)
+struct {
+  char media_type;
+  FD_HANDLE fd;
+  int file;
+  unsigned char *DiskFAT;	// table waiting to be read, NULL when read
+  unsigned int fat_blks;
+} LazyFAT = { 0, (FD_HANDLE) 0, 0, NULL, 0 };
+
+// FAT-tables of file access are read in chunks on first use (see LoadFAT)
+struct {
+  char media_type;
+  FD_HANDLE fd;
+  int file;
+  unsigned char *DiskFAT;	// table, NULL if the slot is free
+  unsigned int fat_blks;
+  unsigned char *Loaded;	// chunks of the table read
+} FileFAT[MAX_LAZY_FATS];
+
+// EDE/EDA image read in place (see MapEDxImage and ImageRead)
+typedef struct {
+  int file;			// EDx file, -1 if none is mapped
+  unsigned int blocks;		// blocks of the image
+  off_t *Offset;		// file offset of each block, 0 = skipped (filler)
+} EDxImageMap;
+
+EDxImageMap EDxMap = { -1, 0, NULL };
+
+// IMD image read in place (see IMDOpen and IMDRead)
+typedef struct {
+  off_t pos;			// data of IMD_DATA sector in the file
+  unsigned char kind;
+  unsigned char fill;		// byte of IMD_FILL sector
+} IMDSector;
+
+typedef struct {
+  unsigned int blocks;
+  IMDSector *Sector;		// each block of the image
+} IMDImageIndex;
+
+IMDImageIndex IMDIndex = { 0, NULL };
+
+// 'Mac'-format files read in place (see ConvertMacFormat and MacPread)
+typedef struct {
+  int file;
+  off_t size;			// size without the extra bytes
+  off_t *Offset;		// file offset of every MAC_MAP_STEP:th byte
+} MacFile;
+
+struct {
+  int files;
+  MacFile *File;
+} MacMap = { 0, NULL };
+
+// Packed image read and written in place (see PackedOpen and ImageRead)
+typedef struct {
+  unsigned int chunk;		// chunk held
+  unsigned int age;		// for LRU, 0 = slot unused
+  int dirty;			// written, not stored yet
+  unsigned char *Data;
+} PackedSlot;
+
+typedef struct {
+  int file;			// EPZ file, -1 if none is open
+  unsigned int chunks;
+  off_t size;			// size of the raw image
+  off_t end;			// new chunks are appended here
+  unsigned char *Index;		// index entries (EPZ_INDEX_ENTRY each)
+  unsigned char *Work;		// compressed chunk
+  int changed;			// index to be written
+  unsigned int clock;
+  PackedSlot Cache[EPZ_CACHE_CHUNKS];
+} PackedImage;
+
+PackedImage Packed = { -1, 0, 0, 0, NULL, NULL, 0, 0, {{0, 0, 0, NULL}} };
+
+// Chunk cache is shared by the hash threads (see HashRuns)
+static pthread_mutex_t PackedLock = PTHREAD_MUTEX_INITIALIZER;
+
+// Image format backend (see ImageOpen and ImageFormats)
+typedef struct {
+  int     (*Open)(int file, char *name, char type, int readonly);
+  ssize_t (*Read)(void *buffer, size_t len, off_t pos);
+  ssize_t (*Write)(void *buffer, size_t len, off_t pos);	// NULL = read only
+  int     (*Flush)(char *name);		// store the changes to file 'name'
+  void    (*Close)(void);
+  int     (*Encode)(int in, off_t size, int out, char type);	// raw image 'in' to file 'out'
+} ImageBackend;
+
+// Image open through its backend (see ImageRead and ImageWrite)
+typedef struct {
+  int file;			// image file, -1 if none is open
+  int alias;			// second descriptor of write modes (see OpenImage)
+  char type;
+  off_t size;			// size of the raw image
+  off_t offset;			// start of the raw image in the file (GKH)
+  const ImageBackend *Backend;
+} ImageHandle;
+
+ImageHandle Image = { -1, -1, 0, 0, 0, NULL };
+
+// Raw image in memory (EDE/EDA, HFE and IMD while written, see MemWrite)
+typedef struct {
+  unsigned char *Data;		// Image.size bytes
+  int changed;			// to be encoded back to the file
+} MemoryImage;
+
+MemoryImage MemImage = { NULL, 0 };
+
+// State of an open image. The current one is in the globals above,
+// the others are kept here until used (see ImageSelect).
+typedef struct {
+  ImageHandle Image;
+  MemoryImage Mem;
+  PackedImage Packed;
+  EDxImageMap EDx;
+  IMDImageIndex IMD;
+} ImageState;
+
+ImageState OtherImage[MAX_OPEN_IMAGES-1];
+
+//////////////
+// ShowUsage
+void ShowUsage()
+{
+  printf("\r\nEpsLin Neo %s -- open source Ensoniq EPS/ASR file and disk utility \r\n", VERSION);
+  printf("==============================================================================\r\n");
+  printf("\r\nUsage: epslin [options] [imagefile or device] [EFE #0] [EFE #1] ... [EFE #N]\r\n\r\n");
+  printf("Options:\r\n-------- \r\n\r\n");
+  printf("   -r           Read image from disk. (Disk type (EPS/ASR) is autodetected!)\r\n");
+  printf("                File extension (IMG/GKH/EDE/EDA/HFE/EPZ/IMD) selects the format.\r\n\r\n");
+
+  printf("   -w           Write image to disk. (Disk type (EPS/ASR) is autodetected!)\r\n");
+  printf("                File extension (IMG/GKH/EDE/EDA/HFE/EPZ/IMD) selects the format.\r\n");
+  printf("                (Existing image files are recognised from their content.)\r\n\r\n");
+
+  printf("   -fe,-fa,-fi  Format disk/image/device (a=ASR, e=EPS, i=image/device)\r\n");
+  printf("                Use '-l' option to define disk label.\r\n");
+  printf("                If imagefile doesn't exist, it will be created. \r\n");
+  printf("                Image size is then needed as an last argument.\r\n");
+  printf("                Size is in bytes ('K' and 'M' can be used as a suffix)\r\n");
+  printf("                If EPS/ASR disk image is wanted, use size 'eps' or 'asr'\r\n");
+  printf("                instead of numeric values!! See examples..\r\n\r\n");
+
+  printf("      Examples: 'epslin -fe'                   : Format EPS floppy\r\n");
+  printf("                'epslin -fa'                   : Format ASR floppy\r\n");
+  printf("                'epslin -fi epsdisk.img eps'   : Create EPS disk image\r\n");
+  printf("                'epslin -fi asrdisk.img asr'   : Create ASR disk image\r\n");
+  printf("                'epslin -fi e16supr.img e16sd' : Create EPS16 SuperDisk image\r\n");
+  printf("                'epslin -fi asrsupr.img asrsd' : Create ASR SuperDisk image\r\n");
+  printf("                'epslin -fi MyImage.img'       : Format MyImage.img\r\n");
+  printf("                                                 NOTE: File exists!\r\n");
+  printf("                'epslin -fi MyCDROM.img 650M'  : Create and format\r\n");
+  printf("                                                 file size 650MB\r\n");
+  printf("                'epslin -l EpsHD -fi /dev/sda' : Format SCSI disk\r\n");
+  printf("                                               : with label 'EpsHD'\r\n\r\n");
+
+  printf("   -c           Convert imagefile from one format to another.\r\n");
+  printf("                Supported conversions:\r\n");
+  printf("                                               .img -> ede (EPS)\r\n");
+  printf("                                               .img -> eda (ASR)\r\n");
+  printf("                                               .img -> gkh (EPS/ASR)\r\n");
+  printf("                                               .ede -> gkh (EPS)\r\n");
+  printf("                                               .eda -> gkh (ASR)\r\n");
+  printf("                                               .gkh -> img (EPS)\r\n");
+  printf("                                               .ede -> img (EPS)\r\n");
+  printf("                                               .eda -> img (ASR)\r\n");
+  printf("                                               .img -> hfe (EPS/ASR/SuperDisk)\r\n");
+  printf("                                               .hfe -> img (EPS/ASR/SuperDisk)\r\n");
+  printf("                                               .img -> epz (any size)\r\n");
+  printf("                                               .epz -> img (any size)\r\n");
+  printf("                                               .img -> imd (EPS/ASR)\r\n");
+  printf("                                               .imd -> img (EPS/ASR)\r\n");
+  printf("                HFE (HxC v1/v3) and ImageDisk (IMD) images can also be\r\n");
+  printf("                used directly.\r\n");
+  printf("                EPZ is a packed image of 64KB chunks compressed one by\r\n");
+  printf("                one. It is listed, read and written in place.\r\n");
+  printf("                Examples: 'epslin -c my_disk.img my_disk.ede'\r\n\r\n");
+
+  printf("   -B format    Batch convert the images of directories and files to\r\n");
+  printf("                'format' (img/ede/eda/gkh/hfe/epz/imd), each next to its\r\n");
+  printf("                source. Conversions run in parallel (one per CPU), and\r\n");
+  printf("                existing outputs are kept. Failed files and throughput\r\n");
+  printf("                are shown at the end. With -R also sub-dirs.\r\n");
+  printf("                Example: 'epslin -B img -R archive/ disk1.gkh'\r\n\r\n");
+
+  printf("   -g index_list \r\n");
+  printf("                Get EFE(s) from image/dev.\r\n");
+  printf("                Examples: -g1,2,4   : EFEs 1,2 and 4.\r\n");
+  printf("                          -g10-20   : from 10 to 20.\r\n");
+  printf("                          -g10-     : from 10 to end.\r\n");
+  printf("                          -g1,3-5,8 : 1,3 to 5, and 8.\r\n");
+  printf("                          -ga       : All from that dir.\r\n");
+  printf("                Also by name and type, here and with -e/-x:\r\n");
+  printf("                          -g 'name:PIANO*'          : name glob\r\n");
+  printf("                          -g 'type:ASR-Bnk'         : type (or number)\r\n");
+  printf("                          -g 'type:Instr,name:*STR*': both must match\r\n");
+  printf("                With -R selected dirs are extracted to local dirs,\r\n");
+  printf("                and name/type are matched in all sub-dirs (also -e).\r\n");
+  printf("                With -J the parts of multi-file instruments are\r\n");
+  printf("                joined to one EFE (also -T).\r\n\r\n");
+#ifdef __CYGWIN__
+  printf("   -p start_index \r\n");
+  printf("                Put EFE(s) to image/dev. The EFE is saved to the\r\n");
+  printf("                first empty index found. The search of empty index\r\n");
+  printf("                can be set to start at start_index.\r\n");
+  printf("                The EFE files must be defined after image file.\r\n");
+  printf("                Examples: -p1  EFE_files.efe : Put EFE in the idx 1 or\r\n");
+  printf("                                               first empty index.\r\n");
+  printf("                          -p1  all           : Put all EFEs found in\r\n");
+  printf("                                               the current dir.\r\n");
+  printf("                          -p1  -             : Put EFE or tar stream\r\n");
+  printf("                                               of EFEs from stdin.\r\n");
+  printf("                With -k EFEs already in the dir (same name, type,\r\n");
+  printf("                size and data) are skipped.\r\n");
+  printf("                          -p0 os_file.efe    : Put Operating System\r\n");
+  printf("                                               to index 0.\r\n\r\n");
+
+#else // Linux and macOS
+  printf("   -p [start_index] \r\n");
+  printf("                Put EFE(s) to image/dev. The EFE is saved to the\r\n");
+  printf("                first empty index found. The search of empty index\r\n");
+  printf("                can be set to start at start_index (default=1).\r\n");
+  printf("                The EFE files must be defined after image file.\r\n");
+  printf("                Examples: -p  EFE_files.efe  : Put EFE in the first \r\n");
+  printf("                                               empty index.\r\n");
+  printf("                          -p  all            : Put all EFEs found in\r\n");
+  printf("                                               the current dir.\r\n");
+  printf("                          -p  -              : Put EFE or tar stream\r\n");
+  printf("                                               of EFEs from stdin.\r\n");
+  printf("                With -k EFEs already in the dir (same name, type,\r\n");
+  printf("                size and data) are skipped.\r\n");
+  printf("                          -p0 os_file.efe    : Put Operating System\r\n");
+  printf("                                               to index 0.\r\n\r\n");
+#endif
+  printf("   -e index_list \r\n");
+  printf("                Erase EFE(s) from image/dev.\r\n");
+  printf("                With -z the freed blocks are discarded: holes are\r\n");
+  printf("                punched in the image file (sparse) or TRIM is sent\r\n");
+  printf("                to the block device (Linux only).\r\n\r\n");
+
+  printf("   -u index     Replace EFE in index with a new version in place. The\r\n");
+  printf("                index is kept and only the changed blocks are written.\r\n");
+  printf("                The EFE file ('-' = stdin) follows the image file.\r\n");
+  printf("                Example: 'epslin -d2 -u5 my.img PIANO.efe'\r\n\r\n");
+
+  printf("   -D           Shows directory and disk information, such as EFE listing and \r\n");
+  printf("                amount of used and free space in blocks and bytes. \r\n");
+  printf("                Example: -D FMsynths.img \r\n");
+  printf("                Example: -D drums.gkh \r\n\r\n");
+
+  printf("   -d path      Directory definition for most operations. \r\n");
+  printf("                Use index number for sub-directory. \r\n");
+  printf("                Example: 'epslin -d2 -ga DX7stabs.img' \r\n\r\n");
+
+  printf("                For nested sub-folders, use forward-slashes. \r\n");
+  printf("                Example: -d12/4/7 \r\n\r\n");
+
+  printf("   -m dir_list  Make directory. Nested dirs are separated by '/' and\r\n");
+  printf("                sibling dirs by ','. Missing parents are made too.\r\n");
+  printf("                Example: 'epslin -m LIB/PIANO,LIB/STRINGS my.img'\r\n\r\n");
+
+  printf("   -M index     Move and/or rename EFE (or directory) without copying\r\n");
+  printf("                any data. Destination directory follows the image file\r\n");
+  printf("                ('.' = same directory), new name is optional.\r\n");
+  printf("                Example: 'epslin -d2 -M5 my.img 3/1'      : idx 5 of dir 2\r\n");
+  printf("                                                            to dir 3/1\r\n");
+  printf("                Example: 'epslin -M7 my.img . \"NEW NAME\"' : Rename idx 7\r\n\r\n");
+
+  printf("   -x index_list \r\n");
+  printf("                Copy EFE(s) and dirs (recursively) directly to another\r\n");
+  printf("                image. Destination image and optional destination\r\n");
+  printf("                directory follow the source image.\r\n");
+  printf("                Example: 'epslin -d2 -x1,3 floppy.img scsi.img 4/1'\r\n\r\n");
+
+  printf("   -C level     Check the disk/image. Gives detailed info about the \r\n");
+  printf("                low-level technical structure of the disk/image.\r\n");
+  printf("                Level can be either 0 or 1.\r\n\r\n");
+
+  printf("   -s EFE_to_split slice_type\r\n");
+  printf("                Split a big EFE into smaller pieces.\r\n");
+  printf("                Example: -s big.efe eps       : Slices to fit EPS DD size \r\n");
+  printf("                Example: -s big.efe asr       : Slices to fit ASR HD size \r\n\r\n");
+
+  printf("   -b bank.efe  Bank info. Prints useful(?) inside info about bank EFE \r\n\r\n");
+
+  printf("   -P           Parse-friendly output. Use with GUI/frontend software \r\n\r\n");
+
+  printf("   -T tar_file  With -g, write the EFEs (with EFE headers) as a tar stream\r\n");
+  printf("                to 'tar_file' instead of separate files. Use '-' for stdout.\r\n");
+  printf("                With -R selected dirs are included with their content.\r\n");
+  printf("                Example: 'epslin -ga -R -T - my.img | gzip > my.tgz'\r\n\r\n");
+
+  printf("   -H           Show content hash (XXH64) of EFE data in the directory\r\n");
+  printf("                listing. Same EFE gives same hash on any disk/image.\r\n\r\n");
+  printf("image_file = Ensoniq EPS/EPS16/ASR-type disk image file \r\n\r\n");
+}
+
+///////////////
+// ParseRange
+void ParseRange(char *optarg, char process_EFE[MAX_NUM_OF_DIR_ENTRIES])
+{
+  size_t ssize;
+  char tmp_str[80];
+  int from_EFE,to_EFE,i;
+
+  strcpy(tmp_str,optarg);
+
+  ssize = strspn(tmp_str,"0123456789");
+  tmp_str[ssize]='\0';
+  from_EFE= atoi(tmp_str);
+
+  if(strlen(optarg)== ssize+1) {
+    to_EFE=MAX_NUM_OF_DIR_ENTRIES-1;
+  } else {
+    to_EFE= atoi(tmp_str+ssize+1);
+  }
+  // Mark the range of EFEs
+  for(i=from_EFE;i<=to_EFE;i++) process_EFE[i]=1;
+
+}
+
+////////////////
+// ParseList
+void ParseList(char *optarg, char process_EFE[MAX_NUM_OF_DIR_ENTRIES])
+{
+  size_t ssize;
+  char tmp_str[80];
+  int j;
+
+  strcpy(tmp_str,optarg);
+  j=0;
+  // Slice the argument using ',' as a separator.
+  while((ssize = strspn(tmp_str+j,"0123456789-")) != 0) {
+    tmp_str[ssize+j]='\0';
+    // List element is 'range'
+    if((index(tmp_str+j,'-')) != NULL) {
+      ParseRange(tmp_str+j,process_EFE);
+    } else {
+      process_EFE[atoi(tmp_str+j)] = 1;
+    }
+    j=j+(ssize+1);
+  }
+}
+
+/////////////////////////
+// ParseEntry
+void ParseEntry(char *optarg, char process_EFE[MAX_NUM_OF_DIR_ENTRIES])
+{
+  char *idx_new;
+  int i;
+
+  // Name/type selectors are resolved when the dir is loaded (see SelectEntries)
+  if((strncasecmp(optarg,"name:",5)==0) || (strncasecmp(optarg,"type:",5)==0)) {
+    select_spec = optarg;
+    return;
+  }
+
+  // See if the "all" parameter has been specified for EFE extraction range, etc.
+  if(strcmp(optarg,"a")==0) {
+	// flag all relevant entries for processing (either 0 to skip, or 1 to process)
+	// index starts at 1 because ASR/EPS16/EPS typically has either pointers or O.S. at index 0, so not much point to extracting
+    for(i=1;i < MAX_NUM_OF_DIR_ENTRIES; i++) process_EFE[i]=1;
+	// Set EFE processing mode to handle *ALL* EFEs -- this is a kludge to support VFX/TS disks!
+	allmode=1;
+  } else {
+    // List ?
+    if((idx_new=index(optarg,',')) == NULL) {
+      // Range ?
+      if(index(optarg,'-')) {
+	ParseRange(optarg,process_EFE);
+      } else {
+	// One number - Mark it
+	process_EFE[atoi(optarg)]=1;
+      }
+    } else {
+      ParseList(optarg,process_EFE);
+    }
+  }
+
+}
+
+//////////////////////
+// MatchSelector
+// -------------
+// Checks dir entry against selector list 'spec', ie. 'name:PIANO*',
+// 'type:ASR-Bnk' or 'type:3'. Terms are separated by ','. Terms with
+// the same key are ORed and different keys ANDed, for example
+// 'type:Instr,type:E16-Bnk,name:*STR*'. Matching is case-insensitive.
+//
+int MatchSelector(char *spec, unsigned char *Entry)
+{
+  char term[80], name[13], type_text[8], *p, *end;
+  int i, key, used[2] = {0,0}, hit[2] = {0,0};
+  int flags = 0;
+
+#ifdef FNM_CASEFOLD
+  flags = FNM_CASEFOLD;
+#endif
+
+  // Trailing spaces are not part of name/type
+  memcpy(name, Entry+2, 12);
+  for(i=12; (i>0) && ((name[i-1] == ' ') || (name[i-1] == '\0')); i--);
+  name[i] = '\0';
+  strcpy(type_text, EpsTypes[Entry[1]]);
+  for(i=strlen(type_text); (i>0) && (type_text[i-1] == ' '); i--);
+  type_text[i] = '\0';
+
+  for(p=spec; *p != '\0'; p=end) {
+    for(end=p; (*end != '\0') && (*end != ','); end++);
+    snprintf(term, sizeof(term), "%.*s", (int) (end-p), p);
+    if(*end == ',') end++;
+
+    if(strncasecmp(term,"name:",5) == 0) {
+      key = 0;
+      if(fnmatch(term+5, name, flags) == 0) hit[key] = 1;
+    } else if(strncasecmp(term,"type:",5) == 0) {
+      key = 1;
+      if(isdigit((unsigned char) term[5])) {
+	if(atoi(term+5) == Entry[1]) hit[key] = 1;
+      } else if(fnmatch(term+5, type_text, flags) == 0) {
+	hit[key] = 1;
+      }
+    } else {
+      EEXIT((stderr,"ERROR: Unknown selector '%s' (use 'name:' or 'type:').\r\n",term));
+    }
+    used[key] = 1;
+  }
+
+  return(((!used[0] || hit[0]) && (!used[1] || hit[1])) ? OK : ERR);
+}
+
+//////////////////////
+// SelectEntries
+// -------------
+// Marks the entries of a dir matching 'spec' for processing.
+// Returns the number of entries selected.
+//
+int SelectEntries(char *spec, unsigned char EFE[MAX_NUM_OF_DIR_ENTRIES][EFE_SIZE],
+		  char process_EFE[MAX_NUM_OF_DIR_ENTRIES])
+{
+  int j, n = 0;
+
+  for(j=0; j<MAX_NUM_OF_DIR_ENTRIES; j++) {
+    process_EFE[j] = 0;
+    if((EFE[j][1] == 0) || (EFE[j][1] == 8) || (EFE[j][1] > 49)) continue;
+    if(MatchSelector(spec, EFE[j]) == OK) {
+      process_EFE[j] = 1;
+      n++;
+    }
+  }
+  return(n);
+}
+
+//////////////////////
+// ParseDir
+int ParseDir(char *dirpath_str, unsigned int *DirPath, unsigned int *subdir_cnt)
+{
+
+  char *idx_new, *idx, dir_str[80];
+
+  // Validity check for 'dirpath_str' ie. can't
+  // be over 70 characters (even that's too much!)
+  if(strlen(dirpath_str) > 70) {
+    EEXIT((stderr,"ERROR: Invalid directory path '%s'.\r\n",dirpath_str));
+  }
+
+  // Clear the 'dir_str'-buffer so that
+  // parsing doesn't fail if buffer contains
+  // character '/' at the "right" place.. (ie. bug fix :-)
+  dir_str[strlen(dirpath_str)+1]= 0;
+
+  // Make a copy of path string
+  strcpy(dir_str,dirpath_str);
+
+  // Check if path starts with '/'
+  if(dir_str[0] == '/') {
+    if(dir_str[1] == '\0') return(OK); else dir_str[0]=' ';
+  }
+
+  *subdir_cnt=0;
+
+  // Parse 'path'
+  if(dir_str[strlen(dir_str)-1] != '/') {
+    dir_str[strlen(dir_str)]='/';
+    dir_str[strlen(dir_str)+1]='\0';
+  }
+
+  idx= dir_str;
+  while((idx_new= (char *) index(idx,'/')) != NULL) {
+    *idx_new= '\0';
+    DirPath[*subdir_cnt]=atoi(idx);
+    idx= idx_new+1;
+    (*subdir_cnt)++;
+  }
+  return(OK);
+}
+
+////////////////////
+// Name to DosName
+// ---------------
+// Some characters allowed by Ensoniq are not allowed by PC operating systems
+// to exist in a filename (such as asterisk, as it is used as a wildcard).
+
+void DosName(register char *dosname, char *name)
+{
+  register char *p;
+
+  // Correct "invalid" character(s) within Ensoniq filename using substitution.
+  strcpy(dosname,name);
+  while((p=(char *) strchr(dosname,'*'))!=NULL) {
+	// substitute '#' when '*' was used in Ensoniq file
+    *p='#';
+  }
+
+  while((p=(char *) strchr(dosname,'/'))!=NULL) {
+	// substitute '^' when '/' was used in Ensoniq file
+    *p='^';
+  }
+
+  // Uncomment if 'space' to '_' -conversion needed
+  // Not generally needed as spaces can exist in Windows filenames when quotes are in use.
+  /*
+    while((p=strchr(dosname,' '))!=NULL) {
+    *p='_';
+    }
+  */
+
+  // Add .efe file extension to corrected filename.
+   strcat(dosname,".efe");
+
+}
+
+///////////////////////////
+// Print the Directory List
+// ------------------------
+// Shows all EFEs stored on disk and how much space is used and free.
+void PrintDir(unsigned char EFE[MAX_NUM_OF_DIR_ENTRIES][EFE_SIZE], unsigned int mode,
+	      char process_EFE[MAX_NUM_OF_DIR_ENTRIES], char in_file[FILENAME_MAX],
+	      char media_type, char *DiskLabel, unsigned int  free_blks, unsigned int used_blks,
+	      int printmode, unsigned long long *EFEHash)
+{
+  unsigned int size, cont, start;
+  unsigned int type, real_type, j, k;
+  char name[13],dosname[17];
+  char media[FILENAME_MAX];
+  char type_text[9];
+
+  // Create variable to hold just the filename without path.
+  char *bname;
+  // Use 'basename' to return just the filename of the input file.
+  bname = basename(in_file);
+
+  switch (media_type)
+    {
+    case 'f':
+      strcpy(media,"FILE: ");
+      strcat(media,bname);
+      break;
+    case 'e':
+      strcpy(media,"EPS DISK ");
+      //strcat(media,DiskLabel);
+      break;
+    case 'a':
+      strcpy(media,"ASR DISK ");
+      //strcat(media,DiskLabel);
+      break;
+    }
+
+  // Print DirectoryList
+  // ===================
+
+	if(printmode== HUMAN_READABLE) {
+		printf("\r\n------------------------------------------+---------------------------------+\r\n");
+		printf(" Disk Label: %-28s |", DiskLabel);
+		printf(" %-31s |\r\n", media);
+		printf("------+----------+--------------+---------+------------------+--------------+\r\n");
+		printf("  Idx |Type      | Name         |Blocks   | FileName         | FileSize     |\r\n");
+		printf("------+----------+--------------+---------+------------------+--------------+\r\n");
+	} else {
+		//Computer readable: Label, media, used block, used bytes, free blocks, free bytes, total blocks, total bytes
+		printf("%s,%s,%d,%lu,%lu,%lu,%lu,%lu\r\n", DiskLabel, media, used_blks, (unsigned long) (used_blks)*512, free_blks, (unsigned long) (free_blks)*512,  free_blks+used_blks, (unsigned long)(free_blks+used_blks)*512);
+	}
+
+  for(j=0;j<MAX_NUM_OF_DIR_ENTRIES;j++){
+
+    //Name
+    for(k=0;k<12;k++) {
+      name[k]=EFE[j][k+2];
+    }
+    name[12]=0;
+
+    DosName(dosname,name);
+
+    size =(unsigned int)  ((EFE[j][14] << 8) + EFE[j][15]);
+    cont =(unsigned int)  ((EFE[j][16] << 8) + EFE[j][17]);
+    start=(unsigned long) ((EFE[j][18] << 24)+ (EFE[j][19] << 16) +
+			   (EFE[j][20] << 8 ) + EFE[j][21]);
+    type=EFE[j][1];
+    real_type=type;
+
+    // Check if type cannot possibly be known
+    if(type>49) {
+      type=49;
+    }
+
+    //if(1) {
+    if(type!=0) {
+
+      if(printmode == HUMAN_READABLE) {
+	if(process_EFE[j] == 1) {
+	  switch(mode)
+	    {
+	    case GET:
+	    case COPY:
+	      printf("<-");
+	      break;
+
+	    case PUT:
+	    case MKDIR:
+	    case MOVE:
+	    case REPLACE:
+	      printf("->");
+	      break;
+
+	    case ERASE:
+	      printf("!!");
+	      break;
+
+	    default:
+	      break;
+	    }
+	} else {
+	  printf("  ");
+	}
+      }
+
+      if(printmode == HUMAN_READABLE) {
+        if((type==2) || (type==8)) {
+          printf(" %02d | %s  | %-12s |         |                  |              |\r\n",j,EpsTypes[type],name);
+	       } else {
+	  if(type!=0) {
+	    strcpy(type_text,EpsTypes[type]);
+		// if EFE[j][22] is not 0 then it's part of a multi-file (ignore for non-ASR/EPS disks)
+	    if((EFE[j][22] != 0) && (familymode==EPS_FAM)) {
+	      type_text[5]='\0';
+		  printf(" %02d | %s(%2d)| %-12s | %7d | %s | %12ld |\r\n",j,type_text,EFE[j][22],name,size,dosname, (unsigned long) (size+1)*512);
+		// otherwise it's not part of a multi-file
+	    } else {
+			// 12 character filenames
+			if(familymode==EPS_FAM){
+				printf(" %02d | %s  | %-12s | %7d | %s | %12ld |\r\n",j,type_text,name ,size,dosname, (unsigned long) (size+1)*512);
+			// 11 character filenames
+			} else {
+				printf(" %02d | %s  | %-12s | %7d | %s  | %12ld |\r\n",j,type_text,name ,size,dosname, (unsigned long) (size+1)*512);
+			}
+	    }
+	  }
+	} // else
+      } else {
+	// Computer readable
+	printf("%d,%s,%d,%s,%d,%d,%s,%ld",j, EpsTypes[type], real_type, name,EFE[j][22], size, dosname, (unsigned long) (size+1)*512);
+	if(EFEHash != NULL) {
+	  if((type==2) || (type==8)) printf(","); else printf(",%016llx",EFEHash[j]);
+	}
+	printf("\r\n");
+      }
+
+      // This line is for debugging. Uncomment it if needed
+      //printf(" %02d | %s(%d)  | %-12s | %4d | start=%d(%x) , cont=%d(%x) |\r\n",j,EpsTypes[type],real_type,name ,size, start,start,cont,cont);
+
+
+    }
+    //else if (printmode == COMPUTER_READABLE) {
+    // If empty dir entry in this index, print "null" line for easier computer parsing...
+    //   printf("%d,%s,%d,%s,%d,%d,%s,%ld\r\n",j, "(empty)",0 ,"", 0,0,"",0);
+    //}
+
+
+  }
+
+	if(printmode== HUMAN_READABLE) {
+		printf("------+----------+--------------+---------+---------------------------------+\r\n");
+		printf(" Used:  %23lu Blocks    |  Used: %16lu Bytes   |\r\n", used_blks, (unsigned long) (used_blks)*512);
+		printf(" Free:  %23lu Blocks    |  Free: %16lu Bytes   |\r\n", free_blks, (unsigned long) (free_blks)*512);
+		printf("----------------------------------------------------------------------------+\r\n");
+		printf(" Total: %23lu Blocks    |  Total:%16lu Bytes   |\r\n", free_blks+used_blks, (unsigned long) (free_blks+used_blks)*512);
+		printf("----------------------------------------------------------------------------+\r\n\r\n");
+
+		// Content hashes (data blocks only, so same EFE gives same hash on any disk)
+		if(EFEHash != NULL) {
+			printf("------+--------------+------------------+\r\n");
+			printf("  Idx | Name         | Hash (XXH64)     |\r\n");
+			printf("------+--------------+------------------+\r\n");
+			for(j=0;j<MAX_NUM_OF_DIR_ENTRIES;j++) {
+				type=EFE[j][1];
+				if((type==0) || (type==2) || (type==8)) continue;
+				for(k=0;k<12;k++) name[k]=EFE[j][k+2];
+				name[12]=0;
+				if(EFEHash[j] == 0) {
+					printf("   %02d | %-12s | (broken chain)   |\r\n",j,name);
+				} else {
+					printf("   %02d | %-12s | %016llx |\r\n",j,name,EFEHash[j]);
+				}
+			}
+			printf("------+--------------+------------------+\r\n\r\n");
+		}
+	}
+
+}
+
+/////////////////////////////////////
+// PrintBankInfo
+// =============
+// - Prints the structure of bank including
+//   instruments and songs.
+int PrintBankInfo(char filename[FILENAME_MAX], int printmode)
+{
+  int mode,count;
+  int instValid[8];
+  int effectFound=0;
+  int fd;
+  int i,j,k;
+  unsigned char data[1024];
+
+  if(printmode == COMPUTER_READABLE) {
+    // COMPUTER READABLE
+
+
+    //Open & Read
+    if( (fd=open(filename,  O_RDONLY | O_BINARY, 0)) <= 0) {
+      printf("1\r\n");
+      return(1);
+    }
+    if((count=read(fd,data,0x222)) < 0x222) {
+      printf("1\r\n");
+      return(1);
+    }
+
+    // Get Bank type
+    if((data[0x32] != 4) &&  (data[0x32] != 23) && (data[0x32] != 30)) {
+      printf("2\r\n");
+      return(1);
+    }
+
+    // OK
+    printf("0\r\n");
+
+    // Bank Type
+    mode=data[0x32];
+    printf("%d\r\n",mode);
+
+    // Check Num of Blocks
+    if(data[0x35] > 3) {
+      effectFound = 1;
+    }
+
+    // Bank Name
+    for(i=0x208;i<0x220;i=i+2) {
+      printf("%c",data[i]);
+    }
+    //Mask
+    printf("\r\n%d\r\n",data[0x220]);
+    instValid[7] = (data[0x220] >> 7) & 0x01;
+    instValid[6] = (data[0x220] >> 6) & 0x01;
+    instValid[5] = (data[0x220] >> 5) & 0x01;
+    instValid[4] = (data[0x220] >> 4) & 0x01;
+    instValid[3] = (data[0x220] >> 3) & 0x01;
+    instValid[2] = (data[0x220] >> 2) & 0x01;
+    instValid[1] = (data[0x220] >> 1) & 0x01;
+    instValid[0] =  data[0x220]       & 0x01;
+
+
+    for(j=0;j<9;j++) {
+
+      //eps
+      if(mode==MODE_EPS) {
+	read(fd,data,16);
+      } else if(mode==MODE_E16) {
+	read(fd,data,16);
+      } else {
+	read(fd,data,28);
+      }
+
+      // Valid instrument?
+      if(j<8) {
+
+	if(!instValid[j]) {
+	  printf("0\r\n");
+	  continue;
+	}
+      } else {
+	// Valid song ?
+	if(data[4] == 0) {
+	  printf("0\r\n");
+	  continue;
+	}
+      }
+
+      // Inst/Song info
+      if(data[0] > 0x7f) {
+	//Song?
+	if(j==8) {
+	  printf("0\r\n");
+	} else {
+	  // "Copy of" + Inst num
+	  printf("2,%d\r\n",(data[0] & 0x0f)+1);
+	}
+      } else {
+
+	//"Valid" + Path Depth
+	printf("1,%d,",data[0]);
+	// Device
+	printf("%d,",data[2]);
+	//Media Name (if any)
+	if(mode==MODE_EPS) {
+	  printf("<NONE>,");
+	} else {
+	  printf("%c%c%c%c%c%c%c,",
+		 data[ 3],
+		 data[ 5],
+		 data[ 7],
+		 data[ 9],
+		 data[11],
+		 data[13],
+		 data[15]);
+	}
+
+	if(data[0] > 0) {
+	  for(k=0;k<data[0];k++) {
+	    printf("/%d",data[ 4+2*k]);
+	  }
+	  printf(",%d\r\n",data[4+2*k]);
+	} else {
+	  printf("/,%d\r\n",data[4]);
+	}
+
+      }
+    }
+    if(effectFound) {
+      lseek(fd,0x800,0);
+      read(fd,data,64);
+      printf("1,%c%c%c%c%c%c%c%c%c%c%c%c\r\n",
+	     data[10],
+	     data[12],
+	     data[14],
+	     data[16],
+	     data[18],
+	     data[20],
+	     data[22],
+	     data[24],
+	     data[26],
+	     data[28],
+	     data[30],
+	     data[32]);
+
+    } else {
+      printf("0\r\n");
+    }
+
+  } else {
+    // HUMAN READABLE
+
+    if( (fd=open(filename,  O_RDONLY | O_BINARY, 0)) <= 0) {
+      printf("ERROR: File not found!\r\n");
+      return(1);
+    }
+
+    if( (count=read(fd,data,0x222)) < 0x222) {
+      printf("ERROR: File read error!\r\n");
+      return(1);
+    }
+
+    // Get Bank type
+    switch (data[0x32]) {
+    case 4:
+      mode=MODE_EPS;
+      printf("Bank type:EPS\r\n");
+      break;
+    case 0x17:
+      mode=MODE_E16;
+      printf("Bank type:EPS16+\r\n");
+      break;
+    case 0x1e:
+      mode=MODE_ASR;
+      printf("Bank type:ASR\r\n");
+      break;
+    default:
+      printf("ERROR: Not an Ensoniq Bank file!\r\n");
+      exit(1);
+    }
+
+    // Check Num of Blocks
+    if(data[0x35] > 3) {
+      effectFound = 1;
+    }
+
+    printf("Bank Name:");
+    for(i=0x208;i<0x220;i=i+2) {
+      printf("%c",data[i]);
+    }
+    printf("\r\n");
+    printf("Inst Mask:0x%x (%d%d%d%d%d%d%d%d)\r\n",data[0x220],
+	   (data[0x220] >> 7) & 0x01,
+	   (data[0x220] >> 6) & 0x01,
+	   (data[0x220] >> 5) & 0x01,
+	   (data[0x220] >> 4) & 0x01,
+	   (data[0x220] >> 3) & 0x01,
+	   (data[0x220] >> 2) & 0x01,
+	   (data[0x220] >> 1) & 0x01,
+	   data[0x220] & 0x01);
+
+    for(j=0;j<9;j++) {
+
+      if(j==8) {
+	printf("\r\nSONG\r\n");
+      } else {
+	printf("\r\nINST %d\r\n",j+1);
+      }
+      //eps
+      if(mode==MODE_EPS) {
+	read(fd,data,16);
+      } else if(mode==MODE_E16) {
+	read(fd,data,16);
+      } else {
+	read(fd,data,28);
+      }
+
+      if(data[0] >= 0x80) {
+	if(j==8) {
+	  printf("<NONE>\r\n");
+	} else {
+	  printf("Copy Of Inst: %d\r\n",(data[0] & 0x0f)+1);
+	}
+      } else if (data[0] == 0x7f) {
+	printf("Deleted\r\n");
+      } else {
+	printf("Path Depth: %d (0x%x)\r\n",data[0],data[0]);
+	printf("0xFF: 0x%x\r\n",data[1]);
+	printf("Media (0=floppy, SCSI+1): 0x%x\r\n",data[2]);
+	printf("Disk Label: %c%c%c%c%c%c%c\r\n",
+	       data[ 3],
+	       data[ 5],
+	       data[ 7],
+	       data[ 9],
+	       data[11],
+	       data[13],
+	       data[15]);
+
+	if(data[0] > 0) {
+	  printf("Path:");
+	  for(k=0;k<data[0];k++) {
+	    printf("/%d",data[ 4+2*k]);
+	  }
+	  printf("\r\nInst Idx:%d\r\n",data[4+2*k]);
+	} else {
+	  printf("Inst Idx:%d\r\n",data[4]);
+	}
+
+      }
+    }
+    if(effectFound) {
+      lseek(fd,0x800,0);
+      read(fd,data,64);
+      printf("\r\nEFFECT: %c%c%c%c%c%c%c%c%c%c%c%c\r\n\r\n",
+	     data[10],
+	     data[12],
+	     data[14],
+	     data[16],
+	     data[18],
+	     data[20],
+	     data[22],
+	     data[24],
+	     data[26],
+	     data[28],
+	     data[30],
+	     data[32]);
+    }
+  }
+  return(0);
+}
+
+
+/////////////////////////////////
+// LoadLazyFAT
+// -Reads the FAT-table of disk access if GetInfo left
+//  it unread (ie. this is the first use of the table),
+//  or the chunk of FAT block 'fatsect' of file access
+//  table of LoadFAT.
+void LoadLazyFAT(unsigned char *DiskFAT, unsigned int fatsect)
+{
+  unsigned int i, first, n;
+
+  if(DiskFAT == NULL) return;
+  if(DiskFAT == LazyFAT.DiskFAT) {
+    LazyFAT.DiskFAT = NULL;
+    ReadBlocks(LazyFAT.media_type,LazyFAT.fd,LazyFAT.file,FAT_START_BLOCK,LazyFAT.fat_blks,DiskFAT);
+    return;
+  }
+
+  for(i=0; i<MAX_LAZY_FATS; i++) {
+    if(FileFAT[i].DiskFAT != DiskFAT) continue;
+    if((fatsect >= FileFAT[i].fat_blks) || FileFAT[i].Loaded[fatsect/LAZY_FAT_CHUNK]) return;
+    first = (fatsect/LAZY_FAT_CHUNK)*LAZY_FAT_CHUNK;
+    n = FileFAT[i].fat_blks - first;
+    if(n > LAZY_FAT_CHUNK) n = LAZY_FAT_CHUNK;
+    ReadBlocks(FileFAT[i].media_type,FileFAT[i].fd,FileFAT[i].file,FAT_START_BLOCK+first,n,DiskFAT+first*BLOCK_SIZE);
+    FileFAT[i].Loaded[fatsect/LAZY_FAT_CHUNK] = 1;
+    return;
+  }
+}
+
+/////////////////////////////////
+// SaveDiskHdr
+// -Writes system blocks (and FAT if it has been read)
+//  of disk access back to the media.
+void SaveDiskHdr(char media_type, FD_HANDLE fd, int file, unsigned int fat_blks, unsigned char *DiskHdr)
+{
+  if((LazyFAT.DiskFAT != NULL) && (LazyFAT.DiskFAT == DiskHdr+FAT_START_BLOCK*BLOCK_SIZE)) {
+    WriteBlocks(media_type,fd,file,0,5,DiskHdr);
+  } else {
+    WriteBlocks(media_type,fd,file,0,5+fat_blks,DiskHdr);
+  }
+}
+
+/////////////////////////////////
+// Get FAT entry - use FAT table
+// (in file access only if the table has been loaded)
+unsigned int GetFatEntry(char media_type, unsigned char *DiskFAT, int file, unsigned int block)
+{
+  unsigned int fatsect, fatpos,tmp;
+  unsigned char FatEntry[3];
+
+  fatsect= (int) block / FAT_ENTRIES_PER_BLK;
+  fatpos = block % FAT_ENTRIES_PER_BLK;
+
+  if((media_type=='f') && (DiskFAT == NULL)) {
+    // FILE ACCESS
+#ifdef __CYGWIN__
+    // To get /dev/scd work...
+    { unsigned char tmp_buff[512];
+    ReadBlocks(media_type,(FD_HANDLE) 0,file,(FAT_START_BLOCK+fatsect),1,tmp_buff);
+    return((tmp_buff[fatpos*3] << 16) + (tmp_buff[fatpos*3+1] << 8) + tmp_buff[fatpos*3+2]);
+
+    }
+#else // Linux and macOS
+    if(ImageRead(file,FatEntry,3,(FAT_START_BLOCK+fatsect)*BLOCK_SIZE+fatpos*3) <= 0) {
+      printf("ERROR in read\r\n");
+    }
+    return((FatEntry[0] << 16) + (FatEntry[1] << 8) + FatEntry[2]);
+#endif
+
+} else { // media type is not file access
+    // DISK ACCESS - uses FAT-table
+    LoadLazyFAT(DiskFAT,fatsect);
+    tmp = (fatsect*BLOCK_SIZE) + fatpos*3;
+    return((DiskFAT[tmp] << 16) + (DiskFAT[tmp+1] << 8) + DiskFAT[tmp+2]);
+  }
+}
+
+/////////////////////
+// PutFatEntry
+int PutFatEntry(char media_type, unsigned char *DiskFAT, int file,
+		unsigned int block, unsigned int fatval)
+{
+  unsigned int fatsect, fatpos,tmp;
+  unsigned char FatEntry[3];
+
+  fatsect= (int) block / FAT_ENTRIES_PER_BLK;
+  fatpos = block % FAT_ENTRIES_PER_BLK;
+
+  FatEntry[2] = fatval  &  0x000000FF;
+  FatEntry[1] = (fatval >> 8) & 0x000000FF;
+  FatEntry[0] = (fatval >> 16) & 0x000000FF;
+
+  if((media_type=='f') && (DiskFAT == NULL)) {
+    // file access
+    if(IsMappedImage(file)) {
+      ImageWrite(file,FatEntry,3,(FAT_START_BLOCK+fatsect)*BLOCK_SIZE+fatpos*3);
+      return(OK);
+    }
+    lseek(file,(FAT_START_BLOCK+fatsect)*BLOCK_SIZE+fatpos*3, SEEK_SET);
+    write(file,FatEntry,3);
+    return(OK);
+
+  } else {
+    // disk access - uses FAT-table
+    LoadLazyFAT(DiskFAT,fatsect);
+    tmp = (fatsect*BLOCK_SIZE) + fatpos*3;
+    memcpy(DiskFAT+tmp, FatEntry,3);
+    return(OK);
+  }
+}
+
+//////////////////////
+// Convert MacFormat
+// ===================
+// - Convert really _stupid_ 'Mac'-format (ie. every '0x0a' is replaced by '0x0d0a')..
+//   Why this even exists !?!?
+// - The file is not copied: the byte before every '0x0a' is skipped
+//   while reading (see MacPread). A map of file offsets, made in one
+//   pass through a fixed buffer, lets reads start anywhere.
+
+// Kept bytes of 'Mac'-format data in Buf[i..n): calls 'Run' for each run
+// between the skipped bytes and returns where the next pass starts.
+// (Buf[n] is looked at, so the byte before a '0x0a' there is skipped.)
+static unsigned int MacRuns(unsigned char *Buf, unsigned int i, unsigned int n,
+			    void (*Run)(void *ctx, unsigned char *p, unsigned int len), void *ctx)
+{
+  unsigned char *lf;
+
+  while(i < n) {
+    // (memchr scans a word or vector at a time)
+    if((lf = memchr(Buf+i+1, 0x0a, n-i)) == NULL) {
+      Run(ctx, Buf+i, n-i);
+      return(n);
+    }
+    Run(ctx, Buf+i, (lf-Buf)-1-i);
+    i = lf-Buf;
+  }
+  return(i);
+}
+
+typedef struct {
+  unsigned char *Buf;		// buffer read from file offset 'pos'
+  off_t pos;
+  off_t size;			// bytes without the skipped ones
+  off_t *Offset;		// file offset of every MAC_MAP_STEP:th byte
+} MacMapPass;
+
+static void MacMapRun(void *ctx, unsigned char *p, unsigned int len)
+{
+  MacMapPass *m = ctx;
+  off_t step;
+
+  for(step=(m->size + MAC_MAP_STEP-1) / MAC_MAP_STEP; step*MAC_MAP_STEP < m->size+len; step++) {
+    m->Offset[step] = m->pos + (p - m->Buf) + (step*MAC_MAP_STEP - m->size);
+  }
+  m->size = m->size + len;
+}
+
+typedef struct {
+  unsigned char *p;
+  size_t skip, left;
+} MacReadPass;
+
+static void MacReadRun(void *ctx, unsigned char *p, unsigned int len)
+{
+  MacReadPass *r = ctx;
+  unsigned int n;
+
+  if(r->skip >= len) {
+    r->skip = r->skip - len;
+    return;
+  }
+  p = p + r->skip;
+  n = len - r->skip;
+  r->skip = 0;
+  if(n > r->left) n = r->left;
+  memcpy(r->p, p, n);
+  r->p    = r->p + n;
+  r->left = r->left - n;
+}
+
+// Forget the map of 'file' (before it is closed)
+void UnmapMacFormat(int file)
+{
+  int i;
+
+  for(i=0; i<MacMap.files; i++) {
+    if(MacMap.File[i].file == file) {
+      free(MacMap.File[i].Offset);
+      MacMap.File[i] = MacMap.File[--MacMap.files];
+      return;
+    }
+  }
+}
+
+//////////////////////
+// MacPread
+// --------
+// pread() of an input file. In a 'Mac'-format file 'pos' and 'len'
+// are of the data without the extra bytes (see ConvertMacFormat).
+ssize_t MacPread(int file, void *buffer, size_t len, off_t pos)
+{
+  unsigned char Buf[STREAM_BUFFER_BLOCKS*BLOCK_SIZE/8+1];
+  MacFile *Mac = NULL;
+  MacReadPass r;
+  off_t phys;
+  ssize_t got;
+  size_t want;
+  unsigned int n;
+  int i;
+
+  for(i=0; i<MacMap.files; i++) {
+    if(MacMap.File[i].file == file) Mac = MacMap.File+i;
+  }
+  if(Mac == NULL) return(pread(file, buffer, len, pos));
+
+  if(pos >= Mac->size) return(0);
+  if(len > Mac->size - pos) len = Mac->size - pos;
+
+  r.p    = buffer;
+  r.left = len;
+  r.skip = pos % MAC_MAP_STEP;
+  phys   = Mac->Offset[pos / MAC_MAP_STEP];
+
+  while(r.left > 0) {
+    // (at most every other byte is skipped)
+    want = 2*(r.skip+r.left)+2;
+    if(want > sizeof(Buf)) want = sizeof(Buf);
+    if((got = pread(file, Buf, want, phys)) <= 0) break;
+    // (last byte of a full read is only looked at)
+    if(got == want) {
+      n = got-1;
+    } else {
+      n = got;
+      Buf[n] = 0;
+    }
+    phys = phys + MacRuns(Buf, 0, n, MacReadRun, &r);
+  }
+
+  return((r.p == buffer) ? -1 : (ssize_t) (r.p - (unsigned char *) buffer));
+}
+
+int ConvertMacFormat(int *in, char *in_file)
+{
+  unsigned char *Buf, Hdr[3];
+  MacMapPass m;
+  struct stat stat_buf;
+  ssize_t got;
+  unsigned int n;
+
+  if((pread(*in, Hdr, 3, 0) != 3) || (Hdr[0] != 0x0d) || (Hdr[1] != 0x0d) || (Hdr[2] != 0x0a)) {
+    return(ERR);
+  }
+
+  if(fstat(*in, &stat_buf) != 0) {
+    EEXIT((stderr,"ERROR: Can't get the filesize of '%s'!!\r\n",in_file));
+  }
+
+  Buf = malloc(STREAM_BUFFER_BLOCKS*BLOCK_SIZE+1);
+  m.Buf = Buf;
+  m.Offset = malloc((stat_buf.st_size/MAC_MAP_STEP+1)*sizeof(off_t));
+  if((Buf == NULL) || (m.Offset == NULL)) EEXIT((stderr,"ERROR: Couldn't allocate memory!!!! \r\n"));
+  m.size = 0;
+
+  // Map every MAC_MAP_STEP:th byte of the data to its file offset
+  for(m.pos=0; (got = pread(*in, Buf, STREAM_BUFFER_BLOCKS*BLOCK_SIZE+1, m.pos)) > 0; ) {
+    if(got == STREAM_BUFFER_BLOCKS*BLOCK_SIZE+1) {
+      n = got-1;
+    } else {
+      n = got;
+      Buf[n] = 0;
+    }
+    m.pos = m.pos + MacRuns(Buf, 0, n, MacMapRun, &m);
+    if(n == got) break;
+  }
+  free(Buf);
+
+  UnmapMacFormat(*in);
+  MacMap.File = realloc(MacMap.File, (MacMap.files+1)*sizeof(MacFile));
+  if(MacMap.File == NULL) EEXIT((stderr,"ERROR: Couldn't allocate memory!!!! \r\n"));
+  MacMap.File[MacMap.files].file   = *in;
+  MacMap.File[MacMap.files].size   = m.size;
+  MacMap.File[MacMap.files].Offset = m.Offset;
+  MacMap.files++;
+
+  return(OK);
+}
+
+// Forget the map (before the file is closed)
+void UnmapEDxImage(void)
+{
+  free(EDxMap.Offset);
+  EDxMap.Offset = NULL;
+  EDxMap.file   = -1;
+  EDxMap.blocks = 0;
+}
+
+//////////////////////
+// MapEDxImage
+// -----------
+// Reads the skip table of EDE/EDA file 'in' and maps each block of
+// the image to its offset in the file, so that the image can be read
+// in place (see ImageRead) without converting it to a raw temp image.
+int MapEDxImage(int in, char image_type)
+{
+  unsigned int i, j, skip_start, skip_size;
+  unsigned char Hdr[BLOCK_SIZE], bits;
+  off_t pos;
+
+  if(image_type == EDE_TYPE) {
+    skip_start= EDE_SKIP_START;
+    skip_size = EDE_SKIP_SIZE;
+  } else {
+    skip_start= EDA_SKIP_START;
+    skip_size = EDA_SKIP_SIZE;
+  }
+
+  if(MacPread(in, Hdr, BLOCK_SIZE, 0) != BLOCK_SIZE) return(ERR);
+
+  UnmapEDxImage();
+  EDxMap.Offset = malloc(skip_size*8*sizeof(off_t));
+  if(EDxMap.Offset == NULL) EEXIT((stderr,"ERROR: Couldn't allocate memory!!!! \r\n"));
+
+  // Used blocks follow the skip table block in order (see ImageToEDx)
+  pos = BLOCK_SIZE;
+  for(i=0; i<skip_size; i++) {
+    bits = Hdr[skip_start+i];
+    for(j=0; j<8; j++) {
+      if(bits & 0x80) {
+	EDxMap.Offset[i*8+j] = 0;
+      } else {
+	EDxMap.Offset[i*8+j] = pos;
+	pos = pos + BLOCK_SIZE;
+      }
+      bits = bits << 1;
+    }
+  }
+
+  EDxMap.file   = in;
+  EDxMap.blocks = skip_size*8;
+  return(OK);
+}
+
+//////////////////////////////////////////////////////////////
+// Packed images
+// -------------
+// - EPZ file holds the raw image in chunks of EPZ_CHUNK_SIZE, each
+//   compressed on its own, so any block is reached by decompressing
+//   one chunk only. Header block (signature, chunk size, image size,
+//   number of chunks and index offset, Intel byte order), then the
+//   chunks, then the index of chunk offsets/lengths/kinds.
+// - Opened image (see PackedOpen) is read and written in place
+//   through a small cache of chunks. Written chunks are appended
+//   after the index, and the new index and header are written last
+//   (see PackedFlush), so the old index stays valid until then.
+// - Superseded chunks and indexes are left behind as dead space, and
+//   when there is too much of it the live data is rewritten to a new
+//   file which replaces the old one (see PackedCompact).
+//
+
+static unsigned long long EPZGet(unsigned char *p, unsigned int bytes)
+{
+  unsigned long long val = 0;
+
+  while(bytes-- > 0) val = (val << 8) + p[bytes];
+  return(val);
+}
+
+static void EPZPut(unsigned char *p, unsigned long long val, unsigned int bytes)
+{
+  unsigned int i;
+
+  for(i=0; i<bytes; i++, val=val >> 8) p[i] = val & 0xFF;
+}
+
+// Length of a sequence field: 4 bits in the token, 255's after it
+static unsigned char *PackLength(unsigned char *o, unsigned int len)
+{
+  for(len=len-15; len>=255; len=len-255) *o++ = 255;
+  *o++ = len;
+  return(o);
+}
+
+/////////////////////
+// PackLZ
+// ------
+// LZ77 of 'len' bytes from 'Src' to 'Dst' as sequences of token
+// (literal and match lengths, 4 bits each), literals, match offset
+// (2 bytes) and the rest of the lengths. Matches are found by a hash
+// of 4 bytes. Returns the compressed length, or 0 if it wouldn't be
+// shorter than 'max'.
+static unsigned int PackLZ(unsigned char *Src, unsigned int len, unsigned char *Dst, unsigned int max)
+{
+  static unsigned int Hash[4096];		// position+1 of the last 4 bytes with the hash
+  unsigned char *o, *token;
+  unsigned int i, anchor, ref, lit, m, seq, h;
+
+  memset(Hash, 0, sizeof(Hash));
+  o = Dst; anchor = 0;
+
+  for(i=0; i+4<=len; ) {
+    memcpy(&seq, Src+i, 4);
+    h = (seq * 2654435761U) >> 20;
+    ref = Hash[h];
+    Hash[h] = i+1;
+    if((ref == 0) || (i-(ref-1) > 0xFFFF) || (memcmp(Src+ref-1, Src+i, 4) != 0)) {
+      i++;
+      continue;
+    }
+    ref--;
+    for(m=4; (i+m < len) && (Src[ref+m] == Src[i+m]); m++);
+
+    lit = i - anchor;
+    if((o-Dst) + lit + lit/255 + m/255 + 6 >= max) return(0);
+    token = o++;
+    *token = ((lit < 15) ? lit : 15) << 4;
+    if(lit >= 15) o = PackLength(o, lit);
+    memcpy(o, Src+anchor, lit);
+    o = o + lit;
+    EPZPut(o, i-ref, 2);
+    o = o + 2;
+    *token |= (m-4 < 15) ? m-4 : 15;
+    if(m-4 >= 15) o = PackLength(o, m-4);
+
+    i = i + m;
+    anchor = i;
+  }
+
+  // Last literals (no match)
+  lit = len - anchor;
+  if((o-Dst) + lit + lit/255 + 2 >= max) return(0);
+  *o++ = ((lit < 15) ? lit : 15) << 4;
+  if(lit >= 15) o = PackLength(o, lit);
+  memcpy(o, Src+anchor, lit);
+  o = o + lit;
+
+  return(o-Dst);
+}
+
+/////////////////////
+// UnpackLZ
+// --------
+// Decompresses 'len' bytes of PackLZ sequences to exactly 'size'
+// bytes of 'Dst'.
+static int UnpackLZ(unsigned char *Src, unsigned int len, unsigned char *Dst, unsigned int size)
+{
+  unsigned int i, o, lit, m, off, n;
+
+  for(i=0, o=0; i<len; ) {
+    lit = Src[i] >> 4;
+    m   = (Src[i] & 15) + 4;
+    i++;
+    if(lit == 15) {
+      do {
+	if(i >= len) return(ERR);
+	n = Src[i++];
+	lit = lit + n;
+      } while(n == 255);
+    }
+    if((i+lit > len) || (o+lit > size)) return(ERR);
+    memcpy(Dst+o, Src+i, lit);
+    i = i + lit;
+    o = o + lit;
+    if(i == len) break;				// last literals
+
+    if(i+2 > len) return(ERR);
+    off = EPZGet(Src+i, 2);
+    i = i + 2;
+    if(m == 19) {
+      do {
+	if(i >= len) return(ERR);
+	n = Src[i++];
+	m = m + n;
+      } while(n == 255);
+    }
+    if((off == 0) || (off > o) || (o+m > size)) return(ERR);
+    // (byte by byte, match may overlap its own output)
+    for(n=0; n<m; n++, o++) Dst[o] = Dst[o-off];
+  }
+
+  return((o == size) ? OK : ERR);
+}
+
+// Compresses a chunk to 'Out', returns its length and kind
+static unsigned int PackChunk(unsigned char *Data, unsigned int len, unsigned char *Out, unsigned char *kind)
+{
+  unsigned int i, n;
+
+  for(i=0; (i<len) && (Data[i] == 0); i++);
+  if(i == len) {
+    *kind = EPZ_ZERO;
+    return(0);
+  }
+  if((n = PackLZ(Data, len, Out, len)) > 0) {
+    *kind = EPZ_LZ;
+    return(n);
+  }
+  *kind = EPZ_STORED;
+  memcpy(Out, Data, len);
+  return(len);
+}
+
+// Raw length of a chunk (last one may be short)
+static unsigned int PackedChunkLen(unsigned int chunk)
+{
+  off_t left = Packed.size - (off_t) chunk*EPZ_CHUNK_SIZE;
+
+  return((left > EPZ_CHUNK_SIZE) ? EPZ_CHUNK_SIZE : (unsigned int) left);
+}
+
+// Writes the header block of a packed image
+static int PackedHeader(int out, off_t size, unsigned int chunks, off_t index)
+{
+  unsigned char Hdr[BLOCK_SIZE];
+
+  memset(Hdr, 0, BLOCK_SIZE);
+  memcpy(Hdr, EPZ_SIGNATURE, 8);
+  EPZPut(Hdr+8, EPZ_CHUNK_SIZE, 4);
+  EPZPut(Hdr+12, size, 8);
+  EPZPut(Hdr+20, chunks, 4);
+  EPZPut(Hdr+24, index, 8);
+  return((pwrite(out, Hdr, BLOCK_SIZE, 0) == BLOCK_SIZE) ? OK : ERR);
+}
+
+// Stores a written chunk of the cache after the end of the file
+static int PackedStore(PackedSlot *Slot)
+{
+  unsigned char *Entry = Packed.Index + Slot->chunk*EPZ_INDEX_ENTRY;
+  unsigned int n;
+
+  n = PackChunk(Slot->Data, PackedChunkLen(Slot->chunk), Packed.Work, Entry+12);
+  if((n > 0) && (pwrite(Packed.file, Packed.Work, n, Packed.end) != n)) return(ERR);
+  EPZPut(Entry, (n > 0) ? Packed.end : 0, 8);
+  EPZPut(Entry+8, n, 4);
+  Packed.end = Packed.end + n;
+  Packed.changed = 1;
+  Slot->dirty = 0;
+  return(OK);
+}
+
+/////////////////////
+// PackedChunk
+// -----------
+// Returns the cache slot holding 'chunk', decompressing it to the
+// least recently used slot if needed.
+static PackedSlot *PackedChunk(unsigned int chunk)
+{
+  PackedSlot *Slot, *Victim;
+  unsigned char *Entry = Packed.Index + chunk*EPZ_INDEX_ENTRY;
+  unsigned int i, len, n;
+
+  Victim = Packed.Cache;
+  for(i=0; i<EPZ_CACHE_CHUNKS; i++) {
+    Slot = Packed.Cache+i;
+    if((Slot->age != 0) && (Slot->chunk == chunk)) {
+      Slot->age = ++Packed.clock;
+      return(Slot);
+    }
+    if(Slot->age < Victim->age) Victim = Slot;
+  }
+
+  if(Victim->Data == NULL) {
+    Victim->Data = malloc(EPZ_CHUNK_SIZE);
+    if(Victim->Data == NULL) EEXIT((stderr,"ERROR: Couldn't allocate memory!!!! \r\n"));
+  }
+  if(Victim->dirty && (PackedStore(Victim) != OK)) {
+    EEXIT((stderr,"ERROR: Couldn't write packed image! \r\n"));
+  }
+
+  len = PackedChunkLen(chunk);
+  n   = EPZGet(Entry+8, 4);
+  switch(Entry[12])
+    {
+    case EPZ_ZERO:
+      memset(Victim->Data, 0, len);
+      break;
+
+    case EPZ_STORED:
+    case EPZ_LZ:
+      if((n > EPZ_CHUNK_SIZE) || (pread(Packed.file, Packed.Work, n, EPZGet(Entry, 8)) != n) ||
+	 ((Entry[12] == EPZ_STORED) ? (n != len) : (UnpackLZ(Packed.Work, n, Victim->Data, len) != OK))) {
+	EEXIT((stderr,"ERROR: Chunk %d of packed image is broken! \r\n", chunk));
+      }
+      if(Entry[12] == EPZ_STORED) memcpy(Victim->Data, Packed.Work, len);
+      break;
+
+    default:
+      EEXIT((stderr,"ERROR: Chunk %d of packed image is broken! \r\n", chunk));
+    }
+
+  Victim->chunk = chunk;
+  Victim->age   = ++Packed.clock;
+  return(Victim);
+}
+
+// Reads (or with 'write' writes) 'len' bytes at 'pos' of the packed image
+static ssize_t PackedAccess(unsigned char *p, size_t len, off_t pos, int write)
+{
+  PackedSlot *Slot;
+  unsigned int off;
+  size_t n, done;
+
+  pthread_mutex_lock(&PackedLock);
+  for(done=0; (done<len) && (pos+done < Packed.size); done=done+n) {
+    Slot = PackedChunk((pos+done) / EPZ_CHUNK_SIZE);
+    off  = (pos+done) % EPZ_CHUNK_SIZE;
+    n    = PackedChunkLen(Slot->chunk) - off;
+    if(n > len-done) n = len-done;
+    if(write) {
+      memcpy(Slot->Data+off, p+done, n);
+      Slot->dirty = 1;
+    } else {
+      memcpy(p+done, Slot->Data+off, n);
+    }
+  }
+  pthread_mutex_unlock(&PackedLock);
+
+  return((done > 0) ? (ssize_t) done : -1);
+}
+
+// Forget the packed image (after PackedFlush)
+void PackedClose(void)
+{
+  unsigned int i;
+
+  for(i=0; i<EPZ_CACHE_CHUNKS; i++) {
+    free(Packed.Cache[i].Data);
+    Packed.Cache[i].Data  = NULL;
+    Packed.Cache[i].age   = 0;
+    Packed.Cache[i].dirty = 0;
+  }
+  free(Packed.Index);
+  free(Packed.Work);
+  Packed.Index = NULL;
+  Packed.Work  = NULL;
+  Packed.file  = -1;
+  Packed.clock = 0;
+}
+
+//////////////////////
+// PackedOpen
+// ----------
+// Reads the header and the index of packed image 'in', so that it can
+// be read and written in place (see ImageRead and ImageWrite).
+int PackedOpen(int in)
+{
+  unsigned char Hdr[BLOCK_SIZE];
+  size_t index_len;
+  off_t index;
+
+  if((pread(in, Hdr, BLOCK_SIZE, 0) != BLOCK_SIZE) || (memcmp(Hdr, EPZ_SIGNATURE, 8) != 0) ||
+     (EPZGet(Hdr+8, 4) != EPZ_CHUNK_SIZE)) {
+    return(ERR);
+  }
+
+  PackedClose();
+  Packed.size   = EPZGet(Hdr+12, 8);
+  Packed.chunks = EPZGet(Hdr+20, 4);
+  index         = EPZGet(Hdr+24, 8);
+  if((off_t) Packed.chunks*EPZ_CHUNK_SIZE < Packed.size) return(ERR);
+
+  index_len = (size_t) Packed.chunks*EPZ_INDEX_ENTRY;
+  Packed.Index = malloc(index_len+1);
+  Packed.Work  = malloc(EPZ_CHUNK_SIZE);
+  if((Packed.Index == NULL) || (Packed.Work == NULL)) EEXIT((stderr,"ERROR: Couldn't allocate memory!!!! \r\n"));
+  if(pread(in, Packed.Index, index_len, index) != (ssize_t) index_len) {
+    PackedClose();
+    return(ERR);
+  }
+
+  Packed.file    = in;
+  Packed.end     = index + index_len;
+  Packed.changed = 0;
+  return(OK);
+}
+
+//////////////////////
+// PackedFlush
+// -----------
+// Stores the written chunks of the cache, then the new index after
+// them and finally the header pointing to it.
+int PackedFlush(void)
+{
+  unsigned int i;
+  size_t index_len = (size_t) Packed.chunks*EPZ_INDEX_ENTRY;
+
+  for(i=0; i<EPZ_CACHE_CHUNKS; i++) {
+    if(Packed.Cache[i].dirty && (PackedStore(Packed.Cache+i) != OK)) return(ERR);
+  }
+  if(!Packed.changed) return(OK);
+
+  if((pwrite(Packed.file, Packed.Index, index_len, Packed.end) != (ssize_t) index_len) ||
+     (PackedHeader(Packed.file, Packed.size, Packed.chunks, Packed.end) != OK)) {
+    return(ERR);
+  }
+  Packed.end = Packed.end + index_len;
+  Packed.changed = 0;
+  return(OK);
+}
+
+//////////////////////
+// PackedCompact
+// -------------
+// Rewrites the live chunks and the index of the flushed packed image
+// to a temp file which then replaces file 'name', if the dead space
+// left by PackedFlush is over 1/EPZ_DEAD_SHARE of the file. The open
+// descriptor is moved to the new file, so the image stays open.
+int PackedCompact(char *name)
+{
+  unsigned char *Index;
+  char *tmp_name;
+  struct stat stat_buf;
+  size_t index_len = (size_t) Packed.chunks*EPZ_INDEX_ENTRY;
+  unsigned int chunk, n;
+  off_t live, pos;
+  int out;
+
+  for(live=BLOCK_SIZE+index_len, chunk=0; chunk<Packed.chunks; chunk++) {
+    live = live + EPZGet(Packed.Index+chunk*EPZ_INDEX_ENTRY+8, 4);
+  }
+  if((Packed.end - live)*EPZ_DEAD_SHARE <= Packed.end) return(OK);
+
+  tmp_name = malloc(strlen(name)+8);
+  Index = malloc(index_len+1);
+  if((tmp_name == NULL) || (Index == NULL)) EEXIT((stderr,"ERROR: Couldn't allocate memory!!!! \r\n"));
+  sprintf(tmp_name, "%s.XXXXXX", name);
+
+  if((out = mkstemp(tmp_name)) < 0) {
+    free(tmp_name); free(Index);
+    return(ERR);
+  }
+
+  memcpy(Index, Packed.Index, index_len);
+  pos = BLOCK_SIZE;
+  for(chunk=0; chunk<Packed.chunks; chunk++) {
+    n = EPZGet(Index+chunk*EPZ_INDEX_ENTRY+8, 4);
+    if(n == 0) continue;
+    if((n > EPZ_CHUNK_SIZE) ||
+       (pread(Packed.file, Packed.Work, n, EPZGet(Index+chunk*EPZ_INDEX_ENTRY, 8)) != n) ||
+       (pwrite(out, Packed.Work, n, pos) != n)) {
+      break;
+    }
+    EPZPut(Index+chunk*EPZ_INDEX_ENTRY, pos, 8);
+    pos = pos + n;
+  }
+
+  if((chunk < Packed.chunks) ||
+     (pwrite(out, Index, index_len, pos) != (ssize_t) index_len) ||
+     (PackedHeader(out, Packed.size, Packed.chunks, pos) != OK) ||
+     (fstat(Packed.file, &stat_buf) != 0) || (fchmod(out, stat_buf.st_mode & 07777) != 0) ||
+     (rename(tmp_name, name) != 0)) {
+    close(out);
+    unlink(tmp_name);
+    free(tmp_name); free(Index);
+    return(ERR);
+  }
+
+  // Same descriptor, new file
+  dup2(out, Packed.file);
+  close(out);
+  free(Packed.Index);
+  Packed.Index = Index;
+  Packed.end   = pos + index_len;
+  free(tmp_name);
+  return(OK);
+}
+
+/////////////////////
+// ImageToPacked
+// -------------
+// Packs 'size' bytes of image 'in' (raw, or mapped EDE/EDA) to EPZ
+// file 'out': the chunks one after another, then the index.
+int ImageToPacked(int in, int out, off_t size)
+{
+  unsigned char *Data, *Work, *Index;
+  unsigned int chunk, chunks, len, n;
+  off_t pos;
+
+  chunks = (size + EPZ_CHUNK_SIZE - 1) / EPZ_CHUNK_SIZE;
+  Data  = malloc(EPZ_CHUNK_SIZE);
+  Work  = malloc(EPZ_CHUNK_SIZE);
+  Index = calloc(chunks+1, EPZ_INDEX_ENTRY);
+  if((Data == NULL) || (Work == NULL) || (Index == NULL)) EEXIT((stderr,"ERROR: Couldn't allocate memory!!!! \r\n"));
+
+  pos = BLOCK_SIZE;
+  for(chunk=0; chunk<chunks; chunk++) {
+    len = (size - (off_t) chunk*EPZ_CHUNK_SIZE > EPZ_CHUNK_SIZE) ? EPZ_CHUNK_SIZE : size - (off_t) chunk*EPZ_CHUNK_SIZE;
+    if(ImageRead(in, Data, len, (off_t) chunk*EPZ_CHUNK_SIZE) != len) return(ERR);
+    n = PackChunk(Data, len, Work, Index+chunk*EPZ_INDEX_ENTRY+12);
+    if((n > 0) && (pwrite(out, Work, n, pos) != n)) return(ERR);
+    EPZPut(Index+chunk*EPZ_INDEX_ENTRY, (n > 0) ? pos : 0, 8);
+    EPZPut(Index+chunk*EPZ_INDEX_ENTRY+8, n, 4);
+    pos = pos + n;
+  }
+
+  if((pwrite(out, Index, (size_t) chunks*EPZ_INDEX_ENTRY, pos) != (ssize_t) chunks*EPZ_INDEX_ENTRY) ||
+     (PackedHeader(out, size, chunks, pos) != OK)) {
+    return(ERR);
+  }
+
+  free(Data); free(Work); free(Index);
+  return(OK);
+}
+
+//////////////////////
+// EDxRead
+// -------
+// Reads the image of the mapped EDE/EDA file (see MapEDxImage) block
+// by block from its offsets, and skipped blocks get the 0x6D/0xB6
+// filler. Consecutive used blocks are read in one go.
+static ssize_t EDxRead(void *buffer, size_t len, off_t pos)
+{
+  unsigned char *p;
+  unsigned int block, off, i;
+  size_t n, done;
+  ssize_t r;
+
+  p = buffer;
+  for(done=0; done<len; done=done+n) {
+    block = (pos+done) / BLOCK_SIZE;
+    off   = (pos+done) % BLOCK_SIZE;
+    if(block >= EDxMap.blocks) break;
+
+    if(EDxMap.Offset[block] == 0) {
+      // Skipped block
+      n = BLOCK_SIZE - off;
+      if(n > len-done) n = len-done;
+      for(i=0; i<n; i++) p[done+i] = ((off+i) & 1) ? 0xB6 : 0x6D;
+    } else {
+      // Run of blocks stored one after another in the file
+      n = BLOCK_SIZE - off;
+      while((n < len-done) && (block+1 < EDxMap.blocks) && (EDxMap.Offset[block+1] == EDxMap.Offset[block]+BLOCK_SIZE)) {
+	n = n + BLOCK_SIZE;
+	block++;
+      }
+      if(n > len-done) n = len-done;
+      if((r = MacPread(EDxMap.file, p+done, n, EDxMap.Offset[(pos+done)/BLOCK_SIZE]+off)) <= 0) break;
+      n = r;
+    }
+  }
+
+  return((done > 0) ? (ssize_t) done : -1);
+}
+
+//////////////////////////////////////////////////////////////
+// Memory image
+// ------------
+// - EDE/EDA and HFE can't be written in place, so the raw image is
+//   held in memory while written and encoded back to the file of its
+//   format when flushed (see MemFlush).
+//
+
+static ssize_t MemRead(void *buffer, size_t len, off_t pos)
+{
+  if(pos >= Image.size) return(-1);
+  if(len > Image.size - pos) len = Image.size - pos;
+  memcpy(buffer, MemImage.Data+pos, len);
+  return(len);
+}
+
+// Image grows to hold what is written after its end
+static ssize_t MemWrite(void *buffer, size_t len, off_t pos)
+{
+  unsigned char *Data;
+
+  if(pos+len > Image.size) {
+    Data = realloc(MemImage.Data, pos+len);
+    if(Data == NULL) EEXIT((stderr,"ERROR: Couldn't allocate memory!!!! \r\n"));
+    memset(Data+Image.size, 0, pos+len-Image.size);
+    MemImage.Data = Data;
+    Image.size = pos+len;
+  }
+  memcpy(MemImage.Data+pos, buffer, len);
+  MemImage.changed = 1;
+  return(len);
+}
+
+//////////////////////////////////////////////////////////////
+// HFE images
+// ----------
+// - HxC floppy emulator image (v1 "HXCPICFE" or v3 "HXCHFEV3") holds
+//   the MFM cells of each track, both sides interleaved in 256 byte
+//   pieces and bits LSB first. Tracks are decoded to the sectors of
+//   a raw image (IBM MFM, 512 byte sectors numbered from 0), and the
+//   raw image is encoded back to tracks.
+// - MFM goes through lookup tables: the cells of each data byte on
+//   encode, and the data bits of each 8 cells on decode.
+//
+
+static unsigned short MfmEncode[256];	// data byte -> 16 cells (previous data bit 0)
+static unsigned char  MfmDecode[256];	// 8 cells -> 4 data bits
+static unsigned char  BitReverse[256];	// HFE bit order <-> MSB first
+static unsigned short Crc16Table[256];	// CRC-CCITT of ID and data fields
+
+static void HFEInitTables(void)
+{
+  static int done = 0;
+  unsigned int i, b, w, prev, crc;
+
+  if(done) return;
+  done = 1;
+
+  for(i=0; i<256; i++) {
+    // Clock cell is set between two zero data bits
+    for(w=0, prev=0, b=0x80; b!=0; b=b>>1) {
+      w = w << 2;
+      if(i & b) w = w | 1; else if(!prev) w = w | 2;
+      prev = i & b;
+    }
+    MfmEncode[i] = w;
+
+    // Data bits are every second cell
+    MfmDecode[i] = ((i >> 3) & 8) | ((i >> 2) & 4) | ((i >> 1) & 2) | (i & 1);
+
+    for(w=0, b=0; b<8; b++) if(i & (1 << b)) w = w | (0x80 >> b);
+    BitReverse[i] = w;
+
+    for(crc=i<<8, b=0; b<8; b++) crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : (crc << 1);
+    Crc16Table[i] = crc & 0xFFFF;
+  }
+}
+
+static unsigned int HFECrc(unsigned int crc, unsigned char *p, unsigned int len)
+{
+  while(len-- > 0) crc = ((crc << 8) ^ Crc16Table[((crc >> 8) ^ *p++) & 0xFF]) & 0xFFFF;
+  return(crc);
+}
+
+// Byte 'c' of side 'side' in HFE track data
+#define HFE_POS(c,side)  ((((c) >> 8) * BLOCK_SIZE) + (side)*256 + ((c) & 255))
+
+// MFM cells of one side of a track (MSB first)
+typedef struct {
+  unsigned char *Cells;
+  unsigned int pos;		// bytes of cells
+  unsigned int prev;		// last data bit
+} MfmTrack;
+
+static void MfmBytes(MfmTrack *t, unsigned char *p, unsigned int len)
+{
+  unsigned int w;
+
+  while(len-- > 0) {
+    w = MfmEncode[*p];
+    if(t->prev) w = w & 0x7FFF;
+    t->Cells[t->pos++] = w >> 8;
+    t->Cells[t->pos++] = w & 0xFF;
+    t->prev = *p++ & 1;
+  }
+}
+
+static void MfmFill(MfmTrack *t, unsigned char val, unsigned int len)
+{
+  while(len-- > 0) MfmBytes(t, &val, 1);
+}
+
+// Address marks ('val' with a missing clock cell)
+static void MfmMark(MfmTrack *t, unsigned char val, unsigned int cells, unsigned int len)
+{
+  while(len-- > 0) {
+    t->Cells[t->pos++] = cells >> 8;
+    t->Cells[t->pos++] = cells & 0xFF;
+  }
+  t->prev = val & 1;
+}
+
+// 16 cells starting from cell 'bit' (buffer has 3 bytes of slack)
+static unsigned int MfmWordAt(unsigned char *Cells, unsigned long bit)
+{
+  unsigned char *p = Cells + (bit >> 3);
+
+  return((((p[0] << 16) | (p[1] << 8) | p[2]) >> (8 - (bit & 7))) & 0xFFFF);
+}
+
+static void MfmRead(unsigned char *Cells, unsigned long bit, unsigned char *p, unsigned int len)
+{
+  unsigned int w;
+
+  for(; len>0; len--, bit=bit+16) {
+    w = MfmWordAt(Cells, bit);
+    *p++ = (MfmDecode[w >> 8] << 4) | MfmDecode[w & 0xFF];
+  }
+}
+
+/////////////////////////////
+// HFEDecodeSide
+// -------------
+// Finds the sectors of one side of a track ('bits' cells). Good
+// sectors (CRC checked) are stored by their number to 'Data', and
+// flagged in 'Found'. Returns the highest sector number + 1.
+//
+static unsigned int HFEDecodeSide(unsigned char *Cells, unsigned long bits,
+				  unsigned char *Data, char *Found)
+{
+  unsigned char Field[4+BLOCK_SIZE+2];
+  unsigned long i, pos;
+  unsigned int sr, sector, nsect, id_ok;
+
+  memcpy(Field, "\xA1\xA1\xA1", 3);
+  sr = 0; nsect = 0; id_ok = 0; sector = 0;
+
+  for(i=0; i<bits; i++) {
+    sr = (sr << 1) | ((Cells[i >> 3] >> (7 - (i & 7))) & 1);
+
+    // Three A1 syncs and the mark
+    if(sr != 0x44894489) continue;
+    pos = i + 1;
+    if((pos + 16*(2+6) > bits) || (MfmWordAt(Cells, pos) != 0x4489)) continue;
+    pos = pos + 16;
+    MfmRead(Cells, pos, Field+3, 1);
+
+    if(Field[3] == 0xFE) {
+      // ID field: track, head, sector, size and CRC
+      MfmRead(Cells, pos+16, Field+4, 6);
+      id_ok = (HFECrc(0xFFFF, Field, 10) == 0) && (Field[7] == 2) && (Field[6] < HFE_MAX_SECT);
+      sector = Field[6];
+      i = pos + 16*7 - 1;
+
+    } else if(((Field[3] == 0xFB) || (Field[3] == 0xF8)) && id_ok) {
+      // Data field of the sector of the last ID
+      id_ok = 0;
+      if(pos + 16*(1+BLOCK_SIZE+2) > bits) break;
+      MfmRead(Cells, pos+16, Field+4, BLOCK_SIZE+2);
+      if(HFECrc(0xFFFF, Field, 4+BLOCK_SIZE+2) != 0) continue;
+
+      memcpy(Data + sector*BLOCK_SIZE, Field+4, BLOCK_SIZE);
+      Found[sector] = 1;
+      if(sector+1 > nsect) nsect = sector+1;
+      i = pos + 16*(1+BLOCK_SIZE+2) - 1;
+    }
+    sr = 0;
+  }
+  return(nsect);
+}
+
+/////////////////////////////
+// HFEToImage
+// ----------
+// Decodes HFE file 'in' to the memory image (see MemWrite), track
+// by track.
+//
+int HFEToImage(int in)
+{
+  unsigned char Hdr[BLOCK_SIZE], *TrackList, *Track, *Side[2], *Data, x;
+  unsigned int tracks, sides, list_blks, track, side, k, n, c, len, offset, nsect, max_len;
+  unsigned long bits[2];
+  char Found[2][HFE_MAX_SECT];
+  int v3, missing;
+  ssize_t r;
+
+  HFEInitTables();
+
+  if(pread(in, Hdr, BLOCK_SIZE, 0) != BLOCK_SIZE) return(ERR);
+  if(memcmp(Hdr, HFE_V1_SIGNATURE, 8) == 0) {
+    v3 = 0;
+  } else if(memcmp(Hdr, HFE_V3_SIGNATURE, 8) == 0) {
+    v3 = 1;
+  } else {
+    return(ERR);
+  }
+
+  tracks = Hdr[9];
+  sides  = Hdr[10];
+  if((sides != 2) || (tracks == 0)) {
+    EEXIT((stderr,"ERROR: HFE with %d side(s) is not an Ensoniq disk! \r\n",sides));
+  }
+
+  // Track list (offset in blocks and length in bytes of each track)
+  list_blks = (tracks*4 + BLOCK_SIZE-1) / BLOCK_SIZE;
+  TrackList = malloc(list_blks*BLOCK_SIZE);
+  if(TrackList == NULL) EEXIT((stderr,"ERROR: Couldn't allocate memory!!!! \r\n"));
+  if(pread(in, TrackList, list_blks*BLOCK_SIZE, (off_t) (Hdr[18] + (Hdr[19] << 8))*BLOCK_SIZE) != list_blks*BLOCK_SIZE) {
+    EEXIT((stderr,"ERROR: HFE track list is broken! \r\n"));
+  }
+
+  for(max_len=0, track=0; track<tracks; track++) {
+    len = TrackList[track*4+2] + (TrackList[track*4+3] << 8);
+    if(len > max_len) max_len = len;
+  }
+
+  Track   = malloc(max_len + BLOCK_SIZE);
+  Side[0] = malloc(max_len/2 + BLOCK_SIZE);
+  Side[1] = malloc(max_len/2 + BLOCK_SIZE);
+  Data    = malloc(2*HFE_MAX_SECT*BLOCK_SIZE);
+  if((Track == NULL) || (Side[0] == NULL) || (Side[1] == NULL) || (Data == NULL)) {
+    EEXIT((stderr,"ERROR: Couldn't allocate memory!!!! \r\n"));
+  }
+
+  nsect = 0; missing = 0;
+  for(track=0; track<tracks; track++) {
+    offset = TrackList[track*4] + (TrackList[track*4+1] << 8);
+    len    = TrackList[track*4+2] + (TrackList[track*4+3] << 8);
+    // (side 1 of the last piece is after 'len', so read whole blocks)
+    memset(Track, 0, max_len + BLOCK_SIZE);
+    r = pread(in, Track, ((len + BLOCK_SIZE-1) / BLOCK_SIZE)*BLOCK_SIZE, (off_t) offset*BLOCK_SIZE);
+    if((len < 2) || (r < (ssize_t) HFE_POS(len/2-1,1)+1)) {
+      EEXIT((stderr,"ERROR: HFE track %d is broken! \r\n",track));
+    }
+
+    // Sides are in turns of 256 bytes. HFE v3 has opcodes (bytes
+    // with four 1-cells, never in MFM) among the cells.
+    for(side=0; side<2; side++) {
+      memset(Side[side], 0, max_len/2 + BLOCK_SIZE);
+      for(bits[side]=0, c=0; c<len/2; c++) {
+	x = Track[HFE_POS(c,side)];
+	if(v3 && ((x & 0x0F) == 0x0F)) {
+	  switch(x >> 4) {
+	  case 0x4:		// SETBITRATE + rate
+	    c++;
+	    continue;
+	  case 0xC:		// SKIPBITS + count + cells
+	    if(c+2 >= len/2) break;
+	    n = BitReverse[Track[HFE_POS(c+1,side)]] & 7;
+	    x = BitReverse[Track[HFE_POS(c+2,side)]] << n;
+	    for(c=c+2; n<8; n++, x=x<<1, bits[side]++) {
+	      if(x & 0x80) Side[side][bits[side] >> 3] |= 0x80 >> (bits[side] & 7);
+	    }
+	    continue;
+	  case 0x2:		// RAND (weak cells)
+	    x = 0;
+	    break;
+	  default:		// NOP, SETINDEX
+	    continue;
+	  }
+	}
+
+	// Append 8 cells
+	x = BitReverse[x];
+	n = bits[side] & 7;
+	Side[side][bits[side] >> 3] |= x >> n;
+	if(n) Side[side][(bits[side] >> 3) + 1] = x << (8 - n);
+	bits[side] = bits[side] + 8;
+      }
+    }
+
+    for(side=0; side<2; side++) {
+      memset(Found[side], 0, HFE_MAX_SECT);
+      memset(Data+side*HFE_MAX_SECT*BLOCK_SIZE, 0, HFE_MAX_SECT*BLOCK_SIZE);
+      n = HFEDecodeSide(Side[side], bits[side], Data+side*HFE_MAX_SECT*BLOCK_SIZE, Found[side]);
+
+      // Sectors per track from the first track (10 = EPS, 20 = ASR)
+      if(nsect == 0) nsect = (n > 10) ? 20 : 10;
+    }
+
+    for(side=0; side<2; side++) {
+      for(k=0; k<nsect; k++) {
+	if(!Found[side][k]) {
+	  if(missing++ < 10) printf("Warning: HFE track %d, head %d, sector %d not found!\r\n",track,side,k);
+	}
+      }
+      MemWrite(Data+side*HFE_MAX_SECT*BLOCK_SIZE, nsect*BLOCK_SIZE, (off_t) (track*2+side)*nsect*BLOCK_SIZE);
+    }
+  }
+
+  if(missing > 0) printf("Warning: %d sector(s) missing from HFE (zero filled)!\r\n",missing);
+
+  free(TrackList); free(Track); free(Side[0]); free(Side[1]); free(Data);
+  return(OK);
+}
+
+/////////////////////////////
+// ImageToHFE
+// ----------
+// Encodes raw image 'in' of 'total_blks' blocks (EPS/ASR disk or
+// SuperDisk) to HFE file 'out'. 'Sig' is the HFE version and 'mode'
+// the floppy interface mode of the header.
+//
+void ImageToHFE(int in, int out, unsigned int total_blks, char *Sig, unsigned char mode)
+{
+  unsigned char Hdr[BLOCK_SIZE], *TrackList, *Track, *Data, Id[4+6];
+  unsigned int nsect, tracks, track, side, sector, k, raw_len, cells_len, track_blks, list_blks, gap3, crc;
+  MfmTrack Side[2];
+
+  HFEInitTables();
+
+  if((total_blks == EPS_IMAGE_SIZE/BLOCK_SIZE) || (total_blks == E16_SD_IMAGE_SIZE/BLOCK_SIZE)) {
+    nsect = 10;
+    raw_len = 6250;		// 250 kbit/s, 300 rpm
+  } else if((total_blks == ASR_IMAGE_SIZE/BLOCK_SIZE) || (total_blks == ASR_SD_IMAGE_SIZE/BLOCK_SIZE)) {
+    nsect = 20;
+    raw_len = 12500;		// 500 kbit/s, 300 rpm
+  } else {
+    EEXIT((stderr,"ERROR: HFE output needs an EPS/ASR disk or SuperDisk image! \r\n"));
+  }
+  tracks = total_blks / (2*nsect);
+
+  // Gap between sectors: what is left of the track, at most the format gap
+  gap3 = (raw_len - HFE_TRACK_START) / nsect - HFE_SECTOR_SIZE;
+  if(gap3 > HFE_GAP3) gap3 = HFE_GAP3;
+
+  cells_len  = 2*raw_len;
+  track_blks = (cells_len + 255) / 256;
+  list_blks  = (tracks*4 + BLOCK_SIZE-1) / BLOCK_SIZE;
+
+  // Header
+  memset(Hdr, 0xFF, BLOCK_SIZE);
+  memcpy(Hdr, Sig, 8);
+  Hdr[8]  = 0;			// format revision
+  Hdr[9]  = tracks;
+  Hdr[10] = 2;			// sides
+  Hdr[11] = 0;			// ISO/IBM MFM
+  Hdr[12] = (raw_len/25) & 0xFF;	// bit rate (kbit/s)
+  Hdr[13] = (raw_len/25) >> 8;
+  Hdr[14] = 300 & 0xFF;		// rpm
+  Hdr[15] = 300 >> 8;
+  Hdr[16] = mode;
+  Hdr[17] = 1;
+  Hdr[18] = 1;			// track list in block 1
+  Hdr[19] = 0;
+
+  TrackList = malloc(list_blks*BLOCK_SIZE);
+  Track     = malloc(track_blks*BLOCK_SIZE);
+  Data      = malloc(2*nsect*BLOCK_SIZE);
+  Side[0].Cells = malloc(track_blks*256);
+  Side[1].Cells = malloc(track_blks*256);
+  if((TrackList == NULL) || (Track == NULL) || (Data == NULL) || (Side[0].Cells == NULL) || (Side[1].Cells == NULL)) {
+    EEXIT((stderr,"ERROR: Couldn't allocate memory!!!! \r\n"));
+  }
+
+  memset(TrackList, 0xFF, list_blks*BLOCK_SIZE);
+  for(track=0; track<tracks; track++) {
+    k = 1 + list_blks + track*track_blks;
+    TrackList[track*4]   = k & 0xFF;
+    TrackList[track*4+1] = k >> 8;
+    TrackList[track*4+2] = cells_len*2 & 0xFF;
+    TrackList[track*4+3] = cells_len*2 >> 8;
+  }
+
+  if((write(out, Hdr, BLOCK_SIZE) != BLOCK_SIZE) ||
+     (write(out, TrackList, list_blks*BLOCK_SIZE) != list_blks*BLOCK_SIZE)) {
+    EEXIT((stderr,"ERROR: Couldn't write HFE file! \r\n"));
+  }
+
+  memcpy(Id, "\xA1\xA1\xA1", 3);
+  for(track=0; track<tracks; track++) {
+    if(ImageRead(in, Data, 2*nsect*BLOCK_SIZE, (off_t) track*2*nsect*BLOCK_SIZE) != 2*nsect*BLOCK_SIZE) {
+      EEXIT((stderr,"ERROR: Image is too short for HFE! \r\n"));
+    }
+
+    for(side=0; side<2; side++) {
+      Side[side].pos  = 0;
+      Side[side].prev = 0;
+
+      // Index gap and index mark
+      MfmFill(&Side[side], 0x4E, 80);
+      MfmFill(&Side[side], 0x00, 12);
+      MfmMark(&Side[side], 0xC2, 0x5224, 3);
+      Id[3] = 0xFC;
+      MfmBytes(&Side[side], Id+3, 1);
+      MfmFill(&Side[side], 0x4E, 50);
+
+      for(sector=0; sector<nsect; sector++) {
+	// ID field
+	MfmFill(&Side[side], 0x00, 12);
+	MfmMark(&Side[side], 0xA1, 0x4489, 3);
+	Id[3] = 0xFE; Id[4] = track; Id[5] = side; Id[6] = sector; Id[7] = 2;
+	crc = HFECrc(0xFFFF, Id, 8);
+	Id[8] = crc >> 8; Id[9] = crc & 0xFF;
+	MfmBytes(&Side[side], Id+3, 7);
+	MfmFill(&Side[side], 0x4E, 22);
+
+	// Data field
+	MfmFill(&Side[side], 0x00, 12);
+	MfmMark(&Side[side], 0xA1, 0x4489, 3);
+	Id[3] = 0xFB;
+	MfmBytes(&Side[side], Id+3, 1);
+	MfmBytes(&Side[side], Data+(side*nsect+sector)*BLOCK_SIZE, BLOCK_SIZE);
+	crc = HFECrc(HFECrc(0xFFFF, Id, 4), Data+(side*nsect+sector)*BLOCK_SIZE, BLOCK_SIZE);
+	Id[4] = crc >> 8; Id[5] = crc & 0xFF;
+	MfmBytes(&Side[side], Id+4, 2);
+	MfmFill(&Side[side], 0x4E, gap3);
+      }
+
+      // Gap to the end of the track (and of the last 256 byte piece)
+      MfmFill(&Side[side], 0x4E, (track_blks*256 - Side[side].pos) / 2);
+    }
+
+    // Sides in turns of 256 bytes, bits LSB first
+    for(k=0; k<track_blks*256; k++) {
+      Track[HFE_POS(k,0)] = BitReverse[Side[0].Cells[k]];
+      Track[HFE_POS(k,1)] = BitReverse[Side[1].Cells[k]];
+    }
+    if(write(out, Track, track_blks*BLOCK_SIZE) != track_blks*BLOCK_SIZE) {
+      EEXIT((stderr,"ERROR: Couldn't write HFE file! \r\n"));
+    }
+  }
+
+  free(TrackList); free(Track); free(Data); free(Side[0].Cells); free(Side[1].Cells);
+}
+
+//////////////////////////////////////////////////////////////
+// GKH stream
+// ----------
+// - GKH (Intel byte order) is written as a stream: header first,
+//   then the image data through one large buffer. Callers read
+//   the data straight into the buffer (see GKHReserve).
+//
+
+typedef struct {
+  int out;
+  unsigned char *Buffer;
+  unsigned int used;
+} GKHStream;
+
+void GKHFlush(GKHStream *gkh)
+{
+  unsigned int done;
+  ssize_t n;
+
+  for(done=0; done<gkh->used; done=done+n) {
+    if((n = write(gkh->out, gkh->Buffer+done, gkh->used-done)) <= 0) {
+      EEXIT((stderr,"ERROR: Couldn't write GKH file! \r\n"));
+    }
+  }
+  gkh->used = 0;
+}
+
+// Room for 'len' bytes in the buffer (len <= buffer size)
+unsigned char *GKHReserve(GKHStream *gkh, unsigned int len)
+{
+  unsigned char *p;
+
+  if(gkh->used + len > GKH_BUFFER_BLOCKS*BLOCK_SIZE) GKHFlush(gkh);
+  p = gkh->Buffer + gkh->used;
+  gkh->used = gkh->used + len;
+  return(p);
+}
+
+// Little endian 16/32 bit fields of the header
+static void GKHPut16(unsigned char *p, unsigned int val)
+{
+  p[0] = val & 0xFF;
+  p[1] = (val >> 8) & 0xFF;
+}
+
+static void GKHPut32(unsigned char *p, unsigned int val)
+{
+  GKHPut16(p, val & 0xFFFF);
+  GKHPut16(p+2, (val >> 16) & 0xFFFF);
+}
+
+/////////////////////////////
+// GKHBegin
+// --------
+// Starts GKH stream to 'out' for a disk of 80 tracks, 2 heads and
+// 'nsect' sectors (10 = EPS, 20 = ASR) per track.
+//
+void GKHBegin(GKHStream *gkh, int out, unsigned int nsect)
+{
+  unsigned char *h;
+
+  gkh->out  = out;
+  gkh->used = 0;
+  gkh->Buffer = malloc(GKH_BUFFER_BLOCKS*BLOCK_SIZE);
+  if(gkh->Buffer == NULL) EEXIT((stderr,"ERROR: Couldn't allocate memory!!!! \r\n"));
+
+  h = GKHReserve(gkh, GKH_HEADER_SIZE);
+  memset(h, 0, GKH_HEADER_SIZE);
+  memcpy(h, "TDDF", 4);
+  h[4] = 'I';
+  h[5] = 1;
+  GKHPut16(h+6, 2);
+
+  h[8] = GKH_TAG_DISKINFO;
+  GKHPut16(h+10, 80);
+  GKHPut16(h+12, 2);
+  GKHPut16(h+14, nsect);
+  GKHPut16(h+16, BLOCK_SIZE);
+
+  h[18] = GKH_TAG_IMAGE;
+  GKHPut32(h+20, 80*2*nsect*BLOCK_SIZE);
+  GKHPut32(h+24, GKH_HEADER_SIZE);
+}
+
+void GKHEnd(GKHStream *gkh)
+{
+  GKHFlush(gkh);
+  free(gkh->Buffer);
+}
+
+/////////////////////////////
+// WriteGKH
+// --------
+// Streams the raw image of 'in' (EPS or ASR size, or a mapped
+// EDE/EDA, see ImageRead) to GKH file 'out'.
+//
+void WriteGKH(int in, int out, unsigned int nsect)
+{
+  GKHStream gkh;
+  unsigned int left, n;
+  off_t pos;
+
+  GKHBegin(&gkh, out, nsect);
+  left = 80*2*nsect*BLOCK_SIZE;
+  for(pos=0; left>0; pos=pos+n, left=left-n) {
+    n = (left > GKH_BUFFER_BLOCKS*BLOCK_SIZE/2) ? GKH_BUFFER_BLOCKS*BLOCK_SIZE/2 : left;
+    if(ImageRead(in, GKHReserve(&gkh, n), n, pos) != n) {
+      EEXIT((stderr,"ERROR: Image is too short for GKH! \r\n"));
+    }
+  }
+  GKHEnd(&gkh);
+}
+
+//////////////////////////////////////////////////////////////
+// ImageDisk images
+// ----------------
+// - IMD holds the tracks one after another, each with its own header
+//   and sector numbering map. Sector is a type byte and its data, or
+//   just one byte when all of its bytes are the same ('compressed').
+// - There is no index in the file, so the tracks are scanned once on
+//   open (see IMDIndexImage) and each block of the raw image gets the
+//   file offset of its data, or its fill byte. Blocks are then read
+//   in place, and compressed sectors expanded when read.
+//
+
+// Sequential scan of the file through one buffer
+typedef struct {
+  int file;
+  off_t pos;			// file offset of Buf[0]
+  unsigned int len, at;
+  unsigned char Buf[STREAM_BUFFER_BLOCKS*BLOCK_SIZE/8];
+} IMDScan;
+
+// Next 'n' bytes (n <= buffer size), NULL at the end of the file
+static unsigned char *IMDTake(IMDScan *s, unsigned int n)
+{
+  ssize_t got;
+
+  if(s->at + n > s->len) {
+    s->pos = s->pos + s->at;
+    got = pread(s->file, s->Buf, sizeof(s->Buf), s->pos);
+    s->len = (got > 0) ? got : 0;
+    s->at  = 0;
+    if(n > s->len) return(NULL);
+  }
+  s->at = s->at + n;
+  return(s->Buf + s->at - n);
+}
+
+// Forget the index (before the file is closed)
+void UnindexIMDImage(void)
+{
+  free(IMDIndex.Sector);
+  IMDIndex.Sector = NULL;
+  IMDIndex.blocks = 0;
+}
+
+/////////////////////////////
+// IMDIndexImage
+// -------------
+// Scans the tracks of IMD file 'in' and indexes the sectors of each
+// block of the image (tracks of 'nsect' sectors, 10 = EPS, 20 = ASR,
+// from the first track). Returns the number of blocks, 0 if 'in' is
+// not an IMD file.
+//
+unsigned int IMDIndexImage(int in)
+{
+  IMDScan *s;
+  unsigned char *p, Map[256], cyl, head, count, size, type;
+  unsigned int nsect, base, k, block, blocks, missing, errors;
+
+  s = malloc(sizeof(IMDScan));
+  if(s == NULL) EEXIT((stderr,"ERROR: Couldn't allocate memory!!!! \r\n"));
+  s->file = in; s->pos = 0; s->len = 0; s->at = 0;
+
+  // ASCII header and comment
+  if(((p = IMDTake(s, 4)) == NULL) || (memcmp(p, IMD_SIGNATURE, 4) != 0)) {
+    free(s);
+    return(0);
+  }
+  do {
+    if((p = IMDTake(s, 1)) == NULL) {
+      EEXIT((stderr,"ERROR: IMD comment has no end! \r\n"));
+    }
+  } while(*p != IMD_EOF);
+
+  UnindexIMDImage();
+  nsect = 0; base = 0; blocks = 0; errors = 0;
+
+  while((p = IMDTake(s, 5)) != NULL) {
+    cyl = p[1]; head = p[2]; count = p[3]; size = p[4];
+    if(size != IMD_SIZE_512) {
+      EEXIT((stderr,"ERROR: IMD track %d has sectors of other than 512 bytes! \r\n",cyl));
+    }
+    if((p = IMDTake(s, count)) == NULL) {
+      EEXIT((stderr,"ERROR: IMD track %d is broken! \r\n",cyl));
+    }
+    memcpy(Map, p, count);
+
+    // Sectors per track and first sector number from the first track
+    // with sectors
+    if((nsect == 0) && (count > 0)) {
+      nsect = (count > 10) ? 20 : 10;
+      for(base=Map[0], k=1; k<count; k++) {
+	if(Map[k] < base) base = Map[k];
+      }
+    }
+
+    if(((head & IMD_CYL_MAP) && (IMDTake(s, count) == NULL)) ||
+       ((head & IMD_HEAD_MAP) && (IMDTake(s, count) == NULL))) {
+      EEXIT((stderr,"ERROR: IMD track %d is broken! \r\n",cyl));
+    }
+    head = head & 0x0F;
+    if(head > 1) {
+      EEXIT((stderr,"ERROR: IMD with more than 2 heads is not an Ensoniq disk! \r\n"));
+    }
+
+    if((cyl+1)*2*nsect > blocks) {
+      IMDIndex.Sector = realloc(IMDIndex.Sector, (cyl+1)*2*nsect*sizeof(IMDSector));
+      if(IMDIndex.Sector == NULL) EEXIT((stderr,"ERROR: Couldn't allocate memory!!!! \r\n"));
+      memset(IMDIndex.Sector+blocks, 0, ((cyl+1)*2*nsect - blocks)*sizeof(IMDSector));
+      blocks = (cyl+1)*2*nsect;
+    }
+
+    for(k=0; k<count; k++) {
+      if((p = IMDTake(s, 1)) == NULL) {
+	EEXIT((stderr,"ERROR: IMD track %d is broken! \r\n",cyl));
+      }
+      type = *p;
+      if(type > 8) {
+	EEXIT((stderr,"ERROR: IMD track %d has unknown sector type %d! \r\n",cyl,type));
+      }
+      if(type >= 5) errors++;
+
+      block = (cyl*2 + head)*nsect + Map[k] - base;
+      if((Map[k] < base) || (Map[k] - base >= nsect)) block = blocks;
+
+      // 0 = no data, odd = data, even = one byte repeated
+      if(type == 0) continue;
+      if(block < blocks) {
+	IMDIndex.Sector[block].kind = (type & 1) ? IMD_DATA : IMD_FILL;
+	IMDIndex.Sector[block].pos  = s->pos + s->at;
+      }
+      if((p = IMDTake(s, (type & 1) ? BLOCK_SIZE : 1)) == NULL) {
+	EEXIT((stderr,"ERROR: IMD track %d is broken! \r\n",cyl));
+      }
+      if((block < blocks) && !(type & 1)) IMDIndex.Sector[block].fill = *p;
+    }
+  }
+  free(s);
+
+  if(nsect == 0) {
+    EEXIT((stderr,"ERROR: IMD has no sectors! \r\n"));
+  }
+
+  for(missing=0, block=0; block<blocks; block++) {
+    if(IMDIndex.Sector[block].kind == IMD_MISSING) missing++;
+  }
+  if(missing > 0) printf("Warning: %d sector(s) missing from IMD (zero filled)!\r\n",missing);
+  if(errors > 0)  printf("Warning: %d sector(s) of IMD were read with errors!\r\n",errors);
+
+  IMDIndex.blocks = blocks;
+  return(blocks);
+}
+
+//////////////////////
+// IMDReadBlocks
+// -------------
+// Reads the image of IMD file 'in' (indexed by IMDIndexImage) block
+// by block. Compressed sectors are expanded, and missing ones are
+// zeros.
+ssize_t IMDReadBlocks(int in, unsigned char *buffer, size_t len, off_t pos)
+{
+  IMDSector *S;
+  unsigned int block, off;
+  size_t n, done;
+
+  for(done=0; done<len; done=done+n) {
+    block = (pos+done) / BLOCK_SIZE;
+    off   = (pos+done) % BLOCK_SIZE;
+    if(block >= IMDIndex.blocks) break;
+
+    n = BLOCK_SIZE - off;
+    if(n > len-done) n = len-done;
+    S = IMDIndex.Sector + block;
+    if(S->kind == IMD_DATA) {
+      if(pread(in, buffer+done, n, S->pos+off) != n) break;
+    } else {
+      memset(buffer+done, S->fill, n);
+    }
+  }
+
+  return((done > 0) ? (ssize_t) done : -1);
+}
+
+/////////////////////////////
+// ImageToIMD
+// ----------
+// Encodes raw image 'in' of 'total_blks' blocks (EPS or ASR disk) to
+// IMD file 'out' after header 'Hdr' of 'hdr_len' bytes (ending with
+// 0x1A). Sectors of one repeated byte are compressed.
+//
+void ImageToIMD(int in, int out, unsigned int total_blks, unsigned char *Hdr, unsigned int hdr_len)
+{
+  unsigned char *Track, *Data, *t, mode;
+  unsigned int nsect, cyl, head, k;
+
+  if(total_blks == EPS_IMAGE_SIZE/BLOCK_SIZE) {
+    nsect = 10;
+    mode  = IMD_MODE_250K_MFM;
+  } else if(total_blks == ASR_IMAGE_SIZE/BLOCK_SIZE) {
+    nsect = 20;
+    mode  = IMD_MODE_500K_MFM;
+  } else {
+    EEXIT((stderr,"ERROR: IMD output needs an EPS or ASR disk image! \r\n"));
+  }
+
+  Track = malloc(5 + nsect + nsect*(1+BLOCK_SIZE));
+  Data  = malloc(nsect*BLOCK_SIZE);
+  if((Track == NULL) || (Data == NULL)) EEXIT((stderr,"ERROR: Couldn't allocate memory!!!! \r\n"));
+
+  if(write(out, Hdr, hdr_len) != hdr_len) {
+    EEXIT((stderr,"ERROR: Couldn't write IMD file! \r\n"));
+  }
+
+  for(cyl=0; cyl<total_blks/(2*nsect); cyl++) {
+    for(head=0; head<2; head++) {
+      if(ImageRead(in, Data, nsect*BLOCK_SIZE, (off_t) (cyl*2+head)*nsect*BLOCK_SIZE) != nsect*BLOCK_SIZE) {
+	EEXIT((stderr,"ERROR: Image is too short for IMD! \r\n"));
+      }
+
+      Track[0] = mode;
+      Track[1] = cyl;
+      Track[2] = head;
+      Track[3] = nsect;
+      Track[4] = IMD_SIZE_512;
+      for(k=0; k<nsect; k++) Track[5+k] = k;
+
+      for(t=Track+5+nsect, k=0; k<nsect; k++) {
+	if(memcmp(Data+k*BLOCK_SIZE, Data+k*BLOCK_SIZE+1, BLOCK_SIZE-1) == 0) {
+	  *t++ = 2;
+	  *t++ = Data[k*BLOCK_SIZE];
+	} else {
+	  *t++ = 1;
+	  memcpy(t, Data+k*BLOCK_SIZE, BLOCK_SIZE);
+	  t = t + BLOCK_SIZE;
+	}
+      }
+
+      if(write(out, Track, t-Track) != t-Track) {
+	EEXIT((stderr,"ERROR: Couldn't write IMD file! \r\n"));
+      }
+    }
+  }
+
+  free(Track); free(Data);
+}
+
+//////////////////////
+// ImageToEDx
+// ----------
+// Encodes raw image 'in' to Giebler EDA/EDE file 'out'.
+int ImageToEDx(int in, int out, char type)
+{
+  unsigned char bits, *SkipTable, *mem_pointer, edx_id, *FAT, *Buffer, eof;
+  char edx_label[12];
+  unsigned int skip_size, skip_start,block, i,j, fat_blks, fatpos, chunk, n, iovs;
+  struct iovec Iov[STREAM_BUFFER_BLOCKS/2+2];
+  ssize_t len;
+
+  if(type == EDE_TYPE) {
+    skip_start= EDE_SKIP_START;
+    skip_size = EDE_SKIP_SIZE;
+    edx_id    = EDE_ID;
+    strcpy(edx_label, EDE_LABEL);
+  } else {
+    skip_start= EDA_SKIP_START;
+    skip_size = EDA_SKIP_SIZE;
+    edx_id    = EDA_ID;
+    strcpy(edx_label, EDA_LABEL);
+  }
+
+  mem_pointer = calloc(1, BLOCK_SIZE);
+  if(mem_pointer == NULL) EEXIT((stderr,"ERROR: Couldn't allocate memory!!!! \r\n"));
+
+  SkipTable=mem_pointer+skip_start;
+
+  // Construct EDx header
+  // --------------------
+  // Giebler has some particular formatting aside from just the skip table, so
+  // write out the expected data before generating the actual skip table.
+
+  // CR & LF
+  mem_pointer[0]=0x0D;
+  mem_pointer[1]=0x0A;
+
+  // Spaces trough 0x02 - 0x4D
+  for(i=0x02; i<0x4E;i++) {
+    mem_pointer[i] = 0x20;
+  }
+
+  // Write EDE label
+  strncpy((char *) (mem_pointer+2), edx_label, 11);
+
+  // CR & LF
+  mem_pointer[0x4E]=0x0D;
+  mem_pointer[0x4F]=0x0A;
+
+  // Spaces through 0x50 - skip_start
+  for(i=0x50; i<skip_start;i++) {
+    mem_pointer[i] = 0x20;
+  }
+
+  // CR & LF
+  mem_pointer[skip_start-3]=0x0D;
+  mem_pointer[skip_start-2]=0x0A;
+  mem_pointer[skip_start-1]=0x1A;
+
+  // Disktype ID
+  mem_pointer[BLOCK_SIZE-1] = edx_id;
+
+  // Generate SkipTable
+  // ------------------
+  // EDA/EDE skip table is easy to generate because the Ensoniq FAT
+  // already declares whether a block is empty or not, so just check
+  // the FAT and set the proper bits within the corresponding bytes
+  // in the skip table. The FAT is read in one go, and the table is
+  // done before any data, so the header is written only once.
+  fat_blks = (skip_size*8 + FAT_ENTRIES_PER_BLK - 1) / FAT_ENTRIES_PER_BLK;
+  FAT = malloc(fat_blks*BLOCK_SIZE);
+  if(FAT == NULL) EEXIT((stderr,"ERROR: Couldn't allocate memory!!!! \r\n"));
+  if(ImageRead(in, FAT, fat_blks*BLOCK_SIZE, FAT_START_BLOCK*BLOCK_SIZE) != fat_blks*BLOCK_SIZE) {
+    EEXIT((stderr,"ERROR: Couldn't read FAT of the image. \r\n"));
+  }
+
+  block=0;
+  // go through each byte in the skip table
+  for(i=0; i<skip_size ; i++) {
+    bits=0;
+    for(j=0; j<8 ; j++) {
+      // rotate through each skip bit in current byte
+      bits=bits << 1;
+      fatpos = (block / FAT_ENTRIES_PER_BLK)*BLOCK_SIZE + (block % FAT_ENTRIES_PER_BLK)*3;
+      if((FAT[fatpos] | FAT[fatpos+1] | FAT[fatpos+2]) == 0) {
+	// if Ensoniq FAT says empty block then set the current skip bit
+	// and do not write any extra data to the EDA/EDE image
+	bits=bits | 0x01;
+      }
+      block++;
+    }
+    SkipTable[i]=bits;
+  }
+  free(FAT);
+
+  // Write Header
+  if(write(out,mem_pointer,BLOCK_SIZE) != BLOCK_SIZE) {
+    return(ERR);
+  }
+
+  // Used blocks
+  // -----------
+  // Image is read in large chunks, and the runs of used blocks of
+  // each chunk go out with one gathered write.
+  Buffer = malloc(STREAM_BUFFER_BLOCKS*BLOCK_SIZE);
+  if(Buffer == NULL) EEXIT((stderr,"ERROR: Couldn't allocate memory!!!! \r\n"));
+  eof = 0x1A;
+
+  for(block=0; block<skip_size*8; block=block+chunk) {
+    chunk = skip_size*8 - block;
+    if(chunk > STREAM_BUFFER_BLOCKS) chunk = STREAM_BUFFER_BLOCKS;
+    if(ImageRead(in, Buffer, chunk*BLOCK_SIZE, (off_t) block*BLOCK_SIZE) != chunk*BLOCK_SIZE) {
+      EEXIT((stderr,"ERROR: Image is too short for %s! \r\n",(type == EDE_TYPE) ? "EDE" : "EDA"));
+    }
+
+    for(iovs=0, len=0, i=0; i<chunk; i=i+n) {
+      // length of the run of skipped or used blocks starting at i
+      bits = SkipTable[(block+i)/8] & (0x80 >> ((block+i)%8));
+      for(n=1; (i+n<chunk) && (((SkipTable[(block+i+n)/8] & (0x80 >> ((block+i+n)%8))) != 0) == (bits != 0)); n++);
+      if(bits) continue;
+
+      Iov[iovs].iov_base = Buffer + i*BLOCK_SIZE;
+      Iov[iovs].iov_len  = n*BLOCK_SIZE;
+      len = len + n*BLOCK_SIZE;
+      iovs++;
+    }
+
+    // Write last EOF-marker
+    if(block+chunk == skip_size*8) {
+      Iov[iovs].iov_base = &eof;
+      Iov[iovs].iov_len  = 1;
+      len = len + 1;
+      iovs++;
+    }
+
+    if((iovs > 0) && (writev(out, Iov, iovs) != len)) {
+      return(ERR);
+    }
+  }
+
+  free(Buffer);
+  free(mem_pointer);
+  return(OK);
+}
+
+
+
+//////////////////////////////////////////////////////////////
+// Image backends
+// --------------
+// - Each image format has a backend (see ImageBackend) which reads
+//   and writes the raw image in its file, and encodes a raw image to
+//   a new file of the format. Image is opened once through its
+//   backend (see ImageOpen), and ImageRead/ImageWrite go to it, so
+//   no format is converted to a temp image.
+// - Raw, GKH and EPZ images are written in place. EDE/EDA, HFE and
+//   IMD are held in memory while written (see MemWrite), and encoded
+//   back to their file by ImageFlush.
+//
+
+static const ImageBackend MemBackend;
+static const ImageBackend *FormatBackend(char type);
+
+// Output file is written from its start (regular file is emptied first)
+static void RewindOutput(int out)
+{
+  struct stat stat_buf;
+
+  if((fstat(out, &stat_buf) == 0) && S_ISREG(stat_buf.st_mode)) ftruncate(out, 0);
+  lseek(out, 0, SEEK_SET);
+}
+
+static int NoFlush(char *name)
+{
+  return(OK);
+}
+
+static void NoClose(void)
+{
+}
+
+// Image opened for writing is loaded to memory (see MemWrite)
+static int MemLoad(void)
+{
+  MemImage.Data = malloc(Image.size);
+  if(MemImage.Data == NULL) EEXIT((stderr,"ERROR: Couldn't allocate memory!!!! \r\n"));
+  if(Image.Backend->Read(MemImage.Data, Image.size, 0) != Image.size) return(ERR);
+  Image.Backend->Close();
+  Image.Backend = &MemBackend;
+  MemImage.changed = 0;
+  return(OK);
+}
+
+//// Raw ////
+
+static int RawOpen(int file, char *name, char type, int readonly)
+{
+  off_t size;
+
+  if((size = lseek(file, 0, SEEK_END)) < 0) return(ERR);
+  Image.size = size;
+  return(OK);
+}
+
+static ssize_t RawRead(void *buffer, size_t len, off_t pos)
+{
+  return(MacPread(Image.file, buffer, len, pos));
+}
+
+static ssize_t RawWrite(void *buffer, size_t len, off_t pos)
+{
+  return(pwrite(Image.file, buffer, len, pos));
+}
+
+// Block of zeros (last one can be short)
+static int IsEmptyBlock(unsigned char *p, size_t len)
+{
+  if(len > BLOCK_SIZE) len = BLOCK_SIZE;
+  return((p[0] == 0) && (memcmp(p, p+1, len-1) == 0));
+}
+
+// Empty blocks are left as holes in a regular file, and runs of used
+// blocks are written in one go
+static int RawEncode(int in, off_t size, int out, char type)
+{
+  unsigned char *Buffer;
+  struct stat stat_buf;
+  size_t len, i, n;
+  off_t pos;
+  int sparse;
+
+  sparse = (fstat(out, &stat_buf) == 0) && S_ISREG(stat_buf.st_mode);
+  RewindOutput(out);
+
+  Buffer = malloc(STREAM_BUFFER_BLOCKS*BLOCK_SIZE);
+  if(Buffer == NULL) EEXIT((stderr,"ERROR: Couldn't allocate memory!!!! \r\n"));
+
+  for(pos=0; pos<size; pos=pos+len) {
+    len = (size-pos > STREAM_BUFFER_BLOCKS*BLOCK_SIZE) ? STREAM_BUFFER_BLOCKS*BLOCK_SIZE : size-pos;
+    if(ImageRead(in, Buffer, len, pos) != len) {
+      EEXIT((stderr,"ERROR: Image is too short! \r\n"));
+    }
+    for(i=0; i<len; i=i+n) {
+      if(sparse && IsEmptyBlock(Buffer+i, len-i)) {
+	n = (len-i > BLOCK_SIZE) ? BLOCK_SIZE : len-i;
+	continue;
+      }
+      for(n=BLOCK_SIZE; (i+n < len) && !(sparse && IsEmptyBlock(Buffer+i+n, len-i-n)); n=n+BLOCK_SIZE);
+      if(n > len-i) n = len-i;
+      if(pwrite(out, Buffer+i, n, pos+i) != n) return(ERR);
+    }
+  }
+  free(Buffer);
+
+  if(sparse && (ftruncate(out, size) != 0)) return(ERR);
+  return(OK);
+}
+
+//// GKH ////
+// Raw image after the header and tags (10 bytes each), read and
+// written in place
+
+static int GKHOpen(int file, char *name, char type, int readonly)
+{
+  unsigned char Data[BLOCK_SIZE], *p;
+  unsigned int i, num_of_tags, num_of_blks, img_offset;
+
+  if(pread(file, Data, BLOCK_SIZE, 0) < 8) {
+    EEXIT((stderr,"ERROR: GKH file '%s' is too short!!\r\n",name));
+  }
+
+  if(Data[4] != 'I') {
+    EEXIT((stderr,"ERROR: GKH file in Motorola format is not supported!!\r\n"));
+  }
+
+  num_of_tags = Data[6] + (Data[7] << 8);
+  if(8+num_of_tags*10 > BLOCK_SIZE) {
+    EEXIT((stderr,"ERROR: GKH file '%s' has too many tags!!\r\n",name));
+  }
+
+  num_of_blks = 0; img_offset = 0;
+  for(i=0; i<num_of_tags; i++) {
+    p = Data+8+i*10;
+
+    // DISKINFO-tag
+    if(p[0] == GKH_TAG_DISKINFO) {
+      num_of_blks = (p[2] + (p[3] << 8)) * (p[4] + (p[5] << 8)) * (p[6] + (p[7] << 8));
+    }
+
+    // IMAGE-tag
+    if(p[0] == GKH_TAG_IMAGE) {
+      img_offset = p[6] + (p[7] << 8) + (p[8] << 16) + ((unsigned int) p[9] << 24);
+    }
+  }
+  if(num_of_blks == 0) return(ERR);
+
+  Image.offset = img_offset;
+  Image.size   = (off_t) num_of_blks*BLOCK_SIZE;
+  return(OK);
+}
+
+static ssize_t GKHRead(void *buffer, size_t len, off_t pos)
+{
+  if(pos >= Image.size) return(-1);
+  if(len > Image.size - pos) len = Image.size - pos;
+  return(pread(Image.file, buffer, len, Image.offset+pos));
+}
+
+static ssize_t GKHWrite(void *buffer, size_t len, off_t pos)
+{
+  if(pos >= Image.size) return(-1);
+  if(len > Image.size - pos) len = Image.size - pos;
+  return(pwrite(Image.file, buffer, len, Image.offset+pos));
+}
+
+static int GKHEncode(int in, off_t size, int out, char type)
+{
+  if((size != EPS_IMAGE_SIZE) && (size != ASR_IMAGE_SIZE)) {
+    EEXIT((stderr,"ERROR: GKH output needs an EPS or ASR disk image! \r\n"));
+  }
+  RewindOutput(out);
+  WriteGKH(in, out, (size == EPS_IMAGE_SIZE) ? 10 : 20);
+  return(OK);
+}
+
+//// EDE / EDA ////
+// Read in place through the skip table map (see MapEDxImage), and
+// loaded to memory when written
+
+static int EDxOpen(int file, char *name, char type, int readonly)
+{
+  // Check if 'Mac'-format :-P is found
+  if(ConvertMacFormat(&file, name) == OK) {
+    printf("Warning: Macintosh generated EDx file found!\r\n");
+  }
+
+  if(MapEDxImage(file, type) != OK) return(ERR);
+  Image.size = (off_t) EDxMap.blocks*BLOCK_SIZE;
+  return(readonly ? OK : MemLoad());
+}
+
+static void EDxClose(void)
+{
+  UnmapEDxImage();
+}
+
+// EDE or EDA is chosen by the image size (like v1.58), not by 'type'
+static int EDxEncode(int in, off_t size, int out, char type)
+{
+  char edx_type;
+
+  if(size == EPS_IMAGE_SIZE) {
+    edx_type = EDE_TYPE;
+  } else if(size == ASR_IMAGE_SIZE) {
+    edx_type = EDA_TYPE;
+  } else {
+    fprintf(stderr,"ERROR: Only EPS and ASR images can be EDE/EDA! \r\n");
+    return(ERR);
+  }
+  if(edx_type != type) {
+    printf("Warning: %s image is written as %s. \r\n",
+	   (edx_type == EDE_TYPE) ? "EPS" : "ASR", (edx_type == EDE_TYPE) ? "EDE" : "EDA");
+  }
+
+  RewindOutput(out);
+  return(ImageToEDx(in, out, edx_type));
+}
+
+//// HFE ////
+// Tracks are decoded to memory on open
+
+static int HFEOpen(int file, char *name, char type, int readonly)
+{
+  int rc;
+
+  rc = HFEToImage(file);
+  // (decoding is not a change, see MemFlush)
+  MemImage.changed = 0;
+  return(rc);
+}
+
+// Keeps version and interface mode of the HFE being replaced
+static int HFEEncode(int in, off_t size, int out, char type)
+{
+  unsigned char HfeHdr[17];
+  char hfe_sig[9];
+
+  strcpy(hfe_sig, HFE_V1_SIGNATURE);
+  if((pread(out, HfeHdr, 17, 0) == 17) &&
+     ((memcmp(HfeHdr, HFE_V1_SIGNATURE, 8) == 0) || (memcmp(HfeHdr, HFE_V3_SIGNATURE, 8) == 0))) {
+    memcpy(hfe_sig, HfeHdr, 8);
+  } else {
+    HfeHdr[16] = HFE_SHUGART_MODE;
+  }
+
+  RewindOutput(out);
+  ImageToHFE(in, out, size/BLOCK_SIZE, hfe_sig, HfeHdr[16]);
+  return(OK);
+}
+
+//// IMD ////
+// Read in place through the sector index (see IMDIndexImage), and
+// loaded to memory when written
+
+static int IMDOpen(int file, char *name, char type, int readonly)
+{
+  if(IMDIndexImage(file) == 0) return(ERR);
+  Image.size = (off_t) IMDIndex.blocks*BLOCK_SIZE;
+  if(readonly) return(OK);
+
+  // (encoded back as an EPS or ASR disk)
+  if((Image.size != EPS_IMAGE_SIZE) && (Image.size != ASR_IMAGE_SIZE)) {
+    EEXIT((stderr,"ERROR: IMD of %d blocks can only be read! \r\n",IMDIndex.blocks));
+  }
+  return(MemLoad());
+}
+
+static ssize_t IMDRead(void *buffer, size_t len, off_t pos)
+{
+  return(IMDReadBlocks(Image.file, buffer, len, pos));
+}
+
+static void IMDClose(void)
+{
+  UnindexIMDImage();
+}
+
+// Keeps the header and comment of the IMD being replaced
+static int IMDEncode(int in, off_t size, int out, char type)
+{
+  unsigned char Hdr[SNIFF_SIZE], *eof;
+  ssize_t len;
+  time_t now;
+
+  len = pread(out, Hdr, SNIFF_SIZE, 0);
+  if((len < 4) || (memcmp(Hdr, IMD_SIGNATURE, 4) != 0) || ((eof = memchr(Hdr, IMD_EOF, len)) == NULL)) {
+    now = time(NULL);
+    len = strftime((char *) Hdr, SNIFF_SIZE, "IMD 1.18: %d/%m/%Y %H:%M:%S\r\n", localtime(&now));
+    len = len + sprintf((char *) Hdr+len, "EpsLin Neo %s\r\n", VERSION);
+    eof = Hdr+len;
+    *eof = IMD_EOF;
+  }
+
+  RewindOutput(out);
+  ImageToIMD(in, out, size/BLOCK_SIZE, Hdr, eof-Hdr+1);
+  return(OK);
+}
+
+//// Memory image ////
+
+// Encodes the image to file 'name' in the format of the image
+static int MemFlush(char *name)
+{
+  int out, rc;
+
+  if(!MemImage.changed) return(OK);
+  if((out = open(name, O_RDWR | O_CREAT | O_BINARY, FILE_RIGHTS)) < 0) return(ERR);
+  rc = FormatBackend(Image.type)->Encode(Image.file, Image.size, out, Image.type);
+  close(out);
+  if(rc == OK) MemImage.changed = 0;
+  return(rc);
+}
+
+static void MemClose(void)
+{
+  free(MemImage.Data);
+  MemImage.Data    = NULL;
+  MemImage.changed = 0;
+}
+
+//// EPZ ////
+// Read and written in place through the chunk cache (see PackedOpen)
+
+static int PackedImageOpen(int file, char *name, char type, int readonly)
+{
+  if(PackedOpen(file) != OK) return(ERR);
+  Image.size = Packed.size;
+  return(OK);
+}
+
+static ssize_t PackedRead(void *buffer, size_t len, off_t pos)
+{
+  return(PackedAccess(buffer, len, pos, 0));
+}
+
+static ssize_t PackedWrite(void *buffer, size_t len, off_t pos)
+{
+  return(PackedAccess(buffer, len, pos, 1));
+}
+
+static int PackedImageFlush(char *name)
+{
+  if(PackedFlush() != OK) return(ERR);
+  // (image is fine as it is, only bigger)
+  if(PackedCompact(name) != OK) {
+    printf("Warning: Couldn't compact packed image '%s'. \r\n",name);
+  }
+  return(OK);
+}
+
+static int PackedEncode(int in, off_t size, int out, char type)
+{
+  RewindOutput(out);
+  return(ImageToPacked(in, out, size));
+}
+
+//// Registry ////
+
+static const ImageBackend RawBackend    = { RawOpen, RawRead, RawWrite, NoFlush, NoClose, RawEncode };
+static const ImageBackend GKHBackend    = { GKHOpen, GKHRead, GKHWrite, NoFlush, NoClose, GKHEncode };
+static const ImageBackend EDxBackend    = { EDxOpen, EDxRead, NULL, NoFlush, EDxClose, EDxEncode };
+static const ImageBackend HFEBackend    = { HFEOpen, MemRead, MemWrite, MemFlush, MemClose, HFEEncode };
+static const ImageBackend PackedBackend = { PackedImageOpen, PackedRead, PackedWrite, PackedImageFlush, PackedClose, PackedEncode };
+static const ImageBackend IMDBackend    = { IMDOpen, IMDRead, NULL, NoFlush, IMDClose, IMDEncode };
+static const ImageBackend MemBackend    = { NULL, MemRead, MemWrite, MemFlush, MemClose, NULL };
+
+// Formats by type and extension, others are raw images (see GetImageType)
+static const struct {
+  char type;
+  char *ext;
+  const ImageBackend *Backend;
+} ImageFormats[] = {
+  { GKH_TYPE, "gkh", &GKHBackend },
+  { EDE_TYPE, "ede", &EDxBackend },
+  { EDA_TYPE, "eda", &EDxBackend },
+  { HFE_TYPE, "hfe", &HFEBackend },
+  { EPZ_TYPE, "epz", &PackedBackend },
+  { IMD_TYPE, "imd", &IMDBackend },
+  { 0, NULL, NULL }
+};
+
+static const ImageBackend *FormatBackend(char type)
+{
+  int i;
+
+  for(i=0; ImageFormats[i].ext != NULL; i++) {
+    if(ImageFormats[i].type == type) return(ImageFormats[i].Backend);
+  }
+  return(&RawBackend);
+}
+
+// Image type without a backend of its own (EPS/ASR/SuperDisk/other raw image or EFE)
+int IsRawImageType(char type)
+{
+  return(FormatBackend(type) == &RawBackend);
+}
+
+// Descriptor of the current image
+static int IsOpenImage(int file)
+{
+  return((file >= 0) && ((file == Image.file) || (file == Image.alias)));
+}
+
+// Current image to/from 'State'
+static void ImageSave(ImageState *State)
+{
+  State->Image  = Image;
+  State->Mem    = MemImage;
+  State->Packed = Packed;
+  State->EDx    = EDxMap;
+  State->IMD    = IMDIndex;
+}
+
+static void ImageLoad(ImageState *State)
+{
+  Image    = State->Image;
+  MemImage = State->Mem;
+  Packed   = State->Packed;
+  EDxMap   = State->EDx;
+  IMDIndex = State->IMD;
+}
+
+//////////////////////
+// ImageSelect
+// -----------
+// Makes the open image of descriptor 'file' the current one, if it is
+// one of the other open images. (Not while hash threads are reading.)
+static void ImageSelect(int file)
+{
+  ImageState Current;
+  int i;
+
+  if((file < 0) || IsOpenImage(file)) return;
+  for(i=0; i<MAX_OPEN_IMAGES-1; i++) {
+    if((OtherImage[i].Image.Backend != NULL) &&
+       ((OtherImage[i].Image.file == file) || (OtherImage[i].Image.alias == file))) {
+      ImageSave(&Current);
+      ImageLoad(OtherImage+i);
+      OtherImage[i] = Current;
+      return;
+    }
+  }
+}
+
+// Keeps the current image open aside, so that another can be opened
+static void ImagePark(void)
+{
+  static const ImageState NoImage = { { -1, -1, 0, 0, 0, NULL }, { NULL, 0 },
+				      { -1, 0, 0, 0, NULL, NULL, 0, 0, {{0, 0, 0, NULL}} },
+				      { -1, 0, NULL }, { 0, NULL } };
+  int i;
+
+  if(Image.file < 0) return;
+  for(i=0; (i<MAX_OPEN_IMAGES-1) && (OtherImage[i].Image.Backend != NULL); i++);
+  if(i == MAX_OPEN_IMAGES-1) EEXIT((stderr,"ERROR: Too many images open! \r\n"));
+  ImageSave(OtherImage+i);
+  ImageLoad((ImageState *) &NoImage);
+}
+
+// Open image whose blocks aren't in place in the file
+// (made the current one, see ImageSelect)
+int IsMappedImage(int file)
+{
+  ImageSelect(file);
+  return(IsOpenImage(file) && (Image.Backend != &RawBackend));
+}
+
+// pread() of image file
+ssize_t ImageRead(int file, void *buffer, size_t len, off_t pos)
+{
+  ImageSelect(file);
+  if(IsOpenImage(file)) return(Image.Backend->Read(buffer, len, pos));
+  return(MacPread(file, buffer, len, pos));
+}
+
+// pwrite() of image file
+ssize_t ImageWrite(int file, void *buffer, size_t len, off_t pos)
+{
+  ImageSelect(file);
+  if(IsOpenImage(file)) {
+    return((Image.Backend->Write != NULL) ? Image.Backend->Write(buffer, len, pos) : -1);
+  }
+  return(pwrite(file, buffer, len, pos));
+}
+
+// Forgets the current image (changes are stored by ImageFlush).
+// Other open image, if any, becomes the current one.
+void ImageClose(void)
+{
+  int i;
+
+  if(Image.file < 0) return;
+  Image.Backend->Close();
+  UnmapMacFormat(Image.file);
+  Image.file    = -1;
+  Image.alias   = -1;
+  Image.Backend = NULL;
+
+  for(i=0; i<MAX_OPEN_IMAGES-1; i++) {
+    if(OtherImage[i].Image.Backend != NULL) {
+      ImageLoad(OtherImage+i);
+      OtherImage[i].Image.Backend = NULL;
+      return;
+    }
+  }
+}
+
+//////////////////////
+// ImageOpen
+// ---------
+// Opens image file 'file' (named 'name') of type 'type' through the
+// backend of its format. Image opened 'readonly' is never written.
+// Image open on another file stays open (see ImageSelect).
+int ImageOpen(int file, char *name, char type, int readonly)
+{
+  if(file == Image.file) ImageClose();
+  ImagePark();
+  Image.file    = file;
+  Image.alias   = -1;
+  Image.type    = type;
+  Image.size    = 0;
+  Image.offset  = 0;
+  Image.Backend = FormatBackend(type);
+
+  if(Image.Backend->Open(file, name, type, readonly) != OK) {
+    ImageClose();
+    return(ERR);
+  }
+  return(OK);
+}
+
+// New empty image of 'size' bytes in memory, written to file 'file'
+// of type 'type' by ImageFlush
+void ImageCreate(int file, char type, off_t size)
+{
+  if(file == Image.file) ImageClose();
+  ImagePark();
+  MemImage.Data = calloc(size, 1);
+  if(MemImage.Data == NULL) EEXIT((stderr,"ERROR: Couldn't allocate memory!!!! \r\n"));
+  MemImage.changed = 1;
+
+  Image.file    = file;
+  Image.alias   = -1;
+  Image.type    = type;
+  Image.size    = size;
+  Image.offset  = 0;
+  Image.Backend = &MemBackend;
+}
+
+// Stores the changes of the open image to its file 'name'
+int ImageFlush(char *name)
+{
+  if(Image.file < 0) return(OK);
+  return(Image.Backend->Flush(name));
+}
+
+// Opens image 'name' for writing. Image with a backend of its own
+// gets a second descriptor of the open image (see ImageWrite).
+int OpenImage(char *name)
+{
+  if(IsMappedImage(Image.file)) {
+    Image.alias = dup(Image.file);
+    return(Image.alias);
+  }
+  return(open(name, O_RDWR | O_BINARY));
+}
+
+// Closes image 'out' of OpenImage, and stores the changes to file 'name'
+void CloseImage(int out, char *name)
+{
+  ImageSelect(out);
+  if(out == Image.alias) Image.alias = -1;
+  close(out);
+  if(ImageFlush(name) != OK) {
+    EEXIT((stderr,"ERROR: Couldn't write file '%s'. \r\n",name));
+  }
+}
+
+//////////////////////
+// ConvertImage
+// ------------
+// Converts image file 'in_file' of any format to file 'out_file' of
+// format 'out_type': the input is read through its backend and the
+// backend of the output encodes it.
+void ConvertImage(char in_file[FILENAME_MAX], char out_file[FILENAME_MAX], char out_type)
+{
+  struct stat in_stat, out_stat;
+  char in_type;
+  int in, out;
+
+  if(ProbeImageType(in_file, &in_type) != OK) {
+    EEXIT((stderr,"ERROR: Can't get the filesize! \r\n"));
+  }
+  if((in=open(in_file, O_RDONLY | O_BINARY)) < 0) {
+    EEXIT((stderr,"ERROR: Couldn't open file '%s'. \r\n",in_file));
+  }
+  if(ImageOpen(in, in_file, in_type, 1) != OK) {
+    EEXIT((stderr,"ERROR: '%s' is not a valid image! \r\n",in_file));
+  }
+
+  if((out=open(out_file, O_RDWR | O_CREAT | O_BINARY, FILE_RIGHTS)) < 0) {
+    EEXIT((stderr,"ERROR: Couldn't open file '%s'. \r\n",out_file));
+  }
+  if((fstat(in, &in_stat) == 0) && (fstat(out, &out_stat) == 0) &&
+     (in_stat.st_dev == out_stat.st_dev) && (in_stat.st_ino == out_stat.st_ino)) {
+    EEXIT((stderr,"ERROR: Unsupported conversion! \r\n\r\n"));
+  }
+
+  if(FormatBackend(out_type)->Encode(in, Image.size, out, out_type) != OK) {
+    close(out);
+    unlink(out_file);
+    EEXIT((stderr,"ERROR: Couldn't write file '%s'. \r\n",out_file));
+  }
+
+  ImageClose();
+  close(in); close(out);
+}
+
+///////////////
+// IsEFEHeader
+//------------
+// Checks the signature bytes of an EFE header in memory, so
+// also EFEs from a pipe can be checked without seeking.
+// Byte offset $00 & $01 and $2F & $30 must be 0x0D & 0x0A.
+// Byte offset $31 must be 0x1A.
+//
+int IsEFEHeader(unsigned char *Hdr)
+{
+  if((Hdr[0] != 0x0D) || (Hdr[1] != 0x0A)) return(ERR);
+  if((Hdr[47] != 0x0D) || (Hdr[48] != 0x0A)) return(ERR);
+  if(Hdr[49] != 0x1A) return(ERR);
+  return(OK);
+}
+
+///////////////
+// IsEFE
+//------
+// Checks if file extension is proper for Giebler EFE/EFA or INS.
+// Also checks presence of expected signature bytes for validity.
+//
+int IsEFE(int *in, char in_file[FILENAME_MAX])
+{
+  char *p;								// holds file extension
+  unsigned char Hdr[EFE_SIG_SIZE];		// start of EFE header with the signatures
+
+  // Check if file even has any extension at all.
+  if((p=rindex(in_file,'.')) != NULL) {
+
+    // Extension found!
+    p++;
+    //printf("Extension: %s\r\n",p);
+
+	// Check that the file extension is one of the three supported types (EFE, EFA, or INS).
+	if((strcasecmp(p,"efe") == 0) || (strcasecmp(p,"efa") == 0) || (strcasecmp(p,"ins") == 0)) {
+		// file is already open, so check the signatures from the header
+		if(MacPread(*in, Hdr, EFE_SIG_SIZE, 0) != EFE_SIG_SIZE) return(ERR);
+		return(IsEFEHeader(Hdr));
+    } // end of extension checking
+	// otherwise file has the wrong extension, so assume not Ensoniq and fall-through to error
+  } // end of if-not-null
+
+  // When input file has wrong or missing extension, can't be opened, or is
+  // missing any signatures then generate an error.
+  return(ERR);
+}
+
+
+// Raw image type from the image size
+static char RawImageType(off_t size)
+{
+  if(size == EPS_IMAGE_SIZE) {
+    return(EPS_TYPE);
+  } else if(size == ASR_IMAGE_SIZE) {
+    return(ASR_TYPE);
+  } else if(size == E16_SD_IMAGE_SIZE) {
+    return(E16_SD_TYPE);
+  } else if(size == ASR_SD_IMAGE_SIZE) {
+    return(ASR_SD_TYPE);
+  }
+  // Might be an HDD image or SCSI device
+  return(OTHER_TYPE);
+}
+
+// Name of a compressed stream (gzip, xz...) from its magic, NULL if none
+char *CompressedFormat(unsigned char *Hdr, ssize_t len)
+{
+  if(len < 6) return(NULL);
+  if((Hdr[0] == 0x1F) && (Hdr[1] == 0x8B)) return("gzip");
+  if(memcmp(Hdr, "\x28\xB5\x2F\xFD", 4) == 0) return("zstd");
+  if(memcmp(Hdr, "\xFD" "7zXZ", 6) == 0) return("xz");
+  if(memcmp(Hdr, "BZh", 3) == 0) return("bzip2");
+  if(memcmp(Hdr, "\x04\x22\x4D\x18", 4) == 0) return("lz4");
+  if(memcmp(Hdr, "PK\x03\x04", 4) == 0) return("zip");
+  return(NULL);
+}
+
+///////////////////
+// SniffImageType
+// --------------
+// Classifies a file from the signatures in its first 'len' bytes
+// (probe read of SNIFF_SIZE) and its 'size': EPZ, HFE, GKH, IMD, EFE,
+// EDE/EDA (also 'Mac'-format, every LF preceded by an extra CR) and
+// raw images by the ID block. Returns ERR if nothing is recognised.
+int SniffImageType(unsigned char *Hdr, ssize_t len, off_t size, char *image_type)
+{
+  if(len >= 8) {
+    if(memcmp(Hdr, EPZ_SIGNATURE, 8) == 0) {
+      *image_type = EPZ_TYPE;
+      return(OK);
+    }
+    if((memcmp(Hdr, HFE_V1_SIGNATURE, 8) == 0) || (memcmp(Hdr, HFE_V3_SIGNATURE, 8) == 0)) {
+      *image_type = HFE_TYPE;
+      return(OK);
+    }
+    if(memcmp(Hdr, "TDDF", 4) == 0) {
+      *image_type = GKH_TYPE;
+      return(OK);
+    }
+    if(memcmp(Hdr, IMD_SIGNATURE, 4) == 0) {
+      *image_type = IMD_TYPE;
+      return(OK);
+    }
+  }
+
+  if((len >= EFE_SIG_SIZE) && (IsEFEHeader(Hdr) == OK)) {
+    *image_type = EFE_TYPE;
+    return(OK);
+  }
+
+  // EDx header ends to 0x1A before the skip table, disktype ID last
+  if((len >= BLOCK_SIZE) && (Hdr[0] == 0x0D) && (Hdr[1] == 0x0A)) {
+    if((Hdr[EDE_SKIP_START-1] == 0x1A) && (Hdr[BLOCK_SIZE-1] == EDE_ID)) {
+      *image_type = EDE_TYPE;
+      return(OK);
+    }
+    if((Hdr[EDA_SKIP_START-1] == 0x1A) && (Hdr[BLOCK_SIZE-1] == EDA_ID)) {
+      *image_type = EDA_TYPE;
+      return(OK);
+    }
+  }
+  // ('Mac'-format: three CRs added before the 0x1A, see ConvertMacFormat)
+  if((len >= BLOCK_SIZE) && (Hdr[0] == 0x0D) && (Hdr[1] == 0x0D) && (Hdr[2] == 0x0A)) {
+    if(Hdr[EDE_SKIP_START-1+3] == 0x1A) {
+      *image_type = EDE_TYPE;
+      return(OK);
+    }
+    if(Hdr[EDA_SKIP_START-1+3] == 0x1A) {
+      *image_type = EDA_TYPE;
+      return(OK);
+    }
+  }
+
+  // Raw image has 'ID' in the ID block (see GetMedia)
+  if((len >= 0x228) && (Hdr[0x226] == 'I') && (Hdr[0x227] == 'D')) {
+    *image_type = RawImageType(size);
+    return(OK);
+  }
+
+  return(ERR);
+}
+
+///////////////////
+// ProbeImageType
+// --------------
+// Type of an existing file from its content (see SniffImageType), so
+// misnamed files work too. Otherwise as in GetImageType.
+int ProbeImageType(char in_file[FILENAME_MAX], char *image_type)
+{
+  unsigned char Hdr[SNIFF_SIZE];
+  struct stat stat_buf;
+  ssize_t len;
+  int in;
+
+  if((in=open(in_file, O_RDONLY | O_BINARY)) >= 0) {
+    len = pread(in, Hdr, SNIFF_SIZE, 0);
+    if((fstat(in, &stat_buf) == 0) && (SniffImageType(Hdr, len, stat_buf.st_size, image_type) == OK)) {
+      close(in);
+      return(OK);
+    }
+    close(in);
+  }
+  return(GetImageType(in_file, image_type));
+}
+
+///////////////////
+// GetImageType
+// ------------
+// Mostly assumes a GKH, EDE, or EDA is actually the type of file
+// that the file extension declares it to be. Used for files to be
+// written, existing files are probed first (see ProbeImageType).
+int GetImageType(char in_file[FILENAME_MAX], char *image_type)
+{
+  char *p;
+  struct stat stat_buf;
+  int i;
+
+  if((p=rindex(in_file,'.')) != NULL) {
+
+    // Extension found!
+    p++;
+    //printf("Extension: %s\r\n",p);
+
+    for(i=0; ImageFormats[i].ext != NULL; i++) {
+      if(strcasecmp(p,ImageFormats[i].ext) == 0) {
+	*image_type = ImageFormats[i].type;
+	return(OK);
+      }
+    }
+  }
+
+  // No or unknown extension - check if known raw-image
+
+
+  // Uncomment for header-check when raw-image expected
+  /*
+    if((in=fopen(in_file, "rb"))== NULL) {
+    EEXIT((stderr, "ERROR: Couldn't open file '%s'.", in_file));
+
+    }
+
+    fseek(in, 512,0);
+    fread(&Hdr,sizeof(unsigned long), 1,in);
+
+    printf("hdr: %lx \r\n", Hdr);
+  */
+
+  if(stat(in_file,&stat_buf) != 0) {
+    //fprintf(stderr,"\r\n(line: %d) ERROR: Can't get the filesize!!\r\n", __LINE__);
+    return(ERR);
+  }
+
+  //printf("filesize: %ld\r\n",stat_buf.st_size);
+
+  *image_type = RawImageType(stat_buf.st_size);
+  return(OK);
+}
+
+////////////////////
+// GetTHS
+//-------
+// Calculates Track, Head, and Sector location for any given block.
+void GetTHS(unsigned int block, unsigned int num_of_sect,
+	    unsigned int *track, unsigned int *head, unsigned int *sector)
+{
+  *track  = block / (2 * num_of_sect);
+  *head   = (block - (*track * 2 * num_of_sect))  / num_of_sect;
+  *sector = block - (*track * 2 * num_of_sect) - (*head * num_of_sect);
+}
+
+
+////////////////////
+// OpenFloppy
+FD_HANDLE OpenFloppy (int drive)
+{
+  FD_HANDLE fd;
+
+#ifdef __CYGWIN__
+  DWORD dwRet;
+  char szDevice[32];
+  DWORD dwVersion = 0;
+
+  HANDLE h = CreateFile("\\\\.\\fdrawcmd", GENERIC_READ|GENERIC_WRITE, 0, NULL, OPEN_EXISTING, 0, NULL);
+
+  if (h != INVALID_HANDLE_VALUE)
+    {
+      DeviceIoControl(h, IOCTL_FDRAWCMD_GET_VERSION, NULL, 0, &dwVersion, sizeof(dwVersion), &dwRet, NULL);
+      CloseHandle(h);
+    } else {
+      printf("fdrawcmd.sys is not installed, see: http://simonowen.com/fdrawcmd/ \r\n");
+      exit(ERR);
+    }
+
+    if (HIWORD(dwVersion) != HIWORD(FDRAWCMD_VERSION)) {
+      printf("The installed fdrawcmd.sys is not compatible with this utility. \r\n");
+      exit(ERR);
+    }
+
+    wsprintf(szDevice, "\\\\.\\fdraw%u", drive);
+
+    if( (fd = CreateFile(szDevice, GENERIC_READ|GENERIC_WRITE, 0, NULL, OPEN_EXISTING, 0, NULL)) ==  INVALID_HANDLE_VALUE) {
+      printf("OpenFloppy - CreateFile: (%ld) %s\r\n",GetLastError (), LastError());
+      exit(ERR);
+    }
+
+    if(DeviceIoControl(fd, IOCTL_FD_RESET, NULL, 0, NULL, 0, &dwRet, NULL) == 0) {
+      printf("OpenFloppy - RESET: (%ld) %s\r\n",GetLastError (), LastError());
+      exit(ERR);
+    }
+
+#elif __APPLE__
+  // macOS, so do nothing
+#else // Linux
+  fd = open( "/dev/fd0", O_ACCMODE | O_NDELAY);
+  //fd = open( "/dev/fd0", O_ACCMODE | O_SYNC);
+  if ( fd < 0 ){
+    perror("open floppy");
+    exit(ERR);
+  }
+#endif
+  return fd;
+}
+
+////////////////////
+// CloseFloppy
+void CloseFloppy(FD_HANDLE fd)
+{
+#ifdef __CYGWIN__
+  CloseHandle(fd);
+#elif __APPLE__
+  // macOS, so do nothing
+#else // Linux
+  close(fd);
+#endif
+}
+
+//////////////////////////////////////
+// Set FD geometry. 'a'=ASR, 'e'=EPS
+void FD_SetGeometry(FD_HANDLE fd, char disk_type)
+{
+#ifdef __CYGWIN__
+  DWORD dwRet;
+  BYTE DataRate;
+
+  if(disk_type == 'a') {
+    // ASR (hd-disk)
+    DataRate=0;
+  } else {
+    // EPS (dd-disk)
+    DataRate=2;
+  }
+
+  if (DeviceIoControl(fd, IOCTL_FD_SET_DATA_RATE, &DataRate, sizeof(DataRate), NULL, 0, &dwRet, NULL) ==0) {
+    printf("FD_SetGeometry - SET_DATA_RATE: (%ld) %s\r\n",GetLastError (), LastError());
+    exit(ERR);
+  }
+
+#elif __APPLE__
+  // macOS, so do nothing
+#else // Linux
+  struct floppy_struct g;
+
+  if(disk_type == 'a') {
+    // Geometry of ASR-Disk
+    g.size = 3200;
+    g.sect = 20;
+
+  } else {
+    // Geometry of EPS-Disk
+    g.size = 1600;
+    g.sect = 10;
+  }
+
+  // Common parameters
+  g.head = 2;
+  g.track = 80;
+  g.stretch = 0;
+
+  // Set Disk geometry
+  if(ioctl(fd, FDSETPRM , &g) < 0) {
+    perror("geometry ioctl");
+    exit(ERR);
+  }
+#endif
+}
+
+// Calibrate FD
+void FD_Calibrate(int fd)
+{
+
+#ifdef __CYGWIN__
+  // do nothing
+#elif __APPLE__
+  // macOS, so do nothing
+#else // Linux
+  struct floppy_raw_cmd raw_cmd;
+
+  // Calibrate
+  raw_cmd.flags     = 8;
+  raw_cmd.cmd_count = 2;
+  raw_cmd.cmd[0]    = 7;
+  raw_cmd.cmd[1]    = 0;
+
+  if (ioctl( fd, FDRAWCMD, & raw_cmd) < 0 ){
+    perror("raw cmd");
+    exit(ERR);
+  }
+#endif
+}
+
+///////////////////////
+// Seek the FD track
+void FD_Seek(FD_HANDLE fd, int track)
+{
+
+#ifdef __CYGWIN__
+  DWORD dwRet;
+  FD_SEEK_PARAMS sp;
+
+  // details of seek location
+  sp.cyl = track;
+  sp.head = 0;
+
+  // seek
+  if(DeviceIoControl(fd, IOCTL_FDCMD_SEEK, &sp, sizeof(sp), NULL, 0, &dwRet, NULL)==0) {
+    printf("FD_Seek - SEEK: (%ld) %s\r\n",GetLastError (), LastError());
+    exit(ERR);
+  }
+
+#elif __APPLE__
+  // macOS, so do nothing
+#else // Linux
+  struct floppy_raw_cmd raw_cmd;
+
+  // SEEK
+  raw_cmd.flags     = 8;
+  raw_cmd.cmd_count = 3;
+  raw_cmd.cmd[0]    = 15;
+  raw_cmd.cmd[1]    = 0;
+  raw_cmd.cmd[2]    = track;
+
+  if (ioctl( fd, FDRAWCMD, & raw_cmd ) < 0 ){
+    perror("raw cmd");
+    exit(ERR);
+  }
+#endif
+}
+
+////////////////////////////
+// FD_Raw Read/Write Track
+// (read: rw=1, write: rw=2)
+int FD_RawRW_DiskTrack(FD_HANDLE fd, char disk_type, int track, int head, char *buffer, int rw)
+{
+#ifdef __CYGWIN__
+  unsigned int datalen;
+  DWORD dwRet;
+  FD_READ_WRITE_PARAMS rwp;
+  FD_SEEK_PARAMS sp;
+
+  rwp.flags = FD_OPTION_MFM;
+  rwp.phead = head;
+  rwp.cyl = track;
+  rwp.head = head;
+  rwp.sector = 0;
+  rwp.size = 2;
+  rwp.gap = 0x0a;
+  rwp.datalen = 0xff;
+
+  // Seek
+  sp.cyl = track;
+  sp.head = head;
+
+  if(disk_type == 'a') {
+    // ASR (hd-disk)
+    rwp.eot = 20;
+    datalen= 20*512;
+    FD_SetGeometry(fd, 'a');
+
+  } else {
+    // EPS (dd-disk)
+    rwp.eot = 10;
+    datalen= 10*512;
+    FD_SetGeometry(fd, 'e');
+  }
+
+  if(DeviceIoControl(fd, IOCTL_FDCMD_SEEK, &sp, sizeof(sp), NULL, track, &dwRet, NULL) ==0) {
+    printf("FD_RawRW_DiskTrack - SEEK: (%ld) %s\r\n",GetLastError(), LastError());
+    exit(ERR);
+  }
+
+  if(rw==1) {
+    // READ TRACK
+    if(DeviceIoControl(fd, IOCTL_FDCMD_READ_DATA, &rwp, sizeof(rwp), buffer, datalen, &dwRet, NULL)==0) {
+      //printf("FD_RawRW_DiskTrack - READ_DATA: (%ld) %s\r\n",GetLastError (), LastError());
+      //exit(ERR);
+      return(ERR);
+    }
+
+  } else {
+    // WRITE TRACK
+    if(DeviceIoControl(fd, IOCTL_FDCMD_WRITE_DATA, &rwp, sizeof(rwp), buffer, datalen, &dwRet, NULL)==0) {
+      printf("FD_RawRW_DiskTrack - WRITE_DATA: (%ld) %s\r\n",GetLastError (), LastError());
+      exit(ERR);
+    }
+  } // end else
+
+#elif __APPLE__
+  // macOS, so do nothing
+#else // Linux
+  struct floppy_raw_cmd raw_cmd;
+
+  // RAW-COMMANDS
+
+  if(disk_type == 'a') {
+    //ASR
+    raw_cmd.length    = 512*20;
+    raw_cmd.rate      = 0;
+    raw_cmd.flags     = 136+rw; // read=137, write=138
+    raw_cmd.cmd[6]    = 20;    // Sectors (20)
+  } else {
+    //EPS
+    raw_cmd.length    = 512*10;
+    raw_cmd.rate      = 2;
+    raw_cmd.flags     = 136+rw;  // read=137, write=138
+    raw_cmd.cmd[6]    = 10;     // Sectors (10)
+  }
+
+  // Common parameters
+  raw_cmd.data      = buffer;
+  raw_cmd.track     = track;
+  raw_cmd.cmd_count = 9;
+
+  raw_cmd.cmd[0]    = 230-33*(rw-1); // read=230, write=197
+  raw_cmd.cmd[1]    = head*4;
+  raw_cmd.cmd[2]    = track;
+  raw_cmd.cmd[3]    = head;
+  raw_cmd.cmd[4]    = 0;
+  raw_cmd.cmd[5]    = 2;
+  raw_cmd.cmd[7]    = 27;
+  raw_cmd.cmd[8]    = 255;
+
+  if (ioctl( fd, FDRAWCMD, & raw_cmd) < 0 ){
+    //perror("Disk access");
+    EEXIT((stderr,"\r\nPlease insert Ensoniq disk in disk drive or define an image file!\r\n\r\n"));
+  }
+
+  if (raw_cmd.reply[0]>= 40) {
+    return(ERR);
+  }
+
+#endif
+  return(OK);
+}
+
+////////////////////////////
+// FD_Raw Read/Write Blocks
+// (read: rw=1, write: rw=2)
+int FD_RawRW_DiskSectors(FD_HANDLE fd, char disk_type, int track, int head,
+			 int sector, int num_of_sectors, char *buffer, int rw)
+{
+
+#ifdef __CYGWIN__
+  unsigned int datalen;
+  DWORD dwRet;
+  FD_READ_WRITE_PARAMS rwp;
+  FD_SEEK_PARAMS sp;
+
+  rwp.flags = FD_OPTION_MFM;
+  rwp.phead = head;
+  rwp.cyl = track;
+  rwp.head = head;
+  rwp.sector = sector;
+  rwp.size = 2;
+  rwp.gap = 0x0a;
+  rwp.datalen = 0xff;
+
+  // Seek
+  sp.cyl = track;
+  sp.head = head;
+
+  rwp.eot = sector+num_of_sectors;
+  datalen= num_of_sectors*512;
+
+  if(DeviceIoControl(fd, IOCTL_FDCMD_SEEK, &sp, sizeof(sp), NULL, track, &dwRet, NULL) ==0) {
+    printf("FD_RawRW_DiskTrack - SEEK: (%ld) %s\r\n",GetLastError(), LastError());
+    exit(ERR);
+  }
+
+  if(rw==1) {
+    // READ BLOCKS
+    if(DeviceIoControl(fd, IOCTL_FDCMD_READ_DATA, &rwp, sizeof(rwp), buffer, datalen, &dwRet, NULL)==0) {
+      printf("FD_RawRW_DiskSectors - READ_DATA: (%ld) %s\r\n",GetLastError (), LastError());
+      exit(ERR);
+    }
+
+  } else {
+    // WRITE BLOCKS
+    if(DeviceIoControl(fd, IOCTL_FDCMD_WRITE_DATA, &rwp, sizeof(rwp), buffer, datalen, &dwRet, NULL)==0) {
+      printf("FD_RawRW_DiskSectors - WRITE_DATA: (%ld) %s\r\n",GetLastError (), LastError());
+      exit(ERR);
+    }
+  } // end else
+
+#elif __APPLE__
+  // macOS, so do nothing
+#else // Linux
+  struct floppy_raw_cmd raw_cmd;
+
+  // RAW-COMMANDS
+
+  if(disk_type == 'a') {
+    //ASR
+    raw_cmd.length    = 512*num_of_sectors;
+    raw_cmd.rate      = 0;
+    raw_cmd.flags     = 136+rw;
+    raw_cmd.cmd[6]    = 20; // Sectors (20)
+  } else {
+    //EPS
+    raw_cmd.length    = 512*num_of_sectors;
+    raw_cmd.rate      = 2;
+    raw_cmd.flags     = 136+rw;
+    raw_cmd.cmd[6]    = 10; // Sectors (10)
+  }
+
+  // Common parameters
+  raw_cmd.data      = buffer;
+  raw_cmd.track     = track;
+  raw_cmd.cmd_count = 9;
+
+  raw_cmd.cmd[0]    = 230-33*(rw-1); // read=230, write=197
+  raw_cmd.cmd[1]    = head*4;
+  raw_cmd.cmd[2]    = track;
+  raw_cmd.cmd[3]    = head;
+  raw_cmd.cmd[4]    = sector;
+  raw_cmd.cmd[5]    = 2;
+  raw_cmd.cmd[7]    = 27;
+  raw_cmd.cmd[8]    = 255;
+
+  if (ioctl( fd, FDRAWCMD, & raw_cmd) < 0 ){
+    //perror("Disk access");
+    EEXIT((stderr,"\r\nPlease insert Ensoniq disk in disk drive or define image file! \r\n\r\n"));
+  }
+
+  if (raw_cmd.reply[0]>= 40) {
+    return(ERR);
+  }
+
+#endif
+  return(OK);
+}
+
+#ifdef __CYGWIN__
+  // do nothing
+#elif __APPLE__
+  // macOS, so do nothing
+#else // Linux
+// Datatypes for Format
+typedef struct {
+  char track;
+  char head;
+  char sector;
+  char szcode;
+} FormatHeader;
+
+typedef FormatHeader FormatHeaders[MAX_DISK_SECT];
+#endif
+
+
+////////////////////
+// Format DiskTrack
+int FD_Format_DiskTrack(FD_HANDLE fd, int track, int head, int nsect, int rate, int skew)
+{
+
+#ifdef __CYGWIN__
+  DWORD dwRet;
+  BYTE abFormat[sizeof(FD_FORMAT_PARAMS) + sizeof(FD_ID_HEADER)*20];
+
+  BYTE s;
+  PFD_FORMAT_PARAMS pfp = (PFD_FORMAT_PARAMS)abFormat;
+  PFD_ID_HEADER ph = pfp->Header;
+  pfp->flags = FD_OPTION_MFM;
+  pfp->phead = head;
+  pfp->size = 2;
+  pfp->sectors = nsect;
+  pfp->gap = 0x20;
+  pfp->fill = 0x00;
+
+  for ( s = 0 ; s < (pfp->sectors) ; s++,ph++)
+    {
+      ph->cyl = track;
+      ph->head = head;
+      ph->sector = (s+skew) % nsect;
+      ph->size = pfp->size;
+    }
+
+  if(DeviceIoControl(fd, IOCTL_FDCMD_SEEK, &track, sizeof(track), NULL, track, &dwRet, NULL) ==0) {
+    printf("FD_RawRW_DiskTrack - SEEK: (%ld) %s\r\n",GetLastError(), LastError());
+    exit(ERR);
+  }
+
+  if(DeviceIoControl(fd, IOCTL_FDCMD_FORMAT_TRACK, pfp,(ULONG) ((PBYTE)ph - abFormat), NULL, 0, &dwRet, NULL)==0) {
+    printf("FD_Format_DiskTrack - FORMAT_TRACK: (%ld) %s\r\n",GetLastError(), LastError());
+    exit(ERR);
+  }
+
+#elif __APPLE__
+  // macOS, so do nothing
+#else // Linux
+  FormatHeaders headers;
+  struct floppy_raw_cmd raw_cmd;
+  int i,tmp;
+
+  for (i=0; i<nsect; i++)
+    {
+
+      headers[i].track    = track;                  // track
+      headers[i].head     = head;                   // head
+      headers[i].sector   = (i+skew) % nsect;       // sector (with skew ie. sector shift)
+      headers[i].szcode   = 2;                      // sizecode
+    }
+
+  raw_cmd.track     = track;
+  raw_cmd.data      = headers;
+  raw_cmd.length    = 4*nsect;
+  raw_cmd.rate      = rate;
+  raw_cmd.flags     = 138;
+  raw_cmd.cmd_count = 6;
+  raw_cmd.cmd[0]    = 77;
+  raw_cmd.cmd[1]    = head*4;
+  raw_cmd.cmd[2]    = 2;
+  raw_cmd.cmd[3]    = nsect;
+  raw_cmd.cmd[4]    = 40;
+  raw_cmd.cmd[5]    = 0;
+
+  tmp = ioctl( fd, FDRAWCMD, & raw_cmd );
+  if ( tmp < 0 ){
+    perror("raw cmd");
+    exit(ERR);
+  }
+
+  if (raw_cmd.reply[0]>= 40) {
+    //printf("\r\nERROR at: head=%d, track=%d !!\r\n\r\n",head,track);
+    printf("\r\n\r\nDisk is WRITE PROTECTED!! \r\n\r\n");
+    return(ERR);
+  }
+
+#endif
+  return(OK);
+}
+
+////////////////
+// MakeID_Block
+void MakeID_Block(unsigned char *buffer, char *label, unsigned int tracks,
+		  unsigned int nsect, unsigned int total_blks)
+{
+  int i;
+
+   // initialize an empty block
+  for(i=0; i<BLOCK_SIZE;i++) {
+    buffer[i]=0;
+  }
+
+  // Device type -- redundant because already zero, but...
+  buffer[0] = 0x00;
+
+  // Removable Media device Type
+  buffer[1] = 0x80;
+
+  // Std. Version #
+  buffer[2] = 0x01;
+
+  // SCSI -- redundant because already zero, but...
+  buffer[3] = 0x00;
+
+  // Nsect
+  buffer[4] = 0x00;  buffer[5] = (unsigned char) nsect;
+
+  // Heads
+  buffer[6] = 0x00;  buffer[7] = 0x02;
+
+  // Tracks
+  buffer[8] = 0x00;  buffer[9] = (unsigned char) tracks;
+
+  // Bytes per Block - 512
+  buffer[10] = 0x00;  buffer[11] = 0x00;  buffer[12] = 0x02;  buffer[13] = 0x00;
+
+  // Total Blocks
+
+  buffer[14] = (total_blks >> 24) & 0x000000ff; // MSB
+  buffer[15] = (total_blks >> 16) & 0x000000ff;
+  buffer[16] = (total_blks >>  8) & 0x000000ff;
+  buffer[17] =  total_blks        & 0x000000ff; // LSB
+
+  // SCSI Medium Type
+  buffer[18] = 0x1e;
+
+  // SCSI Density Code
+  buffer[19] = 0x02;
+
+  // reserved (20-29)
+
+  // Disk label is always seven characters.
+  if(label != NULL) {
+	// an 0xFF always comes before the disk label
+	buffer[30] =  0xff;
+    for(i=0;i<DISK_LABEL_SIZE;i++) {
+      buffer[31+i] = label[i];
+    }
+  }
+
+  // Write "ID" signature directly after disk label.
+  buffer[38] = 'I';  buffer[39] = 'D';
+
+}
+
+/////////////////
+// MakeOS_Block
+void MakeOS_Block(unsigned char *buffer, unsigned int free_blks)
+{
+  int i;
+
+  // initialize an empty block
+  for(i=0; i<BLOCK_SIZE;i++) {
+    buffer[i]=0;
+  }
+
+  // First four bytes of the OS block hold the amount of free
+  // blocks in the entire disk -- 32-bit big endian.
+  buffer[0] = (free_blks >> 24) & 0x000000ff; // MSB
+  buffer[1] = (free_blks >> 16) & 0x000000ff;
+  buffer[2] = (free_blks >>  8) & 0x000000ff;
+  buffer[3] =  free_blks        & 0x000000ff; // LSB
+
+  // Write "OS" signature at proper location in block.
+  buffer[28] = 'O';
+  buffer[29] = 'S';
+}
+
+/////////////////
+// MakeDR_Block
+void MakeDR_Block(unsigned char *buffer, int write_id)
+{
+  int i;
+
+  // initialize an empty block
+  for(i=0; i<BLOCK_SIZE;i++) {
+    buffer[i]=0;
+  }
+
+  // write "DR" signature as last two bytes of block...
+  // ...but only for second directory block!
+  if(write_id == 1) {
+    buffer[510]='D';
+    buffer[511]='R';
+  }
+
+}
+
+
+//////////////////////
+// Format Disk
+// -----------
+// This performs format on a physical disk in an internal floppy drive only!
+
+void FD_Format_Disk(char disk_type, int nsect, int rate, char* disk_label)
+{
+
+  FD_HANDLE fd;
+  int track,head,free_blks,fat_blks,i,j,skew,head_skew,track_skew;
+  unsigned char buffer[BLOCK_SIZE*40];
+  char str[81],tmp;
+
+  // Initialize the skew factor for the disk.
+  if(disk_type=='e') {
+
+    track_skew = nsect-2;
+    head_skew  = nsect-1;
+    skew       = -track_skew;
+
+  } else {
+
+    track_skew = nsect-3;
+    head_skew  = nsect-2;
+    skew       = -track_skew;
+
+  }
+
+  // Calculate disk parameters.
+  // This can remain hardcoded as physical disks will never vary.
+  fat_blks  = nsect*2*80 / FAT_ENTRIES_PER_BLK +1;
+  free_blks = nsect*2*80 - (5 + fat_blks);
+
+  //Open FD
+  fd = OpenFloppy(0);
+
+  FD_SetGeometry(fd,disk_type);
+
+  printf("1       10        20        30        40        50        60        70        80\r\n");
+  sprintf(str,"|---+----|----+----|----+----|----+----|----+----|----+----|----+----|----+----|");
+
+  for(track=0; track<80; track++) {
+
+    // Shift sectors (track skew)
+    skew=skew+track_skew;
+
+    for(head=0; head<2; head++) {
+
+      if(head==0) {
+	tmp = str[track];
+
+	str[track]='\\';
+
+      } else {
+	// Shift sectors (head skew)
+	skew=skew+head_skew;
+
+	str[track]='/';
+
+      }
+      printf("\r%s",str);
+      fflush(stdout);
+
+      if((FD_Format_DiskTrack(fd,track,head,nsect,rate,skew)) == ERR) {
+        exit(ERR);
+      }
+    } //for head
+    if(tmp == '|') str[track]=tmp; else str[track]='#';
+  }// for track
+
+  printf("\r%s",str);
+  fflush(stdout);
+  printf("\r\n\r\nWriting System blocks... \r\n");
+
+  // TODO: Get the FD status so we don't have to wait
+
+  sleep(1);
+
+  // Write System blocks
+
+  for(i=0; i<BLOCK_SIZE*40;i++) {
+    buffer[i]=0;
+  }
+
+  // ID-Block
+  MakeID_Block(buffer+BLOCK_SIZE,disk_label,80,nsect,2*80*nsect);
+
+  // OS-Block
+  MakeOS_Block(buffer+BLOCK_SIZE*2, free_blks);
+
+  // Write Dir-ID (to second Dir-Block)
+  buffer[BLOCK_SIZE*4 + 510] = 'D';
+  buffer[BLOCK_SIZE*4 + 511] = 'R';
+
+  // FAT blocks
+  for(i=0; i<fat_blks; i++) {
+	// handle first FAT block only
+	if(i==0) {
+      for(j=0; j<(fat_blks+5); j++) {
+		// write "001" code for all blocks used by block 0, ID, OS, DR, and FAT
+		buffer[BLOCK_SIZE * 5  +  3*j  + 2] = 1;
+      }
+    }
+	// write "FB" code at end of each FAT block
+    buffer[BLOCK_SIZE * (5+i) + 510] = 'F';
+    buffer[BLOCK_SIZE * (5+i) + 511] = 'B';
+  }
+
+  if(FD_RawRW_DiskTrack(fd,disk_type,0,0,buffer,WRITE) == ERR) {
+    EEXIT((stderr,"ERROR: Couldn't write System data to disk!! \r\n\r\n"));
+  }
+
+  if(FD_RawRW_DiskTrack(fd,disk_type,0,1,buffer+(nsect*BLOCK_SIZE),WRITE) == ERR) {
+    EEXIT((stderr,"ERROR: Couldn't write System data to disk!! \r\n\r\n"));
+  }
+
+  printf("Operation completed successfully! \r\n\r\n");
+
+  CloseFloppy(fd);
+}
+
+///////////////////////////////////////////////////////////
+// Check which type of disk is inserted (EPS=DD or ASR=HD)
+int FD_GetDiskType(char *disk_type, unsigned int *nsect, unsigned int *trk_size)
+{
+
+  FD_HANDLE fd;
+  char buffer[20*512];
+
+  *disk_type='n';
+
+  //Open FD
+  fd=OpenFloppy(0);
+
+  // EPS-Disk !? (DD)
+  FD_SetGeometry(fd,'e');
+  if((FD_RawRW_DiskTrack(fd,'e',0,0,buffer,READ) )== ERR) {
+
+    //.. OR ASR-Disk !? (HD)
+    FD_SetGeometry(fd,'a');
+    if((FD_RawRW_DiskTrack(fd,'a',0,0,buffer,READ) )== ERR) {
+
+      // NEITHER :(
+      return(ERR);
+
+    } else { // ASR
+      //printf("\r\nASR disk detected..\r\n");
+      *disk_type = 'a';
+      *nsect=20;
+      *trk_size = 20* 512;
+    }
+  } else { // EPS
+    //printf("\r\nEPS disk detected..\r\n");
+    *disk_type = 'e';
+    *nsect=10;
+    *trk_size = 10* 512;
+  }
+
+  CloseFloppy(fd);
+
+  return(OK);
+}
+
+//////////////////////////
+// Read/Write the Disk
+void FD_RW_Disk(char in_file[FILENAME_MAX], int rw_disk)
+{
+  int file;
+
+  FD_HANDLE fd;
+  int idx, errors;
+  unsigned int track, head, nsect, trk_size;
+  char disk_type, image_type = OTHER_TYPE;
+  char buffer[512 * 20],str[81],tmp;
+  char mark[5] = {'\\','/','#','E','E'};
+  char errors_text[20000];
+  GKHStream gkh;
+
+  errors=0; idx=0; errors_text[0]='\0';
+
+  // Check image file
+  // (file written to disk is probed, file read from disk goes by its extension)
+  if((((rw_disk == WRITE) ? ProbeImageType(in_file, &image_type) : GetImageType(in_file, &image_type)) == ERR) && (rw_disk == WRITE)) {
+    EEXIT((stderr,"ERROR: Not a valid image! \r\n\r\n"));
+  }
+
+  // Check disk
+  if(FD_GetDiskType(&disk_type, &nsect, &trk_size) == ERR) {
+    EEXIT((stderr,"ERROR: Not an Ensoniq Disk. \r\n\r\n"));
+  }
+
+  // Check if disk and file types match
+  if(disk_type == EPS_TYPE) {
+    strcpy(str,"EPS DISK");
+    if(image_type == EDA_TYPE) {
+      EEXIT((stderr,"ERROR: Don't use EPS disks with EDA files! EPS requires 'ede' extension. \r\n"));
+    }
+
+  } else {
+    strcpy(str,"ASR DISK");
+
+    if(image_type == EDE_TYPE) {
+      EEXIT((stderr,"ERROR: Don't use ASR disks with EDE files! ASR requires 'eda' extension. \r\n"));
+    }
+  }
+
+  //Open FD
+  fd=OpenFloppy(0);
+  FD_SetGeometry(fd,disk_type);
+
+  // Open image-file
+  if((file = open(in_file, (rw_disk == READ) ? (O_RDWR | O_CREAT | O_BINARY) : (O_RDONLY | O_BINARY), FILE_RIGHTS)) < 0) {
+    EEXIT((stderr,"ERROR: Couldn't open file '%s'. \r\n",in_file));
+  }
+
+  if(rw_disk == READ) {
+    // GKH is written straight from the tracks read, other formats are
+    // encoded from memory when the disk is read (see ImageFlush)
+    if(image_type == GKH_TYPE) {
+      if(ftruncate(file, 0) != 0) {
+	EEXIT((stderr,"ERROR: Couldn't empty file '%s'. \r\n",in_file));
+      }
+      GKHBegin(&gkh, file, nsect);
+    } else if(!IsRawImageType(image_type)) {
+      ImageCreate(file, image_type, (off_t) 80*2*trk_size);
+    }
+    printf("Reading %s to file '%s'... \r\n\r\n",str,in_file);
+  } else {
+    // Tracks are read through the backend of the format
+    if(ImageOpen(file, in_file, image_type, 1) != OK) {
+      EEXIT((stderr,"ERROR: Something is wrong with the image file! \r\n"));
+    }
+    printf("Writing %s from file '%s'... \r\n\r\n",str,in_file);
+  }
+
+  printf("1       10        20        30        40        50        60        70        80\r\n");
+  sprintf(str,"|---+----|----+----|----+----|----+----|----+----|----+----|----+----|----+----|");
+
+  for(track=0; track<80; track++) {
+    //FD_Seek(fd,track);
+    for(head=0; head<2; head++) {
+
+      tmp = str[track];
+      str[track]=mark[idx];
+
+      printf("\r%s",str);
+      fflush(stdout);
+
+      if(rw_disk == WRITE)  {
+		ImageRead(file,buffer,trk_size,(off_t) (track*2+head)*trk_size);
+      }
+
+      {
+	  int retry_cnt=0;
+
+      retry:
+
+	if(FD_RawRW_DiskTrack(fd,disk_type,track,head,buffer,rw_disk) == ERR) {
+	  // Error: 'E'
+	  idx=2;
+	  //Show retry count
+	  str[track]='0'+retry_cnt;
+	  printf("\r%s",str);
+	  fflush(stdout);
+	  retry_cnt++;
+	  if (retry_cnt <= 9 ) goto retry; // Yes, I know.. The Goto is a "bad programming"
+
+	  //Error text & count
+	  sprintf(errors_text+strlen(errors_text),"  ERROR: track=%d, head=%d\r\n",track,head);
+	  errors++;
+	}
+
+      }
+
+      if((rw_disk == READ) && (image_type == GKH_TYPE)) {
+		memcpy(GKHReserve(&gkh,trk_size),buffer,trk_size);
+      } else if(rw_disk == READ) {
+		ImageWrite(file,buffer,trk_size,(off_t) (track*2+head)*trk_size);
+      }
+      idx++;
+    } //for head
+
+    if((mark[idx] != 'E') && ((((track+1) % 10) == 0) || (track == 0))) str[track]='|';
+    else str[track]=mark[idx];
+    idx=0;
+  }// for track
+
+  printf("\r%s",str);
+  fflush(stdout);
+
+  if((image_type == GKH_TYPE) && (rw_disk == READ)) {
+    GKHEnd(&gkh);
+  }
+
+  if((rw_disk == READ) && (ImageFlush(in_file) != OK)) {
+    EEXIT((stderr,"ERROR: Couldn't write file '%s'. \r\n",in_file));
+  }
+  ImageClose();
+  close(file);
+
+  if(errors > 0) {
+    printf("\r\n\r\nWarning: %d error(s) found! \r\n",errors);
+    printf("\r\n%s\r\n",errors_text);
+  } else {
+    printf("\r\n\r\nOperation completed successfully! \r\n\r\n");
+  }
+
+  CloseFloppy(fd);
+}
+
+/////////////////////////////////////////////////////////////////
+// ReadBlocks
+// ----------
+//   media_type  :  'file'-access('f') or disk-access('e','a')
+//   fd          :  device (dev/fd0) file descriptor (depends on media_type if needed!)
+//   file        :  file descriptor (depends on media_type if needed!)
+//   start_block :  First block to read
+//   length      :  How many blocks to read
+//   buffer      :  Where to put the data
+
+int ReadBlocks(char media_type, FD_HANDLE fd, int file, unsigned int start_block,
+	       unsigned int length, unsigned char *buffer)
+{
+  unsigned int sector,head,track;
+  unsigned int end_sector,  end_head,  end_track;
+  unsigned int end_block, cur_block,nsect = 0;
+  // read buffer has a size of 20 blocks?
+  unsigned char tmp_buffer[BLOCK_SIZE*20];
+#ifdef __CYGWIN__
+  unsigned int i,count,num_of_blocks;
+  unsigned int pre_blocks;
+  unsigned int post_blocks;
+  unsigned int cont_blocks;
+  unsigned int offset;
+  int skip;
+
+  //char tmp_buffer[2048];
+#endif
+
+  // Image with a backend of its own (see ImageOpen)
+  if((media_type == 'f') && IsMappedImage(file)) {
+    if(ImageRead(file, buffer, BLOCK_SIZE*length, (off_t) start_block*BLOCK_SIZE) <= 0) {
+      printf("ERROR in read! \r\n");
+      exit(ERR);
+    }
+    return(OK);
+  }
+
+  switch (media_type)
+    {
+    case 'f':
+#ifdef __CYGWIN__
+	case 's':
+
+      num_of_blocks=length;
+
+      // Calc how many blocks to read in PRE_LOAD state
+      pre_blocks= (4-(start_block%4))%4;
+      // Not all blocks in the end of PRE_BLOCKS needed
+      // when only 1 or 2 blocks are read in the 2nd or 3rd
+      // block of the 2048..
+
+      skip=pre_blocks-num_of_blocks;
+      if(skip > 0)
+		pre_blocks=pre_blocks-skip;
+
+      cont_blocks=((num_of_blocks-pre_blocks)/4)*4;
+      post_blocks=(num_of_blocks-pre_blocks)%4;
+      offset=(start_block*512) % 2048;
+
+#ifdef DEBUG
+	printf("Start_block=%d \r\n",start_block);
+	printf("SEEK: %d - Offset=%d \r\n",(start_block/ 4)*2048,offset);
+
+	printf("Pre_blocks=%d \r\n",pre_blocks);
+	printf("Cont_blocks=%d \r\n",cont_blocks);
+	printf("Post_blocks=%d \r\n",post_blocks);
+	printf("Num_of_blocks=%d <-> total_blocks=%d \r\n",num_of_blocks,pre_blocks+cont_blocks+post_blocks);
+#endif
+
+      if( (lseek(file,(long) ((start_block / 4)*2048),SEEK_SET)) < 0) {
+		perror("seek");
+      }
+
+      // PRE BLOCKS
+      if(pre_blocks != 0) {
+	//printf("PRE_LOAD  %d blocks\r\n",pre_blocks);
+
+	if( read(file,tmp_buffer,2048) < 2048) {
+	  printf("WARNING: Read error in PRE BLOCKS! \r\n");
+	  printf("Resulting file is likely partially corrupt! \r\n");
+	  // exit(ERR);
+	}
+	memcpy(buffer, tmp_buffer+offset,pre_blocks*512);
+      }
+
+      // CONT BLOCKS
+      if( (cont_blocks != 0) && (skip<0)) {
+	//printf("CONT_LOAD %d blocks\r\n",cont_blocks);
+	if( read(file,buffer+(pre_blocks*512),512*cont_blocks) < (512*cont_blocks)) {
+	  printf("WARNING: Read error in CONT BLOCKS! \r\n");
+	  printf("Resulting file is likely partially corrupt! \r\n");
+	  // exit(ERR);
+	}
+
+      }
+
+      // POST BLOCKS
+      if( (post_blocks != 0) && (skip<0)) {
+	//printf("POST_LOAD %d blocks\r\n",post_blocks);
+	if((read(file,buffer+(pre_blocks*512)+(cont_blocks*512),512*post_blocks)) < (512*post_blocks)) {
+	  printf("WARNING: Read error in POST BLOCKS! \r\n");
+	  printf("Resulting file is likely partially corrupt! \r\n");
+	  // exit(ERR);
+	}
+
+      }
+
+#else // Linux
+    if(lseek(file, start_block * BLOCK_SIZE, SEEK_SET) == -1) {
+		printf("ERROR in seek! \r\n");
+		exit(ERR);
+    }
+    if(read(file,buffer, BLOCK_SIZE*length) == 0) {
+		printf("ERROR in read! \r\n");
+		exit(ERR);
+    }
+#endif
+    return(OK);
+
+    case 'e':
+
+      nsect=10;
+      break;
+
+    case 'a':
+
+      nsect=20;
+      break;
+    }
+  GetTHS(start_block,nsect,&track,&head,&sector);
+
+  end_block = start_block + length -1;
+
+  GetTHS(end_block,nsect,&end_track,&end_head,&end_sector);
+
+  FD_RawRW_DiskTrack(fd,media_type,track,head,tmp_buffer,READ);
+
+  cur_block = start_block;
+
+  while(cur_block <= end_block) {
+    memcpy(buffer,tmp_buffer+(sector*BLOCK_SIZE), BLOCK_SIZE);
+
+    buffer=buffer+BLOCK_SIZE;
+    cur_block++;
+    sector++;
+    //printf("\r Reading from disk:  %-4d of %-4d (blocks) .. ", cur_block-start_block, end_block-start_block+1);
+    //fflush(stdout);
+    if(sector>(nsect-1) && cur_block <= end_block ) {
+      //Load next track
+      GetTHS(cur_block,nsect,&track,&head,&sector);
+      FD_RawRW_DiskTrack(fd,media_type,track,head,tmp_buffer,READ);
+      sector=0;
+    }
+  }
+  //printf("\r                                                   ");
+  //fflush(stdout);
+  return(OK);
+
+}
+
+/////////////////////////////////////////////////////////////////
+// WriteBlocks
+// ----------
+//   media_type  :  'file'-access('f') or disk-access('e','a')
+//   fd          :  device (dev/fd0) file descriptor (depends on media_type if needed!)
+//   file        :  file descriptor (depends on media_type if needed!)
+//   start_block :  First block to write
+//   length      :  How many blocks to write
+//   buffer      :  Where to get the data
+
+int WriteBlocks(char media_type, FD_HANDLE fd, int file, unsigned int start_block,
+		unsigned int length, unsigned char *buffer)
+{
+  unsigned int sector, head, track;
+  unsigned int end_sector, end_head, end_track;
+  unsigned int end_block, cur_block,nsect = 0, num_of_sectors, start_sector, tmp;
+  unsigned char tmp_buffer[BLOCK_SIZE*20];
+
+  switch (media_type)
+    {
+    case 'f':
+#ifdef __CYGWIN__
+	case 's':
+#endif
+      if(IsMappedImage(file)) {
+	// written through the backend of the image
+	ImageWrite(file, buffer, BLOCK_SIZE*length, (off_t) start_block*BLOCK_SIZE);
+	return(OK);
+      }
+      lseek(file, start_block * BLOCK_SIZE, SEEK_SET);
+      write(file,buffer, BLOCK_SIZE*length);
+      return(OK);
+
+    case 'e':
+      nsect=10;
+      break;
+
+    case 'a':
+      nsect=20;
+      break;
+    }
+
+  GetTHS(start_block,nsect,&track,&head,&sector);
+  end_block = start_block + length -1;
+  GetTHS(end_block,nsect,&end_track,&end_head,&end_sector);
+
+  cur_block = start_block;
+  start_sector = sector;
+
+  do {
+    memcpy(tmp_buffer+(sector*BLOCK_SIZE),buffer, BLOCK_SIZE);
+    buffer=buffer+BLOCK_SIZE;
+
+    if(sector >= (nsect-1) || cur_block >= end_block ) {
+      //Write blocks to disk
+
+      num_of_sectors = sector - start_sector+1;
+      GetTHS(cur_block,nsect,&track,&head,&tmp);
+
+      FD_RawRW_DiskSectors(fd,media_type,track,head,start_sector, num_of_sectors, \
+			   tmp_buffer+(start_sector*BLOCK_SIZE),WRITE);
+
+      sector=0;
+      start_sector=0;
+
+    } else {
+      sector++;
+    }
+    cur_block++;
+    printf("\r Writing to disk: %-4d of %-4d (blocks)... ", cur_block-start_block, end_block-start_block+1);
+    fflush(stdout);
+  } while(cur_block <= end_block);
+  printf("\r                                              ");
+  fflush(stdout);
+  return(OK);
+}
+
+
+//////////////////////////////////////////////
+// Load Dir entry to EFE-array - use FAT-table
+void LoadDirBlocks(char media_type, FD_HANDLE fd, unsigned char *DiskFAT, int file,
+		   unsigned long start_blk, int cont, unsigned char EFE[][EFE_SIZE])
+{
+
+  unsigned char Dir[DIR_BLOCKS*BLOCK_SIZE];
+  int i,j;
+
+  // Get DirBlocks
+
+  // First dir-block - Guess the block are contiguous, so read 2 blocks
+  ReadBlocks(media_type,fd,file,start_blk,2,Dir);
+
+  //.. and second, if needed (ie. not contiguous..)
+  // Root dir is always contiguous, and its FAT entry is only the '001' system mark.
+  if((cont != 2) && (start_blk != DIR_START_BLOCK)) {
+    ReadBlocks(media_type,fd,file,GetFatEntry(media_type,DiskFAT,file,start_blk),1,Dir+BLOCK_SIZE);
+  }
+
+  // Scan Directory
+  for(i=0;i<MAX_NUM_OF_DIR_ENTRIES;i++) {
+    for(j=0; j < EFE_SIZE ; j++) {
+      EFE[i][j]=Dir[i * EFE_SIZE+j];
+    }
+  }
+}
+
+//////////////////////////////////////////////////////
+// LoadFAT
+// -------
+// -Gives the FAT as a table in memory. Once loaded and
+//  passed as DiskFAT, Get/PutFatEntry use the table also
+//  in file access, so it must be saved with SaveFAT and
+//  freed with FreeFAT. In file access the table is read
+//  in chunks on first use (see LoadLazyFAT), so only the
+//  part of the FAT of a large device that is used is read.
+//
+unsigned char *LoadFAT(char media_type, FD_HANDLE fd, int file, unsigned int fat_blks)
+{
+  unsigned char *DiskFAT;
+  unsigned int i;
+
+  DiskFAT=malloc(fat_blks*BLOCK_SIZE);
+  if(DiskFAT == NULL) EEXIT((stderr,"ERROR: Couldn't allocate memory!!!! \r\n"));
+
+  if(media_type == 'f') {
+    for(i=0; i<MAX_LAZY_FATS; i++) {
+      if(FileFAT[i].DiskFAT != NULL) continue;
+      FileFAT[i].Loaded = calloc((fat_blks+LAZY_FAT_CHUNK-1)/LAZY_FAT_CHUNK, 1);
+      if(FileFAT[i].Loaded == NULL) EEXIT((stderr,"ERROR: Couldn't allocate memory!!!! \r\n"));
+      FileFAT[i].media_type = media_type;
+      FileFAT[i].fd         = fd;
+      FileFAT[i].file       = file;
+      FileFAT[i].DiskFAT    = DiskFAT;
+      FileFAT[i].fat_blks   = fat_blks;
+      return(DiskFAT);
+    }
+  }
+
+  ReadBlocks(media_type,fd,file,FAT_START_BLOCK,fat_blks,DiskFAT);
+  return(DiskFAT);
+}
+
+//////////////////////////////////////////////////////
+// SaveFAT
+// -------
+// -Writes the FAT table loaded by LoadFAT back in one go
+//  (only the chunks read, others are unchanged).
+//
+void SaveFAT(char media_type, FD_HANDLE fd, int file, unsigned int fat_blks, unsigned char *DiskFAT)
+{
+  unsigned int i, c, n;
+
+  for(i=0; i<MAX_LAZY_FATS; i++) {
+    if(FileFAT[i].DiskFAT != DiskFAT) continue;
+    for(c=0; c*LAZY_FAT_CHUNK < fat_blks; c++) {
+      if(!FileFAT[i].Loaded[c]) continue;
+      n = fat_blks - c*LAZY_FAT_CHUNK;
+      if(n > LAZY_FAT_CHUNK) n = LAZY_FAT_CHUNK;
+      WriteBlocks(media_type,fd,file,FAT_START_BLOCK+c*LAZY_FAT_CHUNK,n,DiskFAT+c*LAZY_FAT_CHUNK*BLOCK_SIZE);
+    }
+    return;
+  }
+  WriteBlocks(media_type,fd,file,FAT_START_BLOCK,fat_blks,DiskFAT);
+}
+
+//////////////////////////////////////////////////////
+// FreeFAT
+// -------
+// -Frees the FAT table of LoadFAT.
+//
+void FreeFAT(unsigned char *DiskFAT)
+{
+  unsigned int i;
+
+  for(i=0; i<MAX_LAZY_FATS; i++) {
+    if((DiskFAT != NULL) && (FileFAT[i].DiskFAT == DiskFAT)) {
+      free(FileFAT[i].Loaded);
+      FileFAT[i].Loaded  = NULL;
+      FileFAT[i].DiskFAT = NULL;
+    }
+  }
+  free(DiskFAT);
+}
+
+//////////////////////////////////////////////////////
+// GetChainRuns
+// ------------
+// -Follows the FAT chain from 'start' and returns it as
+//  runs of contiguous blocks (at most 'blks' blocks).
+//  Returns the number of runs, the array must be freed.
+//
+int GetChainRuns(char media_type, unsigned char *DiskFAT, int file,
+		 unsigned int start, unsigned int blks, BlockRun **runs)
+{
+  unsigned int cur, next, count, n, max_runs;
+  BlockRun *r;
+
+  max_runs = 16;
+  r = malloc(max_runs * sizeof(BlockRun));
+  if(r == NULL) EEXIT((stderr,"ERROR: Couldn't allocate memory!!!! \r\n"));
+
+  n = 0; count = 0; cur = start;
+
+  while(count < blks) {
+    if((n > 0) && (cur == r[n-1].start + r[n-1].count)) {
+      // Block continues the current run
+      r[n-1].count++;
+    } else {
+      // New run
+      if(n == max_runs) {
+	max_runs = max_runs * 2;
+	r = realloc(r, max_runs * sizeof(BlockRun));
+	if(r == NULL) EEXIT((stderr,"ERROR: Couldn't allocate memory!!!! \r\n"));
+      }
+      r[n].start = cur;
+      r[n].count = 1;
+      n++;
+    }
+    count++;
+
+    // '001' is the end-of-EFE mark, '000' means broken chain
+    next = GetFatEntry(media_type,DiskFAT,file,cur);
+    if((next == 1) || (next == 0)) break;
+    cur = next;
+  }
+
+  *runs = r;
+  return(n);
+}
+
+//////////////////////////////////////////////////////
+// AllocateChain
+// -------------
+// -Allocates 'blks' free blocks and links them as a FAT
+//  chain. Contiguous space is preferred, otherwise the
+//  space fragments are used starting from the first free
+//  block (just like PutEFE does). Returns the number of
+//  runs or ERR if there isn't enough free blocks.
+//
+int AllocateChain(char media_type, unsigned char *DiskFAT, int file,
+		  unsigned int fat_blks, unsigned int total_blks,
+		  unsigned int blks, BlockRun **runs)
+{
+  unsigned int i, j, k, free_start, free_cnt, first_free, n, max_runs;
+  BlockRun *r;
+
+  max_runs = 16;
+  r = malloc(max_runs * sizeof(BlockRun));
+  if(r == NULL) EEXIT((stderr,"ERROR: Couldn't allocate memory!!!! \r\n"));
+
+  n = 0; free_start = 0; free_cnt = 0; first_free = 0;
+
+  // First PASS - Check if enough contiguous blocks
+  for(i=FAT_START_BLOCK+fat_blks; i<total_blks; i++) {
+    if(GetFatEntry(media_type,DiskFAT,file,i) == 0) {
+      if(first_free == 0) first_free = i;
+      if(free_cnt == 0) free_start = i;
+      free_cnt++;
+      if(free_cnt == blks) break;
+    } else {
+      free_cnt = 0;
+    }
+  }
+
+  if(free_cnt == blks) {
+    r[0].start = free_start;
+    r[0].count = blks;
+    n = 1;
+  } else {
+    // Second PASS - use the fragments
+    free_cnt = 0;
+    for(i=first_free; (i<total_blks) && (first_free != 0) && (free_cnt < blks); i++) {
+      if(GetFatEntry(media_type,DiskFAT,file,i) != 0) continue;
+
+      if((n > 0) && (i == r[n-1].start + r[n-1].count)) {
+	r[n-1].count++;
+      } else {
+	if(n == max_runs) {
+	  max_runs = max_runs * 2;
+	  r = realloc(r, max_runs * sizeof(BlockRun));
+	  if(r == NULL) EEXIT((stderr,"ERROR: Couldn't allocate memory!!!! \r\n"));
+	}
+	r[n].start = i;
+	r[n].count = 1;
+	n++;
+      }
+      free_cnt++;
+    }
+
+    if(free_cnt < blks) {
+      free(r);
+      *runs = NULL;
+      return(ERR);
+    }
+  }
+
+  // Link the chain - last block of each run points to the next run
+  for(j=0; j<n; j++) {
+    for(k=r[j].start; k<r[j].start+r[j].count-1; k++) {
+      PutFatEntry(media_type,DiskFAT,file,k,k+1);
+    }
+    if(j < n-1) {
+      PutFatEntry(media_type,DiskFAT,file,k,r[j+1].start);
+    } else {
+      // Mark the end-of-EFE
+      PutFatEntry(media_type,DiskFAT,file,k,1);
+    }
+  }
+
+  *runs = r;
+  return(n);
+}
+
+////////////////////////////////////////////////////
+// FormatMedia
+// -----------
+// -Format (and create if needed) imagefile/device
+//
+int FormatMedia(char **argv, int argc, int optind, char format_arg, char *disk_label)
+{
+  int file;
+
+  long long i,j,k,image_size, total_blks, free_blks, fat_blks,storage_overhead;
+  long long partial_blks, rest_blks;
+  unsigned char buffer[BLOCK_SIZE], nsect, tracks;
+
+  image_size=0;
+
+  switch(format_arg)
+    {
+
+    case 'a':
+      // ASR Disk
+      printf("\r\nFormatting ASR HD disk... \r\n\r\n");
+      FD_Format_Disk('a',20,0,disk_label);
+      return(OK);
+
+      // EPS Disk
+    case 'e':
+      printf("\r\nFormatting EPS DD disk... \r\n\r\n");
+      FD_Format_Disk('e',10,2,disk_label);
+      return(OK);
+
+    case 'i':
+
+      // IMAGEFILE/DEVICE
+
+      //Default  values for image/scsi (ie. "don't care")
+      // Exception: for EPS/ASR _DISK_ images these values
+      //            _has_ to be set correctly in the ID Block
+      //            or else you have a disk that _instantly_
+      //            reboots the keyboard when accessed!
+      //            If You dare, test it yourself.. :-)
+      nsect=0;
+      tracks=0;
+
+      // check if file argument exists
+      if(argv[optind] == NULL) {
+		ShowUsage();
+		exit(ERR);
+      }
+
+	// Check if file already exists or not.
+	if((file=open(argv[optind],O_RDWR | O_BINARY)) != -1) {
+
+	// File already exists, so get its size...
+	if((image_size=lseek(file,0,SEEK_END)) == -1) {
+	  perror("lseek");
+	  exit(ERR);
+	}
+
+	// Check if disk image size can even be valid for Ensoniq.
+	if((image_size % BLOCK_SIZE) != 0) {
+	  printf("Valid images must be a multiple of %d! \r\n",BLOCK_SIZE);
+	  exit(ERR);
+	}
+
+	if(image_size == EPS_IMAGE_SIZE) {
+	  // when image is 800K then assume it is EPS DD
+	  tracks=80;
+	  nsect=10;
+	}
+	if(image_size == ASR_IMAGE_SIZE) {
+	  // when image is 1600K then assume it is ASR HD
+	  tracks=80;
+	  nsect=20;
+	}
+	if(image_size == E16_SD_IMAGE_SIZE) {
+	  // when image is 2550K then assume EPS16 SuperDisk
+	  tracks=255;
+	  nsect=10;
+	}
+	if(image_size == ASR_SD_IMAGE_SIZE) {
+	  // when image is 5110K then assume ASR SuperDisk
+	  tracks=255;
+	  nsect=20;
+	}
+
+	// Calculate amount of blocks since image_size is set in bytes.
+	total_blks=image_size/BLOCK_SIZE;
+
+      } else {
+
+	// File does NOT already exist, so...
+
+	// Check that file size was given as an argument.
+	if(argv[optind+1] == NULL) {
+	  printf("No file size was specified! \r\n\r\n");
+	  exit(ERR);
+	} else {
+
+	  // Check specified size for template matches...
+	  if((strcasecmp(argv[optind+1],"eps"))==0) {
+        //eps disk image
+	    // Set the correct values for nsect and tracks (see above)
+	    tracks=80;
+	    nsect=10;
+	    image_size=EPS_IMAGE_SIZE;
+	  } else if ((strcasecmp(argv[optind+1],"asr"))==0) {
+	    //asr disk image
+	    // Set the correct values for nsect and tracks (see above)
+	    tracks=80;
+	    nsect=20;
+	    image_size=ASR_IMAGE_SIZE;
+	  } else if ((strcasecmp(argv[optind+1],"e16sd"))==0) {
+	    //EPS16 SuperDisk image
+	    // Set the correct values for nsect and tracks (see above)
+	    tracks=255;
+	    nsect=10;
+	    image_size=E16_SD_IMAGE_SIZE;
+	  } else if ((strcasecmp(argv[optind+1],"asrsd"))==0) {
+	    //ASR SuperDisk image
+	    // Set the correct values for nsect and tracks (see above)
+	    tracks=255;
+	    nsect=20;
+	    image_size=ASR_SD_IMAGE_SIZE;
+	  // ...otherwise revert to generic numeric sizes
+	  } else {
+	    // specific size is taken from numeric command line argument
+	    image_size=atol(argv[optind+1]);
+
+	    if(image_size == 0) {
+	      printf("Image size cannot be zero, obviously! \r\n\r\n");
+	      exit(ERR);
+	    } // end if
+
+	    // Check if 'M' or 'K' suffix used
+	    switch(argv[optind+1][strlen(argv[optind+1])-1])
+	      {
+			case 'm':
+			case 'M':
+			// express M value in actual bytes	-- ends up being 1024 squared because of...
+			image_size=image_size*1024;         // ...fall-through to 'K' (no break statement)
+			case 'k':
+			case 'K':
+			// express K value in actual bytes
+			image_size=image_size*1024;
+	      } // end switch
+		} // end of numeric size command line routine
+	} // end of new disk image sizing
+
+	// Check the validity of the given filesize ie. that is multiple of block size
+
+	if((image_size % BLOCK_SIZE) != 0) {
+	  printf("Image size has to be a multiple of %d! \r\n",BLOCK_SIZE);
+	  exit(ERR);
+	}
+
+	// Calculate amount of blocks since image_size is set in bytes.
+	total_blks=image_size/BLOCK_SIZE;
+
+	// create file
+	file = open( argv[optind], O_RDWR | O_CREAT | O_BINARY, FILE_RIGHTS);
+
+	// Make empty file
+	// 1st clear the buffer
+	for(k=0; k<BLOCK_SIZE;k++) {
+	  buffer[k]=0;
+	}
+
+	// Divide progress into a percentage.
+	partial_blks = total_blks/100;
+	rest_blks    = total_blks % 100;
+
+	// Write 100 percent of blocks, but one percent at a time.
+	for(j=0;j<100;j++) {
+	  printf("\rCreating image file... %d%% completed", (int) j);
+	  fflush(stdout);
+      // Write amount of blocks which correspond to one percent completion.
+	  for(i=0; i< partial_blks;i++) {
+	    write(file,buffer,BLOCK_SIZE);
+	  }
+	}
+	// Write the few remaining blocks, if any.
+	for(i=0;i<rest_blks;i++) {
+	  write(file,buffer,BLOCK_SIZE);
+	}
+	printf("\rCreating image file...  OK!                     \r\n");
+	fflush(stdout);
+    }
+
+      // Calculate number of needed FAT blocks.
+      printf("\rWriting filesystem...");
+      fflush(stdout);
+
+		// Each FAT block holds only so many entries, so take total
+		// amount of needed blocks and divide by 170 which is the
+		// amount of entries which can be stored in one FAT block.
+		//
+		// Division result usually has to be adjusted up by one, except
+		// when blocks needed is perfectly divisible by 170.
+		//    ex: 800K = 1600 blocks, so 9.4 FAT blocks needed.
+		//        Cannot have partial FAT blocks, so a full 10
+		//        FAT blocks are required.
+		//
+		//        However, 850K = 1700 blocks, so exactly 10 FAT
+		//        blocks are needed.
+		//
+		if((total_blks % FAT_ENTRIES_PER_BLK) != 0)
+		{
+			fat_blks=total_blks/FAT_ENTRIES_PER_BLK+1;
+		} else {
+			fat_blks=total_blks/FAT_ENTRIES_PER_BLK;
+		}
+
+      // There is always at least a 5 block overhead due to null block,
+      // ID block, OS block, and two DR blocks. Then add all FAT blocks
+      // to calculate total storage overhead.
+      //
+      // This is the amount of blocks which have to be marked in the FAT
+      // as allocated, even though the "blank" disk has nothing stored
+      // except formatting and disk geometry information.
+      //
+      storage_overhead=fat_blks+5;
+
+	  // Calculate amount of empty blocks left after overhead.
+      free_blks=total_blks-storage_overhead;
+
+      //
+      // Write null block (block 0) -- technically unused, so some programs
+	  // put extra info here such as "Formatted by <xyz>", etc. but stock
+	  // Ensoniq disks use a specific byte pattern as filler.
+	  //
+      lseek(file,0,SEEK_SET);
+	  // Create buffer filled with traditional Ensoniq filler bytes.
+	  for(i=0; i<BLOCK_SIZE;i=i+2) {
+		buffer[i  ]=0x6D;
+		buffer[i+1]=0xB6;
+      }
+      // Alternately, create an empty buffer with EpsLin message.
+	  //for(i=0;i<BLOCK_SIZE;i++) buffer[i]=0;
+      //sprintf(buffer,"m%s",FIRST_BLOCK_MESSAGE);
+      write(file,buffer,BLOCK_SIZE);
+
+      // Write ID block.
+      lseek(file,BLOCK_SIZE*ID_BLOCK,SEEK_SET);
+      MakeID_Block(buffer,disk_label,tracks,nsect,total_blks);
+      write(file,buffer,BLOCK_SIZE);
+
+      // Write OS block.
+      lseek(file,BLOCK_SIZE*OS_BLOCK,SEEK_SET);
+      MakeOS_Block(buffer,free_blks);
+      write(file,buffer,BLOCK_SIZE);
+
+      // Write first DR (directory) block.
+      lseek(file,BLOCK_SIZE*DIR_START_BLOCK,SEEK_SET);
+      MakeDR_Block(buffer,0);	// 0 argument means no "DR" signature
+      write(file,buffer,BLOCK_SIZE);
+      // Write second DR (directory) block.
+      lseek(file,BLOCK_SIZE*DIR_END_BLOCK,SEEK_SET);
+      MakeDR_Block(buffer,1);	// 1 argument means write "DR" signature
+      write(file,buffer,BLOCK_SIZE);
+
+      // Write all FAT blocks.
+
+      // Buffer is already mostly empty from previous MakeDR, so just
+	  // update the last two bytes with an "FB" signature.
+      buffer[510] = 'F';		// "FB" is always the last two bytes...
+      buffer[511] = 'B';		// ...of any FAT block
+
+	  // Run loop once per FAT block being created.
+      for(i=0; i<fat_blks; i++) {
+
+		// Clear block buffer (except "FB" signature) every pass.
+		for(k=0; k<BLOCK_SIZE-2;k++) {
+			buffer[k]=0;
+		}
+
+		// Allocate FAT entries for all disk overhead blocks of:
+		// Null block, ID block, OS block, two DR blocks, and all FAT blocks.
+		//
+		// Each FAT entry is three bytes, and "001" means block allocated.
+		//
+		if(storage_overhead > 0) {				// if any used blocks have still not been marked
+			for(j=0; j<BLOCK_SIZE-2; j=j+3) {	// then mark as many entries as possible within the
+				buffer[j]   = 0;				// current FAT block. Last two bytes must stay "FB"
+				buffer[j+1] = 0;				// so never write to them.
+				buffer[j+2] = 1;				//
+				storage_overhead--;				// block now marked as used, so decrement count
+				if(storage_overhead == 0) {
+					break;						// no more entries to mark
+				}
+			} // end of used block marking loop
+		}
+
+        // Go to starting write position of current FAT entry.
+		lseek(file,BLOCK_SIZE*(i+5),SEEK_SET);
+		// Write current FAT block to disk.
+		if( write(file,buffer,BLOCK_SIZE) <= 0)
+			perror("write:");
+      } // end of for loop done once per FAT
+
+      printf("\rWriting filesystem....  OK! \r\n");
+      fflush(stdout);
+      close(file);
+    } // case
+  return(OK);
+}
+
+////////////////////////////////////////////////
+// Save Dir entry from EFE-array - use FAT-table
+void SaveDirBlocks(char media_type, FD_HANDLE fd, unsigned char *DiskFAT, int file,
+		   unsigned long start_blk, int cont, unsigned char EFE[][EFE_SIZE])
+{
+
+  unsigned char Dir[DIR_BLOCKS*BLOCK_SIZE];
+  int i,j;
+
+  // Put Directory
+  for(i=0;i<MAX_NUM_OF_DIR_ENTRIES;i++) {
+    for(j=0; j < EFE_SIZE ; j++) {
+      Dir[i * EFE_SIZE+j]=EFE[i][j];
+    }
+  }
+  // .. and tail (ie. '00000000' and 'DR')
+
+  for(i=10; i>2; i--) {
+    Dir[DIR_BLOCKS*BLOCK_SIZE - i] = 0;
+  }
+  Dir[DIR_BLOCKS*BLOCK_SIZE - 2] = 'D';
+  Dir[DIR_BLOCKS*BLOCK_SIZE - 1] = 'R';
+
+
+  // Put DirBlocks
+
+  if((cont == 2) || (start_blk == DIR_START_BLOCK)) {
+    // If contiguous (as root dir always is), write all in one
+    WriteBlocks(media_type,fd,file,start_blk,2,Dir);
+  } else {
+    // .. and if not, do it separately
+    WriteBlocks(media_type,fd,file,start_blk,1,Dir);
+    WriteBlocks(media_type,fd,file,GetFatEntry(media_type,DiskFAT,file,start_blk),1,Dir+BLOCK_SIZE);
+  }
+}
+
+
+//////////////////////////////////////////////////////
+// ChangeDir
+// ---------
+// -Descends from the directory loaded in EFE (usually
+//  root) along the index 'path' and loads the last dir.
+//
+void ChangeDir(char media_type, FD_HANDLE fd, unsigned char *DiskFAT, int in,
+	       unsigned char EFE[MAX_NUM_OF_DIR_ENTRIES][EFE_SIZE],
+	       unsigned int *dir_start, unsigned int *dir_cont,
+	       char *parent_dir_name, int subdir_cnt, unsigned int *DirPath)
+{
+  unsigned int i,j;
+
+  // SUB-DIRS - Use the 'path' to 'change dir'...
+  if(subdir_cnt >0) {
+    for(i=0; i < subdir_cnt; i++) {
+      j=DirPath[i];
+      if ((j >= MAX_NUM_OF_DIR_ENTRIES) || (EFE[j][1] != 2)) {
+		EEXIT((stderr,"ERROR: Index '%d' is not a directory! \r\n\r\n",j));
+      }
+
+      strncpy(parent_dir_name, EFE[j]+2, 12);
+      *dir_cont  =(unsigned int)  ((EFE[j][16] << 8) + EFE[j][17]);
+      *dir_start =(unsigned long) ((EFE[j][18] << 24) + (EFE[j][19] << 16)
+				   +(EFE[j][20] << 8 ) +  EFE[j][21]);
+
+      LoadDirBlocks(media_type,fd,DiskFAT,in,*dir_start,*dir_cont,EFE);
+    }
+
+  } else {
+    // if parent is root dir, set parent_name to 'ROOT'
+    strncpy(parent_dir_name,"ROOT        ", 12);
+  }
+}
+
+//////////////////////////////////////////////////////
+// AdjustDirCount
+// --------------
+// -Adds 'delta' to the 'num. of files' of a sub-dir.
+//  The dir is found through its parent pointer entry
+//  (ie. idx 0 of the sub-dir).
+//
+void AdjustDirCount(char media_type, FD_HANDLE fd, unsigned char *DiskFAT, int file,
+		    unsigned char ParentPtr[EFE_SIZE], int delta)
+{
+  unsigned char ParentEFE[MAX_NUM_OF_DIR_ENTRIES][EFE_SIZE];
+  unsigned int parent_dir_idx, parent_start;
+  signed int parent_dir_files;
+
+  // Get info about parent dir
+  parent_dir_idx = (unsigned int)  ((ParentPtr[16] << 8) + ParentPtr[17]);
+  parent_start   = (unsigned long) ((ParentPtr[18] << 24) + (ParentPtr[19] << 16)
+				    +(ParentPtr[20] << 8 ) +  ParentPtr[21]);
+
+  // Don't know how many contiguous blocks so assume worst case.
+  LoadDirBlocks(media_type,fd,DiskFAT,file,parent_start,1,ParentEFE);
+
+  parent_dir_files = (ParentEFE[parent_dir_idx][14] << 8) + ParentEFE[parent_dir_idx][15];
+  parent_dir_files = parent_dir_files + delta;
+  if(parent_dir_files < 0) parent_dir_files = 0;
+
+  ParentEFE[parent_dir_idx][14] = (unsigned char) (parent_dir_files >> 8) & 0xFF;
+  ParentEFE[parent_dir_idx][15] = (unsigned char) (parent_dir_files & 0xFF);
+
+  SaveDirBlocks(media_type,fd,DiskFAT,file,parent_start,1,ParentEFE);
+}
+
+
+/////////////////////////////
+// EFEFileName
+// -----------
+// Makes the local filename of an EFE, ie. "[idx][type] name.efe".
+//
+void EFEFileName(char *dosname, unsigned char Entry[EFE_SIZE], unsigned int j)
+{
+  unsigned int k;
+  unsigned char type;
+  char name[13],tmp_name[64];
+  char type_text[8];
+
+  type=Entry[1];
+  if(type > 49) type=49;
+
+  //Name
+  for(k=0;k<12;k++) {
+    name[k]=Entry[k+2];
+  }
+  name[12]=0;
+
+  // Correct any "invalid" Ensoniq characters in EFE name so that
+  // the operating system will not choke.
+  DosName(dosname,name);
+
+  // Add type (and multi-file) prefix to filename when applicable.
+  if((Entry[22] != 0) && (familymode == EPS_FAM)) {
+    strcpy(type_text,EpsTypes[type]);
+    type_text[5]='\0';
+    sprintf(type_text,"%s%2d",type_text,Entry[22]);
+    sprintf(tmp_name,"[%s] %s",type_text,dosname);
+  // Don't use multi-file prefix when not a multi-file, or any non-ASR/EPS types.
+  } else {
+    sprintf(tmp_name,"[%s] %s",EpsTypes[type],dosname);
+  }
+  sprintf(dosname,"%s",tmp_name);
+
+  // Add index prefix to filename.
+  sprintf(tmp_name,"[%02d]%s",j,dosname);
+  sprintf(dosname,"%s",tmp_name);
+}
+
+/////////////////////////////
+// MakeEFEHeader
+// -------------
+// Makes the Giebler EFE header of a dir entry.
+//
+void MakeEFEHeader(unsigned char Header[BLOCK_SIZE], unsigned char Entry[EFE_SIZE])
+{
+  unsigned int i,k;
+  unsigned char type;
+  char name[13];
+
+  type=Entry[1];
+  if(type > 49) type=49;
+
+  for(k=0;k<12;k++) {
+  name[k]=Entry[k+2];
+  }
+  name[12]=0;
+
+  // Generate Giebler EFE header (not actual Ensoniq data).
+
+  // Construct Header
+  Header[0] =0x0D;
+  Header[1] =0x0A;
+  strcpy(&Header[2],"Eps File:       ");
+  strcpy(&Header[18],name);
+  strcpy(&Header[30],EpsTypes[type]);
+  strcpy(&Header[37],"          ");
+
+  // CR, LF, EOF
+  Header[47]=0x0D; Header[48]=0x0A; Header[49]=0x1A;
+
+  Header[50]=Entry[1]; // Instrument
+  Header[51]=0;
+  Header[52]=Entry[14];
+  Header[53]=Entry[15];
+  Header[54]=Entry[16];
+  Header[55]=Entry[17];
+  Header[56]=Entry[20];
+  Header[57]=Entry[21];
+  Header[58]=Entry[22]; // MultiFile index
+
+  for(i=59;i<BLOCK_SIZE;i++) Header[i]=0;
+}
+
+/////////////////////////////
+// CopyBlocks
+// ----------
+// Appends 'blks' blocks of image file 'in' (starting from block
+// 'start') to the current position of file 'out'. In Linux the kernel
+// does the copy (copy_file_range, or sendfile with older kernels), so
+// data doesn't go through user space and may even be reflinked.
+// Otherwise (or if the kernel refuses) 'Buffer' is used.
+//
+int CopyBlocks(int in, int out, unsigned int start, unsigned int blks, unsigned char *Buffer)
+{
+  off_t pos;
+  size_t left, len;
+  ssize_t n;
+
+  pos  = (off_t) start*BLOCK_SIZE;
+  left = (size_t) blks*BLOCK_SIZE;
+
+#ifdef __linux__
+  // (blocks of a mapped EDE/EDA or packed image are not in place for the kernel)
+  if(!IsMappedImage(in)) {
+    static int no_copy_range = 0, no_sendfile = 0;
+
+#ifdef SYS_copy_file_range
+    long long range_pos = pos;
+
+    while((left > 0) && !no_copy_range) {
+      n = syscall(SYS_copy_file_range, in, &range_pos, out, NULL, left, 0);
+      if(n <= 0) {
+	// Not supported (old kernel, other fs etc.) - don't try again
+	if(n < 0) no_copy_range = 1;
+	break;
+      }
+      left = left - n;
+    }
+    pos = (off_t) range_pos;
+#endif
+
+    while((left > 0) && !no_sendfile) {
+      n = sendfile(out, in, &pos, left);
+      if(n <= 0) {
+	if(n < 0) no_sendfile = 1;
+	break;
+      }
+      left = left - n;
+    }
+  }
+#endif
+
+  while(left > 0) {
+    len = (left > STREAM_BUFFER_BLOCKS*BLOCK_SIZE) ? STREAM_BUFFER_BLOCKS*BLOCK_SIZE : left;
+    if((n = ImageRead(in, Buffer, len, pos)) <= 0) break;
+    if(write(out, Buffer, n) != n) break;
+    pos  = pos + n;
+    left = left - n;
+  }
+
+  return((left == 0) ? OK : ERR);
+}
+
+/////////////////////////////
+// CopyEFEData
+// -----------
+// Appends the data of one EFE (FAT chain from 'start') to file 'out'.
+// In FILE mode whole runs are copied (see CopyBlocks), in DISK mode the
+// contiguous blocks first and then the rest in runs.
+//
+void CopyEFEData(char media_type, FD_HANDLE fd, int in, unsigned char *FAT, unsigned char *DiskFAT,
+		 int out, unsigned int size, unsigned int cont, unsigned int start,
+		 unsigned char *Buffer, char *dosname)
+{
+  unsigned int i, fatval, bp;
+  unsigned char *mem_pointer;
+  BlockRun *Run;
+  int runs;
+
+    if(media_type == 'f') {
+		// FILE access mode
+		// Copy each run of contiguous blocks of the FAT chain in one go.
+		runs = GetChainRuns(media_type,FAT,in,start,size,&Run);
+		for(i=0;i<runs;i++) {
+			if(CopyBlocks(in,out,Run[i].start,Run[i].count,Buffer) != OK) {
+				EEXIT((stderr,"ERROR: Couldn't write '%s'! \r\n",dosname));
+			}
+		}
+		free(Run);
+	} else {
+
+    // Stage 1: Copy all contiguous blocks within the EFE.
+		// DISK access mode
+		// Create a buffer which can hold the entire range of contiguous blocks.
+		mem_pointer=malloc(BLOCK_SIZE*cont);
+		// Quit on error if buffer could not be created.
+		if(mem_pointer == NULL) EEXIT((stderr,"ERROR: Couldn't allocate memory!!!! \r\n"));
+		// Read *all* contiguous blocks into buffer.
+		ReadBlocks(media_type,fd,in,start,cont,mem_pointer);
+		// Write out the contiguous blocks which were stored into buffer.
+		write(out,mem_pointer,BLOCK_SIZE*cont);
+		free(mem_pointer);
+
+	// Stage 2: Contiguous blocks have all been read, so now get
+    // any remaining blocks which were not contiguous.
+
+	// All FAT entries which belonged to the contiguous blocks can
+	// just be skipped over since those blocks have already been read.
+
+	// FAT block pointer -- starting block + number of contiguous blocks - 1
+	// In other words: This points to the last FAT entry for the block at
+	// the end of the *contiguous* range, but not necessary the end of EFE.
+    bp=start+cont-1;
+
+	// Get the FAT entry for the last contiguous block in the EFE.
+    fatval=GetFatEntry(media_type,DiskFAT,in,bp);
+
+	// A code of '001' signifies block is both used and also the last
+	// block in the FAT chain. In other words: EOF -- end of file.
+	// If the last FAT entry in the contiguous range was also the EOF
+	// flag then stage 2 can simply be skipped because there are no
+	// non-contiguous blocks in the EFE at all.
+    if(fatval != 1) {
+			// DISK ACCESS -- non-contiguous block handling (Linux and Windows)
+			//                seek issues with CD/Zip, so buffer as much as possible
+			//
+			// Keep reading the next FAT entry and the block to which it points, so long as
+			// the '001' end-of-file code has not yet been reached.
+			while(fatval != 1) {
+				// Find any "runs" of contiguous blocks, if possible.
+				// Each run has to be a minimum of 1 block, as the current
+				// block must be loaded, if nothing else.
+				cont=1;
+				// First (and sometimes only) block to be read is the current block.
+				start=fatval;
+				// Change next block to be read to the block pointed to by the current FAT entry.
+				bp=fatval;
+				// Get a *new* FAT entry using former FAT entry as the pointer.
+				fatval=GetFatEntry(media_type,DiskFAT,in,start);
+
+				// Keep count of blocks in the run, if any are found.
+				// This only happens when the next entry in the FAT points to
+				// the disk block which is directly after the current disk block.
+				while(fatval == bp+1) {
+					bp=fatval;
+					fatval = GetFatEntry(media_type,DiskFAT,in,bp);
+					cont++;
+				} // end of block run
+
+				// Copy single block, or a single run of contiguous blocks.
+				mem_pointer=malloc(BLOCK_SIZE*cont);
+				if(mem_pointer == NULL) EEXIT((stderr,"ERROR: Couldn't allocate memory!!!! \r\n"));
+				ReadBlocks(media_type,fd,in,start,cont,mem_pointer);
+				write(out,mem_pointer,BLOCK_SIZE*cont);
+				free(mem_pointer);
+			} // end of non-contiguous disk access -- '001' FAT entry found
+	} // skip over stage 2 -- EFE has only contiguous blocks
+	} // end of DISK mode
+}
+
+/////////////////////////////
+// FindMultiParts
+// --------------
+// If entry 'j' is the first part of a multi-file instrument, finds
+// the rest of the parts (same name, part numbers 2, 3, ...) from
+// the whole dir. Returns the number of parts in 'Part' if all parts
+// of the set are there and selected, otherwise 1 (with 'report' a
+// warning is printed once for the set, its parts are then got one
+// by one).
+//
+unsigned int FindMultiParts(unsigned char EFE[MAX_NUM_OF_DIR_ENTRIES][EFE_SIZE], char *process_EFE,
+			    unsigned int j, unsigned int *Part, int report)
+{
+  unsigned int k, parts, last, first;
+
+  Part[0] = j;
+  if((EFE[j][1] != 3) || (EFE[j][22] == 0) || (familymode != EPS_FAM)) return(1);
+
+  // Highest part of the set, and the lowest one selected
+  last = 0;
+  first = EFE[j][22];
+  for(k=0; k<MAX_NUM_OF_DIR_ENTRIES; k++) {
+    if((EFE[k][1] != 3) || (EFE[k][22] == 0) || (memcmp(&EFE[k][2], &EFE[j][2], 12) != 0)) continue;
+    if(EFE[k][22] > last) last = EFE[k][22];
+    if((process_EFE[k] != 0) && (EFE[k][22] < first)) first = EFE[k][22];
+  }
+
+  if(EFE[j][22] == 1) {
+    for(parts=1; parts<last; parts++) {
+      for(k=0; k<MAX_NUM_OF_DIR_ENTRIES; k++) {
+	if((EFE[k][1] == 3) && (EFE[k][22] == parts+1) &&
+	   (memcmp(&EFE[k][2], &EFE[j][2], 12) == 0)) break;
+      }
+      if((k == MAX_NUM_OF_DIR_ENTRIES) || (process_EFE[k] == 0)) break;
+      Part[parts] = k;
+    }
+    if((parts == last) && (parts > 1)) return(parts);
+  }
+
+  if(report && (last > 1) && (EFE[j][22] == first)) {
+    printf("Warning: Not all %d parts of [%.12s] are selected, they are not joined! \r\n",last,&EFE[j][2]);
+  }
+  return(1);
+}
+
+/////////////////////////////
+// GetEFEs
+// -------
+// This extracts EFEs from an Ensoniq disk or image, and saves the
+// individual files to local storage.
+//
+// This routine was rewritten to eliminate serious regression introduced in v1.42, so
+// performance under CD/Zip may not be fast, but EFEs with non-contiguous blocks are now
+// extracted properly under Windows during FILE access.
+//
+
+int GetEFEs(char media_type, FD_HANDLE fd, int in, unsigned char EFE[MAX_NUM_OF_DIR_ENTRIES][EFE_SIZE],
+	    char *process_EFE, unsigned char *DiskFAT, unsigned int fat_blks)
+{
+  int out;
+  unsigned int j,k,p, size, cont, start, parts;
+  unsigned int Part[MAX_NUM_OF_DIR_ENTRIES];
+  unsigned char type, Header[BLOCK_SIZE], Entry[EFE_SIZE];
+  char name[13],dosname[64], Joined[MAX_NUM_OF_DIR_ENTRIES];
+  unsigned char *FAT, *Buffer;
+
+	// In FILE mode the FAT chains are resolved from a FAT-table
+	// read once, and the data is copied run by run (see CopyBlocks).
+	FAT = DiskFAT;
+	Buffer = NULL;
+	if(media_type == 'f') {
+		FAT = LoadFAT(media_type,fd,in,fat_blks);
+		Buffer = malloc(STREAM_BUFFER_BLOCKS*BLOCK_SIZE);
+		if(Buffer == NULL) EEXIT((stderr,"ERROR: Couldn't allocate memory!!!! \r\n"));
+	}
+  
+	// Test if *ALL* EFEs should be extracted, and avoid skipping index 0 when SD-1/VFXSD/TS disk is detected -- this is a kludge!
+	if( (allmode == 1) && (familymode != EPS_FAM) )
+	{
+		// flag index 0 for extraction
+		process_EFE[0] = 1;
+	}
+
+  // With -J the later parts of complete multi-file sets go to the first part
+  memset(Joined, 0, MAX_NUM_OF_DIR_ENTRIES);
+  for(j=0; joinmode && (j<MAX_NUM_OF_DIR_ENTRIES); j++) {
+    if(process_EFE[j] == 0) continue;
+    parts = FindMultiParts(EFE,process_EFE,j,Part,0);
+    for(p=1; p<parts; p++) Joined[Part[p]] = 1;
+  }
+
+  // Process list of EFEs
+  for(j=0;j<MAX_NUM_OF_DIR_ENTRIES;j++) {
+
+    // Check if current EFE is within the parse list -- ASR/EPS rarely use entry "0", so it is flagged to skip when -ga is used.
+	// Using -g0 specifically will extract an OS stored at entry "0", however.
+	// 
+	// Checking against '0' here means if the entry is not flagged for extraction, so do not conflate it with simply being index 0!
+    if(process_EFE[j] == 0) continue;
+
+    // Get file type for current entry being processed -- skip if entry cannot be exported to EFE
+	type=EFE[j][1];
+    if(type == 0) continue;						// skip Unused/Blank/Empty
+	if(type == 2) continue;						// skip Sub-Directory
+	if(type == 8) continue;						// skip Pointer to Parent Directory
+	if(type > 49) continue;						// skip any entry which is definitely out-of-range
+	if(Joined[j]) continue;						// skip part already joined to the first part
+
+    //Name
+    for(k=0;k<12;k++) {
+      name[k]=EFE[j][k+2];
+    }
+    name[12]=0;
+
+    // Joined multi-file is one single-file EFE of all the parts
+    memcpy(Entry, EFE[j], EFE_SIZE);
+    parts = 1;
+    Part[0] = j;
+    if(joinmode && ((parts = FindMultiParts(EFE,process_EFE,j,Part,1)) > 1)) {
+      for(p=0, size=0; p<parts; p++) size = size + (EFE[Part[p]][14] << 8) + EFE[Part[p]][15];
+      Entry[14] = (size >> 8) & 0xFF;
+      Entry[15] = size & 0xFF;
+      Entry[22] = 0;
+      printf("\rJoining %d parts of [%s]... \r\n",parts,name);
+    } else {
+      parts = 1;
+    }
+
+    EFEFileName(dosname,Entry,j);
+    MakeEFEHeader(Header,Entry);
+
+	// Open for reading and writing (O_RDWR).
+    if((out=open(dosname,O_RDWR | O_CREAT | O_BINARY, FILE_RIGHTS)) < 0) {
+      EEXIT((stderr,"ERROR: Couldn't create '%s' to write EFE! \r\n",dosname));
+    }
+
+	// Write Giebler specific EFE header (not actual Ensoniq data).
+    write(out,Header,BLOCK_SIZE);
+
+	// Report which EFE is being handled.
+    printf("\rProcessing [%s]... \r\n",name);fflush(stdout);
+
+    // Data of the EFE, or of all parts of a joined multi-file
+    for(p=0; p<parts; p++) {
+      k = Part[p];
+      size =(unsigned int)  ((EFE[k][14] << 8) + EFE[k][15]);
+      cont =(unsigned int)  ((EFE[k][16] << 8) + EFE[k][17]);
+      start=(unsigned long) ((EFE[k][18] << 24) + (EFE[k][19] << 16)
+			     +(EFE[k][20] <<8 ) +  EFE[k][21]);
+      CopyEFEData(media_type,fd,in,FAT,DiskFAT,out,size,cont,start,Buffer,dosname);
+    }
+    printf("\r                                                     ");
+	// Close newly created EFE file.
+	close(out);
+	// Current EFE has been processed, so repeat loop if needed.
+  } // end of EFE processing loop
+
+  if(FAT != DiskFAT) FreeFAT(FAT);
+  if(Buffer != NULL) free(Buffer);
+  return(OK);
+}
+
+/////////////////////////////
+// GetEFETree
+// ----------
+// Extracts the selected EFEs (see GetEFEs). With 'recursive' the
+// selected sub-dirs are extracted whole to local dirs named
+// '[idx]NAME' (like in tar output). With name/type selectors all
+// sub-dirs are searched and only the matching EFEs extracted.
+//
+void GetEFETree(char media_type, FD_HANDLE fd, int in, unsigned char EFE[MAX_NUM_OF_DIR_ENTRIES][EFE_SIZE],
+		char *process_EFE, unsigned char *DiskFAT, unsigned int fat_blks,
+		int recursive, int depth)
+{
+  unsigned char SubEFE[MAX_NUM_OF_DIR_ENTRIES][EFE_SIZE];
+  char SubSelect[MAX_NUM_OF_DIR_ENTRIES];
+  char name[13], dosname[64], dirname[80];
+  unsigned int j, k, start, cont;
+
+  GetEFEs(media_type, fd, in, EFE, process_EFE, DiskFAT, fat_blks);
+  if(!recursive) return;
+
+  for(j=0;j<MAX_NUM_OF_DIR_ENTRIES;j++) {
+    if(EFE[j][1] != 2) continue;
+    if((process_EFE[j] == 0) && (select_spec == NULL)) continue;
+    if(depth >= MAX_DIR_DEPTH) {
+      EEXIT((stderr,"ERROR: Directory structure is too deep! \r\n"));
+    }
+
+    cont =(unsigned int)  ((EFE[j][16] << 8) + EFE[j][17]);
+    start=(unsigned long) ((EFE[j][18] << 24) + (EFE[j][19] << 16)
+			   +(EFE[j][20] <<8 ) +  EFE[j][21]);
+
+    LoadDirBlocks(media_type,fd,DiskFAT,in,start,cont,SubEFE);
+    if(select_spec != NULL) {
+      if(SelectEntries(select_spec,SubEFE,SubSelect) == 0) {
+	// Nothing here, but maybe deeper
+	for(k=1;k<MAX_NUM_OF_DIR_ENTRIES;k++) if(SubEFE[k][1] == 2) break;
+	if(k == MAX_NUM_OF_DIR_ENTRIES) continue;
+      }
+    } else {
+      for(k=0;k<MAX_NUM_OF_DIR_ENTRIES;k++) SubSelect[k]=1;
+    }
+
+    // Same naming as with EFEs, without the extension
+    for(k=0;k<12;k++) name[k]=EFE[j][k+2];
+    name[12]=0;
+    DosName(dosname,name);
+    dosname[strlen(dosname)-4] = '\0';
+    snprintf(dirname,sizeof(dirname),"[%02d]%s",j,dosname);
+
+    if((mkdir(dirname, FILE_RIGHTS) != 0) && (errno != EEXIST)) {
+      EEXIT((stderr,"ERROR: Couldn't create dir '%s'! \r\n",dirname));
+    }
+    if(chdir(dirname) != 0) {
+      EEXIT((stderr,"ERROR: Couldn't enter dir '%s'! \r\n",dirname));
+    }
+    printf("\rEntering [%s]... \r\n",dirname);
+    GetEFETree(media_type,fd,in,SubEFE,SubSelect,DiskFAT,fat_blks,recursive,depth+1);
+    if(chdir("..") != 0) {
+      EEXIT((stderr,"ERROR: Couldn't leave dir '%s'! \r\n",dirname));
+    }
+  }
+}
+
+//////////////////////////////////////////////////////////////
+// Tar stream
+// ----------
+// - EFEs are written as a POSIX (ustar) tar stream. All output
+//   goes through one large buffer, and EFE data is read from
+//   the media straight into it.
+//
+
+typedef struct {
+  int out;
+  unsigned char *Buffer;
+  unsigned int used;
+  unsigned long long total;
+} TarStream;
+
+void TarFlush(TarStream *tar)
+{
+  unsigned int done;
+  ssize_t n;
+
+  for(done=0; done<tar->used; done=done+n) {
+    if((n = write(tar->out, tar->Buffer+done, tar->used-done)) <= 0) {
+      EEXIT((stderr,"ERROR: Couldn't write tar stream! \r\n"));
+    }
+  }
+  tar->total = tar->total + tar->used;
+  tar->used = 0;
+}
+
+// Room for 'len' bytes in the buffer (len <= buffer size)
+unsigned char *TarReserve(TarStream *tar, unsigned int len)
+{
+  unsigned char *p;
+
+  if(tar->used + len > TAR_BUFFER_BLOCKS*BLOCK_SIZE) TarFlush(tar);
+  p = tar->Buffer + tar->used;
+  tar->used = tar->used + len;
+  return(p);
+}
+
+/////////////////////////////
+// TarHeader
+// ---------
+// Adds ustar header of a file ('0') or directory ('5').
+// Long paths are split to 'prefix' and 'name'.
+//
+void TarHeader(TarStream *tar, char *path, char typeflag, unsigned long size, unsigned long mtime)
+{
+  unsigned char *h;
+  unsigned int i, len, sum;
+  char *split;
+
+  h = TarReserve(tar, BLOCK_SIZE);
+  memset(h, 0, BLOCK_SIZE);
+
+  len = strlen(path);
+  if(len <= 100) {
+    memcpy(h, path, len);
+  } else {
+    // Split at a '/' so that prefix fits to 155 and name to 100 chars
+    for(split=path+len-1; split>path; split--) {
+      if((*split == '/') && ((split-path) <= 155) && ((path+len-split-1) <= 100)) break;
+    }
+    if(split == path) {
+      EEXIT((stderr,"ERROR: Path '%s' is too long for tar! \r\n",path));
+    }
+    memcpy(h, split+1, path+len-split-1);
+    memcpy(h+345, path, split-path);
+  }
+
+  sprintf((char *) h+100, "%07o", (typeflag == '5') ? 0755 : 0644);   // mode
+  sprintf((char *) h+108, "%07o", 0);                                  // uid
+  sprintf((char *) h+116, "%07o", 0);                                  // gid
+  sprintf((char *) h+124, "%011lo", size);
+  sprintf((char *) h+136, "%011lo", mtime);
+  h[156] = typeflag;
+  memcpy(h+257, "ustar", 6);
+  memcpy(h+263, "00", 2);
+
+  // Checksum is counted with checksum field as spaces
+  memset(h+148, ' ', 8);
+  for(sum=0, i=0; i<BLOCK_SIZE; i++) sum = sum + h[i];
+  sprintf((char *) h+148, "%06o", sum);
+  h[155] = ' ';
+}
+
+/////////////////////////////
+// TarEntries
+// ----------
+// Adds the selected entries of a dir. With 'recursive' the
+// sub-dirs are added as tar dirs with all their entries, or
+// with name/type selectors, with the matching entries.
+//
+void TarEntries(TarStream *tar, char media_type, FD_HANDLE fd, int in, unsigned char *FAT,
+		unsigned char EFE[MAX_NUM_OF_DIR_ENTRIES][EFE_SIZE], char *process_EFE,
+		char *path, int recursive, int depth, unsigned long mtime)
+{
+  unsigned char SubEFE[MAX_NUM_OF_DIR_ENTRIES][EFE_SIZE], Entry[EFE_SIZE];
+  char SubSelect[MAX_NUM_OF_DIR_ENTRIES], Joined[MAX_NUM_OF_DIR_ENTRIES];
+  char name[13], dosname[64], entry_path[1024];
+  unsigned int j, k, m, n, size, cont, start, parts, Part[MAX_NUM_OF_DIR_ENTRIES];
+  unsigned char type, *p;
+  BlockRun *Run;
+  int runs, i;
+
+  // With -J the later parts of complete multi-file sets go to the first part
+  memset(Joined, 0, MAX_NUM_OF_DIR_ENTRIES);
+  for(j=0; joinmode && (j<MAX_NUM_OF_DIR_ENTRIES); j++) {
+    if(process_EFE[j] == 0) continue;
+    parts = FindMultiParts(EFE,process_EFE,j,Part,0);
+    for(k=1; k<parts; k++) Joined[Part[k]] = 1;
+  }
+
+  for(j=0;j<MAX_NUM_OF_DIR_ENTRIES;j++) {
+    type=EFE[j][1];
+
+    // With selectors all sub-dirs are searched
+    if((process_EFE[j] == 0) && !(recursive && (select_spec != NULL) && (type == 2))) continue;
+    if((type == 0) || (type == 8) || (type > 49) || Joined[j]) continue;
+
+    size =(unsigned int)  ((EFE[j][14] << 8) + EFE[j][15]);
+    cont =(unsigned int)  ((EFE[j][16] << 8) + EFE[j][17]);
+    start=(unsigned long) ((EFE[j][18] << 24) + (EFE[j][19] << 16)
+			   +(EFE[j][20] <<8 ) +  EFE[j][21]);
+
+    for(k=0;k<12;k++) {
+      name[k]=EFE[j][k+2];
+    }
+    name[12]=0;
+
+    if(type == 2) {
+      // DIRECTORY
+      if(!recursive) continue;
+      if(depth >= MAX_DIR_DEPTH) {
+	EEXIT((stderr,"ERROR: Directory structure is too deep! \r\n"));
+      }
+
+      // Same naming as with EFEs, without the extension
+      DosName(dosname,name);
+      dosname[strlen(dosname)-4] = '\0';
+      snprintf(entry_path,sizeof(entry_path),"%s[%02d]%s/",path,j,dosname);
+      TarHeader(tar,entry_path,'5',0,mtime);
+
+      LoadDirBlocks(media_type,fd,FAT,in,start,cont,SubEFE);
+      if(select_spec != NULL) {
+	SelectEntries(select_spec,SubEFE,SubSelect);
+      } else {
+	for(k=0;k<MAX_NUM_OF_DIR_ENTRIES;k++) SubSelect[k]=1;
+      }
+      TarEntries(tar,media_type,fd,in,FAT,SubEFE,SubSelect,entry_path,recursive,depth+1,mtime);
+      continue;
+    }
+
+    // Joined multi-file is one single-file EFE of all the parts
+    memcpy(Entry, EFE[j], EFE_SIZE);
+    parts = 1;
+    Part[0] = j;
+    if(joinmode && ((parts = FindMultiParts(EFE,process_EFE,j,Part,1)) > 1)) {
+      for(k=0, n=0; k<parts; k++) n = n + (EFE[Part[k]][14] << 8) + EFE[Part[k]][15];
+      Entry[14] = (n >> 8) & 0xFF;
+      Entry[15] = n & 0xFF;
+      Entry[22] = 0;
+    } else {
+      parts = 1;
+    }
+
+    EFEFileName(dosname,Entry,j);
+    snprintf(entry_path,sizeof(entry_path),"%s%s",path,dosname);
+
+    fprintf(stderr,"\rProcessing [%s%s]... \r\n",path,name);
+
+    // Header of tar entry and Giebler EFE header
+    TarHeader(tar,entry_path,'0',(unsigned long) (((Entry[14] << 8) + Entry[15])+1)*BLOCK_SIZE,mtime);
+    MakeEFEHeader(TarReserve(tar,BLOCK_SIZE),Entry);
+
+    // Data - read runs of the chains straight into the stream buffer
+    for(m=0; m<parts; m++) {
+      size =(unsigned int)  ((EFE[Part[m]][14] << 8) + EFE[Part[m]][15]);
+      start=(unsigned long) ((EFE[Part[m]][18] << 24) + (EFE[Part[m]][19] << 16)
+			     +(EFE[Part[m]][20] <<8 ) +  EFE[Part[m]][21]);
+
+      runs = GetChainRuns(media_type,FAT,in,start,size,&Run);
+      for(n=0,i=0;i<runs;i++) n=n+Run[i].count;
+      if(n < size) {
+	EEXIT((stderr,"ERROR: FAT chain of [%s] is broken! \r\n",name));
+      }
+      for(i=0;i<runs;i++) {
+	for(k=0;k<Run[i].count;k=k+n) {
+	  n = Run[i].count - k;
+	  if(n > TAR_BUFFER_BLOCKS) n = TAR_BUFFER_BLOCKS;
+	  p = TarReserve(tar,n*BLOCK_SIZE);
+	  ReadBlocks(media_type,fd,in,Run[i].start+k,n,p);
+	}
+      }
+      free(Run);
+    }
+  }
+}
+
+/////////////////////////////
+// TarEFEs
+// -------
+// Writes the selected EFEs (with Giebler headers) as a tar
+// stream to 'tar_file' ("-" = stdout) in one pass.
+//
+int TarEFEs(char media_type, FD_HANDLE fd, int in, unsigned char EFE[MAX_NUM_OF_DIR_ENTRIES][EFE_SIZE],
+	    char *process_EFE, unsigned char *DiskFAT, unsigned int fat_blks,
+	    int tar_out, int recursive)
+{
+  TarStream tar;
+  unsigned char *FAT;
+  unsigned int pad;
+
+  // Test if *ALL* EFEs should be extracted, and avoid skipping index 0 when SD-1/VFXSD/TS disk is detected
+  if( (allmode == 1) && (familymode != EPS_FAM) ) process_EFE[0] = 1;
+
+  if(DiskFAT == NULL) {
+    FAT = LoadFAT(media_type,fd,in,fat_blks);
+  } else {
+    FAT = DiskFAT;
+  }
+
+  tar.out = tar_out;
+  tar.used = 0;
+  tar.total = 0;
+  tar.Buffer = malloc(TAR_BUFFER_BLOCKS*BLOCK_SIZE);
+  if(tar.Buffer == NULL) EEXIT((stderr,"ERROR: Couldn't allocate memory!!!! \r\n"));
+
+  TarEntries(&tar,media_type,fd,in,FAT,EFE,process_EFE,"",recursive,0,(unsigned long) time(NULL));
+
+  // End of archive: two zero blocks, padded to full record
+  memset(TarReserve(&tar,2*BLOCK_SIZE),0,2*BLOCK_SIZE);
+  pad = (TAR_RECORD_SIZE - (tar.total + tar.used) % TAR_RECORD_SIZE) % TAR_RECORD_SIZE;
+  if(pad > 0) memset(TarReserve(&tar,pad),0,pad);
+  TarFlush(&tar);
+
+  fprintf(stderr,"\rTar stream done! Total %llu Bytes written. \r\n",tar.total);
+
+  free(tar.Buffer);
+  if(FAT != DiskFAT) FreeFAT(FAT);
+  return(OK);
+}
+
+/////////////////////////////
+// PutBlocks
+// ---------
+// Streams 'blks' blocks of EFE data from file 'in' (offset 'pos')
+// to the media starting from block 'start'. 'Buffer' holds
+// STREAM_BUFFER_BLOCKS, so memory use doesn't depend on the EFE size.
+//
+void PutBlocks(char media_type, FD_HANDLE fd, int out, int in, off_t pos,
+	       unsigned int start, unsigned int blks, unsigned char *Buffer)
+{
+  unsigned int n, len, got;
+  ssize_t r;
+
+  while(blks > 0) {
+    n = (blks > STREAM_BUFFER_BLOCKS) ? STREAM_BUFFER_BLOCKS : blks;
+    len = n*BLOCK_SIZE;
+
+    // Truncated EFE is padded with zeros
+    for(got=0; got<len; got=got+r) {
+      if((r = MacPread(in, Buffer+got, len-got, pos+got)) <= 0) break;
+    }
+    if(got < len) memset(Buffer+got, 0, len-got);
+
+    WriteBlocks(media_type,fd,out,start,n,Buffer);
+    pos   = pos + len;
+    start = start + n;
+    blks  = blks - n;
+  }
+}
+
+// EFE stream (see NextStreamEFE)
+typedef struct {
+  int in;
+  int tar;                      // tar stream of EFEs
+  int started;
+  char name[101];
+  unsigned char Ahead[BLOCK_SIZE]; // read but not used yet
+  size_t ahead, at;
+  size_t left;                  // bytes of the current EFE (or tar header) left
+  size_t pad;                   // tar padding after them
+  int mac;                      // 'Mac'-format EFE
+  int held;                     // byte held back (see ReadStreamEFE)
+  unsigned char hold;
+  off_t pos;                    // in the EFE
+} EFEStream;
+
+// EFE to be put (see PutEFE)
+typedef struct {
+  int in;                       // EFE file, or -1 if from a stream
+  unsigned char *Data;          // head of EFE from a stream
+  size_t len;
+  EFEStream *Stream;            // rest of it, until read
+  unsigned int idx;             // dir entry
+  unsigned int blks;
+  unsigned int OS;              // OS version, 0 if not OS
+  BlockRun *Run;
+  int runs;
+  int skip;                     // identical EFE already in dir
+} PutItem;
+
+// Piece of EFE data to be written
+typedef struct {
+  unsigned int start;           // first block on disk/image
+  unsigned int count;
+  unsigned int item;
+  unsigned int offset;          // in blocks from the start of EFE data
+} PutExtent;
+
+// Biggest EFE first, in command order when equal size
+static PutItem *SortItems;
+static int CompareItemSize(const void *a, const void *b)
+{
+  int i = *(const int *) a, j = *(const int *) b;
+
+  if(SortItems[i].blks != SortItems[j].blks) {
+    return((SortItems[i].blks < SortItems[j].blks) ? 1 : -1);
+  }
+  return(i - j);
+}
+
+// Ascending block order
+static int CompareExtentStart(const void *a, const void *b)
+{
+  const PutExtent *x = a, *y = b;
+
+  return((x->start > y->start) - (x->start < y->start));
+}
+
+/////////////////////////////
+// AddPutItem
+// ----------
+// Adds an EFE source (file or memory) to the list of EFEs to be put.
+//
+void AddPutItem(PutItem **Item, int *items, int *max_items,
+		int in, unsigned char *Data, size_t len)
+{
+  if(*items == *max_items) {
+    *max_items = (*max_items == 0) ? 16 : (*max_items)*2;
+    *Item = realloc(*Item, (*max_items) * sizeof(PutItem));
+    if(*Item == NULL) EEXIT((stderr,"ERROR: Couldn't allocate memory!!!! \r\n"));
+  }
+  memset(&(*Item)[*items], 0, sizeof(PutItem));
+  (*Item)[*items].in   = in;
+  (*Item)[*items].Data = Data;
+  (*Item)[*items].len  = len;
+  (*items)++;
+}
+
+size_t ReadStreamEFE(EFEStream *s, unsigned char *Buffer, size_t len);
+
+/////////////////////////////
+// ReadPutItem
+// -----------
+// Reads 'len' bytes from 'pos' of an EFE to be put. EFE from a
+// stream is read in order after its head (see NextStreamEFE).
+// Bytes beyond the end of the EFE are zeros.
+//
+void ReadPutItem(PutItem *It, void *Buffer, size_t len, off_t pos)
+{
+  ssize_t got;
+  off_t from;
+
+  if(It->Data == NULL) {
+    if((got = MacPread(It->in, Buffer, len, pos)) < 0) got = 0;
+    if(got < len) memset((unsigned char *) Buffer+got, 0, len-got);
+  } else {
+    memset(Buffer, 0, len);
+    if(pos < It->len) {
+      memcpy(Buffer, It->Data+pos, (It->len-pos < len) ? It->len-pos : len);
+    }
+    from = (pos > It->len) ? pos : It->len;
+    if((It->Stream != NULL) && (pos+len > from) && (It->Stream->pos == from)) {
+      ReadStreamEFE(It->Stream, (unsigned char *) Buffer + (from-pos), pos+len-from);
+    }
+  }
+}
+
+/////////////////////////////
+// ReadStream
+// ----------
+// Reads 'len' bytes from a pipe where short reads are normal.
+// Returns the bytes read (less only at the end of stream).
+//
+size_t ReadStream(int in, unsigned char *Buffer, size_t len)
+{
+  size_t got;
+  ssize_t r;
+
+  for(got=0; got<len; got=got+r) {
+    if((r = read(in, Buffer+got, len-got)) <= 0) break;
+  }
+  return(got);
+}
+
+// Raw bytes of the current EFE (see ReadStreamEFE)
+static size_t StreamRaw(EFEStream *s, unsigned char *Buffer, size_t len)
+{
+  size_t n;
+
+  if(len > s->left) len = s->left;
+  n = (s->ahead - s->at < len) ? s->ahead - s->at : len;
+  memcpy(Buffer, s->Ahead + s->at, n);
+  s->at = s->at + n;
+  n = n + ReadStream(s->in, Buffer+n, len-n);
+  s->left = s->left - n;
+  return(n);
+}
+
+// At least 'n' bytes of the current EFE (if it has them) in Ahead
+static void StreamPeek(EFEStream *s, size_t n)
+{
+  if(n > s->left) n = s->left;
+  if(s->ahead - s->at >= n) return;
+  memmove(s->Ahead, s->Ahead + s->at, s->ahead - s->at);
+  s->ahead = s->ahead - s->at;
+  s->at = 0;
+  s->ahead = s->ahead + ReadStream(s->in, s->Ahead + s->ahead, n - s->ahead);
+}
+
+/////////////////////////////
+// ReadStreamEFE
+// -------------
+// Reads next 'len' bytes of the current EFE of stream 's'. In a
+// 'Mac'-format EFE the byte before every '0x0a' is skipped (it is
+// held back until the next byte is seen). Returns the bytes read
+// (less only at the end of EFE).
+//
+size_t ReadStreamEFE(EFEStream *s, unsigned char *Buffer, size_t len)
+{
+  size_t got, n, r, w;
+  unsigned char c;
+
+  for(got=0; got<len; got=w) {
+    if((n = StreamRaw(s, Buffer+got, len-got)) == 0) {
+      if(s->left > 0) {
+	if(s->tar) EEXIT((stderr,"ERROR: Tar stream ended in the middle of '%s'! \r\n",s->name));
+	s->left = 0;
+      }
+      if(s->held) {
+	Buffer[got++] = s->hold;
+	s->held = 0;
+      }
+      break;
+    }
+    if(!s->mac) {
+      w = got + n;
+      continue;
+    }
+    // (in place: every byte read gives at most one byte)
+    for(r=got, w=got; r<got+n; r++) {
+      c = Buffer[r];
+      if(s->held && (c != 0x0a)) Buffer[w++] = s->hold;
+      s->hold = c;
+      s->held = 1;
+    }
+  }
+  s->pos = s->pos + got;
+  return(got);
+}
+
+/////////////////////////////
+// OpenEFEStream
+// -------------
+// Starts reading EFEs from stream 'in' (ie. stdin) without seeking:
+// either one EFE, or a tar stream of EFEs (as written by -T).
+//
+void OpenEFEStream(EFEStream *s, int in)
+{
+  memset(s, 0, sizeof(EFEStream));
+  s->in = in;
+  s->ahead = ReadStream(in, s->Ahead, BLOCK_SIZE);
+  s->tar = (s->ahead == BLOCK_SIZE) && (memcmp(s->Ahead+257, "ustar", 5) == 0);
+  if(s->ahead < BLOCK_SIZE) printf("Warning: No EFE found in stdin! \r\n");
+}
+
+/////////////////////////////
+// NextStreamEFE
+// -------------
+// Moves to the next EFE of stream 's' and adds it to the EFEs to be
+// put. Only the head of the EFE (header and OS version) is read to
+// memory: the rest is read in order by ReadPutItem, before the next
+// EFE. Tar entries other than files, and not valid EFEs are skipped.
+// Returns ERR at the end of stream.
+//
+int NextStreamEFE(EFEStream *s, PutItem **Item, int *items, int *max_items)
+{
+  unsigned char Hdr[BLOCK_SIZE], *Head;
+  char octal[13];
+  size_t len, size, n;
+
+  while(1) {
+    if(!s->tar) {
+      // One EFE, its size is known only at the end of stream
+      if(s->started || (s->ahead < BLOCK_SIZE)) return(ERR);
+      strcpy(s->name, "stdin");
+      s->left = (size_t) -1;
+    } else {
+      // Rest of the previous entry and its padding
+      while((s->left > 0) && (StreamRaw(s, Hdr, BLOCK_SIZE) > 0));
+      for(; s->pad > 0; s->pad = s->pad - n) {
+	n = (s->pad > BLOCK_SIZE) ? BLOCK_SIZE : s->pad;
+	if(ReadStream(s->in, Hdr, n) < n) return(ERR);
+      }
+
+      // Zero block ends the archive
+      s->left = BLOCK_SIZE;
+      if((StreamRaw(s, Hdr, BLOCK_SIZE) < BLOCK_SIZE) || (Hdr[0] == 0)) return(ERR);
+
+      memcpy(s->name, Hdr, 100);
+      s->name[100] = '\0';
+      memcpy(octal, Hdr+124, 12);
+      octal[12] = '\0';
+      size = strtoul(octal, NULL, 8);
+      s->left = size;
+      s->pad  = ((size + BLOCK_SIZE - 1) / BLOCK_SIZE) * BLOCK_SIZE - size;
+
+      // Data of dirs, links etc. is skipped
+      if((Hdr[156] != '0') && (Hdr[156] != '\0')) continue;
+    }
+    s->started = 1;
+    s->pos  = 0;
+    s->held = 0;
+
+    // 'Mac'-format (every '0x0a' replaced by '0x0d0a')
+    StreamPeek(s, 3);
+    s->mac = (s->ahead - s->at >= 3) && (s->Ahead[s->at] == 0x0d) &&
+      (s->Ahead[s->at+1] == 0x0d) && (s->Ahead[s->at+2] == 0x0a);
+    if(s->mac) printf("Warning: Macintosh generated EFx file found. \r\n");
+
+    Head = malloc(EFE_HEAD_SIZE);
+    if(Head == NULL) EEXIT((stderr,"ERROR: Couldn't allocate memory!!!! \r\n"));
+    len = ReadStreamEFE(s, Head, EFE_HEAD_SIZE);
+
+    if((len < BLOCK_SIZE) || (IsEFEHeader(Head) != OK)) {
+      printf("Warning: '%s' does not appear to be a valid Ensoniq file, skipped! \r\n",s->name);
+      free(Head);
+      continue;
+    }
+
+    AddPutItem(Item, items, max_items, -1, Head, len);
+    (*Item)[*items-1].Stream = s;
+    return(OK);
+  }
+}
+
+//////////////////////////////////////////////////////////////
+// FindIdenticalEFE
+// ----------------
+// - Looks for an EFE identical to the one to be put in the dir.
+//   Name, type, size and multi-file index are compared first, and
+//   only for those the data is hashed (see XXH64). Returns the
+//   index, or MAX_NUM_OF_DIR_ENTRIES if not found.
+//
+unsigned int FindIdenticalEFE(char media_type, FD_HANDLE fd, int out, unsigned char *FAT,
+			      unsigned char EFE[MAX_NUM_OF_DIR_ENTRIES][EFE_SIZE],
+			      PutItem *It, unsigned char *EFEData, unsigned char *EFE_name,
+			      unsigned char *Buffer)
+{
+  unsigned long long hash = 0;
+  unsigned int j, size, start;
+  BlockRun *Run;
+  int runs;
+
+  size = (EFEData[2] << 8) + EFEData[3];
+
+  for(j=0; j<MAX_NUM_OF_DIR_ENTRIES; j++) {
+    start = (EFE[j][18] << 24) + (EFE[j][19] << 16) + (EFE[j][20] << 8) + EFE[j][21];
+
+    // Entries reserved for this put have no start block yet
+    if((EFE[j][1] != EFEData[0]) || (start == 0)) continue;
+    if(memcmp(&EFE[j][2], EFE_name, 12) != 0) continue;
+    if((EFE[j][14] != EFEData[2]) || (EFE[j][15] != EFEData[3])) continue;
+    if(EFE[j][22] != EFEData[8]) continue;
+
+    if(hash == 0) {
+      // (EFE from stream is hashed where it was written)
+      if(It->Data != NULL) {
+	hash = HashRuns(media_type,fd,out,It->Run,It->runs,size,Buffer);
+      } else {
+	hash = HashData(It->in, size, Buffer);
+      }
+    }
+
+    runs = GetChainRuns(media_type,FAT,out,start,size,&Run);
+    if(HashRuns(media_type,fd,out,Run,runs,size,Buffer) == hash) {
+      free(Run);
+      return(j);
+    }
+    free(Run);
+  }
+
+  return(MAX_NUM_OF_DIR_ENTRIES);
+}
+
+//////////////////////////////////////////////////////////////
+// PutEFE
+// ------
+// - Writes EFEs from files to disk/image in three phases:
+//   1) All EFE headers are read, and the dir entries and the
+//      free space are checked before anything is written.
+//   2) Space is allocated for all EFEs together, biggest
+//      first, so that they get the contiguous areas.
+//   3) The data is written in one sweep in ascending block
+//      order, then FAT, 'disk-free' and dir are committed once.
+// - With 'skip_identical' EFEs already in the dir (same name,
+//   type, size and data) are skipped.
+//
+
+int PutEFE(
+	    char *process_EFE,
+	    unsigned char start_idx,
+	    unsigned char EFE[MAX_NUM_OF_DIR_ENTRIES][EFE_SIZE],
+	    char media_type,
+	    char image_type,
+	    char *image_file,
+	    char **EFE_files,
+	    int optind,
+	    char *orig_image_name,
+	    unsigned int dir_start,
+	    unsigned int dir_cont,
+	    unsigned int total_blks,
+	    unsigned int *free_blks,
+	    unsigned int fat_blks,
+	    FD_HANDLE fd,
+	    unsigned char *DiskFAT,
+	    unsigned char *DiskHdr,
+	    int skip_identical
+	    )
+{
+
+  int in, out = 0;
+  char in_file[FILENAME_MAX];
+  unsigned int idx,i,j,k,n,offset,need_blks;
+  unsigned char EFE_name[13], EFEData[EFE_SIZE], OSBlock[BLOCK_SIZE];
+  unsigned char *Buffer, *FAT;
+  unsigned int OS;
+  char **EFE_list;
+  PutItem *Item;
+  PutExtent *Extent;
+  int *Order;
+  int items, max_items, extents, added;
+  EFEStream Stream;
+  unsigned int stream_blks, b;
+
+#ifdef __CYGWIN__
+  if((media_type ==  'f') || (media_type ==  's')) {
+#else // Linux
+  if(media_type ==  'f') {
+#endif
+    // FILE ACCESS
+
+    if((out=OpenImage(image_file)) < 0) {
+      EEXIT((stderr,"ERROR: Couldn't open image file '%s'. \r\n",image_file));
+    }
+    // skip over the image filename passed by the command-line to arrive at just EFE names
+    optind++;
+  }
+
+  // Check if any EFE filenames were supplied by command-line at all -- if not then routine has nothing to do!
+  if(EFE_files[optind] == NULL) {
+	printf("Warning: Cannot put an EFE which has not been specified! \r\n");
+	return(ERR);
+  }
+
+  // Allocate memory for EFE filenames array.
+  EFE_list = malloc(500 * sizeof(*EFE_list));			// 500 entries is hopefully enough for any circumstance -- kludge!
+  if(EFE_list == NULL) EEXIT((stderr,"ERROR: Couldn't allocate memory!!!! \r\n"));
+  int EFEindex=0;						// initialize an index for EFE filename listing
+  EFE_list[EFEindex]=NULL;				// initialize the first entry to NULL -- last entry always has to be NULL, so assume first will be last and only
+
+  // PROCESS ALL EFEs
+  //
+  // Check for wildcard globbing, and process if found, otherwise use individual filenames from command-line.
+  //
+  // Copy the first EFE filename passed by command-line into another variable -- maybe a normal name, maybe a wildcard.
+  strcpy(in_file,EFE_files[optind]);
+  // See if EFE filename is normal or a wildcard -- expands the wildcard to individual filename if applicable.
+  // Remember: strcmp returns 0 when true rather than 1.
+  if( (strcasecmp(in_file,"ALL")==0) || (strcasecmp(in_file,"*.EFE")==0) || (strcasecmp(in_file,"*.EFA")==0) || (strcasecmp(in_file,"*.INS")==0) ) {
+	printf("Attempting to add all found EFE, EFA, and INS files... \r\n");
+	// Itemize all possible EFE, EFA, and INS files in current directory -- replaces wildcard argument with actual filenames
+	DIR *dp;							// structure representing a directory stream
+	struct dirent *entry;
+	dp = opendir ("./");				// opens a directory stream corresponding to local directory
+	if (dp != NULL)	{					// do the following if the local directory exists and can be accessed
+	// start directory parsing
+		while ( (entry=readdir (dp)) ) {
+			// d_name is filename for current file being examined in the directory
+			//
+			// Check if extension exists at all.
+			char *p;		// holds file extension of filename
+			if((p= (char *) rindex(entry->d_name,'.')) != NULL) {
+				// File extension exists, so see if it is one of the allowed types (EFE/EFA/INS).
+				p++;		// skip '.' to get only file extension
+				if( (strcasecmp(p,"efe") == 0) || (strcasecmp(p,"efa") == 0) || (strcasecmp(p,"ins") == 0) ) {
+					// Allocate enough memory for new filename string.
+					EFE_list[EFEindex] = malloc(strlen(entry->d_name) + 1); 	// + 1 for the '\0' character at the end of C-style strings
+					if(EFE_list[EFEindex] == NULL) EEXIT((stderr,"ERROR: Couldn't allocate memory!!!! \r\n"));
+					// Copy filename into newly allocated string.
+					strcpy(EFE_list[EFEindex],entry->d_name);					// add proper filename to EFE/EFA/INS input list
+					EFEindex++;													// go to next filename slot
+				}
+			} // end of file extension check
+		}
+		(void) closedir (dp);					// properly close directory
+	} // end of directory parsing
+	else								// do the follow if the local directory cannot be accessed
+		EEXIT((stderr,"ERROR: Couldn't open local directory. \r\n"));
+  } // end of wildcard globbing processing routine
+  else {
+  // No wildcards found, so copy all command-line filenames into EFE file list without alteration.
+	int copyIndex=optind;									// initialize an index for EFE filename copying
+    while(EFE_files[copyIndex] != NULL) {
+		// Allocate enough memory for new filename string.
+		EFE_list[EFEindex] = malloc(strlen(EFE_files[copyIndex]) + 1); 	// + 1 for the '\0' character at the end of C-style strings
+		if(EFE_list[EFEindex] == NULL) EEXIT((stderr,"ERROR: Couldn't allocate memory!!!! \r\n"));
+		strcpy(EFE_list[EFEindex],EFE_files[copyIndex]);				// copy command-line filename directly into EFE filelist
+		copyIndex++;													// advance to next command-line filename
+		EFEindex++;														// go to next filename slot
+	} // end while
+  } // end else
+
+  // Always set the last file list entry to NULL -- will be the first *and* last entry if no valid files are found!
+  EFE_list[EFEindex]=NULL;
+
+
+
+  // FAT is modified in memory and committed once
+  if(DiskFAT == NULL) {
+    FAT = LoadFAT(media_type,fd,out,fat_blks);
+  } else {
+    FAT = DiskFAT;
+  }
+
+  // All data goes through one fixed size buffer
+  Buffer = malloc(STREAM_BUFFER_BLOCKS*BLOCK_SIZE);
+  if(Buffer == NULL) EEXIT((stderr,"ERROR: Couldn't allocate memory!!!! \r\n"));
+
+  // SOURCES
+  //========
+  // Files are read in place, '-' reads EFE(s) from stdin.
+  Item = NULL;
+  items = 0;
+  max_items = 0;
+  stream_blks = 0;
+
+  for(i=0; EFE_list[i] != NULL; i++) {
+
+    if(strcmp(EFE_list[i],"-") == 0) {
+      // Stream can't be read again, so each EFE is written to
+      // its own space as it is read. Blocks stay free in the FAT
+      // on disk until COMMIT.
+      OpenEFEStream(&Stream, STDIN_FILENO);
+      while(NextStreamEFE(&Stream, &Item, &items, &max_items) == OK) {
+	PutItem *It = &Item[items-1];
+
+	ReadPutItem(It, EFEData, EFE_SIZE, 0x32);
+	It->blks = (EFEData[2] << 8) + EFEData[3];
+	if(stream_blks + It->blks > *free_blks) {
+	  EEXIT((stderr,"Not enough free space! %d needed, %d available. \r\n", stream_blks + It->blks, *free_blks));
+	}
+	stream_blks = stream_blks + It->blks;
+
+	if(It->blks > 0) {
+	  if((It->runs = AllocateChain(media_type,FAT,out,fat_blks,total_blks,It->blks,&It->Run)) == ERR) {
+	    EEXIT((stderr,"ERROR: Image/disk has a corrupted FAT!! \r\n"));
+	  }
+	}
+	for(j=0, offset=0; j<It->runs; offset=offset+It->Run[j].count, j++) {
+	  for(b=0; b<It->Run[j].count; b=b+n) {
+	    n = It->Run[j].count - b;
+	    if(n > STREAM_BUFFER_BLOCKS) n = STREAM_BUFFER_BLOCKS;
+	    ReadPutItem(It, Buffer, n*BLOCK_SIZE, (off_t) (offset+b+1)*BLOCK_SIZE);
+	    WriteBlocks(media_type,fd,out,It->Run[j].start+b,n,Buffer);
+	  }
+	}
+	It->Stream = NULL;
+      }
+      continue;
+    }
+
+    // Attempts to open and also check that current file specified for EFE input exists.
+    strcpy(in_file,EFE_list[i]);
+    if((in=open(in_file, O_RDONLY | O_BINARY)) < 0) {
+      EEXIT((stderr,"ERROR: Couldn't open '%s' as an EFE input. \r\n",in_file));
+    }
+
+    // Check and convert if 'Mac'-format :-P is found
+    if(ConvertMacFormat(&in, in_file) == OK) {
+      printf("Warning: Macintosh generated EFx file found. \r\n");
+    }
+
+    // Check that EFE input file specified is actually a valid EFE/EFA/INS.
+    if(IsEFE(&in, in_file) != OK) {
+      EEXIT((stderr,"ERROR: '%s' does not appear to be a valid Ensoniq file! \r\n",in_file));
+    }
+
+    AddPutItem(&Item, &items, &max_items, in, NULL, 0);
+  }
+
+  // PLAN
+  //=====
+  // Read all EFE headers and reserve the dir entries before
+  // anything is written, so a put that doesn't fit leaves
+  // the disk/image untouched.
+  need_blks = 0;
+  added = 0;
+  idx = start_idx;
+
+  for(k=0; k<items; k++) {
+
+    ReadPutItem(&Item[k], EFEData, EFE_SIZE, 0x32);
+    ReadPutItem(&Item[k], EFE_name, 12, 0x12);
+    EFE_name[12]='\0';
+
+    if(skip_identical) {
+      j = FindIdenticalEFE(media_type,fd,out,FAT,EFE,&Item[k],EFEData,EFE_name,Buffer);
+      if(j < MAX_NUM_OF_DIR_ENTRIES) {
+	printf("\rSkipping [%s]: identical to idx %d. \r\n",EFE_name,j);
+	Item[k].skip = 1;
+	// (EFE from stream was already written to its space)
+	for(j=0; j<Item[k].runs; j++) {
+	  for(b=0; b<Item[k].Run[j].count; b++) PutFatEntry(media_type,FAT,out,Item[k].Run[j].start+b,0);
+	}
+	free(Item[k].Run);
+	Item[k].Run  = NULL;
+	Item[k].runs = 0;
+	continue;
+      }
+    }
+
+    // Starting at pos 'start_idx' !!
+    // On the ASR/EPS, index 0 is almost always used to hold OS or SubDir, but this is *not* true for SD/TS/VFD!
+	// This should likely be changed to add proper support for SD/TS/VFD, at least when not in the root folder.
+    for(; idx<MAX_NUM_OF_DIR_ENTRIES; idx++) {
+      if(EFE[idx][1] == 0) break;
+    }
+
+    // Produce an error if attempting to write a 39th entry to one directory.
+    if(idx==MAX_NUM_OF_DIR_ENTRIES) {
+      printf("\r                                         \r");fflush(stdout);
+      printf("ERROR: Directory full! %d EFEs given, room for %d. \r\n", items, added);
+      for(j=0; j<items; j++) {
+	if(Item[j].Data == NULL) { UnmapMacFormat(Item[j].in); close(Item[j].in); }
+	free(Item[j].Data);
+	free(Item[j].Run);
+	if((j < k) && !Item[j].skip) {
+	  process_EFE[Item[j].idx] = 0;
+	  memset(EFE[Item[j].idx], 0, EFE_SIZE);
+	}
+      }
+      for(j=0; EFE_list[j] != NULL; j++) free(EFE_list[j]);
+      free(EFE_list);
+      free(Item);
+      free(Buffer);
+      if(FAT != DiskFAT) FreeFAT(FAT);
+      return(ERR);
+    }
+
+    // If EFE is OS, get OS version
+    switch (EFEData[0])
+      {
+      case 1:  // EPS OS
+	ReadPutItem(&Item[k], &OS, 4, EPS_OS_POS);
+	break;
+      case 27: // E16 OS
+	ReadPutItem(&Item[k], &OS, 4, E16_OS_POS);
+	break;
+      case 32: // ASR OS
+	ReadPutItem(&Item[k], &OS, 4, ASR_OS_POS);
+	break;
+      default:
+	OS = 0;
+      }
+
+    // Dir entry without location (see COMMIT)
+    memset(EFE[idx], 0, EFE_SIZE);
+    // type
+    EFE[idx][1] = EFEData[0];
+    // name
+    memcpy(&EFE[idx][2], EFE_name, 12);
+    // size
+    EFE[idx][14] = EFEData[2];
+    EFE[idx][15] = EFEData[3];
+    // MultiFile index
+    EFE[idx][22] = EFEData[8];
+
+    process_EFE[idx] = 1;
+
+    Item[k].idx  = idx;
+    Item[k].blks = (EFEData[2] << 8) + EFEData[3];
+    Item[k].OS   = OS;
+    need_blks = need_blks + Item[k].blks;
+    added++;
+    idx++;
+  }
+
+  if(need_blks > *free_blks) {
+    EEXIT((stderr,"Not enough free space! %d needed, %d available. \r\n", need_blks, *free_blks));
+  }
+
+  // ALLOCATE
+  //=========
+  // Biggest first: they would fragment the most
+  Order = malloc((items+1) * sizeof(int));
+  if(Order == NULL) EEXIT((stderr,"ERROR: Couldn't allocate memory!!!! \r\n"));
+  for(k=0; k<items; k++) Order[k] = k;
+  SortItems = Item;
+  qsort(Order, items, sizeof(int), CompareItemSize);
+
+  extents = 0;
+  for(k=0; k<items; k++) {
+    PutItem *It = &Item[Order[k]];
+
+    // (EFEs from stream have their space already)
+    if((It->blks == 0) || It->skip || (It->Data != NULL)) continue;
+    if((It->runs = AllocateChain(media_type,FAT,out,fat_blks,total_blks,It->blks,&It->Run)) == ERR) {
+      EEXIT((stderr,"ERROR: Image/disk has a corrupted FAT!! \r\n"));
+    }
+    extents = extents + It->runs;
+  }
+  free(Order);
+
+  // WRITE
+  //======
+  // All pieces of all EFEs in ascending block order
+  Extent = malloc((extents+1) * sizeof(PutExtent));
+  if(Extent == NULL) EEXIT((stderr,"ERROR: Couldn't allocate memory!!!! \r\n"));
+
+  n = 0;
+  for(k=0; k<items; k++) {
+    if(Item[k].Data != NULL) continue;
+    offset = 0;
+    for(j=0; j<Item[k].runs; j++) {
+      Extent[n].start  = Item[k].Run[j].start;
+      Extent[n].count  = Item[k].Run[j].count;
+      Extent[n].item   = k;
+      Extent[n].offset = offset;
+      offset = offset + Item[k].Run[j].count;
+      n++;
+    }
+  }
+  qsort(Extent, extents, sizeof(PutExtent), CompareExtentStart);
+
+  for(n=0; n<extents; n++) {
+    PutItem *It = &Item[Extent[n].item];
+
+    PutBlocks(media_type,fd,out,It->in,(off_t) (Extent[n].offset+1)*BLOCK_SIZE,
+	      Extent[n].start,Extent[n].count,Buffer);
+  }
+
+  free(Buffer);
+  free(Extent);
+
+  // COMMIT
+  //=======
+  OS = 0;
+  for(k=0; k<items; k++) {
+    idx = Item[k].idx;
+
+    if(Item[k].skip) {
+      if(Item[k].Data == NULL) { UnmapMacFormat(Item[k].in); close(Item[k].in); }
+      free(Item[k].Data);
+      continue;
+    }
+
+    if(Item[k].runs > 0) {
+      // contiguous blocks
+      EFE[idx][16] = (unsigned char) (Item[k].Run[0].count >> 8);
+      EFE[idx][17] = (unsigned char) Item[k].Run[0].count & 0x00FF;
+
+      // start block
+      EFE[idx][18] = Item[k].Run[0].start >> 24;
+      EFE[idx][19] = Item[k].Run[0].start >> 16;
+      EFE[idx][20] = Item[k].Run[0].start >>  8;
+      EFE[idx][21] = Item[k].Run[0].start & 0x000000FF;
+    }
+
+    if(Item[k].OS != 0) OS = Item[k].OS;
+
+    //Print progress info..
+    printf("\rProcessing [%.12s]... \r\n",&EFE[idx][2]);fflush(stdout);
+
+    if(Item[k].Data == NULL) { UnmapMacFormat(Item[k].in); close(Item[k].in); }
+    free(Item[k].Data);
+    free(Item[k].Run);
+  }
+
+  // Nothing is written if all EFEs were already there
+  if(added > 0) {
+
+    // Update disk-free field (and OS-version if OS was put)
+    *free_blks = (*free_blks) - need_blks;
+
+    if(media_type=='f') {
+      ReadBlocks(media_type,fd,out,OS_BLOCK,1,OSBlock);
+    } else {
+      memcpy(OSBlock, DiskHdr+OS_BLOCK*BLOCK_SIZE, BLOCK_SIZE);
+    }
+    OSBlock[0] = ((*free_blks) >> 24) & 0x000000ff; // MSB
+    OSBlock[1] = ((*free_blks) >> 16) & 0x000000ff;
+    OSBlock[2] = ((*free_blks) >>  8) & 0x000000ff;
+    OSBlock[3] =  (*free_blks)        & 0x000000ff; // LSB
+    if(OS != 0) {
+      memcpy(OSBlock+4,&OS,4);
+    }
+
+    if(media_type=='f') {
+      WriteBlocks(media_type,fd,out,OS_BLOCK,1,OSBlock);
+      SaveFAT(media_type,fd,out,fat_blks,FAT);
+    } else {
+      memcpy(DiskHdr+OS_BLOCK*BLOCK_SIZE, OSBlock, BLOCK_SIZE);
+      SaveDiskHdr(media_type,fd,out,fat_blks,DiskHdr);
+    }
+
+    // Dir after the header (root dir is also in DiskHdr)
+    SaveDirBlocks(media_type,fd,FAT,out,dir_start,dir_cont,EFE);
+
+    // If Not in Main Dir, update num. of files in parent dir
+    if(dir_start != DIR_START_BLOCK) {
+      AdjustDirCount(media_type,fd,FAT,out,EFE[0],added);
+    }
+  }
+
+  if(FAT != DiskFAT) FreeFAT(FAT);
+  if(media_type != 'f') {
+    free(DiskHdr);
+  } else {
+
+    // Store the changes of the image to its file (see ImageFlush)
+    CloseImage(out, orig_image_name);
+  }
+
+  for(j=0; EFE_list[j] != NULL; j++) free(EFE_list[j]);
+  free(EFE_list);	// free memory for EFE filelist
+  free(Item);
+  printf("\r                                         \r");fflush(stdout);
+
+  return(OK);
+}
+
+
+/////////////////////////////
+// DiscardBlocks
+// -------------
+// Tells the storage that the freed block runs are unused: holes
+// are punched in image files (so they get sparse) and block devices
+// (ie. SD cards behind SCSI2SD) get BLKDISCARD, ie. TRIM. Linux
+// only. Returns the number of blocks discarded.
+//
+unsigned int DiscardBlocks(int out, BlockRun *Run, int runs)
+{
+  unsigned int blks = 0;
+
+#ifdef __linux__
+  struct stat stat_buf;
+  unsigned long long range[2];
+  int i, ret;
+
+  // (chunks of a packed image stay as they are)
+  if(IsMappedImage(out) || (fstat(out, &stat_buf) != 0)) return(0);
+
+  for(i=0; i<runs; i++) {
+    range[0] = (unsigned long long) Run[i].start*BLOCK_SIZE;
+    range[1] = (unsigned long long) Run[i].count*BLOCK_SIZE;
+
+    if(S_ISBLK(stat_buf.st_mode)) {
+      ret = ioctl(out, BLKDISCARD, range);
+    } else {
+#ifdef SYS_fallocate
+      ret = syscall(SYS_fallocate, out, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+		    (off_t) range[0], (off_t) range[1]);
+#else
+      ret = -1;
+#endif
+    }
+
+    if(ret != 0) {
+      // Not supported by the device/fs - data is still freed
+      fprintf(stderr,"Warning: Couldn't discard freed blocks (%s). \r\n",strerror(errno));
+      break;
+    }
+    blks = blks + Run[i].count;
+  }
+#endif
+
+  return(blks);
+}
+
+/////////////////////////////
+// EraseEntries
+// ------------
+// Erases the selected entries of one dir (in memory) and frees their
+// FAT chains. With 'recursive' and name/type selectors the sub-dirs
+// are searched too: they are saved, and their counts updated in EFE.
+// Freed runs are collected to 'Freed' if not NULL (see DiscardBlocks).
+// Returns the number of entries erased from this dir.
+//
+int EraseEntries(char media_type, FD_HANDLE fd, unsigned char *DiskFAT, int out,
+		 unsigned char EFE[MAX_NUM_OF_DIR_ENTRIES][EFE_SIZE], char *process_EFE,
+		 unsigned int *free_blks, unsigned int *OS, int recursive, int depth,
+		 BlockRun **Freed, int *freed_runs, int *max_runs)
+{
+  unsigned char SubEFE[MAX_NUM_OF_DIR_ENTRIES][EFE_SIZE];
+  char SubSelect[MAX_NUM_OF_DIR_ENTRIES];
+  unsigned int size,cont,start,type,i,j,counter,files;
+
+  counter = 0;
+
+  // Sub-dirs first, so a dir emptied by the selector can be erased too
+  for(j=0; recursive && (select_spec != NULL) && (j<MAX_NUM_OF_DIR_ENTRIES); j++) {
+    if(EFE[j][1] != 2) continue;
+    if(depth >= MAX_DIR_DEPTH) {
+      EEXIT((stderr,"ERROR: Directory structure is too deep! \r\n"));
+    }
+
+    cont =(unsigned int)  ((EFE[j][16] << 8) + EFE[j][17]);
+    start=(unsigned long) ((EFE[j][18] << 24) + (EFE[j][19] << 16)
+			   +(EFE[j][20] <<8 ) +  EFE[j][21]);
+
+    LoadDirBlocks(media_type,fd,DiskFAT,out,start,cont,SubEFE);
+    SelectEntries(select_spec,SubEFE,SubSelect);
+    for(i=1; (i<MAX_NUM_OF_DIR_ENTRIES) && (SubSelect[i] == 0) && (SubEFE[i][1] != 2); i++);
+    if(i == MAX_NUM_OF_DIR_ENTRIES) continue;
+
+    if((i = EraseEntries(media_type,fd,DiskFAT,out,SubEFE,SubSelect,free_blks,OS,
+			 recursive,depth+1,Freed,freed_runs,max_runs)) > 0) {
+      SaveDirBlocks(media_type,fd,DiskFAT,out,start,cont,SubEFE);
+
+      files = (EFE[j][14] << 8) + EFE[j][15];
+      files = (files > i) ? files - i : 0;
+      EFE[j][14] = (unsigned char) (files >> 8) & 0xFF;
+      EFE[j][15] = (unsigned char) (files & 0xFF);
+    }
+  }
+
+  // Process list of EFEs
+  for(j=0;j<MAX_NUM_OF_DIR_ENTRIES;j++) {
+    // Check if current EFE has to be processed
+    if(process_EFE[j] == 0) continue;
+
+    // Get info
+    type=EFE[j][1];
+
+    switch (type)
+      {
+      case 0: // Empty
+	continue;
+
+      case 2: 	// Sub dir
+	if(EFE[j][15] > 0) {
+	  fprintf(stderr, "\r\nIDX %-2d: Can't erase directory! Directory not empty. \r\n\r\n",j);
+	  continue;
+	}
+	size = 2;
+	break;
+
+      case 8: 	// Pointer to 'root'
+	fprintf(stderr, "\r\nIDX %-2d: Can't erase link to parent dir! \r\n\r\n",j);
+	continue;
+
+	// If erasing os, clear version field
+      case 1:
+      case 27:
+      case 32:
+	*OS = 0;
+
+      default:
+	size =(unsigned int)  ((EFE[j][14] << 8) + EFE[j][15]);
+      }
+
+    cont =(unsigned int)  ((EFE[j][16] << 8) + EFE[j][17]);
+    start=(unsigned long) ((EFE[j][18] << 24) + (EFE[j][19] << 16)
+			   +(EFE[j][20] <<8 ) +  EFE[j][21]);
+
+    // Calculate 'disk-free'
+    *free_blks = (*free_blks) + size;
+
+    // Clear FAT entries (and collect freed runs for discard)
+
+    for(;;) {
+      if(Freed != NULL) {
+	if((*freed_runs > 0) && (start == (*Freed)[*freed_runs-1].start + (*Freed)[*freed_runs-1].count)) {
+	  (*Freed)[*freed_runs-1].count++;
+	} else {
+	  if(*freed_runs == *max_runs) {
+	    *max_runs = (*max_runs == 0) ? 16 : (*max_runs)*2;
+	    *Freed = realloc(*Freed, (*max_runs) * sizeof(BlockRun));
+	    if(*Freed == NULL) EEXIT((stderr,"ERROR: Couldn't allocate memory!!!! \r\n"));
+	  }
+	  (*Freed)[*freed_runs].start = start;
+	  (*Freed)[*freed_runs].count = 1;
+	  (*freed_runs)++;
+	}
+      }
+
+      // .. last entry is the stopmark '1'
+      if((i=GetFatEntry(media_type,DiskFAT,out,start)) == 1) break;
+      PutFatEntry(media_type,DiskFAT,out,start,0);
+      start=i;
+    }
+    PutFatEntry(media_type,DiskFAT,out,start,0);
+
+    // Clear Dir entry
+    for(i=0;i<26;i++) {
+      EFE[j][i] = 0;
+    }
+
+    // Count erased files for 'num of files' in parent dir
+    counter++;
+
+  } // For 'process_EFEs'
+
+  return(counter);
+}
+
+/////////////////////////////
+// EraseEFEs
+int EraseEFEs(char media_type, char image_type, FD_HANDLE fd,
+	      unsigned char *DiskFAT, unsigned char *DiskHdr,
+	      char *in_file, char *orig_image_name,
+	      unsigned char EFE[MAX_NUM_OF_DIR_ENTRIES][EFE_SIZE], char *process_EFE,
+	      unsigned int fat_blks, unsigned int *free_blks,
+	      unsigned int dir_start, unsigned int dir_cont, int discard, int recursive)
+{
+  int out = 0;
+  unsigned int counter;
+  unsigned int OS = 1;
+  unsigned char buffer[4];
+  BlockRun *Freed = NULL;
+  int freed_runs = 0, max_runs = 0;
+
+  // FILE ACCESS
+#ifdef __CYGWIN__
+  if((media_type=='f') || (media_type=='s')) {
+#else //Linux
+  if(media_type=='f') {
+#endif
+    // Image-file
+    if((out=OpenImage(in_file)) < 0) {
+      EEXIT((stderr,"ERROR: Couldn't open file '%s'. \r\n",in_file));
+    }
+  }
+
+	// Test if *ALL* EFEs should be erased, and avoid skipping index 0 when SD-1/VFXSD/TS disk is detected -- this is a kludge!
+	if( (allmode == 1) && (familymode != EPS_FAM) )
+	{
+		// flag index 0 for extraction
+		process_EFE[0] = 1;
+	}
+
+  // Process list of EFEs (and sub-dirs)
+  counter = EraseEntries(media_type,fd,DiskFAT,out,EFE,process_EFE,free_blks,&OS,recursive,0,
+			 (discard && (media_type == 'f')) ? &Freed : NULL,&freed_runs,&max_runs);
+
+  // Update disk-free field
+  buffer[0] = ((*free_blks) >> 24) & 0x000000ff; // MSB
+  buffer[1] = ((*free_blks) >> 16) & 0x000000ff;
+  buffer[2] = ((*free_blks) >>  8) & 0x000000ff;
+  buffer[3] =  (*free_blks)        & 0x000000ff; // LSB
+
+  if(media_type=='f') {
+    // FILE ACCESS
+    ImageWrite(out,buffer,4,OS_BLOCK*BLOCK_SIZE);
+    // If erasing OS, clear OS-field
+    if(!OS) {
+      ImageWrite(out,&OS,4,OS_BLOCK*BLOCK_SIZE+4);
+    }
+
+  } else {
+    // DISK ACCESS
+    memcpy(DiskHdr+OS_BLOCK*BLOCK_SIZE,buffer,4);
+    // If erasing OS, clear OS-field
+    if(!OS) {
+      memcpy(DiskHdr+OS_BLOCK*BLOCK_SIZE+4,&OS,4);
+    }
+
+  }
+
+  // Write System Blocks
+  if(media_type != 'f') {
+    // DISK ACCESS
+    SaveDiskHdr(media_type,fd,out,fat_blks,DiskHdr);
+  }
+
+
+  // Update Dir Entries
+  SaveDirBlocks(media_type, fd, DiskFAT, out, dir_start, dir_cont,EFE);
+
+  // If Not in Main Dir, update Dir Entries & num. of  files in dir
+  if(dir_start != DIR_START_BLOCK) {
+
+    unsigned char ParentEFE[MAX_NUM_OF_DIR_ENTRIES][EFE_SIZE];
+    unsigned int parent_dir_idx;
+    signed int parent_dir_files;
+
+    // Get info about parent dir
+    parent_dir_idx  = (unsigned int)  ((EFE[0][16] << 8) + EFE[0][17]);
+    dir_start       = (unsigned long) ((EFE[0][18] << 24) + (EFE[0][19] << 16)
+				       +(EFE[0][20] << 8 ) +  EFE[0][21]);
+
+    // Don't know how many cont blocks so suppose worst case
+    dir_cont = 1;
+
+    // Load parent dir
+    LoadDirBlocks(media_type,fd,DiskFAT,out,dir_start,dir_cont,ParentEFE);
+
+    // Update parent dir 'num of files'
+    parent_dir_files =(unsigned int)  ((ParentEFE[parent_dir_idx][14] << 8) +
+				       ParentEFE[parent_dir_idx][15]);
+
+    // Decrement 'num. of files' in parent dir
+    parent_dir_files = parent_dir_files - counter;
+
+    // if everything is OK, this _should_ NOT happen...
+    // for this compare to work, parent_dir_files cannot be unsigned, although
+    // assumed to be zero or positive!
+    if(parent_dir_files < 0) parent_dir_files = 0;
+
+    ParentEFE[parent_dir_idx][14] = (unsigned char) (parent_dir_files >> 8) & 0xFF;
+    ParentEFE[parent_dir_idx][15] = (unsigned char) (parent_dir_files & 0xFF);
+
+    // Save changes in parent dir
+    SaveDirBlocks(media_type, fd, DiskFAT, out, dir_start, dir_cont,ParentEFE);
+  }
+
+  // Discard freed blocks once they are free on the media
+  if(freed_runs > 0) {
+    printf("Discarded %d freed blocks. \r\n", DiscardBlocks(out, Freed, freed_runs));
+    free(Freed);
+  }
+
+  // Free memory used for DiskFat etc. cache
+  if(media_type != 'f') {
+    free(DiskHdr);
+
+  } else {
+
+    // Store the changes of the image to its file (see ImageFlush)
+    CloseImage(out, orig_image_name);
+  }
+
+  return(OK);
+}
+
+//////////////////////////////////////////////////////////////
+// ReplaceEFE
+// ----------
+// - Replaces EFE in 'idx' with a new version in place: the
+//   FAT chain is reused, trimmed or extended only as needed,
+//   and only data blocks that differ are written. The dir
+//   index (and so bank references) stays the same.
+//
+int ReplaceEFE(char media_type, char image_type, FD_HANDLE fd,
+	       unsigned char *DiskFAT, unsigned char *DiskHdr,
+	       char *in_file, char *orig_image_name,
+	       unsigned char EFE[MAX_NUM_OF_DIR_ENTRIES][EFE_SIZE], char *process_EFE,
+	       unsigned int idx, char **EFE_files, int optind,
+	       unsigned int total_blks, unsigned int *free_blks, unsigned int fat_blks,
+	       unsigned int dir_start, unsigned int dir_cont)
+{
+  int out = 0, in, runs, new_runs, items = 0, max_items = 0;
+  unsigned int old_blks, new_blks, start, blks, last, next, pos, n, b, first, changed, OS;
+  unsigned char EFEData[EFE_SIZE], EFE_name[13], OSBlock[BLOCK_SIZE];
+  unsigned char *FAT, *Old, *New;
+  BlockRun *Run, *NewRun;
+  PutItem *Item = NULL;
+  EFEStream Stream;
+  char *efe_file;
+  int i, r;
+
+  if((idx >= MAX_NUM_OF_DIR_ENTRIES) || (EFE[idx][1] == 0)) {
+    EEXIT((stderr,"ERROR: Index '%d' is empty! \r\n",idx));
+  }
+  if((EFE[idx][1] == 2) || (EFE[idx][1] == 8)) {
+    EEXIT((stderr,"ERROR: Index '%d' is a directory! \r\n",idx));
+  }
+
+#ifdef __CYGWIN__
+  if((media_type=='f') || (media_type=='s')) {
+#else //Linux
+  if(media_type=='f') {
+#endif
+    // Image-file
+    if((out=OpenImage(in_file)) < 0) {
+      EEXIT((stderr,"ERROR: Couldn't open file '%s'. \r\n",in_file));
+    }
+    // skip over the image filename to arrive at the EFE name
+    optind++;
+  }
+
+  if((efe_file = EFE_files[optind]) == NULL) {
+    EEXIT((stderr,"ERROR: No EFE given for replacing index '%d'! \r\n",idx));
+  }
+
+  // New version from file or stdin ('-'), which is read in order
+  // while the blocks are compared
+  if(strcmp(efe_file,"-") == 0) {
+    OpenEFEStream(&Stream, STDIN_FILENO);
+    if(NextStreamEFE(&Stream, &Item, &items, &max_items) != OK) exit(ERR);
+  } else {
+    if((in=open(efe_file, O_RDONLY | O_BINARY)) < 0) {
+      EEXIT((stderr,"ERROR: Couldn't open '%s' as an EFE input. \r\n",efe_file));
+    }
+    if(ConvertMacFormat(&in, efe_file) == OK) {
+      printf("Warning: Macintosh generated EFx file found. \r\n");
+    }
+    if(IsEFE(&in, efe_file) != OK) {
+      EEXIT((stderr,"ERROR: '%s' does not appear to be a valid Ensoniq file! \r\n",efe_file));
+    }
+    AddPutItem(&Item, &items, &max_items, in, NULL, 0);
+  }
+
+  ReadPutItem(&Item[0], EFEData, EFE_SIZE, 0x32);
+  ReadPutItem(&Item[0], EFE_name, 12, 0x12);
+  EFE_name[12] = '\0';
+
+  switch (EFEData[0])
+    {
+    case 1:  // EPS OS
+      ReadPutItem(&Item[0], &OS, 4, EPS_OS_POS);
+      break;
+    case 27: // E16 OS
+      ReadPutItem(&Item[0], &OS, 4, E16_OS_POS);
+      break;
+    case 32: // ASR OS
+      ReadPutItem(&Item[0], &OS, 4, ASR_OS_POS);
+      break;
+    default:
+      OS = 0;
+    }
+
+  old_blks = (EFE[idx][14] << 8) + EFE[idx][15];
+  new_blks = (EFEData[2] << 8) + EFEData[3];
+  start    = (EFE[idx][18] << 24) + (EFE[idx][19] << 16) + (EFE[idx][20] << 8) + EFE[idx][21];
+
+  if(new_blks == 0) {
+    EEXIT((stderr,"ERROR: '%s' has no data! \r\n",efe_file));
+  }
+  if(new_blks > old_blks + *free_blks) {
+    EEXIT((stderr,"Not enough free space! %d needed, %d available. \r\n", new_blks-old_blks, *free_blks));
+  }
+
+  // FAT is modified in memory and committed once
+  if(DiskFAT == NULL) {
+    FAT = LoadFAT(media_type,fd,out,fat_blks);
+  } else {
+    FAT = DiskFAT;
+  }
+
+  runs = GetChainRuns(media_type,FAT,out,start,old_blks,&Run);
+  for(i=0, blks=0; i<runs; i++) blks = blks + Run[i].count;
+  if(blks != old_blks) {
+    EEXIT((stderr,"ERROR: Image/disk has a corrupted FAT!! \r\n"));
+  }
+  last = Run[runs-1].start + Run[runs-1].count - 1;
+
+  if(new_blks > old_blks) {
+    // Extend: link new blocks after the old chain
+    if((new_runs = AllocateChain(media_type,FAT,out,fat_blks,total_blks,new_blks-old_blks,&NewRun)) == ERR) {
+      EEXIT((stderr,"ERROR: Image/disk has a corrupted FAT!! \r\n"));
+    }
+    PutFatEntry(media_type,FAT,out,last,NewRun[0].start);
+
+    Run = realloc(Run, (runs+new_runs) * sizeof(BlockRun));
+    if(Run == NULL) EEXIT((stderr,"ERROR: Couldn't allocate memory!!!! \r\n"));
+    memcpy(Run+runs, NewRun, new_runs * sizeof(BlockRun));
+    runs = runs + new_runs;
+    free(NewRun);
+
+  } else if(new_blks < old_blks) {
+    // Trim: cut the chain and free the rest
+    for(i=0, blks=0; blks+Run[i].count < new_blks; i++) blks = blks + Run[i].count;
+    last = Run[i].start + (new_blks - blks) - 1;
+    Run[i].count = new_blks - blks;
+    runs = i+1;
+
+    next = GetFatEntry(media_type,FAT,out,last);
+    PutFatEntry(media_type,FAT,out,last,1);
+    for(b=old_blks-new_blks; b>0; b--) {
+      n = GetFatEntry(media_type,FAT,out,next);
+      PutFatEntry(media_type,FAT,out,next,0);
+      next = n;
+    }
+  }
+
+  // Write only the blocks that differ
+  Old = malloc(2*STREAM_BUFFER_BLOCKS*BLOCK_SIZE);
+  if(Old == NULL) EEXIT((stderr,"ERROR: Couldn't allocate memory!!!! \r\n"));
+  New = Old + STREAM_BUFFER_BLOCKS*BLOCK_SIZE;
+
+  changed = 0;
+  pos = 0;
+  for(r=0; r<runs; r++) {
+    for(b=0; b<Run[r].count; b=b+n) {
+      n = Run[r].count - b;
+      if(n > STREAM_BUFFER_BLOCKS) n = STREAM_BUFFER_BLOCKS;
+
+      ReadPutItem(&Item[0], New, n*BLOCK_SIZE, (off_t) (pos+b+1)*BLOCK_SIZE);
+
+      // Blocks added to the chain are always written (runs of
+      // the old chain and the added ones are never mixed)
+      if(pos+b >= old_blks) {
+	WriteBlocks(media_type,fd,out,Run[r].start+b,n,New);
+	changed = changed + n;
+	continue;
+      }
+
+      ReadBlocks(media_type,fd,out,Run[r].start+b,n,Old);
+      for(i=0; i<n; i++) {
+	if(memcmp(Old+i*BLOCK_SIZE, New+i*BLOCK_SIZE, BLOCK_SIZE) == 0) continue;
+	// Contiguous changed blocks in one write
+	for(first=i; (i+1<n) && (memcmp(Old+(i+1)*BLOCK_SIZE, New+(i+1)*BLOCK_SIZE, BLOCK_SIZE) != 0); i++);
+	WriteBlocks(media_type,fd,out,Run[r].start+b+first,i-first+1,New+first*BLOCK_SIZE);
+	changed = changed + i-first+1;
+      }
+    }
+    pos = pos + Run[r].count;
+  }
+  free(Old);
+
+  if(Item[0].Stream != NULL) {
+    Item[0].Stream = NULL;
+    if(NextStreamEFE(&Stream, &Item, &items, &max_items) == OK) {
+      printf("Warning: Only the first EFE of the stream is used. \r\n");
+    }
+  }
+
+  printf("\rReplacing [%.12s] with [%s]: %d of %d blocks changed. \r\n",
+	 &EFE[idx][2], EFE_name, changed, new_blks);
+
+  // Dir entry, same index and start block
+  EFE[idx][1] = EFEData[0];
+  memcpy(&EFE[idx][2], EFE_name, 12);
+  EFE[idx][14] = EFEData[2];
+  EFE[idx][15] = EFEData[3];
+  // (added blocks may continue the first run)
+  for(i=1, blks=Run[0].count; (i<runs) && (Run[i].start == Run[i-1].start+Run[i-1].count); i++) {
+    blks = blks + Run[i].count;
+  }
+  EFE[idx][16] = (unsigned char) (blks >> 8);
+  EFE[idx][17] = (unsigned char) blks & 0x00FF;
+  EFE[idx][22] = EFEData[8];
+  process_EFE[idx] = 1;
+
+  // Commit FAT and 'disk-free' if the chain changed
+  *free_blks = (*free_blks) + old_blks - new_blks;
+
+  if((new_blks != old_blks) || (OS != 0)) {
+    if(media_type=='f') {
+      ReadBlocks(media_type,fd,out,OS_BLOCK,1,OSBlock);
+    } else {
+      memcpy(OSBlock, DiskHdr+OS_BLOCK*BLOCK_SIZE, BLOCK_SIZE);
+    }
+    OSBlock[0] = ((*free_blks) >> 24) & 0x000000ff; // MSB
+    OSBlock[1] = ((*free_blks) >> 16) & 0x000000ff;
+    OSBlock[2] = ((*free_blks) >>  8) & 0x000000ff;
+    OSBlock[3] =  (*free_blks)        & 0x000000ff; // LSB
+    if(OS != 0) {
+      memcpy(OSBlock+4,&OS,4);
+    }
+
+    if(media_type=='f') {
+      WriteBlocks(media_type,fd,out,OS_BLOCK,1,OSBlock);
+      if(new_blks != old_blks) SaveFAT(media_type,fd,out,fat_blks,FAT);
+    } else {
+      memcpy(DiskHdr+OS_BLOCK*BLOCK_SIZE, OSBlock, BLOCK_SIZE);
+      SaveDiskHdr(media_type,fd,out,fat_blks,DiskHdr);
+    }
+  }
+
+  // Dir after the header (root dir is also in DiskHdr)
+  SaveDirBlocks(media_type,fd,FAT,out,dir_start,dir_cont,EFE);
+
+  free(Run);
+  if(Item[0].Data == NULL) { UnmapMacFormat(Item[0].in); close(Item[0].in); }
+  for(i=0; i<items; i++) free(Item[i].Data);
+  free(Item);
+  if(FAT != DiskFAT) FreeFAT(FAT);
+
+  if(media_type != 'f') {
+    free(DiskHdr);
+  } else {
+
+    // Store the changes of the image to its file (see ImageFlush)
+    CloseImage(out, orig_image_name);
+  }
+
+  return(OK);
+}
+
+//////////////////
+// MkDir
+// -----
+// Makes directories. 'dir_spec' is a comma separated list
+// of paths, relative to the current dir, whose components
+// are separated by '/', e.g. "LIB/PIANO,LIB/STRINGS,DRUMS".
+// Missing components are created (existing ones are reused),
+// so a whole tree is made in one run.
+//
+// All dirs touched are kept in memory. At the end FAT and
+// 'disk-free' are committed once, and only then the dir blocks
+// are written, so the new dirs are not visible before their
+// blocks are allocated.
+//
+
+// Directory kept in memory during MkDir
+typedef struct {
+  unsigned int start;
+  unsigned int cont;
+  int parent;            // index of parent node (-1 = current dir)
+  unsigned int idx;      // index of the dir within its parent
+  char name[12];
+  unsigned char EFE[MAX_NUM_OF_DIR_ENTRIES][EFE_SIZE];
+} DirNode;
+
+int MkDir(char media_type, char image_type, FD_HANDLE fd,
+	  unsigned char *DiskFAT, unsigned char *DiskHdr,
+	  char *in_file, char *orig_image_name,
+	  unsigned char EFE[MAX_NUM_OF_DIR_ENTRIES][EFE_SIZE],
+	  unsigned int dir_start, unsigned int dir_cont, char *dir_name,
+	  unsigned int subdir_cnt, unsigned int total_blks,
+	  unsigned int *free_blks, unsigned int fat_blks, char *dir_spec)
+{
+  DirNode *Node;
+  BlockRun *Run;
+  unsigned char *FAT, OSBlock[BLOCK_SIZE];
+  unsigned int i, j, n, files, depth, start, cont, made;
+  int out, nodes, node, child, top_files;
+  char Name[12], *p;
+
+  out = 0;
+
+  // FILE ACCESS
+#ifdef __CYGWIN__
+  if((media_type=='f') || (media_type=='s')) {
+#else //Linux
+  if(media_type=='f') {
+#endif
+    // Image-file
+    if((out=OpenImage(in_file)) < 0) {
+      EEXIT((stderr,"ERROR: Couldn't open file '%s'. \r\n",in_file));
+    }
+  }
+
+  // FAT is modified in memory and committed once
+  if(DiskFAT == NULL) {
+    FAT = LoadFAT(media_type,fd,out,fat_blks);
+  } else {
+    FAT = DiskFAT;
+  }
+
+  // Node 0 is the current dir
+  Node = malloc(sizeof(DirNode));
+  if(Node == NULL) EEXIT((stderr,"ERROR: Couldn't allocate memory!!!! \r\n"));
+  nodes = 1;
+  Node[0].start  = dir_start;
+  Node[0].cont   = dir_cont;
+  Node[0].parent = -1;
+  Node[0].idx    = 0;
+  memcpy(Node[0].name, dir_name, 12);
+  memcpy(Node[0].EFE, EFE, MAX_NUM_OF_DIR_ENTRIES*EFE_SIZE);
+
+  made = 0;
+  p = dir_spec;
+  while(*p != '\0') {
+
+    // One path
+    node = 0;
+    depth = subdir_cnt;
+    while((*p != '\0') && (*p != ',')) {
+
+      // Get name of the next component (upper case, padded with spaces)
+      for(n=0; (*p != '\0') && (*p != '/') && (*p != ','); p++, n++) {
+	if(n < 12) Name[n] = (char) toupper(*p);
+      }
+      if((n == 0) || (n > 12)) {
+	EEXIT((stderr,"ERROR: Invalid directory name in '%s'! \r\n",dir_spec));
+      }
+      for(; n<12; n++) Name[n] = 0x20;
+      if(*p == '/') p++;
+
+      if(++depth > MAX_DIR_DEPTH) {
+	EEXIT((stderr,"ERROR: Directory structure is too deep! \r\n"));
+      }
+
+      // Already there?
+      for(i=1; i<MAX_NUM_OF_DIR_ENTRIES; i++) {
+	if((Node[node].EFE[i][1] != 0) && (Node[node].EFE[i][1] != 8)
+	   && (memcmp(Node[node].EFE[i]+2, Name, 12) == 0)) break;
+      }
+
+      if(i < MAX_NUM_OF_DIR_ENTRIES) {
+	if(Node[node].EFE[i][1] != 2) {
+	  EEXIT((stderr,"ERROR: '%.12s' exists and is not a directory! \r\n",Name));
+	}
+	cont  =(unsigned int)  ((Node[node].EFE[i][16] << 8) + Node[node].EFE[i][17]);
+	start =(unsigned long) ((Node[node].EFE[i][18] << 24) + (Node[node].EFE[i][19] << 16)
+				+(Node[node].EFE[i][20] << 8 ) +  Node[node].EFE[i][21]);
+
+	// Existing dir - use the copy in memory if it has one
+	for(child=1; child<nodes; child++) {
+	  if(Node[child].start == start) break;
+	}
+	if(child == nodes) {
+	  Node = realloc(Node, (nodes+1)*sizeof(DirNode));
+	  if(Node == NULL) EEXIT((stderr,"ERROR: Couldn't allocate memory!!!! \r\n"));
+	  Node[child].start  = start;
+	  Node[child].cont   = cont;
+	  Node[child].parent = node;
+	  Node[child].idx    = i;
+	  memcpy(Node[child].name, Name, 12);
+	  LoadDirBlocks(media_type,fd,FAT,out,start,cont,Node[child].EFE);
+	  nodes++;
+	}
+	node = child;
+	continue;
+      }
+
+      // New dir - first empty index (idx 0 holds OS or link to parent)
+      for(i=1; i<MAX_NUM_OF_DIR_ENTRIES; i++) {
+	if(Node[node].EFE[i][1] == 0) break;
+      }
+      if(i == MAX_NUM_OF_DIR_ENTRIES) {
+	EEXIT((stderr,"ERROR: Directory '%.12s' full! \r\n",Node[node].name));
+      }
+
+      if(AllocateChain(media_type,FAT,out,fat_blks,total_blks,DIR_BLOCKS,&Run) == ERR) {
+	EEXIT((stderr,"Not enough free space! %d needed, %d available. \r\n", DIR_BLOCKS, *free_blks));
+      }
+      *free_blks = *free_blks - DIR_BLOCKS;
+
+      Node = realloc(Node, (nodes+1)*sizeof(DirNode));
+      if(Node == NULL) EEXIT((stderr,"ERROR: Couldn't allocate memory!!!! \r\n"));
+      child = nodes++;
+
+      Node[child].start  = Run[0].start;
+      Node[child].cont   = Run[0].count;
+      Node[child].parent = node;
+      Node[child].idx    = i;
+      memcpy(Node[child].name, Name, 12);
+      free(Run);
+
+      for(j=0; j<MAX_NUM_OF_DIR_ENTRIES; j++) {
+	for(n=0; n<EFE_SIZE; n++) Node[child].EFE[j][n] = 0;
+      }
+
+      // First entry is link to parent dir (name, idx and start block)
+      Node[child].EFE[0][1] = 8;
+      memcpy(Node[child].EFE[0]+2, Node[node].name, 12);
+      Node[child].EFE[0][17] = i;
+      Node[child].EFE[0][18] = (Node[node].start >> 24) & 0x000000FF;
+      Node[child].EFE[0][19] = (Node[node].start >> 16) & 0x000000FF;
+      Node[child].EFE[0][20] = (Node[node].start >>  8) & 0x000000FF;
+      Node[child].EFE[0][21] =  Node[node].start        & 0x000000FF;
+
+      // Dir entry into parent (size = num. of files)
+      Node[node].EFE[i][1] = 2;
+      memcpy(Node[node].EFE[i]+2, Name, 12);
+      Node[node].EFE[i][16] = (unsigned char) (Node[child].cont >> 8);
+      Node[node].EFE[i][17] = (unsigned char) Node[child].cont & 0x00FF;
+      Node[node].EFE[i][18] = Node[child].start >> 24;
+      Node[node].EFE[i][19] = Node[child].start >> 16;
+      Node[node].EFE[i][20] = Node[child].start >>  8;
+      Node[node].EFE[i][21] = Node[child].start & 0x000000FF;
+
+      // One more file in the parent (counter of current dir is in its parent)
+      if(Node[node].parent >= 0) {
+	j = Node[node].idx;
+	files = (Node[Node[node].parent].EFE[j][14] << 8) + Node[Node[node].parent].EFE[j][15] + 1;
+	Node[Node[node].parent].EFE[j][14] = (unsigned char) (files >> 8) & 0xFF;
+	Node[Node[node].parent].EFE[j][15] = (unsigned char) (files & 0xFF);
+      }
+
+      printf("Making dir [%.12s] to idx %d. \r\n", Name, i);
+      made++;
+      node = child;
+    }
+    if(*p == ',') p++;
+  }
+
+  if(made == 0) {
+    printf("Nothing to do: directories already exist. \r\n");
+  } else {
+
+    // Commit FAT and 'disk-free' (one write each)
+    if(media_type=='f') {
+      ReadBlocks(media_type,fd,out,OS_BLOCK,1,OSBlock);
+    } else {
+      memcpy(OSBlock, DiskHdr+OS_BLOCK*BLOCK_SIZE, BLOCK_SIZE);
+    }
+    OSBlock[0] = (*free_blks >> 24) & 0x000000ff; // MSB
+    OSBlock[1] = (*free_blks >> 16) & 0x000000ff;
+    OSBlock[2] = (*free_blks >>  8) & 0x000000ff;
+    OSBlock[3] =  *free_blks        & 0x000000ff; // LSB
+
+    if(media_type=='f') {
+      WriteBlocks(media_type,fd,out,OS_BLOCK,1,OSBlock);
+      SaveFAT(media_type,fd,out,fat_blks,FAT);
+    } else {
+      memcpy(DiskHdr+OS_BLOCK*BLOCK_SIZE, OSBlock, BLOCK_SIZE);
+      SaveDiskHdr(media_type,fd,out,fat_blks,DiskHdr);
+    }
+
+    // Write new dirs first, then the existing ones linking them
+    for(node=nodes-1; node>=0; node--) {
+      SaveDirBlocks(media_type,fd,FAT,out,Node[node].start,Node[node].cont,Node[node].EFE);
+    }
+
+    // Count of the current dir is in its parent (root has no counter)
+    top_files = 0;
+    for(i=1; i<MAX_NUM_OF_DIR_ENTRIES; i++) {
+      if((Node[0].EFE[i][1] != 0) && (EFE[i][1] == 0)) top_files++;
+    }
+    if((dir_start != DIR_START_BLOCK) && (top_files > 0)) {
+      AdjustDirCount(media_type,fd,FAT,out,EFE[0],top_files);
+    }
+
+    // Current dir for the directory listing
+    memcpy(EFE, Node[0].EFE, MAX_NUM_OF_DIR_ENTRIES*EFE_SIZE);
+  }
+
+  free(Node);
+  if(FAT != DiskFAT) FreeFAT(FAT);
+
+#ifdef __CYGWIN__
+  if((media_type=='f') || (media_type=='s')) {
+#else //Linux
+  if(media_type=='f') {
+#endif
+    // Store the changes of the image to its file (see ImageFlush)
+    CloseImage(out, orig_image_name);
+  }
+
+  return(OK);
+}
+
+/////////////////////////////
+// MoveEFE
+// -------
+// Moves and/or renames one entry by relinking its 26-byte directory entry
+// into the destination directory. The FAT chain (ie. the data) is not touched,
+// so only the directory blocks and the 'num. of files' of both parents change.
+//
+int MoveEFE(char media_type, char image_type, FD_HANDLE fd, unsigned char *DiskFAT,
+	    char *in_file, char *orig_image_name,
+	    unsigned char EFE[MAX_NUM_OF_DIR_ENTRIES][EFE_SIZE],
+	    unsigned int src_idx, unsigned int dir_start, unsigned int dir_cont,
+	    unsigned int *DirPath, unsigned int subdir_cnt,
+	    char *dest_path, char *new_name)
+{
+  int out;
+  unsigned char DestEFE[MAX_NUM_OF_DIR_ENTRIES][EFE_SIZE];
+  unsigned char SubEFE[MAX_NUM_OF_DIR_ENTRIES][EFE_SIZE];
+  unsigned char Entry[EFE_SIZE];
+  unsigned int DestPath[MAX_DIR_DEPTH], dest_cnt, dest_start, dest_cont;
+  unsigned int idx, i, same_dir, sub_start, sub_cont;
+  char dest_dir_name[13];
+
+  out = 0;
+
+  // Check the entry to be moved
+  if(src_idx >= MAX_NUM_OF_DIR_ENTRIES) {
+    EEXIT((stderr,"ERROR: Invalid index '%d'! \r\n",src_idx));
+  }
+  if(EFE[src_idx][1] == 0) {
+    EEXIT((stderr,"ERROR: Index '%d' is empty! \r\n",src_idx));
+  }
+  if(EFE[src_idx][1] == 8) {
+    EEXIT((stderr,"ERROR: Can't move link to parent dir! \r\n"));
+  }
+
+  // Destination dir ('.' or nothing = same dir, ie. rename only)
+  dest_cnt = 0;
+  if((dest_path == NULL) || (strcmp(dest_path,".") == 0)) {
+    dest_cnt = subdir_cnt;
+    for(i=0; i<subdir_cnt; i++) DestPath[i] = DirPath[i];
+  } else {
+    ParseDir(dest_path, DestPath, &dest_cnt);
+  }
+
+  same_dir = (dest_cnt == subdir_cnt);
+  for(i=0; (i<dest_cnt) && same_dir; i++) {
+    if(DestPath[i] != DirPath[i]) same_dir = 0;
+  }
+
+  // Dir can't be moved inside itself
+  if((EFE[src_idx][1] == 2) && (dest_cnt > subdir_cnt)) {
+    for(i=0; i<subdir_cnt; i++) {
+      if(DestPath[i] != DirPath[i]) break;
+    }
+    if((i == subdir_cnt) && (DestPath[subdir_cnt] == src_idx)) {
+      EEXIT((stderr,"ERROR: Can't move directory inside itself! \r\n"));
+    }
+  }
+
+  if(same_dir && (new_name == NULL)) {
+    printf("Nothing to do: destination is the current directory. \r\n");
+    return(OK);
+  }
+
+  // FILE ACCESS
+#ifdef __CYGWIN__
+  if((media_type=='f') || (media_type=='s')) {
+#else //Linux
+  if(media_type=='f') {
+#endif
+    // Image-file
+    if((out=OpenImage(in_file)) < 0) {
+      EEXIT((stderr,"ERROR: Couldn't open file '%s'. \r\n",in_file));
+    }
+  }
+
+  // Make the new dir entry
+  memcpy(Entry, EFE[src_idx], EFE_SIZE);
+  if(new_name != NULL) {
+    // Ensoniq names are always 12 characters padded with spaces
+    for(i=0; i<12; i++) {
+      if(i < strlen(new_name)) Entry[2+i] = new_name[i]; else Entry[2+i] = 0x20;
+    }
+  }
+
+  if(same_dir) {
+    // RENAME ONLY - keep the index
+    idx = src_idx;
+    memcpy(EFE[idx], Entry, EFE_SIZE);
+    SaveDirBlocks(media_type, fd, DiskFAT, out, dir_start, dir_cont, EFE);
+    dest_start = dir_start;
+
+  } else {
+    // MOVE - Load destination dir starting from root
+    dest_start = DIR_START_BLOCK;
+    dest_cont  = 2;
+    LoadDirBlocks(media_type,fd,DiskFAT,out,dest_start,dest_cont,DestEFE);
+    ChangeDir(media_type,fd,DiskFAT,out,DestEFE,&dest_start,&dest_cont,dest_dir_name,dest_cnt,DestPath);
+
+    // First empty index (idx 0 holds OS or link to parent)
+    for(idx=1; idx<MAX_NUM_OF_DIR_ENTRIES; idx++) {
+      if(DestEFE[idx][1] == 0) break;
+    }
+    if(idx == MAX_NUM_OF_DIR_ENTRIES) {
+      EEXIT((stderr,"ERROR: Destination directory full! \r\n"));
+    }
+
+    // Relink the entry
+    memcpy(DestEFE[idx], Entry, EFE_SIZE);
+    for(i=0; i<EFE_SIZE; i++) EFE[src_idx][i] = 0;
+
+    SaveDirBlocks(media_type, fd, DiskFAT, out, dest_start, dest_cont, DestEFE);
+    SaveDirBlocks(media_type, fd, DiskFAT, out, dir_start, dir_cont, EFE);
+
+    // Moved dir has to know its new parent (name, idx and start block)
+    if(Entry[1] == 2) {
+      sub_cont  = (unsigned int)  ((Entry[16] << 8) + Entry[17]);
+      sub_start = (unsigned long) ((Entry[18] << 24) + (Entry[19] << 16)
+				   +(Entry[20] << 8 ) +  Entry[21]);
+      LoadDirBlocks(media_type,fd,DiskFAT,out,sub_start,sub_cont,SubEFE);
+      memcpy(SubEFE[0]+2, dest_dir_name, 12);
+      SubEFE[0][16] = 0;
+      SubEFE[0][17] = idx;
+      SubEFE[0][18] = (dest_start >> 24) & 0x000000FF;
+      SubEFE[0][19] = (dest_start >> 16) & 0x000000FF;
+      SubEFE[0][20] = (dest_start >>  8) & 0x000000FF;
+      SubEFE[0][21] =  dest_start        & 0x000000FF;
+      SaveDirBlocks(media_type,fd,DiskFAT,out,sub_start,sub_cont,SubEFE);
+    }
+
+    // Update 'num. of files' of both parents (root has no counter).
+    // Counters are reloaded from the media as a parent may be
+    // either of the dirs saved above.
+    if(dir_start != DIR_START_BLOCK) {
+      AdjustDirCount(media_type,fd,DiskFAT,out,EFE[0],-1);
+    }
+    if(dest_start != DIR_START_BLOCK) {
+      AdjustDirCount(media_type,fd,DiskFAT,out,DestEFE[0],1);
+    }
+
+    // Reload current dir for the directory listing
+    LoadDirBlocks(media_type,fd,DiskFAT,out,dir_start,dir_cont,EFE);
+  }
+
+  // Renamed dir - links to parent in its sub-dirs carry the old name
+  if((Entry[1] == 2) && (new_name != NULL)) {
+    unsigned char ChildEFE[MAX_NUM_OF_DIR_ENTRIES][EFE_SIZE];
+    unsigned int child_start, child_cont;
+
+    sub_cont  = (unsigned int)  ((Entry[16] << 8) + Entry[17]);
+    sub_start = (unsigned long) ((Entry[18] << 24) + (Entry[19] << 16)
+				 +(Entry[20] << 8 ) +  Entry[21]);
+    LoadDirBlocks(media_type,fd,DiskFAT,out,sub_start,sub_cont,SubEFE);
+
+    for(i=1; i<MAX_NUM_OF_DIR_ENTRIES; i++) {
+      if(SubEFE[i][1] != 2) continue;
+      child_cont  = (unsigned int)  ((SubEFE[i][16] << 8) + SubEFE[i][17]);
+      child_start = (unsigned long) ((SubEFE[i][18] << 24) + (SubEFE[i][19] << 16)
+				     +(SubEFE[i][20] << 8 ) +  SubEFE[i][21]);
+      LoadDirBlocks(media_type,fd,DiskFAT,out,child_start,child_cont,ChildEFE);
+      memcpy(ChildEFE[0]+2, Entry+2, 12);
+      SaveDirBlocks(media_type,fd,DiskFAT,out,child_start,child_cont,ChildEFE);
+    }
+  }
+
+  printf("Moved idx %d to idx %d. \r\n", src_idx, idx);
+
+#ifdef __CYGWIN__
+  if((media_type=='f') || (media_type=='s')) {
+#else //Linux
+  if(media_type=='f') {
+#endif
+    // Store the changes of the image to its file (see ImageFlush)
+    CloseImage(out, orig_image_name);
+  }
+
+  return(OK);
+}
+
+/////////////////////////////
+// EntryBlocks
+// -----------
+// Returns the number of blocks an entry will need when
+// copied (ie. data blocks or dir blocks + its content).
+unsigned int EntryBlocks(Volume *src, unsigned char Entry[EFE_SIZE], int depth)
+{
+  unsigned char SubEFE[MAX_NUM_OF_DIR_ENTRIES][EFE_SIZE];
+  unsigned int i, blks;
+
+  if(Entry[1] != 2) {
+    return((Entry[14] << 8) + Entry[15]);
+  }
+
+  if(depth >= MAX_DIR_DEPTH) {
+    EEXIT((stderr,"ERROR: Directory structure is too deep! \r\n"));
+  }
+
+  LoadDirBlocks(src->media_type,src->fd,src->DiskFAT,src->file,
+		(Entry[18] << 24) + (Entry[19] << 16) + (Entry[20] << 8) + Entry[21],
+		(Entry[16] << 8) + Entry[17], SubEFE);
+
+  blks = DIR_BLOCKS;
+  for(i=1; i<MAX_NUM_OF_DIR_ENTRIES; i++) {
+    if((SubEFE[i][1] == 0) || (SubEFE[i][1] == 8)) continue;
+    blks = blks + EntryBlocks(src, SubEFE[i], depth+1);
+  }
+  return(blks);
+}
+
+/////////////////////////////
+// CopyEntry
+// ---------
+// Copies one entry from the source volume to the destination volume.
+// Data is streamed from the block runs of the source FAT chain straight
+// to the runs given by the destination allocator. Directories are copied
+// recursively and their entries keep their indexes (banks refer by index).
+//
+void CopyEntry(Volume *src, Volume *dst, unsigned char SrcEntry[EFE_SIZE],
+	       unsigned char DstEntry[EFE_SIZE], char *dst_dir_name,
+	       unsigned int dst_dir_start, unsigned int dst_idx,
+	       unsigned char *Buffer, int depth)
+{
+  unsigned char SrcDir[MAX_NUM_OF_DIR_ENTRIES][EFE_SIZE];
+  unsigned char NewDir[MAX_NUM_OF_DIR_ENTRIES][EFE_SIZE];
+  unsigned int size, cont, start, i, j, n, files, si, soff, di, doff, left;
+  int src_runs, dst_runs;
+  BlockRun *SrcRun, *DstRun;
+  char name[13];
+
+  cont =(unsigned int)  ((SrcEntry[16] << 8) + SrcEntry[17]);
+  start=(unsigned long) ((SrcEntry[18] << 24) + (SrcEntry[19] << 16)
+			 +(SrcEntry[20] << 8 ) +  SrcEntry[21]);
+
+  memcpy(name, SrcEntry+2, 12);
+  name[12] = '\0';
+
+  if(SrcEntry[1] == 2) {
+    size = DIR_BLOCKS;
+  } else {
+    size = (SrcEntry[14] << 8) + SrcEntry[15];
+  }
+
+  // Allocate space from the destination
+  if((dst_runs = AllocateChain('f',dst->DiskFAT,dst->file,dst->fat_blks,dst->total_blks,size,&DstRun)) == ERR) {
+    EEXIT((stderr,"Not enough free space! %d needed, %d available. \r\n", size, dst->free_blks));
+  }
+  dst->free_blks = dst->free_blks - size;
+
+  memcpy(DstEntry, SrcEntry, EFE_SIZE);
+
+  // contiguous blocks
+  DstEntry[16] = (unsigned char) (DstRun[0].count >> 8);
+  DstEntry[17] = (unsigned char) DstRun[0].count & 0x00FF;
+
+  // start block
+  DstEntry[18] = DstRun[0].start >> 24;
+  DstEntry[19] = DstRun[0].start >> 16;
+  DstEntry[20] = DstRun[0].start >>  8;
+  DstEntry[21] = DstRun[0].start & 0x000000FF;
+
+  if(SrcEntry[1] == 2) {
+    // DIRECTORY - make a new dir and copy the content
+    printf("\rCopying dir [%s]... \r\n",name);fflush(stdout);
+
+    LoadDirBlocks(src->media_type,src->fd,src->DiskFAT,src->file,start,cont,SrcDir);
+
+    for(i=0; i<MAX_NUM_OF_DIR_ENTRIES; i++) {
+      for(j=0; j<EFE_SIZE; j++) NewDir[i][j] = 0;
+    }
+
+    // First entry is link to parent dir
+    NewDir[0][1] = 8;
+    memcpy(NewDir[0]+2, dst_dir_name, 12);
+    NewDir[0][17] = dst_idx;
+    NewDir[0][18] = (dst_dir_start >> 24) & 0x000000FF;
+    NewDir[0][19] = (dst_dir_start >> 16) & 0x000000FF;
+    NewDir[0][20] = (dst_dir_start >>  8) & 0x000000FF;
+    NewDir[0][21] =  dst_dir_start        & 0x000000FF;
+
+    files = 0;
+    for(i=1; i<MAX_NUM_OF_DIR_ENTRIES; i++) {
+      if((SrcDir[i][1] == 0) || (SrcDir[i][1] == 8)) continue;
+      CopyEntry(src, dst, SrcDir[i], NewDir[i], (char *) SrcEntry+2, DstRun[0].start, i, Buffer, depth+1);
+      files++;
+    }
+
+    // dir's size = num of files
+    DstEntry[14] = (unsigned char) (files >> 8) & 0xFF;
+    DstEntry[15] = (unsigned char) (files & 0xFF);
+
+    SaveDirBlocks('f',(FD_HANDLE) 0,dst->DiskFAT,dst->file,DstRun[0].start,DstRun[0].count,NewDir);
+
+  } else {
+    // EFE - stream the runs
+    printf("\rCopying [%s]... \r\n",name);fflush(stdout);
+
+    src_runs = GetChainRuns(src->media_type,src->DiskFAT,src->file,start,size,&SrcRun);
+
+    for(n=0,i=0; i<src_runs; i++) n = n + SrcRun[i].count;
+    if(n < size) {
+      EEXIT((stderr,"ERROR: FAT chain of [%s] is broken! \r\n",name));
+    }
+
+    si = 0; soff = 0; di = 0; doff = 0; left = size;
+    while(left > 0) {
+      // Largest piece which is contiguous in both ends
+      n = SrcRun[si].count - soff;
+      if(n > DstRun[di].count - doff) n = DstRun[di].count - doff;
+      if(n > STREAM_BUFFER_BLOCKS) n = STREAM_BUFFER_BLOCKS;
+
+      ReadBlocks(src->media_type,src->fd,src->file,SrcRun[si].start+soff,n,Buffer);
+      WriteBlocks('f',(FD_HANDLE) 0,dst->file,DstRun[di].start+doff,n,Buffer);
+
+      left = left - n;
+      soff = soff + n;
+      doff = doff + n;
+      if(soff == SrcRun[si].count) { si++; soff = 0; }
+      if(doff == DstRun[di].count) { di++; doff = 0; }
+    }
+    free(SrcRun);
+
+    // If OS, copy OS-version too
+    if((SrcEntry[1] == 1) || (SrcEntry[1] == 27) || (SrcEntry[1] == 32)) {
+      memcpy(dst->OSBlock+4, src->OSBlock+4, 4);
+    }
+  }
+
+  free(DstRun);
+}
+
+/////////////////////////////
+// CopyEFEs
+// --------
+// Copies the selected EFEs (and dirs recursively) from the current image
+// straight to the destination image, without intermediate files.
+// All metadata of the destination is committed once at the end.
+//
+int CopyEFEs(char media_type, FD_HANDLE fd, int in, unsigned char *DiskFAT,
+	     unsigned int fat_blks, unsigned char EFE[MAX_NUM_OF_DIR_ENTRIES][EFE_SIZE],
+	     char *process_EFE, char *dst_file, char *dst_path)
+{
+  Volume src, dst;
+  unsigned char DstEFE[MAX_NUM_OF_DIR_ENTRIES][EFE_SIZE];
+  unsigned char *Buffer;
+  unsigned int DstPath[MAX_DIR_DEPTH], dst_cnt, dst_start, dst_cont;
+  unsigned int j, idx, needed, slots, copied;
+  char dst_dir_name[13], image_type;
+  struct stat src_stat, dst_stat;
+
+  // Source volume
+  src.media_type = media_type;
+  src.fd         = fd;
+  src.file       = in;
+  src.fat_blks   = fat_blks;
+  if(DiskFAT == NULL) {
+    src.DiskFAT = LoadFAT(media_type,fd,in,fat_blks);
+  } else {
+    src.DiskFAT = DiskFAT;
+  }
+  ReadBlocks(media_type,fd,in,OS_BLOCK,1,src.OSBlock);
+
+  // Destination volume (any image format, opened next to the source)
+  ProbeImageType(dst_file, &image_type);
+  dst.media_type = 'f';
+  dst.fd         = (FD_HANDLE) 0;
+  if((dst.file=open(dst_file, O_RDWR | O_BINARY)) < 0) {
+    EEXIT((stderr,"ERROR: Couldn't open file '%s'. \r\n",dst_file));
+  }
+  if((media_type == 'f') && (fstat(in, &src_stat) == 0) && (fstat(dst.file, &dst_stat) == 0) &&
+     (src_stat.st_dev == dst_stat.st_dev) && (src_stat.st_ino == dst_stat.st_ino)) {
+    EEXIT((stderr,"ERROR: Source and destination are the same image! \r\n"));
+  }
+  if(ImageOpen(dst.file, dst_file, image_type, 0) != OK) {
+    EEXIT((stderr,"ERROR: '%s' is not a valid image! \r\n",dst_file));
+  }
+
+  Buffer = malloc(STREAM_BUFFER_BLOCKS*BLOCK_SIZE);
+  if(Buffer == NULL) EEXIT((stderr,"ERROR: Couldn't allocate memory!!!! \r\n"));
+
+  // Get 'TotalBlocks' from ID_BLOCK (and check it is Ensoniq)
+  ReadBlocks('f',dst.fd,dst.file,ID_BLOCK,1,Buffer);
+  if((Buffer[38] != 'I') || (Buffer[39] != 'D')) {
+    EEXIT((stderr,"ERROR: '%s' is not a valid image file! \r\n",dst_file));
+  }
+  dst.total_blks = (Buffer[14] << 24) + (Buffer[15] << 16) + (Buffer[16] << 8) + Buffer[17];
+  if((dst.total_blks % FAT_ENTRIES_PER_BLK) != 0) {
+    dst.fat_blks = dst.total_blks/FAT_ENTRIES_PER_BLK+1;
+  } else {
+    dst.fat_blks = dst.total_blks/FAT_ENTRIES_PER_BLK;
+  }
+
+  // Get 'FreeBlocks' from OS_BLOCK
+  ReadBlocks('f',dst.fd,dst.file,OS_BLOCK,1,dst.OSBlock);
+  dst.free_blks = (dst.OSBlock[0] << 24) + (dst.OSBlock[1] << 16) + (dst.OSBlock[2] << 8) + dst.OSBlock[3];
+
+  dst.DiskFAT = LoadFAT('f',dst.fd,dst.file,dst.fat_blks);
+
+  // Load destination dir
+  dst_cnt = 0;
+  if(dst_path != NULL) {
+    ParseDir(dst_path, DstPath, &dst_cnt);
+  }
+  dst_start = DIR_START_BLOCK;
+  dst_cont  = 2;
+  LoadDirBlocks('f',dst.fd,dst.DiskFAT,dst.file,dst_start,dst_cont,DstEFE);
+  ChangeDir('f',dst.fd,dst.DiskFAT,dst.file,DstEFE,&dst_start,&dst_cont,dst_dir_name,dst_cnt,DstPath);
+
+  // Check that everything fits before writing anything
+  needed = 0; copied = 0; slots = 0;
+  for(j=0; j<MAX_NUM_OF_DIR_ENTRIES; j++) {
+    if(process_EFE[j] == 0) continue;
+    if((EFE[j][1] == 0) || (EFE[j][1] == 8)) continue;
+    needed = needed + EntryBlocks(&src, EFE[j], 0);
+    copied++;
+  }
+  for(idx=1; idx<MAX_NUM_OF_DIR_ENTRIES; idx++) {
+    if(DstEFE[idx][1] == 0) slots++;
+  }
+  if(copied > slots) {
+    EEXIT((stderr,"ERROR: Destination directory full! %d entries needed, %d available. \r\n", copied, slots));
+  }
+  if(needed > dst.free_blks) {
+    EEXIT((stderr,"Not enough free space! %d needed, %d available. \r\n", needed, dst.free_blks));
+  }
+
+  // Copy
+  idx = 1;
+  for(j=0; j<MAX_NUM_OF_DIR_ENTRIES; j++) {
+    if(process_EFE[j] == 0) continue;
+    if((EFE[j][1] == 0) || (EFE[j][1] == 8)) continue;
+
+    while(DstEFE[idx][1] != 0) idx++;
+    CopyEntry(&src, &dst, EFE[j], DstEFE[idx], dst_dir_name, dst_start, idx, Buffer, 0);
+  }
+
+  // Commit FAT and 'disk-free' before making the entries visible
+  dst.OSBlock[0] = (dst.free_blks >> 24) & 0x000000ff; // MSB
+  dst.OSBlock[1] = (dst.free_blks >> 16) & 0x000000ff;
+  dst.OSBlock[2] = (dst.free_blks >>  8) & 0x000000ff;
+  dst.OSBlock[3] =  dst.free_blks        & 0x000000ff; // LSB
+  WriteBlocks('f',dst.fd,dst.file,OS_BLOCK,1,dst.OSBlock);
+  SaveFAT('f',dst.fd,dst.file,dst.fat_blks,dst.DiskFAT);
+
+  SaveDirBlocks('f',dst.fd,dst.DiskFAT,dst.file,dst_start,dst_cont,DstEFE);
+  if((dst_start != DIR_START_BLOCK) && (copied > 0)) {
+    AdjustDirCount('f',dst.fd,dst.DiskFAT,dst.file,DstEFE[0],copied);
+  }
+
+  ImageSelect(dst.file);
+  if(ImageFlush(dst_file) != OK) {
+    EEXIT((stderr,"ERROR: Couldn't write file '%s'. \r\n",dst_file));
+  }
+  ImageClose();
+  close(dst.file);
+
+  printf("\r%d entries (%d blocks) copied to '%s'. \r\n", copied, needed, dst_file);
+
+  FreeFAT(dst.DiskFAT);
+  free(Buffer);
+  if(src.DiskFAT != DiskFAT) FreeFAT(src.DiskFAT);
+
+  return(OK);
+}
+
+/////////////////////////////
+// XXH64
+// -----
+// 64-bit xxHash of EFE data. Data is always fed in whole blocks,
+// so the state needs no buffer for partial stripes.
+//
+#define XXH_PRIME64_1  0x9E3779B185EBCA87ULL
+#define XXH_PRIME64_2  0xC2B2AE3D27D4EB4FULL
+#define XXH_PRIME64_3  0x165667B19E3779F9ULL
+#define XXH_PRIME64_4  0x85EBCA77C2B2AE63ULL
+#define XXH_PRIME64_5  0x27D4EB2F165667C5ULL
+
+#define XXH_ROTL64(x,r)  (((x) << (r)) | ((x) >> (64 - (r))))
+
+typedef struct {
+  unsigned long long v[4];
+  unsigned long long total_len;
+} XXH64State;
+
+static unsigned long long XXH64Read(const unsigned char *p)
+{
+  return(((unsigned long long) p[0])       | ((unsigned long long) p[1] << 8)  |
+	 ((unsigned long long) p[2] << 16) | ((unsigned long long) p[3] << 24) |
+	 ((unsigned long long) p[4] << 32) | ((unsigned long long) p[5] << 40) |
+	 ((unsigned long long) p[6] << 48) | ((unsigned long long) p[7] << 56));
+}
+
+static unsigned long long XXH64Round(unsigned long long acc, unsigned long long input)
+{
+  acc = acc + input * XXH_PRIME64_2;
+  acc = XXH_ROTL64(acc, 31);
+  return(acc * XXH_PRIME64_1);
+}
+
+static unsigned long long XXH64Merge(unsigned long long h, unsigned long long v)
+{
+  h = h ^ XXH64Round(0, v);
+  return(h * XXH_PRIME64_1 + XXH_PRIME64_4);
+}
+
+void XXH64Init(XXH64State *st)
+{
+  st->v[0] = XXH_PRIME64_1 + XXH_PRIME64_2;
+  st->v[1] = XXH_PRIME64_2;
+  st->v[2] = 0;
+  st->v[3] = 0 - XXH_PRIME64_1;
+  st->total_len = 0;
+}
+
+// 'len' has to be multiple of 32 (ie. whole blocks)
+void XXH64Update(XXH64State *st, const unsigned char *p, unsigned long len)
+{
+  unsigned long i;
+
+  for(i=0; i<len; i=i+32) {
+    st->v[0] = XXH64Round(st->v[0], XXH64Read(p+i));
+    st->v[1] = XXH64Round(st->v[1], XXH64Read(p+i+8));
+    st->v[2] = XXH64Round(st->v[2], XXH64Read(p+i+16));
+    st->v[3] = XXH64Round(st->v[3], XXH64Read(p+i+24));
+  }
+  st->total_len = st->total_len + len;
+}
+
+unsigned long long XXH64Final(XXH64State *st)
+{
+  unsigned long long h;
+
+  if(st->total_len >= 32) {
+    h = XXH_ROTL64(st->v[0], 1) + XXH_ROTL64(st->v[1], 7)
+      + XXH_ROTL64(st->v[2], 12) + XXH_ROTL64(st->v[3], 18);
+    h = XXH64Merge(h, st->v[0]);
+    h = XXH64Merge(h, st->v[1]);
+    h = XXH64Merge(h, st->v[2]);
+    h = XXH64Merge(h, st->v[3]);
+  } else {
+    h = XXH_PRIME64_5;
+  }
+  h = h + st->total_len;
+
+  // Avalanche
+  h = h ^ (h >> 33);
+  h = h * XXH_PRIME64_2;
+  h = h ^ (h >> 29);
+  h = h * XXH_PRIME64_3;
+  h = h ^ (h >> 32);
+  return(h);
+}
+
+/////////////////////////////
+// HashRuns
+// --------
+// Hashes 'blks' blocks read from the given runs. Image files are
+// read with 'pread' so that several threads can share the file.
+// Returns 0 if the chain has less blocks than the dir entry says.
+//
+unsigned long long HashRuns(char media_type, FD_HANDLE fd, int file,
+			    BlockRun *Run, int runs, unsigned int blks,
+			    unsigned char *Buffer)
+{
+  XXH64State st;
+  unsigned int n, off, left;
+  int i;
+
+  XXH64Init(&st);
+  left = blks;
+
+  for(i=0; (i<runs) && (left>0); i++) {
+    for(off=0; (off<Run[i].count) && (left>0); off=off+n) {
+      n = Run[i].count - off;
+      if(n > STREAM_BUFFER_BLOCKS) n = STREAM_BUFFER_BLOCKS;
+      if(n > left) n = left;
+
+      if(media_type == 'f') {
+	if(ImageRead(file, Buffer, n*BLOCK_SIZE, (off_t) (Run[i].start+off)*BLOCK_SIZE) != n*BLOCK_SIZE) {
+	  return(0);
+	}
+      } else {
+	ReadBlocks(media_type,fd,file,Run[i].start+off,n,Buffer);
+      }
+      XXH64Update(&st, Buffer, n*BLOCK_SIZE);
+      left = left - n;
+    }
+  }
+
+  if(left > 0) return(0);
+  return(XXH64Final(&st));
+}
+
+/////////////////////////////
+// HashData
+// --------
+// XXH64 of 'blks' blocks of EFE data (after the EFE header) from
+// file 'in'. Short file is hashed zero padded, just like it would
+// be put.
+//
+unsigned long long HashData(int in, unsigned int blks, unsigned char *Buffer)
+{
+  XXH64State st;
+  unsigned int n, got;
+  off_t pos;
+  ssize_t r;
+
+  XXH64Init(&st);
+
+  for(pos=BLOCK_SIZE; blks>0; blks=blks-n) {
+    n = (blks > STREAM_BUFFER_BLOCKS) ? STREAM_BUFFER_BLOCKS : blks;
+    for(got=0; got<n*BLOCK_SIZE; got=got+r) {
+      if((r = MacPread(in, Buffer+got, n*BLOCK_SIZE-got, pos+got)) <= 0) break;
+    }
+    if(got < n*BLOCK_SIZE) memset(Buffer+got, 0, n*BLOCK_SIZE-got);
+    XXH64Update(&st, Buffer, n*BLOCK_SIZE);
+    pos = pos + n*BLOCK_SIZE;
+  }
+  return(XXH64Final(&st));
+}
+
+// Work shared by the hash threads
+typedef struct {
+  int file;
+  BlockRun *Run[MAX_NUM_OF_DIR_ENTRIES];
+  int runs[MAX_NUM_OF_DIR_ENTRIES];
+  unsigned int blks[MAX_NUM_OF_DIR_ENTRIES];
+  unsigned int job[MAX_NUM_OF_DIR_ENTRIES];
+  unsigned int jobs, next;
+  unsigned long long *EFEHash;
+  pthread_mutex_t lock;
+} HashWork;
+
+/////////////////////////////
+// HashThread
+// ----------
+// Takes EFEs from the shared list until all are hashed.
+//
+static void *HashThread(void *arg)
+{
+  HashWork *w = (HashWork *) arg;
+  unsigned char *Buffer;
+  unsigned int j;
+
+  Buffer = malloc(STREAM_BUFFER_BLOCKS*BLOCK_SIZE);
+  if(Buffer == NULL) EEXIT((stderr,"ERROR: Couldn't allocate memory!!!! \r\n"));
+
+  for(;;) {
+    pthread_mutex_lock(&w->lock);
+    if(w->next == w->jobs) {
+      pthread_mutex_unlock(&w->lock);
+      break;
+    }
+    j = w->job[w->next++];
+    pthread_mutex_unlock(&w->lock);
+
+    w->EFEHash[j] = HashRuns('f',(FD_HANDLE) 0,w->file,w->Run[j],w->runs[j],w->blks[j],Buffer);
+  }
+
+  free(Buffer);
+  return(NULL);
+}
+
+/////////////////////////////
+// HashEFEs
+// --------
+// Computes content hash of every EFE in the dir. The FAT chains are
+// first resolved to block runs (FAT is read once), then image files
+// are hashed by a pool of threads. Disk access is sequential.
+//
+void HashEFEs(char media_type, FD_HANDLE fd, int in, unsigned char *DiskFAT,
+	      unsigned int fat_blks, unsigned char EFE[MAX_NUM_OF_DIR_ENTRIES][EFE_SIZE],
+	      unsigned long long *EFEHash)
+{
+  HashWork w;
+  pthread_t Thread[MAX_HASH_THREADS];
+  unsigned char *FAT, *Buffer;
+  unsigned int j, start, threads;
+  long cpus;
+
+  w.file = in;
+  w.jobs = 0;
+  w.next = 0;
+  w.EFEHash = EFEHash;
+
+  if(DiskFAT == NULL) {
+    FAT = LoadFAT(media_type,fd,in,fat_blks);
+  } else {
+    FAT = DiskFAT;
+  }
+
+  // Resolve chains
+  for(j=0; j<MAX_NUM_OF_DIR_ENTRIES; j++) {
+    EFEHash[j] = 0;
+    if((EFE[j][1] == 0) || (EFE[j][1] == 2) || (EFE[j][1] == 8)) continue;
+
+    start = (EFE[j][18] << 24) + (EFE[j][19] << 16) + (EFE[j][20] << 8) + EFE[j][21];
+    w.blks[j] = (EFE[j][14] << 8) + EFE[j][15];
+    w.runs[j] = GetChainRuns(media_type,FAT,in,start,w.blks[j],&w.Run[j]);
+    w.job[w.jobs++] = j;
+  }
+
+  if(FAT != DiskFAT) FreeFAT(FAT);
+
+  // Number of threads
+  cpus = sysconf(_SC_NPROCESSORS_ONLN);
+  if(cpus < 1) cpus = 1;
+  threads = (cpus > MAX_HASH_THREADS) ? MAX_HASH_THREADS : (unsigned int) cpus;
+  if(threads > w.jobs) threads = w.jobs;
+
+  if((media_type == 'f') && (threads > 1)) {
+    pthread_mutex_init(&w.lock, NULL);
+    for(j=0; j<threads; j++) {
+      if(pthread_create(&Thread[j], NULL, HashThread, &w) != 0) break;
+    }
+    // If no thread could be made, this one does the work
+    if(j == 0) HashThread(&w);
+    threads = j;
+    for(j=0; j<threads; j++) {
+      pthread_join(Thread[j], NULL);
+    }
+    pthread_mutex_destroy(&w.lock);
+
+  } else {
+    // DISK ACCESS (or single cpu)
+    Buffer = malloc(STREAM_BUFFER_BLOCKS*BLOCK_SIZE);
+    if(Buffer == NULL) EEXIT((stderr,"ERROR: Couldn't allocate memory!!!! \r\n"));
+    for(j=0; j<w.jobs; j++) {
+      start = w.job[j];
+      EFEHash[start] = HashRuns(media_type,fd,in,w.Run[start],w.runs[start],w.blks[start],Buffer);
+    }
+    free(Buffer);
+  }
+
+  for(j=0; j<w.jobs; j++) {
+    free(w.Run[w.job[j]]);
+  }
+}
+
+/////////////////////////////
+// SplitEFE
+void SplitEFE(char *in_file, char *slice_type, int argc)
+{
+  int in, out;
+  struct stat stat_buf;
+  unsigned int i,slice_size, slice_count, data_len;
+  unsigned char Data[BLOCK_SIZE];
+  unsigned char Hdr[BLOCK_SIZE];
+  char out_file[FILENAME_MAX],out_file_head[12], out_file_tail[FILENAME_MAX];
+
+
+  // Check arguments
+  if((argc != 4) || ((strcasecmp(slice_type,"eps") != 0) && (strcasecmp(slice_type,"asr") != 0) && (strcasecmp(slice_type,"asrsd") != 0))) {
+    fprintf(stderr,"ERROR: Invalid or wrong number of arguments. \r\n");
+    ShowUsage();
+    exit(ERR);
+  }
+
+  // EPS/EPS16 800K
+  if(strcasecmp(slice_type,"eps") == 0) {
+    slice_size = 1585 * BLOCK_SIZE;
+  }
+  // EPS16 2550K is pointless to split because of EPS RAM limit, but...
+  // ASR 5100K holds less than 16MB, so split to ideal size.
+  else if(strcasecmp(slice_type,"asrsd") == 0) {
+    // 10135 should be ideal size, but seems to fail load when attempted by
+    // actual sampler. Higher split values may not be allowed, possibly.
+    slice_size = 3176 * BLOCK_SIZE;
+  }
+  else { // ASR 1600K
+    slice_size = 3176 * BLOCK_SIZE;
+  }
+
+  // Open input EFE file
+  if((in=open(in_file, O_RDONLY | O_BINARY)) < 0) {
+    EEXIT((stderr,"ERROR: Couldn't open file '%s'. \r\n",in_file));
+  }
+
+  // Get filesize
+  if(stat(in_file,&stat_buf) != 0) {
+    EEXIT((stderr,"\r\n(line: %d) ERROR: Can't get the filesize! \r\n", __LINE__));
+  }
+
+  data_len = stat_buf.st_size - BLOCK_SIZE;
+
+  // Check the validity of the given filesize ie. that is multiple of block size
+  if((data_len % BLOCK_SIZE) != 0) {
+    EEXIT((stderr,"Image size has to be a multiple of %d! \r\n",BLOCK_SIZE));
+  }
+
+  // Check if split is needed..
+  if(data_len <= slice_size) {
+    printf("No split needed. EFE will fit in one disk. \r\n");
+    exit(OK);
+  }
+
+  // ASR max mem 16M!
+  if(data_len > 16777216 ) {
+    EEXIT((stderr,"EFE is too large to be valid! It is probably corrupted. \r\n"));
+  }
+
+  // Read EFE Header
+  //fseek(in, 512,0);
+  read(in,&Hdr, BLOCK_SIZE);
+
+
+  // Check EFE type
+  if(Hdr[0x32] != 3) {
+    EEXIT((stderr,"ERROR: File '%s' is not an INSTRUMENT type. \r\n",in_file));
+  }
+
+  // Check filesize and EFE header blocksize match..
+  if(((data_len / BLOCK_SIZE) != ( ((Hdr[0x34] << 8) + Hdr[0x35])))) {
+    EEXIT((stderr,"ERROR: File size and block size in EFE header doesn't match! \r\n"));
+  }
+
+  // Part_ string must be added to just the base filename and not the full path as
+  // otherwise splitting only works properly if the EFE is in the same dir as EpsLin
+
+  // Create variable to hold just the filename without path.
+  char *bsname;
+  // Use 'basename' to return just the filename of the input file.
+  bsname = basename(in_file);
+
+  // Create variable to hold just the path without filename.
+  char *dsname;
+  // Use 'dirname' to return just the directory name without filename.
+  dsname = dirname(in_file);
+
+  // If EFE is named using EpsLin "format"
+  if(strncmp("[Instr  ]",bsname+4,9) == 0) {
+    bsname[10]='\0';
+    strcpy(out_file_head,bsname);
+    strcpy(out_file_tail,bsname+12);
+  } else {
+    strcpy(out_file_head ,"Part_");
+    sprintf(out_file_tail,"_%s", bsname);
+  }
+
+  slice_count=0;
+
+  printf("\r\nSplitting in progress: \r\n");
+
+  // Split
+  while(data_len > 0) {
+
+    // Seek inputfile
+    lseek(in, BLOCK_SIZE + slice_count*slice_size,0);
+
+    // Construct output filename
+    slice_count++;
+    sprintf(out_file,"%s/%s%02d%s", dsname, out_file_head, slice_count, out_file_tail);
+
+    if((out=open(out_file, O_RDWR | O_CREAT | O_BINARY, FILE_RIGHTS)) < 0) {
+      EEXIT((stderr,"ERROR: Couldn't open file '%s'. \r\n",out_file));
+    }
+
+    printf("\rWriting MultiFile EFE #%d",slice_count);
+
+    // If last slice...
+    if(data_len < slice_size) slice_size=data_len;
+
+    // Generate EFE header
+
+    Hdr[0x34] = ((slice_size/BLOCK_SIZE) & 0xFF00) >> 8;     // Blocks
+    Hdr[0x35] = ((slice_size/BLOCK_SIZE) & 0x00FF);
+    Hdr[0x3a] = slice_count; // Multifile
+
+    // Write header
+    write(out,Hdr,BLOCK_SIZE);
+
+    // Copy data
+    for(i=0;i<slice_size;i=i+BLOCK_SIZE) {
+      read(in,Data,BLOCK_SIZE);
+      write(out,Data,BLOCK_SIZE);
+    }
+
+    data_len=data_len - slice_size;
+
+  } // while
+
+  printf("\rEFE splitting OK!            \r\n");
+
+  close(in);close(out);
+}
+
+/////////////////////////////
+// JoinEFE
+void JoinEFEs (int argc, char **argv) {
+  int in, out;
+  unsigned char Data[BLOCK_SIZE];
+  unsigned char Hdr[BLOCK_SIZE];
+  char out_file[FILENAME_MAX];
+  char in_file[FILENAME_MAX];
+  struct stat stat_buf;
+  unsigned int i, slice_idx, data_len, data_total;
+
+  // Check arguments
+  if( argc < 5 ) {
+    fprintf(stderr,"ERROR: Invalid or wrong number of arguments. \r\n");
+    ShowUsage();
+    exit(ERR);
+  }
+
+  sprintf(out_file,"%s",argv[2]);
+  // Open Output file
+  if((out=open(out_file, O_RDWR | O_CREAT | O_BINARY, FILE_RIGHTS)) < 0) {
+    EEXIT((stderr,"ERROR: Couldn't open file '%s'. \r\n",out_file));
+  }
+
+  slice_idx=0;
+  data_total=0;
+
+  while(slice_idx < (argc-3)) {
+    strcpy(in_file,argv[slice_idx+3]);
+
+    printf("Processing EFE part #%d: %s \r\n",slice_idx+1,in_file);
+
+    // Open input EFE file
+    if((in=open(in_file, O_RDONLY | O_BINARY)) < 0) {
+      EEXIT((stderr,"ERROR: Couldn't open file '%s'. \r\n",in_file));
+    }
+
+    // Get filesize
+    if(stat(in_file,&stat_buf) != 0) {
+      EEXIT((stderr,"\r\n(line: %d) ERROR: Can't get the filesize! \r\n", __LINE__));
+    }
+
+    data_len = stat_buf.st_size - BLOCK_SIZE;
+
+    // Check the validity of the given filesize ie. that is multiple of block size
+    if((data_len % BLOCK_SIZE) != 0) {
+      EEXIT((stderr,"Image size has to be a multiple of %d! \r\n",BLOCK_SIZE));
+    }
+
+    // Read EFE Header
+    read(in,&Hdr, BLOCK_SIZE);
+
+    // Check EFE type
+    if(Hdr[0x32] != 3) {
+      EEXIT((stderr,"ERROR: File '%s' is not an INSTRUMENT type. \r\n",in_file));
+    }
+
+    // Check filesize and EFE header blocksize match..
+    if(((data_len / BLOCK_SIZE) != ( ((Hdr[0x34] << 8) + Hdr[0x35])))) {
+      EEXIT((stderr,"ERROR: File size and block size in EFE header do not match! \r\n"));
+    }
+
+    // Copy header before first slice..
+    if(slice_idx==0) {
+      write(out,Hdr,BLOCK_SIZE);
+    }
+
+    // Copy data
+    for(i=0;i<data_len;i=i+BLOCK_SIZE) {
+      read(in,Data,BLOCK_SIZE);
+      write(out,Data,BLOCK_SIZE);
+    }
+
+    data_total=data_total+data_len;
+    slice_idx++;
+  }// while
+
+  // Fix the final header of the output file
+  // Generate EFE header
+  Hdr[0x34] = ((data_total/BLOCK_SIZE) & 0xFF00) >> 8;     // Blocks
+  Hdr[0x35] = ((data_total/BLOCK_SIZE) & 0x00FF);
+  Hdr[0x3a] = 0; // Singlefile
+
+  // Overwrite header
+  lseek(out, 0L, SEEK_SET);
+  write(out,Hdr,BLOCK_SIZE);
+  printf("Join operation OK! Total size of the joined EFE is %d blocks. \r\n\r\n",data_total/BLOCK_SIZE);
+  close(in);close(out);
+}
+
+
+/////////////////////////////
+// DoConversion
+// ------------
+// Output format comes from the extension of 'out_file'. Without
+// one, raw image goes to EDE/EDA by its size and the other formats
+// to a raw image.
+void DoConversion(char in_file[FILENAME_MAX], char out_file[FILENAME_MAX], int argc)
+{
+  char image_type, out_type;
+
+  if(argc != 4) {
+    fprintf(stderr,"ERROR: Wrong number of arguments. \r\n");
+    ShowUsage();
+    exit(ERR);
+  }
+
+  if(ProbeImageType(in_file, &image_type) != OK) {
+    EEXIT((stderr,"ERROR: Can't get the filesize! \r\n"));
+  }
+
+  if((GetImageType(out_file, &out_type) != OK) || IsRawImageType(out_type)) {
+    if(!IsRawImageType(image_type)) {
+      out_type = OTHER_TYPE;
+    } else if(image_type == EPS_TYPE) {
+      out_type = EDE_TYPE;
+    } else if(image_type == ASR_TYPE) {
+      out_type = EDA_TYPE;
+    } else {
+      EEXIT((stderr,"ERROR: Unsupported image type! \r\n\r\n"));
+    }
+  }
+
+  if(out_type == image_type) {
+    EEXIT((stderr,"ERROR: Unsupported conversion! \r\n\r\n"));
+  }
+
+  ConvertImage(in_file, out_file, out_type);
+}
+
+/////////////////////////////
+// Batch conversion
+// ----------------
+// - Images of the given directories (with -R also their sub-dirs)
+//   and files are converted to one format, each next to its source
+//   with the new extension. Existing outputs are kept.
+// - Each file is converted in memory (see ConvertImage) by a child
+//   process of its own, at most one per CPU at a time. Conversion
+//   exits on the first error, so this way a broken image only fails
+//   itself: its error message comes back through a pipe, and the
+//   partial output is removed.
+//
+
+typedef struct {
+  char *in_file;
+  char *out_file;
+  off_t size;
+  pid_t pid;
+  int err;			// read end of the stderr pipe of the child
+  char *msg;			// why it failed, NULL if converted
+} BatchJob;
+
+typedef struct {
+  BatchJob *Job;
+  int jobs, max_jobs;
+  int skipped;			// output exists, or already in the format
+} BatchList;
+
+static int CompareJobName(const void *a, const void *b)
+{
+  return(strcmp(((BatchJob *) a)->in_file, ((BatchJob *) b)->in_file));
+}
+
+// Type of image file 'name' from its content only (see SniffImageType)
+static int SniffFile(char *name, char *image_type, off_t *size)
+{
+  unsigned char Probe[SNIFF_SIZE];
+  struct stat stat_buf;
+  ssize_t len;
+  int in, rc;
+
+  *size = 0;
+  if((in = open(name, O_RDONLY | O_BINARY)) < 0) return(ERR);
+  if(fstat(in, &stat_buf) != 0) {
+    close(in);
+    return(ERR);
+  }
+  len = pread(in, Probe, SNIFF_SIZE, 0);
+  rc = ((SniffImageType(Probe, len, stat_buf.st_size, image_type) == OK) && (*image_type != EFE_TYPE)) ? OK : ERR;
+  *size = stat_buf.st_size;
+  close(in);
+  return(rc);
+}
+
+// Adds image 'name' to the batch. Files found in directories
+// ('listed' = 0) which are not images are left out quietly.
+static void BatchAdd(BatchList *b, char *name, char *ext, char out_type, int listed)
+{
+  BatchJob *J;
+  struct stat stat_buf;
+  char image_type, *p, *dot;
+  off_t size;
+
+  if(SniffFile(name, &image_type, &size) != OK) {
+    if(!listed) return;
+    image_type = 0;
+  } else if((image_type == out_type) || (IsRawImageType(image_type) && IsRawImageType(out_type))) {
+    b->skipped++;
+    return;
+  }
+
+  if(b->jobs == b->max_jobs) {
+    b->max_jobs = b->max_jobs*2 + 64;
+    b->Job = realloc(b->Job, b->max_jobs*sizeof(BatchJob));
+    if(b->Job == NULL) EEXIT((stderr,"ERROR: Couldn't allocate memory!!!! \r\n"));
+  }
+  J = b->Job + b->jobs;
+  memset(J, 0, sizeof(BatchJob));
+  J->in_file  = strdup(name);
+  J->out_file = malloc(strlen(name) + strlen(ext) + 2);
+  if((J->in_file == NULL) || (J->out_file == NULL)) EEXIT((stderr,"ERROR: Couldn't allocate memory!!!! \r\n"));
+  J->size = size;
+  J->err  = -1;
+
+  // Same name with the new extension
+  strcpy(J->out_file, name);
+  p = ((p = rindex(J->out_file, '/')) != NULL) ? p+1 : J->out_file;
+  if(((dot = rindex(p, '.')) != NULL) && (dot != p)) *dot = '\0';
+  strcat(J->out_file, ".");
+  strcat(J->out_file, ext);
+
+  if(image_type == 0) {
+    J->msg = strdup((access(name, R_OK) != 0) ? "Couldn't open file" : "Not an image");
+  } else if(stat(J->out_file, &stat_buf) == 0) {
+    free(J->in_file); free(J->out_file);
+    b->skipped++;
+    return;
+  }
+  b->jobs++;
+}
+
+// Adds the images of directory 'path' (and its sub-dirs if 'recursive')
+static void BatchScan(BatchList *b, char *path, char *ext, char out_type, int recursive)
+{
+  DIR *dp;
+  struct dirent *entry;
+  struct stat stat_buf;
+  char *name;
+
+  if((dp = opendir(path)) == NULL) {
+    EEXIT((stderr,"ERROR: Couldn't open directory '%s'. \r\n",path));
+  }
+  while((entry = readdir(dp)) != NULL) {
+    if(entry->d_name[0] == '.') continue;
+    name = malloc(strlen(path) + strlen(entry->d_name) + 2);
+    if(name == NULL) EEXIT((stderr,"ERROR: Couldn't allocate memory!!!! \r\n"));
+    sprintf(name, "%s/%s", path, entry->d_name);
+    if(stat(name, &stat_buf) == 0) {
+      if(S_ISDIR(stat_buf.st_mode)) {
+	if(recursive) BatchScan(b, name, ext, out_type, recursive);
+      } else if(S_ISREG(stat_buf.st_mode)) {
+	BatchAdd(b, name, ext, out_type, 0);
+      }
+    }
+    free(name);
+  }
+  closedir(dp);
+}
+
+// Starts the child converting 'J'
+static void BatchStart(BatchJob *J, char out_type)
+{
+  int Pipe[2];
+
+  if(pipe(Pipe) != 0) EEXIT((stderr,"ERROR: Couldn't create pipe! \r\n"));
+  fflush(stdout); fflush(stderr);
+
+  if((J->pid = fork()) < 0) EEXIT((stderr,"ERROR: Couldn't start a conversion! \r\n"));
+  if(J->pid == 0) {
+    close(Pipe[0]);
+    dup2(Pipe[1], STDERR_FILENO);
+    close(Pipe[1]);
+    ConvertImage(J->in_file, J->out_file, out_type);
+    exit(OK);
+  }
+  close(Pipe[1]);
+  J->err = Pipe[0];
+}
+
+// Result of the child of 'J' which exited with 'status'
+static void BatchDone(BatchJob *J, int status)
+{
+  char Msg[BLOCK_SIZE], *p;
+  ssize_t n, len;
+
+  for(len=0; (len < BLOCK_SIZE-1) && ((n = read(J->err, Msg+len, BLOCK_SIZE-1-len)) > 0); len=len+n);
+  close(J->err);
+  Msg[len] = '\0';
+
+  if(WIFEXITED(status) && (WEXITSTATUS(status) == OK)) return;
+
+  unlink(J->out_file);
+  if(WIFSIGNALED(status)) sprintf(Msg, "Crashed (signal %d)", WTERMSIG(status));
+
+  // First line, without 'ERROR:'
+  for(p=Msg; (*p == ' ') || (*p == '\r') || (*p == '\n'); p++);
+  if(strncmp(p, "ERROR: ", 7) == 0) p = p+7;
+  p[strcspn(p, "\r\n")] = '\0';
+  for(len=strlen(p); (len > 0) && (p[len-1] == ' '); len--) p[len-1] = '\0';
+  J->msg = strdup((*p != '\0') ? p : "Conversion failed");
+}
+
+/////////////////////////////
+// BatchConvert
+// ------------
+// Converts the images of the files and directories argv[first..argc)
+// to format 'ext' ('img' = raw image). Prints the failed files and
+// the throughput at the end, and exits with ERR if any failed.
+void BatchConvert(char *ext, int argc, char **argv, int first, int recursive)
+{
+  BatchList b;
+  BatchJob *J;
+  struct stat stat_buf;
+  struct timespec t0, t1;
+  char out_type;
+  int i, j, workers, running, next, done, failed, status;
+  long cpus;
+  pid_t pid;
+  double secs, mbytes;
+
+  // Output format from the extension
+  if(strcasecmp(ext, "img") == 0) {
+    out_type = OTHER_TYPE;
+  } else {
+    for(i=0; (ImageFormats[i].ext != NULL) && (strcasecmp(ext, ImageFormats[i].ext) != 0); i++);
+    if(ImageFormats[i].ext == NULL) {
+      EEXIT((stderr,"ERROR: Unknown image format '%s'! \r\n",ext));
+    }
+    out_type = ImageFormats[i].type;
+  }
+
+  if(first >= argc) {
+    fprintf(stderr,"ERROR: No files or directories to convert. \r\n");
+    ShowUsage();
+    exit(ERR);
+  }
+
+  memset(&b, 0, sizeof(b));
+  for(i=first; i<argc; i++) {
+    if((stat(argv[i], &stat_buf) == 0) && S_ISDIR(stat_buf.st_mode)) {
+      BatchScan(&b, argv[i], ext, out_type, recursive);
+    } else {
+      BatchAdd(&b, argv[i], ext, out_type, 1);
+    }
+  }
+  qsort(b.Job, b.jobs, sizeof(BatchJob), CompareJobName);
+
+  // Only the first of images with the same output name is converted
+  for(i=0; i<b.jobs; i++) {
+    for(j=0; (j < i) && ((b.Job[j].msg != NULL) || (strcmp(b.Job[i].out_file, b.Job[j].out_file) != 0)); j++);
+    if((j < i) && (b.Job[i].msg == NULL)) {
+      b.Job[i].msg = malloc(strlen(b.Job[j].in_file) + 32);
+      if(b.Job[i].msg == NULL) EEXIT((stderr,"ERROR: Couldn't allocate memory!!!! \r\n"));
+      sprintf(b.Job[i].msg, "Same output as '%s'", b.Job[j].in_file);
+    }
+  }
+
+  cpus = sysconf(_SC_NPROCESSORS_ONLN);
+  if(cpus < 1) cpus = 1;
+  workers = (cpus > MAX_BATCH_WORKERS) ? MAX_BATCH_WORKERS : (int) cpus;
+  printf("Converting %d image(s) to %s with %d worker(s)... \r\n", b.jobs, ext, workers);
+
+  clock_gettime(CLOCK_MONOTONIC, &t0);
+  mbytes = 0; failed = 0;
+  for(running=0, next=0, done=0; done < b.jobs; ) {
+    // Keep the workers busy
+    while((running < workers) && (next < b.jobs)) {
+      J = b.Job + next++;
+      if(J->msg != NULL) {
+	done++; failed++;
+	continue;
+      }
+      BatchStart(J, out_type);
+      running++;
+    }
+    if(running == 0) continue;
+
+    if((pid = wait(&status)) < 0) EEXIT((stderr,"ERROR: Lost the conversions! \r\n"));
+    for(J=b.Job; (J < b.Job+next) && (J->pid != pid); J++);
+    if(J == b.Job+next) continue;
+    running--; done++;
+
+    BatchDone(J, status);
+    if(J->msg != NULL) {
+      failed++;
+    } else {
+      mbytes = mbytes + J->size/(1024.0*1024.0);
+    }
+    printf("\r %d of %d converted, %d failed ", done-failed, b.jobs, failed);
+    fflush(stdout);
+  }
+  clock_gettime(CLOCK_MONOTONIC, &t1);
+  secs = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec)/1e9;
+  if(secs < 0.001) secs = 0.001;
+
+  if(failed > 0) {
+    printf("\r\n\r\nFailed:\r\n");
+    for(i=0; i<b.jobs; i++) {
+      if(b.Job[i].msg != NULL) printf("  %s: %s\r\n", b.Job[i].in_file, b.Job[i].msg);
+    }
+  }
+
+  printf("\r\n%d converted, %d failed, %d skipped (output exists or already %s). \r\n",
+	 b.jobs-failed, failed, b.skipped, ext);
+  printf("%.1f MB in %.2f s: %.1f MB/s, %.1f images/s \r\n\r\n",
+	 mbytes, secs, mbytes/secs, (b.jobs-failed)/secs);
+
+  exit((failed > 0) ? ERR : OK);
+}
+
+/////////////////////////////////////////
+// GetMedia
+// ------------
+// - Determines if disk or image is used,
+//   and opens the image through the backend of its format (see ImageOpen)
+
+void GetMedia(char *arg, int argc, char *media_type, char *image_type,
+	      unsigned int *nsect, unsigned int *trk_size, FD_HANDLE *fd,
+	      char *in_file, int *in, int readonly)
+{
+  unsigned int tmp;
+  unsigned char Probe[SNIFF_SIZE];
+  struct stat stat_buf;
+  ssize_t probe_len = -1;
+  char probe_type = 0, *packer;
+  int probe_file = -1, probed = 0;
+
+  // One probe read classifies the file (see SniffImageType)
+  if((arg != NULL) && ((probe_file = open(arg, O_RDONLY | O_BINARY)) >= 0)) {
+    probe_len = pread(probe_file, Probe, SNIFF_SIZE, 0);
+    if((fstat(probe_file, &stat_buf) != 0) || (SniffImageType(Probe, probe_len, stat_buf.st_size, &probe_type) != OK)) {
+      probe_type = 0;
+    }
+  }
+
+  // Determines if this is DISK or FILE access
+
+  // TODO: THIS IS EXPERIMENTAL
+  if((arg == NULL) || ((probe_type == EFE_TYPE) && (argc >= 3))) {
+    // DISK ACCESS
+    if(probe_file >= 0) close(probe_file);
+
+    if(FD_GetDiskType(media_type,nsect,trk_size) == ERR) {
+      EEXIT((stderr,"ERROR: Not an Ensoniq Disk. \r\n       Please format the disk (-fe or -fa) and try again! \r\n\r\n"));
+    }
+
+    //Open FD
+    *fd=OpenFloppy(0);
+
+  } else {
+    // FILE ACCESS
+    *media_type='f';
+
+    // Get the image filename
+    strcpy(in_file,arg);
+
+    // Type from the content, or from the extension and size
+    if((probe_type != 0) && (probe_type != EFE_TYPE)) {
+      *image_type = probe_type;
+    } else {
+      if((packer = CompressedFormat(Probe, probe_len)) != NULL) {
+	EEXIT((stderr,"ERROR: '%s' is compressed (%s). Unpack it first, or use a packed image (.epz). \r\n",in_file,packer));
+      }
+      GetImageType(in_file, image_type);
+    }
+
+    // Raw image (or EFE) and images only read are read from the probed
+    // file, other formats are written through their file
+    if(IsRawImageType(*image_type) || readonly) {
+      *in = probe_file;
+      probed = IsRawImageType(*image_type);
+    } else {
+      if(probe_file >= 0) close(probe_file);
+      *in = open(in_file, O_RDWR | O_BINARY);
+    }
+    if(*in < 0) {
+      perror("open:");
+      EEXIT((stderr,"ERROR: Couldn't open file '%s'. \r\n",in_file));
+    }
+
+    // Image is read and written in place through the backend of its format
+    if(ImageOpen(*in, in_file, *image_type, readonly) != OK) {
+      EEXIT((stderr,"ERROR: '%s' is not a valid image! \r\n",in_file));
+    }
+
+    if(probe_type != EFE_TYPE) {
+      // Check that EPS/ASR image is valid! (ie. do the 'ID-check')
+#ifdef __CYGWIN__
+      // To get /dev/scd work...
+      { unsigned char tmp_buff[512];
+      ReadBlocks(*media_type,*fd,*in,1,1,tmp_buff);
+      tmp = *(((unsigned int *) tmp_buff)+9);
+      }
+#else
+      // (raw image from the probe read)
+      if(!probed || (probe_len < 0x228)) {
+	ImageRead(*in, &tmp, 4, 0x224);
+      } else {
+	memcpy(&tmp, Probe+0x224, 4);
+      }
+#endif
+
+      if((tmp & 0xffff0000) != 0x44490000) {
+		EEXIT((stderr,"ERROR: Not a valid image file! \r\n"));
+      }
+#ifdef __CYGWIN__
+      // Find out if Iomega Zip device ie. writing only possible
+      // in blocks.. !!
+	  { int out;
+	    unsigned char mark='I';
+		struct stat	buf;
+		if (lstat(in_file, &buf) < 0) {
+			perror("lstat");
+			EEXIT((stderr,"Couldn't get info about file! \r\n"));
+		}
+		// If block device
+		if(S_ISBLK(buf.st_mode)) {
+			// If CD-ROM
+			if(strncmp("/dev/scd",in_file,8) == 0) {
+				*media_type='s';
+			} else {
+		    // Other block device...
+				if((out =open(in_file, O_RDWR | O_BINARY)) < 0) {
+					perror("open:");
+					EEXIT((stderr,"ERROR: Couldn't open file for write '%s'. \r\n",in_file));
+				}
+
+				// If can't read single byte, set media type to 's' = special
+				// ie. Zip drive..
+				if(lseek(out,0x226,SEEK_SET) <0) {
+					perror("seek");
+					EEXIT((stderr,"ERROR: File is not seekable! \r\n"));
+				}
+				if(write(out,&mark,1) <= 0)
+					*media_type='s';
+				close(out);
+			}
+		}
+	  }
+#endif
+    }
+  }
+}
+
+
+////////////////////////////////////////////////////
+// GetInfo
+// -------
+// -Get info about used media and loads the selected
+//  directory structure.
+//
+
+void GetInfo(char *media_type, FD_HANDLE fd, unsigned char **DiskFAT, unsigned char **DiskHdr,
+	     int in,
+	     unsigned char EFE[MAX_NUM_OF_DIR_ENTRIES][EFE_SIZE],
+	     unsigned int *fat_blks, unsigned int *free_blks, unsigned int *total_blks,
+	     unsigned int *dir_start, unsigned int *dir_cont,
+	     char *parent_dir_name, int subdir_cnt,
+	     unsigned int *DirPath, char *DiskLabel)
+{
+
+  unsigned char *mem_pointer;
+  unsigned int tmp,i,j;
+
+  if(*media_type=='f') {
+    // FILE ACCESS
+    mem_pointer=malloc(5*BLOCK_SIZE);
+    if(mem_pointer == NULL) EEXIT((stderr,"ERROR: Couldn't allocate memory!!!! \r\n"));
+
+    ReadBlocks(*media_type,fd,in,0,5,mem_pointer);
+
+#ifdef __CYGWIN__
+   } else if(*media_type == 's') {
+    unsigned char Data[BLOCK_SIZE];
+	ReadBlocks(*media_type,fd,in,ID_BLOCK,1,Data);
+	*total_blks = ((Data[14] << 24) +
+		          (Data[15] << 16) +
+		          (Data[16] << 8 ) +
+		          (Data[17] & 0x000000ff));
+
+		// Each FAT block holds only so many entries, so take total
+		// amount of needed blocks and divide by 170 which is the
+		// amount of entries which can be stored in one FAT block.
+		//
+		// Division result usually has to be adjusted up by one, except
+		// when blocks needed is perfectly divisible by 170.
+		//    ex: 800K = 1600 blocks, so 9.4 FAT blocks needed.
+		//        Cannot have partial FAT blocks, so a full 10
+		//        FAT blocks are required.
+		//
+		//        However, 850K = 1700 blocks, so exactly 10 FAT
+		//        blocks are needed.
+		//
+		if((*total_blks % FAT_ENTRIES_PER_BLK) != 0)
+		{
+			*fat_blks=*total_blks/FAT_ENTRIES_PER_BLK+1;
+		} else {
+			*fat_blks=*total_blks/FAT_ENTRIES_PER_BLK;
+		}
+
+#ifdef DEBUG
+	printf("total_blks=%d \r\n",*total_blks);
+#endif
+	// Room for FAT too, but read only system blocks here.
+	// FAT of a large device is big and many operations
+	// (e.g. dir listing) don't need it at all.
+	mem_pointer=malloc((5+(*fat_blks))*BLOCK_SIZE);
+    if(mem_pointer == NULL) EEXIT((stderr,"ERROR: Couldn't allocate memory!!!! \r\n"));
+    ReadBlocks(*media_type,fd,in,0,5,mem_pointer);
+    *DiskHdr=mem_pointer;
+    *DiskFAT=mem_pointer+FAT_START_BLOCK*BLOCK_SIZE;
+#endif
+
+	} else {
+	// DISK ACCESS
+		if(*media_type=='e') *fat_blks=10; else *fat_blks=19;
+		
+		mem_pointer=malloc((5+(*fat_blks))*BLOCK_SIZE);
+		if(mem_pointer == NULL) EEXIT((stderr,"ERROR: Couldn't allocate memory!!!! \r\n"));
+		
+		ReadBlocks(*media_type,fd,in,0,5,mem_pointer);
+		*DiskHdr=mem_pointer;
+		*DiskFAT=mem_pointer+FAT_START_BLOCK*BLOCK_SIZE;
+	}
+
+	// FAT-table (if any) is read on first use
+	if(*media_type != 'f') {
+		LazyFAT.media_type = *media_type;
+		LazyFAT.fd         = fd;
+		LazyFAT.file       = in;
+		LazyFAT.DiskFAT    = *DiskFAT;
+		LazyFAT.fat_blks   = *fat_blks;
+	}
+
+	//
+	//  Get 'TotalBlocks' and 'DiskLabel' from ID_BLOCK
+	//
+
+	tmp=ID_BLOCK*BLOCK_SIZE;
+	*total_blks = (unsigned int) ((mem_pointer[tmp+14] << 24) +
+					(mem_pointer[tmp+15] << 16) +
+					(mem_pointer[tmp+16] << 8 ) +
+					(mem_pointer[tmp+17] & 0x000000ff));
+	
+	strncpy(DiskLabel, mem_pointer+tmp+31,7);
+	DiskLabel[7]='\0';
+	
+	if(strlen(DiskLabel) == 0) strcpy(DiskLabel,"<NONE>");
+	
+	// Calculate amount of FAT blocks.
+	// Adjust up for partial FAT block, unless total
+	// size in blocks is perfectly divisible by 170.
+	if((*total_blks % FAT_ENTRIES_PER_BLK) != 0)
+	{
+		*fat_blks=*total_blks/FAT_ENTRIES_PER_BLK+1;
+	} else {
+		*fat_blks=*total_blks/FAT_ENTRIES_PER_BLK;
+	}
+	
+	//  Get 'FreeBlocks' from OS_BLOCK
+	tmp=OS_BLOCK*BLOCK_SIZE;
+	*free_blks = (unsigned int)  ((mem_pointer[tmp]   << 24) +
+					(mem_pointer[tmp+1] << 16) +
+					(mem_pointer[tmp+2] << 8 ) +
+					(mem_pointer[tmp+3] & 0x000000ff));
+
+	// Check for ID string within ID block (at 0x226) and fail validation if not present.
+	tmp=ID_BLOCK*BLOCK_SIZE+38;
+	if((mem_pointer[tmp] != 'I') || (mem_pointer[tmp+1] != 'D'))  {
+		passedValidation = 0;
+	}
+
+	// Check for OS string within OS block (at 0x41C) and fail validation if not present.
+	tmp=OS_BLOCK*BLOCK_SIZE+28;
+	if((mem_pointer[tmp] != 'O') || (mem_pointer[tmp+1] != 'S'))  {
+		passedValidation = 0;
+	}
+	
+	if(passedValidation != 1) {
+		printf("Warning: Expected signatures not found! Corrupt or non-Ensoniq volume?! \r\n");
+	}
+					
+	// Determine whether disk is ASR/EPS, VFX, or TS type.
+	// This signature is the 9th byte within the OS block.
+	tmp=OS_BLOCK*BLOCK_SIZE+9;
+	familymode=mem_pointer[tmp];
+	// 0x02 is signature for TS10/TS12 diskettes.
+	if(familymode==TS_FAM) {
+		printf("Warning: TS disk support is experimental! \r\n");
+	}
+	// 0x01 is signature for SD-1/VFXSD diskettes.
+	if(familymode==VFX_FAM) {
+		printf("Warning: SD-1/VFXSD disk support is experimental! \r\n");
+	}
+	
+	// Load main directory
+	*dir_start=DIR_START_BLOCK;
+	*dir_cont = 2;
+	
+	// Scan Main Directory
+	for(i=0;i<MAX_NUM_OF_DIR_ENTRIES;i++) {
+		for(j=0; j < EFE_SIZE ; j++) {
+			EFE[i][j]=mem_pointer[DIR_START_BLOCK*BLOCK_SIZE + i * EFE_SIZE + j];
+		}
+	}
+
+  // SUB-DIRS - Use the 'path' to 'change dir'...
+  ChangeDir(*media_type,fd,*DiskFAT,in,EFE,dir_start,dir_cont,parent_dir_name,subdir_cnt,DirPath);
+
+}
+
+////////////////////////////////////////////////////
+// CheckMedia
+// ----------
+// -Get info about used media and check the filesystem
+//  structure
+
+void CheckMedia(char media_type, FD_HANDLE fd, int file, int check_level)
+{
+  unsigned long i,j,count,used_blks;
+  unsigned char buffer[BLOCK_SIZE],*root_dir;
+  unsigned long total_blks,free_blks;
+  unsigned long file_size;
+
+
+  //Get File/Device info
+#ifdef __CYGWIN__
+  if((media_type=='f') || (media_type=='s')) {
+#else // Linux and macOS
+  if(media_type=='f') {
+#endif
+    // FILE ACCESS
+    if((file_size=lseek(file,0,SEEK_END)) == -1) {
+      perror("lseek");
+      exit(ERR);
+    }
+  } else {
+    // DISK ACCESS
+#ifdef __CYGWIN__
+    // How to do this in Windows!?
+
+#else // Linux and macOS
+    if((file_size=lseek(fd,0,SEEK_END)) == -1) {
+      perror("lseek");
+      exit(ERR);
+    }
+#endif
+
+  }
+
+  // Image with a backend of its own has the size of the raw image
+  if((media_type=='f') && IsMappedImage(file)) file_size = Image.size;
+
+  printf("\r\nFile/Device size: %ld bytes (%ld blocks) \r\n\r\n",file_size,file_size/BLOCK_SIZE);
+
+  //ID Block
+
+  ReadBlocks(media_type,fd,file,ID_BLOCK,1,buffer);
+
+  printf("\r\nID BLOCK\r\n");
+  printf("========\r\n\r\n");
+
+  printf("Device type            : %d(%x)\r\n"  ,buffer[0],buffer[0]);
+  printf("Rem. Media Device type : %d(%x)\r\n"  ,buffer[1],buffer[1]);
+  printf("Std. Version #         : %d(%x)\r\n"  ,buffer[2],buffer[2]);
+  printf("SCSI (?)               : %d(%x)\r\n"  ,buffer[3],buffer[3]);
+  printf("Number of Sectors      : %d(%x%x)\r\n",(buffer[4]*256+buffer[5]),buffer[4],buffer[5]);
+  printf("Number of Heads        : %d(%x%x)\r\n",(buffer[6]*256+buffer[7]),buffer[6],buffer[7]);
+  printf("Number of Tracks       : %d(%x%x)\r\n",(buffer[8]*256+buffer[9]),buffer[8],buffer[9]);
+  printf("Bytes per Block (512)  : %d(%x%x)\r\n",(buffer[12]*256+buffer[13]),buffer[12],buffer[13]);
+
+  total_blks = ((buffer[14] << 24) +
+		(buffer[15] << 16) +
+		(buffer[16] << 8 ) +
+		(buffer[17] & 0x000000ff));
+  printf("Total Blocks           : %ld(%x%x%x%x) (%ld Bytes = %ld KBytes = %ld MBytes)\r\n",
+	 total_blks,
+	 buffer[14],buffer[15],buffer[16],buffer[17],
+	 total_blks*512,total_blks*512/1024,total_blks*512/1024/1024);
+
+  printf("SCSI Medium type       : %d(%x)\r\n"  ,buffer[18],buffer[18]);
+  printf("SCSI Density Code      : %d(%x)\r\n"  ,buffer[19],buffer[19]);
+
+  printf("DISK LABEL             : \"%c%c%c%c%c%c%c\" \r\n",buffer[31],buffer[32],buffer[33],
+	 buffer[34],buffer[35],buffer[36],buffer[37]);
+
+  printf("End of ID Block(\"ID\")  : \"%c%c\"\r\n",buffer[38],buffer[39]);
+
+  //OS Block
+  ReadBlocks(media_type,fd,file,OS_BLOCK,1,buffer);
+
+  printf("\r\nOS BLOCK\r\n");
+  printf("========\r\n\r\n");
+
+  free_blks = ((buffer[0] << 24) +
+	       (buffer[1] << 16) +
+	       (buffer[2] << 8 ) +
+	       (buffer[3] & 0x000000ff));
+
+  printf("Free Blocks            : %ld(%x%x%x%x)\r\n",free_blks,
+	 buffer[0],buffer[1],buffer[2],buffer[3]);
+
+  printf("Disk OS Version        : %d.%d(%x.%x)\r\n"  ,buffer[4],buffer[5],buffer[4],buffer[5]);
+  printf("ROM  OS Version        : %d.%d(%x.%x)\r\n"  ,buffer[6],buffer[7],buffer[6],buffer[7]);
+
+  printf("End of OS Block(\"OS\")  : \"%c%c\"\r\n",buffer[28],buffer[29]);
+
+  printf("\r\nOther Blocks\r\n");
+  printf("============\r\n\r\n");
+
+  count=0;
+  used_blks=0;
+
+  ReadBlocks(media_type,fd,file,DIR_END_BLOCK,1,buffer);
+
+  printf("Root DirBlocks    : ");
+  if(buffer[510]=='D' && buffer[511]=='R')
+    printf("OK\r\n");
+  else
+    printf("NOT OK - DISK/FILE is corrupted!\r\n");
+
+  for(i=FAT_START_BLOCK;;i++) {
+
+    ReadBlocks(media_type,fd,file,i,1,buffer);
+
+    //Check if valid FAT BLOCK
+    if(buffer[510]!='F' || buffer[511]!='B')
+      break;
+
+    // Count used blocks by looking for all entries which are not '000' coded
+	// within the FAT. Each FAT entries is three bytes, and last two bytes of
+	// FAT block must be "FB", so only 510 bytes (170 entries) need to be
+	// checked per FAT block.
+    for(j=2;j<510;j=j+3) {
+
+      if( !((buffer[j] == 0) && (buffer[j-1] ==0) && (buffer[j-2]==0)))
+	  // if FAT entry is not '000' then that block has to store data
+	  used_blks++;
+
+    }
+    count++;
+  }
+
+  printf("Num. of FAT blocks: %ld\r\n",count);
+  printf("FAT entries       : %ld  => ",FAT_ENTRIES_PER_BLK*count);
+  if((FAT_ENTRIES_PER_BLK*count) >= total_blks)
+    printf("OK\r\n");
+  else
+    printf("FAT corrupted!! Not enough FAT tables!\r\n");
+
+  printf("Used Blocks in FAT: %ld  => ",used_blks);
+  if( (total_blks - (used_blks+free_blks)) == 0)
+    printf("OK\r\n");
+  else
+    printf("FAT corrupted!! Used blocks should be %ld\r\n",total_blks - free_blks);
+
+  printf("\r\n");
+
+  // If higher check_level, display also root dir structure
+  if(check_level > 0) {
+    // Directory structure info
+    printf("\r\nROOT DIR:\r\n");
+    printf("=========\r\n");
+
+    root_dir=(unsigned char *) malloc(BLOCK_SIZE*2);
+
+    ReadBlocks(media_type,fd,file,DIR_START_BLOCK,2,root_dir);
+
+    // Scan Directory
+    for(i=0;i<MAX_NUM_OF_DIR_ENTRIES;i++) {
+      char name[13];
+      printf("%3ld:",i);
+      for(j=0; j < EFE_SIZE ; j++) {
+	printf("%02x ",root_dir[i * EFE_SIZE+j]);
+      }
+      printf("\r\n");
+      strncpy(name, &root_dir[i * EFE_SIZE+2],12);
+      name[12]='\0';
+
+      printf("    Type:%2d, Name:%12s, Size:%ld, Cont:%ld, Start:%ld \r\n\r\n",
+	     root_dir[i * EFE_SIZE+1],
+	     name,
+	     (long) root_dir[i * EFE_SIZE+14]*256+root_dir[i * EFE_SIZE+15],
+	     (long) root_dir[i * EFE_SIZE+16]*256+root_dir[i * EFE_SIZE+17],
+	     (long) root_dir[i * EFE_SIZE+18]*256*256*256+root_dir[i * EFE_SIZE+19]*256*256 +
+	     root_dir[i * EFE_SIZE+20]*256+root_dir[i * EFE_SIZE+21]
+	     );
+    }
+    free(root_dir);
+  }
+
+}
+
+////////////////////////////////////////////////////
+// Confirm
+// -------
+// -Asks if user wants to proceed
+
+void Confirm()
+{
+  char answer;
+
+  printf("\r\nThis operation will DESTROY everything in the TARGET medium! \r\n\r\n");
+  printf("Are you *ABSOLUTELY* sure you want to proceed? (y/n) ");
+  scanf("%c",&answer);
+
+  if((answer == 'y') || (answer == 'Y'))
+    printf("\r\n");
+  else {
+    printf("Operation aborted! \r\n\r\n");
+    exit(OK);
+  }
+}
+
+///////////////////////
+// ImageCopy
+// ----------
+// -Copy image file to another one. Use to copy
+// for ex. CD-ROM to HD etc.
+
+int ImageCopy(char *source_file_name, char *target_file_name)
+{
+	//FILE *source, *target;
+	unsigned int i=0;
+	unsigned long source_file_size, target_file_size;
+	unsigned char buffer[IMAGE_COPY_BUFFER_BLOCKS*BLOCK_SIZE];
+
+	int source,target;
+  // these values need to be larger than a signed int can hold!
+	signed long read_bytes, write_bytes;
+
+	printf("\r\n");
+
+	// Open source file and get file size
+	if( (source=open(source_file_name,O_RDONLY | O_BINARY)) < 0) {
+      perror("open:");
+      EEXIT((stderr,"ERROR: Couldn't open source file '%s'. \r\n",source_file_name));
+	}
+
+	source_file_size=lseek(source, 0, SEEK_END);
+
+	// Check validity of source file
+	if(source_file_size == 0)
+      EEXIT((stderr,"ERROR: Source file '%s' is empty. \r\n",source_file_name));
+	if((source_file_size % BLOCK_SIZE) != 0) {
+	  EEXIT((stderr,"Source size has to be a multiple of block size %d! \r\n",BLOCK_SIZE));
+	  exit(ERR);
+	}
+
+	if((target=open(target_file_name,O_RDWR | O_BINARY)) < 0) {
+		if((target=open(target_file_name,O_RDWR | O_CREAT | O_BINARY, FILE_RIGHTS)) < 0) {	 // was S_IRWXU (0700)
+			perror("open:");
+			EEXIT((stderr,"ERROR: Couldn't open target file '%s'. \r\n",target_file_name));
+		}
+	    //printf("Creating new file '%s'\r\n", target_file_name);
+    }
+
+	target_file_size=lseek(target,0,SEEK_END);
+
+	if(target_file_size == 0) {
+		printf("Creating target file %s \r\n",target_file_name);
+	} else {
+		if(source_file_size > target_file_size) {
+		EEXIT((stderr,"ERROR: Couldn't fit! \r\nSource '%s' is BIGGER that target '%s'. \r\n\r\nSource size: %ld Bytes, target size %ld Bytes \r\n\r\n",
+			source_file_name, target_file_name,source_file_size,target_file_size));
+
+		}
+	}
+
+	//printf("s:%ld,t:%ld\r\n",source_file_size,target_file_size);
+
+	if(lseek(source,0,SEEK_SET) < 0) {
+		perror("seek");
+		return(ERR);
+	}
+
+	if(lseek(target,0,SEEK_SET) < 0) {
+		perror("seek");
+		return(ERR);
+	}
+
+	// Do copy in big chunks...
+	do {
+		read_bytes=read(source,buffer,IMAGE_COPY_BUFFER_BLOCKS*BLOCK_SIZE);
+    // for this comparison to work, read_bytes has to counter-intuitively
+    // be unsigned to allow for negative state of errorlevel
+		if(read_bytes < 0) {
+			perror("read");
+			return(ERR);
+		}
+		// if last read was "full" read, but get all the data left, next read is 0
+		if(read_bytes == 0) break;
+
+    // calculate proper percentage in integer form
+    unsigned int copyPercentage = ((100*i++) / ((source_file_size / BLOCK_SIZE) / IMAGE_COPY_BUFFER_BLOCKS));
+    printf("\rCopying image file... %d%% completed",copyPercentage);
+
+		write_bytes=write(target,buffer,read_bytes);
+    // for this comparison to work, write_bytes has to counter-intuitively
+    // be unsigned to allow for negative state of errorlevel
+		if(write_bytes< 0) {
+			perror("write");
+			return(ERR);
+		}
+	} while (read_bytes == (IMAGE_COPY_BUFFER_BLOCKS*BLOCK_SIZE));
+
+	printf("\rImage copy from '%s' to '%s' done! Total %ld Bytes copied. \r\n",source_file_name,target_file_name,source_file_size);
+	fflush(stdout);
+
+	close(source);close(target);
+	return(OK);
+}
+
+
+//##############################################################################
+//############################### MAIN PROGRAM   ###############################
+//##############################################################################
+
+int main(int argc, char **argv)
+{
+  int in;
+
+  unsigned char EFE[MAX_NUM_OF_DIR_ENTRIES][EFE_SIZE];
+  unsigned char *DiskFAT,*DiskHdr, *mem_pointer;
+  char DiskLabel[DISK_LABEL_SIZE];
+
+  unsigned int DirPath[MAX_DIR_DEPTH], subdir_cnt;
+  unsigned int total_blks, free_blks, fat_blks;
+  unsigned int dir_start, dir_cont, start_idx, move_idx, replace_idx;
+
+  unsigned long i,j;
+
+  char c, media_type, image_type, process_EFE[MAX_NUM_OF_DIR_ENTRIES], in_file[FILENAME_MAX];
+  char *mkdir_spec, parent_dir_name[12];
+  char format_arg, *batch_format;
+  FD_HANDLE fd;
+  unsigned int trk_size, nsect;
+  int mode, printmode, hashmode, recursive, tar_out, discard, skip_identical;
+  char *tar_file;
+  unsigned long long EFEHash[MAX_NUM_OF_DIR_ENTRIES];
+  int check_level, confirm_operation;
+
+  //
+  // Initialize variables
+  //
+  mode = NONE; subdir_cnt = 0; j = 0; image_type= -1; printmode = HUMAN_READABLE; hashmode = 0; discard = 0; skip_identical = 0;
+  recursive = 0; tar_file = NULL; tar_out = -1; batch_format = NULL;
+  //
+  trk_size =  0; media_type  = 0; fat_blks   = 0; in = 0;
+  //
+  DiskFAT = NULL; mem_pointer=NULL; start_idx = 1; move_idx = 0; replace_idx = 0;
+  // whether or not confirmation is needed on operations such as Format...
+  // ..."quiet" mode silences the confirm operation prompt
+  confirm_operation = 0;
+  // generate default disk label
+  strncpy(DiskLabel,DEFAULT_DISK_LABEL,DISK_LABEL_SIZE);
+  //
+  fd= (FD_HANDLE) NULL;
+
+  // initialize an array which deals with GetEFE routine
+  for(i=0;i < MAX_NUM_OF_DIR_ENTRIES; i++) process_EFE[i]=0;
+
+  //printf("\r\n");
+
+  // Get options and parameters
+  while (1)
+	{
+		// parse command-line arguments
+		// c = getopt(argc, argv, "Pj:b:srwf:g:p::e:d:m:itc:C::l:qI");
+		   c = getopt(argc, argv, "PHkzJT:RB:j:b:srwf:g:p::e:d:m:M:x:u:itc:C::l:qID?");
+		if (c == -1)
+		{
+			break;			// break the while loop if no arguments are supplied -- skips switch handling
+		}
+
+		switch (c)
+		{
+			case 'b':         // ** Bank Info **
+			PrintBankInfo(optarg,printmode);
+			//printf("%d,%s\r\n",printmode,optarg);
+			exit(OK);
+			break;
+			case 'P':         // ** COMPUTER READABLE DIRLIST **
+			printmode = COMPUTER_READABLE;
+			break;
+			case 'H':         // ** CONTENT HASHES IN DIRLIST **
+			hashmode = 1;
+			break;
+			case 'k':         // ** KEEP IDENTICAL EFEs ON PUT **
+			skip_identical = 1;
+			break;
+			case 'z':         // ** DISCARD FREED BLOCKS ON ERASE **
+			discard = 1;
+			break;
+			case 'T':         // ** GET EFEs AS TAR STREAM **
+			tar_file = optarg;
+			break;
+			case 'J':         // ** JOIN MULTI-FILES ON GET **
+			joinmode = 1;
+			break;
+			case 'R':         // ** RECURSIVE (sub-dirs) **
+			recursive = 1;
+			break;
+			case 's':	  // ** SPLIT EFE **
+			SplitEFE(argv[2], argv[3], argc);
+			exit(OK);
+			break;
+			case 'j':	  // ** JOIN EFEs **
+			JoinEFEs(argc,argv);
+			exit(OK);
+			break;
+			case 't':	  // ** TEST **
+			//EEXIT((stderr,"ERROR: No test modes!\r\n"));
+			mode =  TEST;
+			break;
+
+			case 'C':        // ** CHECK MEDIA **
+			//printf("argv[optind=%d]=%s,argc=%d\r\n",optind,argv[optind],argc);
+			GetMedia(argv[optind], argc,  &media_type, &image_type, &nsect, &trk_size, &fd, in_file, &in, 1);
+			if(optarg==NULL) check_level=0; else check_level=*optarg-'0';
+			CheckMedia(media_type, fd, in, check_level);
+			exit(OK);
+			break;
+
+			case 'c':	  // ** CONVERT **
+			DoConversion(argv[2], argv[3], argc);
+			exit(OK);
+			break;
+
+			case 'B':	  // ** BATCH CONVERT **
+			mode = BATCH;
+			batch_format = optarg;
+			break;
+
+			case 'i':	  // ** INFO **
+			if(FD_GetDiskType(&media_type,&nsect,&trk_size) == ERR) {
+				EEXIT((stderr,"ERROR: Not an Ensoniq disk. \r\n       Please format the disk (-fe or -fa) and try again! \r\n\r\n"));
+			}
+			exit(OK);
+			break;
+
+			case 'I':        // ** IMAGE COPY ***
+			if(confirm_operation ==0) Confirm();
+			//printf("source=%s,target=%s\r\n",argv[optind],argv[optind+1]);
+			ImageCopy(argv[optind],argv[optind+1]);
+			exit(OK);
+			break;
+
+			case 'r':  	  // ** READ DISK to IMAGE **
+			mode = READ;
+			confirm_operation++;
+			break;
+
+			case 'w':  	  // ** WRITE DISK from IMAGE **
+			mode = WRITE;
+			confirm_operation++;
+			break;
+
+			case 'f':  	  // ** FORMAT DISK/IMAGE **
+			mode=FORMAT;
+			confirm_operation++;
+			format_arg=optarg[0];
+			break;
+
+			case 'l':
+			strncpy(DiskLabel,optarg,DISK_LABEL_SIZE);
+			break;
+
+			case 'g': 	  // ** Get EFEs **
+			ParseEntry(optarg,process_EFE);
+			mode=GET;
+			break;
+
+			case 'p': 	  // ** Put EFEs **
+			if(optarg != NULL) {
+				start_idx = atoi(optarg);
+			}
+			mode=PUT;
+			break;
+
+			case 'e': 	  // ** Erase EFEs **
+			ParseEntry(optarg,process_EFE);
+			mode=ERASE;
+			break;
+
+			case 'd': 	  // ** Directory **
+			ParseDir(optarg, DirPath, &subdir_cnt);
+			//printf("DirPath:%s\r\n",optarg);
+			break;
+
+			case 'D': 	  // ** Directory **
+			mode=DIRLIST;
+			break;
+
+			case 'm': 	  // ** Make directory **
+			mode=MKDIR;
+			mkdir_spec = optarg;
+			break;
+
+			case 'M': 	  // ** Move/rename EFE **
+			mode=MOVE;
+			move_idx = atoi(optarg);
+			process_EFE[move_idx % MAX_NUM_OF_DIR_ENTRIES] = 1;
+			break;
+
+			case 'x': 	  // ** Copy EFEs to another image **
+			ParseEntry(optarg,process_EFE);
+			mode=COPY;
+			break;
+
+			case 'u': 	  // ** Replace EFE in place **
+			replace_idx = atoi(optarg);
+			mode=REPLACE;
+			break;
+
+			case 'q':        // Quiet mode -- suppress confirmation prompt
+			confirm_operation--;
+			break;
+
+			case '?':		// usage help -- same as supplying no argument
+			break;
+
+			default:
+			printf("DEFAULT\r\n");
+			printf ("\r\n");
+		}	// end switch
+    }	// end while
+
+  // if no command-argument (or '?') is given then display program usage help information
+  if(mode == NONE) {
+	ShowUsage();			// show help
+	return(ERR);			// quit program with error code
+  }
+
+  if(mode == FORMAT) {
+	// make sure user intends to actually format
+    if(confirm_operation) Confirm();
+	// if so then proceed to format routine
+    FormatMedia(argv, argc, optind, format_arg, DiskLabel);
+  }
+
+  // (after all options, as -R may follow -B)
+  if(mode == BATCH) {
+    BatchConvert(batch_format, argc, argv, optind, recursive);
+  }
+
+  // Tar stream output. If it goes to stdout, all messages go to stderr.
+  if(tar_file != NULL) {
+    if(mode != GET) {
+      EEXIT((stderr,"ERROR: Tar output (-T) needs EFEs selected with -g. \r\n"));
+    }
+    if(strcmp(tar_file,"-") == 0) {
+      tar_out = dup(STDOUT_FILENO);
+      dup2(STDERR_FILENO, STDOUT_FILENO);
+    } else {
+      tar_out = open(tar_file, O_WRONLY | O_CREAT | O_TRUNC | O_BINARY, FILE_RIGHTS);
+    }
+    if(tar_out < 0) {
+      EEXIT((stderr,"ERROR: Couldn't open tar output '%s'. \r\n",tar_file));
+    }
+  }
+
+  // If mode is anything other than disk read/write then GETMEDIA and GETINFO
+  if((mode != WRITE) && (mode != READ)) {
+
+    // Check if DISK or FILE access and get media parameters
+#ifdef DEBUG
+	printf("GETMEDIA\r\n");fflush(stdout);
+#endif
+    GetMedia(argv[optind], argc,  &media_type, &image_type,
+	     &nsect, &trk_size, &fd, in_file, &in,
+	     (mode == NONE) || (mode == DIRLIST) || (mode == GET) || (mode == COPY) || (mode == TEST));
+#ifdef DEBUG
+	printf("media_type=%c\r\n",media_type);
+#endif
+
+    // GET DIR & MISC INFO
+#ifdef DEBUG
+	printf("GETINFO\r\n");fflush(stdout);
+#endif
+    GetInfo(&media_type, fd, &DiskFAT, &DiskHdr, in, EFE,
+    	    &fat_blks, &free_blks, &total_blks, &dir_start, &dir_cont,
+    	    parent_dir_name, subdir_cnt, DirPath, DiskLabel);
+
+  } // end of GETMEDIA/GETINFO stage
+
+  // Name/type selectors of -g/-e/-x are resolved against the loaded dir
+  if(select_spec != NULL) {
+    if((SelectEntries(select_spec, EFE, process_EFE) == 0) && !recursive) {
+      printf("Warning: No entries match '%s'. \r\n", select_spec);
+    }
+  }
+
+  // Select operation mode (if any)
+  // ==============================
+  switch (mode)
+    {
+    case READ:    // Read/Write DISK
+    case WRITE:
+      if(confirm_operation) Confirm();
+      FD_RW_Disk(argv[optind], mode);
+      exit(OK);
+
+    case GET:   // Get EFEs
+      if(tar_file != NULL) {
+	TarEFEs(media_type, fd, in, EFE, process_EFE, DiskFAT, fat_blks, tar_out, recursive);
+	close(tar_out);
+      } else {
+		GetEFETree(media_type, fd, in, EFE, process_EFE, DiskFAT, fat_blks, recursive, 0);
+      }
+      break;
+
+    case PUT:   // Put EFEs
+#ifdef DEBUG
+	  printf("PUTEFE\r\n");fflush(stdout);
+#endif
+      PutEFE(process_EFE, start_idx, EFE, media_type, image_type,
+	     in_file, argv, optind,  argv[optind],
+	     dir_start, dir_cont, total_blks, &free_blks, fat_blks,
+	     fd, DiskFAT, DiskHdr, skip_identical);
+      break;
+
+    case ERASE: // Erase EFEs
+		EraseEFEs(media_type, image_type, fd, DiskFAT, DiskHdr, in_file, argv[optind],
+		EFE, process_EFE,
+		fat_blks, &free_blks, dir_start, dir_cont, discard, recursive);
+      break;
+
+    case MKDIR: // Make Dir(s)
+      MkDir(media_type, image_type, fd, DiskFAT, DiskHdr,
+	    in_file, argv[optind], EFE,
+	    dir_start, dir_cont, parent_dir_name, subdir_cnt,
+	    total_blks, &free_blks, fat_blks, mkdir_spec);
+      break;
+
+    case MOVE: // Move/rename EFE
+      if(argv[optind] == NULL) {
+	ShowUsage();
+	exit(ERR);
+      }
+      MoveEFE(media_type, image_type, fd, DiskFAT, in_file, argv[optind],
+	      EFE, move_idx, dir_start, dir_cont, DirPath, subdir_cnt,
+	      argv[optind+1], (argv[optind+1] != NULL) ? argv[optind+2] : NULL);
+      break;
+
+    case REPLACE: // Replace EFE in place
+      ReplaceEFE(media_type, image_type, fd, DiskFAT, DiskHdr, in_file, argv[optind],
+		 EFE, process_EFE, replace_idx, argv, optind,
+		 total_blks, &free_blks, fat_blks, dir_start, dir_cont);
+      break;
+
+    case COPY: // Copy EFEs to another image
+      if((argv[optind] == NULL) || (argv[optind+1] == NULL)) {
+	ShowUsage();
+	exit(ERR);
+      }
+      CopyEFEs(media_type, fd, in, DiskFAT, fat_blks, EFE, process_EFE,
+	       argv[optind+1], argv[optind+2]);
+      break;
+
+    case TEST:
+      printf("\r\nFAT:\r\n");
+      for(i=0 ; i<total_blks; i++) {
+	switch(GetFatEntry(media_type,DiskFAT,in,i)) {
+	case 0:
+	  printf(".");
+	  break;
+	case 1:
+	  printf("E");
+	  break;
+	default:
+	  printf("#");
+	}
+
+      }
+      printf("\r\n");
+      exit(0);
+
+    }
+
+  // Content hashes for the listing (before the media is closed)
+  if(hashmode) {
+    HashEFEs(media_type, fd, in, DiskFAT, fat_blks, EFE, EFEHash);
+  }
+
+  // Close file-pointers if needed
+  if(in != 0) close(in);
+
+  if(fd != (FD_HANDLE) NULL) {
+    CloseFloppy(fd);
+  }
+
+#ifdef DEBUG
+  printf("PRINTDIR\r\n");fflush(stdout);
+#endif
+
+  if(mode == DIRLIST) {
+	printf("Ensoniq Disk and Directory Information \r\n");
+  }
+
+  // Print the DirectoryList - Uses 'original' filename (not tmp :-)
+  PrintDir(EFE, mode, process_EFE, argv[optind], media_type, DiskLabel,
+	   free_blks, (total_blks - free_blks - fat_blks - 5),printmode,
+	   hashmode ? EFEHash : NULL);
+
+  exit(OK);
+}